@@ -26,5 +26,17 @@ namespace winrt::ProteinModeler::implementation
     {
         // Unbox the parameter (and cast to ModelerMain*)
         ModelerMainPtr(winrt::unbox_value<int64_t>(e.Parameter()));
+
+        // Long-range electrostatics are not worth their cost while molecules are being placed, so the simulation runs
+        // with reaction-field Coulomb until the user leaves this page
+        concurrency::critical_section::scoped_lock lock(m_modelerMain->GetCriticalSection());
+        m_previousCoulombMethod = m_modelerMain->GetCoulombMethod();
+        m_modelerMain->SetCoulombMethod(CoulombMethod::ReactionField);
+    }
+
+    void AddMoleculePage::OnNavigatedFrom(NavigationEventArgs const&)
+    {
+        concurrency::critical_section::scoped_lock lock(m_modelerMain->GetCriticalSection());
+        m_modelerMain->SetCoulombMethod(m_previousCoulombMethod);
     }
 }
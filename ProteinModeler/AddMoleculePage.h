@@ -13,12 +13,16 @@ namespace winrt::ProteinModeler::implementation
             // See https://github.com/microsoft/cppwinrt/tree/master/nuget#initializecomponent
         }
         void OnNavigatedTo(winrt::Windows::UI::Xaml::Navigation::NavigationEventArgs const& e);
+        void OnNavigatedFrom(winrt::Windows::UI::Xaml::Navigation::NavigationEventArgs const& e);
 
         int64_t ModelerMainPtr();
         void ModelerMainPtr(int64_t value);
 
     private:
         ModelerMain* m_modelerMain;
+
+        // Electrostatics in use before this page switched to reaction field, restored when leaving
+        CoulombMethod m_previousCoulombMethod = CoulombMethod::Cutoff;
     };
 }
 
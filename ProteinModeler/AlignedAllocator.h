@@ -0,0 +1,39 @@
+#pragma once
+#include "pch.h"
+#include <new>
+
+// Minimal allocator that hands out memory aligned to Alignment bytes. 64 bytes matches both the cache line size and
+// the width of an AVX-512 register, so SIMD loops over the arrays never straddle a line on their first element.
+template<typename T, size_t Alignment = 64>
+class AlignedAllocator
+{
+	static_assert(Alignment >= alignof(T), "Alignment must be at least the natural alignment of T");
+	static_assert((Alignment & (Alignment - 1)) == 0, "Alignment must be a power of two");
+
+public:
+	using value_type = T;
+
+	template<typename U>
+	struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+	AlignedAllocator() noexcept = default;
+	template<typename U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+	ND T* allocate(size_t count)
+	{
+		return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(Alignment)));
+	}
+	void deallocate(T* pointer, size_t) noexcept
+	{
+		::operator delete(pointer, std::align_val_t(Alignment));
+	}
+
+	template<typename U>
+	bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept { return true; }
+	template<typename U>
+	bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept { return false; }
+};
+
+template<typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
@@ -0,0 +1,525 @@
+#include "pch.h"
+#include "BarnesHutTree.h"
+#include "NeighborList.h"
+
+
+namespace
+{
+	// The top levels are split serially into up to 8^SplitDepth subtrees, which are then built in parallel
+	constexpr unsigned int SplitDepth = 3;
+
+	// Each node pushes at most 8 children and the tree is at most MaxDepth levels deep
+	constexpr size_t StackSize = 8 * (BarnesHutTree::MaxDepth + 1);
+}
+
+BarnesHutTree::BarnesHutTree() noexcept :
+	m_theta(0.3f),
+	m_leafSize(16),
+	m_subtreeCount(0)
+{}
+
+void BarnesHutTree::SetExclusions(const std::vector<unsigned int>& offsets, const std::vector<unsigned int>& excluded)
+{
+	NeighborList::MirrorExclusions(offsets, excluded, m_exclusionOffsets, m_exclusions);
+}
+
+float BarnesHutTree::Compute(ParticleArrays& particles, ThreadPool& pool)
+{
+	if (particles.Size() == 0)
+	{
+		m_nodes.clear();
+		return 0.0f;
+	}
+	WINRT_ASSERT(particles.Size() < std::numeric_limits<uint32_t>::max());
+
+	m_threadSums.assign(pool.ThreadCount(), ThreadSum());
+
+	SortByMortonCode(particles, pool);
+	BuildTree(pool);
+
+	return Traverse(particles, pool) + ExcludedPairs(particles, pool);
+}
+
+void BarnesHutTree::SortByMortonCode(const ParticleArrays& particles, ThreadPool& pool)
+{
+	const size_t count = particles.Size();
+	m_sort.Sort(particles.x.data(), particles.y.data(), particles.z.data(), count, SpaceFillingCurve::Morton, pool);
+
+	const uint32_t* order = m_sort.Order().data();
+	m_x.resize(count);
+	m_y.resize(count);
+	m_z.resize(count);
+	m_charge.resize(count);
+	pool.ParallelFor(0, count, [&](unsigned int, size_t begin, size_t end)
+		{
+			for (size_t iii = begin; iii < end; ++iii)
+			{
+				const uint32_t atom = order[iii];
+				m_x[iii] = particles.x[atom];
+				m_y[iii] = particles.y[atom];
+				m_z[iii] = particles.z[atom];
+				m_charge[iii] = particles.charge[atom];
+			}
+		}
+	);
+}
+
+void BarnesHutTree::BuildTree(ThreadPool& pool)
+{
+	m_nodes.clear();
+	m_topInternal.clear();
+	m_subtreeCount = 0;
+
+	Node root;
+	root.end = static_cast<unsigned int>(m_sort.Codes().size());
+	m_nodes.push_back(root);
+	SplitTop(0, 0);
+
+	pool.ParallelFor(0, m_subtreeCount, [&](unsigned int, size_t first, size_t last)
+		{
+			for (size_t iii = first; iii < last; ++iii)
+			{
+				Subtree& subtree = m_subtrees[iii];
+				subtree.nodes.clear();
+				subtree.nodes.push_back(m_nodes[subtree.root]);
+				BuildSubtree(subtree.nodes, 0, subtree.depth);
+			}
+		}, 1
+	);
+
+	// Each subtree's root replaces its placeholder and the rest of its nodes are appended, with the child indices
+	// shifted from the subtree's array to m_nodes
+	size_t nodeCount = m_nodes.size();
+	for (size_t iii = 0; iii < m_subtreeCount; ++iii)
+	{
+		m_subtrees[iii].base = static_cast<unsigned int>(nodeCount);
+		nodeCount += m_subtrees[iii].nodes.size() - 1;
+	}
+	m_nodes.resize(nodeCount);
+
+	pool.ParallelFor(0, m_subtreeCount, [&](unsigned int, size_t first, size_t last)
+		{
+			for (size_t iii = first; iii < last; ++iii)
+			{
+				const Subtree& subtree = m_subtrees[iii];
+				const unsigned int shift = subtree.base - 1;
+				auto relocate = [=](Node node) {
+					if (node.childCount > 0)
+						node.firstChild += shift;
+					return node;
+				};
+
+				m_nodes[subtree.root] = relocate(subtree.nodes[0]);
+				for (size_t jjj = 1; jjj < subtree.nodes.size(); ++jjj)
+					m_nodes[subtree.base + jjj - 1] = relocate(subtree.nodes[jjj]);
+			}
+		}, 1
+	);
+
+	// The top nodes were split parents first, so in reverse every node's children are complete before it is
+	for (auto it = m_topInternal.rbegin(); it != m_topInternal.rend(); ++it)
+	{
+		Node& node = m_nodes[*it];
+		InternalMoments(node, m_nodes.data() + node.firstChild);
+	}
+}
+
+void BarnesHutTree::SplitTop(unsigned int nodeIndex, unsigned int depth)
+{
+	const unsigned int begin = m_nodes[nodeIndex].begin;
+	const unsigned int end = m_nodes[nodeIndex].end;
+
+	if (depth == SplitDepth || depth == MaxDepth || end - begin <= m_leafSize)
+	{
+		if (m_subtreeCount == m_subtrees.size())
+			m_subtrees.emplace_back();
+
+		Subtree& subtree = m_subtrees[m_subtreeCount++];
+		subtree.root = nodeIndex;
+		subtree.depth = depth;
+		return;
+	}
+
+	std::array<std::pair<unsigned int, unsigned int>, 8> ranges;
+	const unsigned int childCount = SplitRange(begin, end, depth, ranges);
+	const unsigned int firstChild = static_cast<unsigned int>(m_nodes.size());
+
+	m_nodes[nodeIndex].firstChild = firstChild;
+	m_nodes[nodeIndex].childCount = childCount;
+	m_topInternal.push_back(nodeIndex);
+
+	for (unsigned int iii = 0; iii < childCount; ++iii)
+	{
+		Node child;
+		child.begin = ranges[iii].first;
+		child.end = ranges[iii].second;
+		m_nodes.push_back(child);
+	}
+
+	for (unsigned int iii = 0; iii < childCount; ++iii)
+		SplitTop(firstChild + iii, depth + 1);
+}
+
+void BarnesHutTree::BuildSubtree(std::vector<Node>& nodes, unsigned int nodeIndex, unsigned int depth) const
+{
+	const unsigned int begin = nodes[nodeIndex].begin;
+	const unsigned int end = nodes[nodeIndex].end;
+
+	if (depth == MaxDepth || end - begin <= m_leafSize)
+	{
+		LeafMoments(nodes[nodeIndex]);
+		return;
+	}
+
+	std::array<std::pair<unsigned int, unsigned int>, 8> ranges;
+	const unsigned int childCount = SplitRange(begin, end, depth, ranges);
+	const unsigned int firstChild = static_cast<unsigned int>(nodes.size());
+
+	nodes[nodeIndex].firstChild = firstChild;
+	nodes[nodeIndex].childCount = childCount;
+
+	for (unsigned int iii = 0; iii < childCount; ++iii)
+	{
+		Node child;
+		child.begin = ranges[iii].first;
+		child.end = ranges[iii].second;
+		nodes.push_back(child);
+	}
+
+	for (unsigned int iii = 0; iii < childCount; ++iii)
+		BuildSubtree(nodes, firstChild + iii, depth + 1);
+
+	InternalMoments(nodes[nodeIndex], nodes.data() + firstChild);
+}
+
+unsigned int BarnesHutTree::SplitRange(unsigned int begin, unsigned int end, unsigned int depth, std::array<std::pair<unsigned int, unsigned int>, 8>& ranges) const noexcept
+{
+	// Every code in the node shares the digits above this depth, so the range is sorted by the octant digit
+	const unsigned int shift = 3 * (MaxDepth - 1 - depth);
+	auto octant = [=](uint32_t code) { return (code >> shift) & 7u; };
+	const uint32_t* codes = m_sort.Codes().data();
+
+	unsigned int childCount = 0;
+	while (begin < end)
+	{
+		const uint32_t digit = octant(codes[begin]);
+		const uint32_t* last = std::upper_bound(codes + begin, codes + end, digit,
+			[&](uint32_t value, uint32_t code) { return value < octant(code); });
+
+		const unsigned int split = static_cast<unsigned int>(last - codes);
+		ranges[childCount++] = { begin, split };
+		begin = split;
+	}
+	return childCount;
+}
+
+void BarnesHutTree::LeafMoments(Node& node) const noexcept
+{
+	float charge = 0.0f;
+	float absCharge = 0.0f;
+	float weightedX = 0.0f, weightedY = 0.0f, weightedZ = 0.0f;
+	float sumX = 0.0f, sumY = 0.0f, sumZ = 0.0f;
+	for (unsigned int iii = node.begin; iii < node.end; ++iii)
+	{
+		const float weight = std::abs(m_charge[iii]);
+		charge += m_charge[iii];
+		absCharge += weight;
+		weightedX += weight * m_x[iii];
+		weightedY += weight * m_y[iii];
+		weightedZ += weight * m_z[iii];
+		sumX += m_x[iii];
+		sumY += m_y[iii];
+		sumZ += m_z[iii];
+	}
+
+	if (absCharge > 0.0f)
+	{
+		node.centerX = weightedX / absCharge;
+		node.centerY = weightedY / absCharge;
+		node.centerZ = weightedZ / absCharge;
+	}
+	else
+	{
+		const float inverseCount = 1.0f / static_cast<float>(node.end - node.begin);
+		node.centerX = sumX * inverseCount;
+		node.centerY = sumY * inverseCount;
+		node.centerZ = sumZ * inverseCount;
+	}
+	node.charge = charge;
+	node.absCharge = absCharge;
+
+	float dipoleX = 0.0f, dipoleY = 0.0f, dipoleZ = 0.0f;
+	float xx = 0.0f, yy = 0.0f, zz = 0.0f, xy = 0.0f, xz = 0.0f, yz = 0.0f;
+	float radius2 = 0.0f;
+	for (unsigned int iii = node.begin; iii < node.end; ++iii)
+	{
+		const float q = m_charge[iii];
+		const float dx = m_x[iii] - node.centerX;
+		const float dy = m_y[iii] - node.centerY;
+		const float dz = m_z[iii] - node.centerZ;
+		const float r2 = dx * dx + dy * dy + dz * dz;
+		dipoleX += q * dx;
+		dipoleY += q * dy;
+		dipoleZ += q * dz;
+		xx += q * (3.0f * dx * dx - r2);
+		yy += q * (3.0f * dy * dy - r2);
+		zz += q * (3.0f * dz * dz - r2);
+		xy += q * 3.0f * dx * dy;
+		xz += q * 3.0f * dx * dz;
+		yz += q * 3.0f * dy * dz;
+		radius2 = std::max(radius2, r2);
+	}
+	node.dipoleX = dipoleX;
+	node.dipoleY = dipoleY;
+	node.dipoleZ = dipoleZ;
+	node.quadrupoleXX = xx;
+	node.quadrupoleYY = yy;
+	node.quadrupoleZZ = zz;
+	node.quadrupoleXY = xy;
+	node.quadrupoleXZ = xz;
+	node.quadrupoleYZ = yz;
+	node.radius = std::sqrt(radius2);
+}
+
+void BarnesHutTree::InternalMoments(Node& node, const Node* children) noexcept
+{
+	float charge = 0.0f;
+	float absCharge = 0.0f;
+	float weightedX = 0.0f, weightedY = 0.0f, weightedZ = 0.0f;
+	float sumX = 0.0f, sumY = 0.0f, sumZ = 0.0f;
+	for (unsigned int iii = 0; iii < node.childCount; ++iii)
+	{
+		const Node& child = children[iii];
+		const float count = static_cast<float>(child.end - child.begin);
+		charge += child.charge;
+		absCharge += child.absCharge;
+		weightedX += child.absCharge * child.centerX;
+		weightedY += child.absCharge * child.centerY;
+		weightedZ += child.absCharge * child.centerZ;
+		sumX += count * child.centerX;
+		sumY += count * child.centerY;
+		sumZ += count * child.centerZ;
+	}
+
+	if (absCharge > 0.0f)
+	{
+		node.centerX = weightedX / absCharge;
+		node.centerY = weightedY / absCharge;
+		node.centerZ = weightedZ / absCharge;
+	}
+	else
+	{
+		const float inverseCount = 1.0f / static_cast<float>(node.end - node.begin);
+		node.centerX = sumX * inverseCount;
+		node.centerY = sumY * inverseCount;
+		node.centerZ = sumZ * inverseCount;
+	}
+	node.charge = charge;
+	node.absCharge = absCharge;
+
+	// Child moments shifted by s = (child center - node center): p' = p + q s and
+	// Q'_ab = Q_ab + 3 (p_a s_b + s_a p_b) + 3 q s_a s_b - (2 p.s + q s^2) delta_ab.
+	// The bounding sphere encloses the children's spheres.
+	float dipoleX = 0.0f, dipoleY = 0.0f, dipoleZ = 0.0f;
+	float xx = 0.0f, yy = 0.0f, zz = 0.0f, xy = 0.0f, xz = 0.0f, yz = 0.0f;
+	float radius = 0.0f;
+	for (unsigned int iii = 0; iii < node.childCount; ++iii)
+	{
+		const Node& child = children[iii];
+		const float q = child.charge;
+		const float sx = child.centerX - node.centerX;
+		const float sy = child.centerY - node.centerY;
+		const float sz = child.centerZ - node.centerZ;
+		const float s2 = sx * sx + sy * sy + sz * sz;
+		const float trace = 2.0f * (child.dipoleX * sx + child.dipoleY * sy + child.dipoleZ * sz) + q * s2;
+
+		dipoleX += child.dipoleX + q * sx;
+		dipoleY += child.dipoleY + q * sy;
+		dipoleZ += child.dipoleZ + q * sz;
+		xx += child.quadrupoleXX + 6.0f * child.dipoleX * sx + 3.0f * q * sx * sx - trace;
+		yy += child.quadrupoleYY + 6.0f * child.dipoleY * sy + 3.0f * q * sy * sy - trace;
+		zz += child.quadrupoleZZ + 6.0f * child.dipoleZ * sz + 3.0f * q * sz * sz - trace;
+		xy += child.quadrupoleXY + 3.0f * (child.dipoleX * sy + sx * child.dipoleY + q * sx * sy);
+		xz += child.quadrupoleXZ + 3.0f * (child.dipoleX * sz + sx * child.dipoleZ + q * sx * sz);
+		yz += child.quadrupoleYZ + 3.0f * (child.dipoleY * sz + sy * child.dipoleZ + q * sy * sz);
+		radius = std::max(radius, std::sqrt(s2) + child.radius);
+	}
+	node.dipoleX = dipoleX;
+	node.dipoleY = dipoleY;
+	node.dipoleZ = dipoleZ;
+	node.quadrupoleXX = xx;
+	node.quadrupoleYY = yy;
+	node.quadrupoleZZ = zz;
+	node.quadrupoleXY = xy;
+	node.quadrupoleXZ = xz;
+	node.quadrupoleYZ = yz;
+	node.radius = radius;
+}
+
+float BarnesHutTree::Traverse(ParticleArrays& particles, ThreadPool& pool)
+{
+	const float theta2 = m_theta * m_theta;
+
+	// Targets are walked in Morton order so consecutive atoms open nearly the same nodes. Each atom only writes its own
+	// force, and the energy 1/2 sum_i k q_i phi_i counts every pair once.
+	pool.ParallelFor(0, m_sort.Codes().size(), [&](unsigned int threadIndex, size_t begin, size_t end)
+		{
+			std::array<unsigned int, StackSize> stack;
+			double energy = 0.0;
+
+			for (size_t iii = begin; iii < end; ++iii)
+			{
+				const float qi = m_charge[iii];
+				if (qi == 0.0f)
+					continue;
+
+				const float xi = m_x[iii];
+				const float yi = m_y[iii];
+				const float zi = m_z[iii];
+
+				// Potential and field of every other charge at atom i
+				float potential = 0.0f;
+				float ex = 0.0f;
+				float ey = 0.0f;
+				float ez = 0.0f;
+
+				size_t stackSize = 0;
+				stack[stackSize++] = 0;
+				while (stackSize > 0)
+				{
+					const Node& node = m_nodes[stack[--stackSize]];
+					if (node.absCharge == 0.0f)
+						continue;
+
+					const float dx = xi - node.centerX;
+					const float dy = yi - node.centerY;
+					const float dz = zi - node.centerZ;
+					const float d2 = dx * dx + dy * dy + dz * dz;
+
+					if (node.radius * node.radius < theta2 * d2)
+					{
+						// phi = q / d + p.d / d^3 + d.Q.d / (2 d^5)
+						// E = (q + 3 p.d / d^2 + 5 d.Q.d / (2 d^4)) d / d^3 - p / d^3 - Q.d / d^5
+						const float invD2 = 1.0f / d2;
+						const float invD = std::sqrt(invD2);
+						const float invD3 = invD * invD2;
+						const float invD5 = invD3 * invD2;
+						const float pDotD = node.dipoleX * dx + node.dipoleY * dy + node.dipoleZ * dz;
+						const float qdX = node.quadrupoleXX * dx + node.quadrupoleXY * dy + node.quadrupoleXZ * dz;
+						const float qdY = node.quadrupoleXY * dx + node.quadrupoleYY * dy + node.quadrupoleYZ * dz;
+						const float qdZ = node.quadrupoleXZ * dx + node.quadrupoleYZ * dy + node.quadrupoleZZ * dz;
+						const float dQd = dx * qdX + dy * qdY + dz * qdZ;
+						potential += node.charge * invD + pDotD * invD3 + 0.5f * dQd * invD5;
+
+						const float radial = (node.charge + 3.0f * pDotD * invD2 + 2.5f * dQd * invD2 * invD2) * invD3;
+						ex += radial * dx - node.dipoleX * invD3 - qdX * invD5;
+						ey += radial * dy - node.dipoleY * invD3 - qdY * invD5;
+						ez += radial * dz - node.dipoleZ * invD3 - qdZ * invD5;
+					}
+					else if (node.childCount == 0)
+					{
+						for (unsigned int jjj = node.begin; jjj < node.end; ++jjj)
+						{
+							const float rx = xi - m_x[jjj];
+							const float ry = yi - m_y[jjj];
+							const float rz = zi - m_z[jjj];
+							const float r2 = rx * rx + ry * ry + rz * rz;
+
+							// Skips atom i itself and any atom on top of it
+							if (r2 < 1e-12f)
+								continue;
+
+							const float invR = 1.0f / std::sqrt(r2);
+							const float qOverR = m_charge[jjj] * invR;
+							potential += qOverR;
+
+							const float fieldScalar = qOverR * invR * invR;
+							ex += fieldScalar * rx;
+							ey += fieldScalar * ry;
+							ez += fieldScalar * rz;
+						}
+					}
+					else
+					{
+						for (unsigned int child = 0; child < node.childCount; ++child)
+							stack[stackSize++] = node.firstChild + child;
+					}
+				}
+
+				const float kqi = CoulombConstant * qi;
+				const uint32_t atom = m_sort.Order()[iii];
+				particles.fx[atom] += kqi * ex;
+				particles.fy[atom] += kqi * ey;
+				particles.fz[atom] += kqi * ez;
+				energy += 0.5 * kqi * potential;
+			}
+
+			m_threadSums[threadIndex].value += energy;
+		}
+	);
+
+	double energy = 0.0;
+	for (ThreadSum& sum : m_threadSums)
+	{
+		energy += sum.value;
+		sum.value = 0.0;
+	}
+	return static_cast<float>(energy);
+}
+
+float BarnesHutTree::ExcludedPairs(ParticleArrays& particles, ThreadPool& pool)
+{
+	const size_t rowCount = std::min(particles.Size(), m_exclusionOffsets.empty() ? size_t(0) : m_exclusionOffsets.size() - 1);
+	if (rowCount == 0 || m_exclusions.empty())
+		return 0.0f;
+
+	// The tree includes every pair, so -k q_i q_j / r is added back for the excluded ones. Each atom walks its full row
+	// and only updates its own force, so every pair is visited twice and the energy is halved.
+	pool.ParallelFor(0, rowCount, [&](unsigned int threadIndex, size_t begin, size_t end)
+		{
+			double energy = 0.0;
+			for (size_t i = begin; i < end; ++i)
+			{
+				const float qi = CoulombConstant * particles.charge[i];
+				if (qi == 0.0f)
+					continue;
+
+				float fxi = 0.0f;
+				float fyi = 0.0f;
+				float fzi = 0.0f;
+				for (unsigned int n = m_exclusionOffsets[i]; n < m_exclusionOffsets[i + 1]; ++n)
+				{
+					const unsigned int j = m_exclusions[n];
+					const float dx = particles.x[i] - particles.x[j];
+					const float dy = particles.y[i] - particles.y[j];
+					const float dz = particles.z[i] - particles.z[j];
+					const float r2 = dx * dx + dy * dy + dz * dz;
+					if (r2 < 1e-12f)
+						continue;
+
+					const float invR = 1.0f / std::sqrt(r2);
+					const float qqOverR = qi * particles.charge[j] * invR;
+					energy -= 0.5 * qqOverR;
+
+					const float fScalar = qqOverR * invR * invR;
+					fxi -= fScalar * dx;
+					fyi -= fScalar * dy;
+					fzi -= fScalar * dz;
+				}
+
+				particles.fx[i] += fxi;
+				particles.fy[i] += fyi;
+				particles.fz[i] += fzi;
+			}
+			m_threadSums[threadIndex].value += energy;
+		}
+	);
+
+	double energy = 0.0;
+	for (ThreadSum& sum : m_threadSums)
+	{
+		energy += sum.value;
+		sum.value = 0.0;
+	}
+	return static_cast<float>(energy);
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include "pch.h"
+#include "AlignedAllocator.h"
+#include "Elements.h"
+#include "ParticleArrays.h"
+#include "ThreadPool.h"
+#include "SpatialSort.h"
+
+// Coulomb interactions between every pair of atoms in open (non-periodic) boundaries through a Barnes-Hut octree, in
+// O(N log N) rather than O(N^2). The tree is rebuilt from the particle positions on every call: atoms are sorted by
+// 30-bit Morton code with a parallel radix sort, the top levels of the octree are split serially and the subtrees
+// below them are built concurrently.
+//
+// Each node stores the monopole, dipole and quadrupole moments of its charges about their charge-weighted center. A node whose
+// bounding sphere radius is below theta times its distance from the target atom is evaluated through its moments;
+// otherwise it is opened, down to direct sums over the atoms of the leaves. theta = 0 opens every node and gives the
+// exact pairwise sum; larger opening angles trade accuracy for speed, with errors growing roughly as theta^3. The
+// approximated forces are not the exact gradient of an energy, so the energy drift grows with theta as well: 0.3 (the
+// default) is reasonable for production runs, while interactive sessions can go up to 0.6 or so.
+//
+// Measured against a double precision pairwise sum for 4000 random +-0.5 charges in a globule at liquid density. The
+// energy error is relative to the total of this neutral system, a small difference of large terms, and is
+// correspondingly smaller for charges that pair up into dipoles. See Benchmark::BarnesHutAccuracy.
+//
+//   theta            0.2     0.3     0.4     0.5     0.6     0.7     0.8     0.9
+//   energy error     0.25%   0.86%   2.1%    4.5%    6.4%    8.6%    23%     34%
+//   rms force error  0.03%   0.15%   0.42%   0.94%   1.8%    3.5%    6.6%    9.7%
+class BarnesHutTree
+{
+public:
+	BarnesHutTree() noexcept;
+
+	// Adds the Coulomb force on each atom to particles.fx/fy/fz and returns the Coulomb energy (kJ/mol)
+	float Compute(ParticleArrays& particles, ThreadPool& pool);
+
+	// Pairs with no Coulomb interaction, in the compressed-row form of NeighborList::SetExclusions
+	void SetExclusions(const std::vector<unsigned int>& offsets, const std::vector<unsigned int>& excluded);
+
+	void SetOpeningAngle(float theta) noexcept { WINRT_ASSERT(theta >= 0.0f && theta < 1.0f); m_theta = theta; }
+	ND inline float OpeningAngle() const noexcept { return m_theta; }
+
+	// Nodes with at most this many atoms are not split further
+	void SetLeafSize(unsigned int leafSize) noexcept { WINRT_ASSERT(leafSize > 0); m_leafSize = leafSize; }
+	ND inline unsigned int LeafSize() const noexcept { return m_leafSize; }
+
+	// Size of the tree built by the last Compute call
+	ND inline size_t NodeCount() const noexcept { return m_nodes.size(); }
+
+	// Octree levels resolved by the Morton codes
+	static constexpr unsigned int MaxDepth = SpatialSort::BitsPerAxis;
+
+private:
+	struct Node
+	{
+		// Expansion center (the center of |q|, or of the atoms if they are all neutral) and the bounding sphere about it
+		float centerX = 0.0f;
+		float centerY = 0.0f;
+		float centerZ = 0.0f;
+		float radius = 0.0f;
+
+		float charge = 0.0f;
+		float absCharge = 0.0f;
+		float dipoleX = 0.0f;
+		float dipoleY = 0.0f;
+		float dipoleZ = 0.0f;
+
+		// Traceless quadrupole sum q (3 r_a r_b - r^2 delta_ab)
+		float quadrupoleXX = 0.0f;
+		float quadrupoleYY = 0.0f;
+		float quadrupoleZZ = 0.0f;
+		float quadrupoleXY = 0.0f;
+		float quadrupoleXZ = 0.0f;
+		float quadrupoleYZ = 0.0f;
+
+		// Atoms [begin, end) of the Morton-sorted arrays; children are stored contiguously
+		unsigned int begin = 0;
+		unsigned int end = 0;
+		unsigned int firstChild = 0;
+		unsigned int childCount = 0;
+	};
+
+	// A subtree below the serially split top levels, built by one thread into its own node array
+	struct Subtree
+	{
+		unsigned int root = 0;
+		unsigned int depth = 0;
+		unsigned int base = 0;		// where nodes[1..] go in m_nodes
+		std::vector<Node> nodes;
+	};
+
+	void SortByMortonCode(const ParticleArrays& particles, ThreadPool& pool);
+	void BuildTree(ThreadPool& pool);
+	void SplitTop(unsigned int nodeIndex, unsigned int depth);
+	void BuildSubtree(std::vector<Node>& nodes, unsigned int nodeIndex, unsigned int depth) const;
+
+	// Splits the atoms of a node at the given depth into its (up to 8) non-empty octants. Returns the octant count.
+	unsigned int SplitRange(unsigned int begin, unsigned int end, unsigned int depth, std::array<std::pair<unsigned int, unsigned int>, 8>& ranges) const noexcept;
+	void LeafMoments(Node& node) const noexcept;
+	static void InternalMoments(Node& node, const Node* children) noexcept;
+
+	ND float Traverse(ParticleArrays& particles, ThreadPool& pool);
+	ND float ExcludedPairs(ParticleArrays& particles, ThreadPool& pool);
+
+	float m_theta;
+	unsigned int m_leafSize;
+
+	// Morton codes and the atom index of every sorted position
+	SpatialSort m_sort;
+
+	// Positions and charges in Morton order
+	AlignedVector<float> m_x;
+	AlignedVector<float> m_y;
+	AlignedVector<float> m_z;
+	AlignedVector<float> m_charge;
+
+	std::vector<Node> m_nodes;
+	std::vector<unsigned int> m_topInternal;
+	std::vector<Subtree> m_subtrees;
+	size_t m_subtreeCount;
+
+	// Both directions of every excluded pair (see NeighborList::MirrorExclusions)
+	std::vector<unsigned int> m_exclusionOffsets;
+	std::vector<unsigned int> m_exclusions;
+
+	struct alignas(64) ThreadSum
+	{
+		double value = 0.0;
+	};
+	std::vector<ThreadSum> m_threadSums;
+};
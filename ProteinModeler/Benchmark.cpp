@@ -0,0 +1,697 @@
+#include "pch.h"
+#include "Benchmark.h"
+#include "Simulation.h"
+#include <complex>
+#include <numeric>
+#include <random>
+
+namespace
+{
+	constexpr float LatticeSpacing = 0.3f;
+
+	unsigned int LatticeSitesPerSide(size_t atomCount) noexcept
+	{
+		return static_cast<unsigned int>(std::ceil(std::cbrt(static_cast<double>(atomCount))));
+	}
+
+	// Fills a cubic box with atoms on a 0.3 nm lattice, which is close to liquid density for the UFF parameters.
+	// Shuffled adds the lattice sites in random order, so array order says nothing about position.
+	void FillLattice(Simulation& simulation, size_t atomCount, bool shuffled = false)
+	{
+		const float spacing = LatticeSpacing;
+		const unsigned int perSide = LatticeSitesPerSide(atomCount);
+		const float boxMax = 0.5f * spacing * perSide + spacing;
+		simulation.SetBoxMax(boxMax);
+
+		std::vector<size_t> sites(atomCount);
+		std::iota(sites.begin(), sites.end(), size_t{ 0 });
+		if (shuffled)
+			std::shuffle(sites.begin(), sites.end(), std::mt19937(2024u));
+
+		for (size_t site : sites)
+		{
+			const size_t iii = site;
+			DirectX::XMFLOAT3 position = {
+				-boxMax + spacing * (1.0f + static_cast<float>(iii % perSide)),
+				-boxMax + spacing * (1.0f + static_cast<float>((iii / perSide) % perSide)),
+				-boxMax + spacing * (1.0f + static_cast<float>(iii / (static_cast<size_t>(perSide) * perSide)))
+			};
+			// Small deterministic velocities so the neighbor list occasionally needs rebuilding
+			DirectX::XMFLOAT3 velocity = {
+				0.1f * static_cast<float>(static_cast<int>(iii % 7) - 3),
+				0.1f * static_cast<float>(static_cast<int>(iii % 5) - 2),
+				0.1f * static_cast<float>(static_cast<int>(iii % 3) - 1)
+			};
+			simulation.Add(Element::Neon, position, velocity);
+		}
+	}
+
+	// Bonds each atom of an unshuffled FillLattice to its neighbor along x at the lattice spacing, turning the rows into
+	// chains. Stiff enough to vibrate with a period of about 60 fs, like the heavy-atom bonds of a protein.
+	void BondLatticeRows(Simulation& simulation, size_t atomCount)
+	{
+		constexpr float ForceConstant = 1e5f;
+		const unsigned int perSide = LatticeSitesPerSide(atomCount);
+		for (size_t iii = 0; iii + 1 < atomCount; ++iii)
+		{
+			if ((iii + 1) % perSide != 0)
+				simulation.Bonded().AddBond(static_cast<unsigned int>(iii), static_cast<unsigned int>(iii + 1), LatticeSpacing, ForceConstant);
+		}
+	}
+
+	// Reciprocal-space Ewald sum, (k / 2 pi V) sum_m exp(-pi^2 m^2 / beta^2) / m^2 |S(m)|^2 over every m = (kx/Lx, ky/Ly, kz/Lz)
+	// whose Gaussian factor is above 1e-12, in double precision. Returns the energy and writes the forces.
+	double DirectEwaldReciprocal(const ParticleArrays& particles, const SimulationBox& box, double beta,
+		std::vector<double>& fx, std::vector<double>& fy, std::vector<double>& fz)
+	{
+		constexpr double Pi = 3.14159265358979323846;
+		const size_t count = particles.Size();
+		const DirectX::XMFLOAT3 lengths = box.Lengths();
+		const double length[3] = { lengths.x, lengths.y, lengths.z };
+		const double volume = length[0] * length[1] * length[2];
+
+		const double maxM = beta * std::sqrt(std::log(1e12)) / Pi;
+		int maxK[3];
+		for (int d = 0; d < 3; ++d)
+			maxK[d] = static_cast<int>(std::ceil(maxM * length[d]));
+
+		// exp(2 pi i k x / L) for every atom and k in [-maxK, maxK], per axis
+		const float* position[3] = { particles.x.data(), particles.y.data(), particles.z.data() };
+		std::vector<std::complex<double>> phase[3];
+		for (int d = 0; d < 3; ++d)
+		{
+			const size_t width = 2 * maxK[d] + 1;
+			phase[d].resize(count * width);
+			for (size_t iii = 0; iii < count; ++iii)
+				for (int k = -maxK[d]; k <= maxK[d]; ++k)
+					phase[d][iii * width + (k + maxK[d])] = std::polar(1.0, 2.0 * Pi * k * position[d][iii] / length[d]);
+		}
+
+		fx.assign(count, 0.0);
+		fy.assign(count, 0.0);
+		fz.assign(count, 0.0);
+
+		std::vector<std::complex<double>> atomPhase(count);
+		double energy = 0.0;
+		for (int kx = -maxK[0]; kx <= maxK[0]; ++kx)
+		{
+			for (int ky = -maxK[1]; ky <= maxK[1]; ++ky)
+			{
+				for (int kz = -maxK[2]; kz <= maxK[2]; ++kz)
+				{
+					const double mx = kx / length[0];
+					const double my = ky / length[1];
+					const double mz = kz / length[2];
+					const double m2 = mx * mx + my * my + mz * mz;
+					if (m2 == 0.0 || m2 > maxM * maxM)
+						continue;
+
+					std::complex<double> structureFactor = 0.0;
+					for (size_t iii = 0; iii < count; ++iii)
+					{
+						atomPhase[iii] = static_cast<double>(particles.charge[iii]) *
+							phase[0][iii * (2 * maxK[0] + 1) + (kx + maxK[0])] *
+							phase[1][iii * (2 * maxK[1] + 1) + (ky + maxK[1])] *
+							phase[2][iii * (2 * maxK[2] + 1) + (kz + maxK[2])];
+						structureFactor += atomPhase[iii];
+					}
+
+					const double factor = CoulombConstant * std::exp(-Pi * Pi * m2 / (beta * beta)) / m2;
+					energy += factor * std::norm(structureFactor) / (2.0 * Pi * volume);
+
+					// -dE/dr_j = (2k / V) factor m Im(conj(S) q_j exp(2 pi i m.r_j))
+					for (size_t iii = 0; iii < count; ++iii)
+					{
+						const double projection = 2.0 / volume * factor * (std::conj(structureFactor) * atomPhase[iii]).imag();
+						fx[iii] += projection * mx;
+						fy[iii] += projection * my;
+						fz[iii] += projection * mz;
+					}
+				}
+			}
+		}
+		return energy;
+	}
+
+	template<typename F>
+	double MillisecondsPerCall(unsigned int calls, F&& fn)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (unsigned int iii = 0; iii < calls; ++iii)
+			fn();
+		auto end = std::chrono::steady_clock::now();
+		return std::chrono::duration<double, std::milli>(end - start).count() / calls;
+	}
+
+	// Set-associative LRU cache of 64-byte lines; only tags are tracked
+	class CacheModel
+	{
+	public:
+		CacheModel(size_t sets, size_t ways) : m_sets(sets), m_ways(ways), m_tags(sets * ways, std::numeric_limits<uintptr_t>::max()) {}
+
+		// Returns true on a miss. Each set keeps its tags most recently used first.
+		bool Access(uintptr_t address) noexcept
+		{
+			const uintptr_t line = address / 64;
+			uintptr_t* set = m_tags.data() + (line % m_sets) * m_ways;
+			size_t way = 0;
+			while (way < m_ways && set[way] != line)
+				++way;
+			const bool miss = way == m_ways;
+			std::move_backward(set, set + (miss ? m_ways - 1 : way), set + (miss ? m_ways : way + 1));
+			set[0] = line;
+			return miss;
+		}
+
+	private:
+		size_t m_sets;
+		size_t m_ways;
+		std::vector<uintptr_t> m_tags;
+	};
+
+	// Locality of the neighbor coordinate loads, replayed row by row in list order
+	void MeasureNeighborLocality(Simulation& simulation, SpatialReorderSample& sample)
+	{
+		const NeighborList& list = simulation.Nonbonded().Neighbors();
+		const std::vector<unsigned int>& offsets = list.Offsets();
+		const std::vector<unsigned int>& neighbors = list.Neighbors();
+		const float* x = simulation.Particles().x.data();
+		const size_t rows = offsets.empty() ? 0 : offsets.size() - 1;
+
+		CacheModel cache(64, 8);
+		std::vector<uintptr_t> lines;
+		size_t distinctLines = 0;
+		size_t misses = 0;
+		for (size_t iii = 0; iii < rows; ++iii)
+		{
+			cache.Access(reinterpret_cast<uintptr_t>(x + iii));
+			lines.clear();
+			for (unsigned int k = offsets[iii]; k < offsets[iii + 1]; ++k)
+			{
+				const uintptr_t address = reinterpret_cast<uintptr_t>(x + neighbors[k]);
+				misses += cache.Access(address);
+				lines.push_back(address / 64);
+			}
+			std::sort(lines.begin(), lines.end());
+			distinctLines += std::unique(lines.begin(), lines.end()) - lines.begin();
+		}
+
+		sample.cacheLinesPerRow = rows > 0 ? static_cast<double>(distinctLines) / rows : 0.0;
+		sample.modelledMissesPerPair = neighbors.empty() ? 0.0 : static_cast<double>(misses) / neighbors.size();
+	}
+
+	// Benchmark-only baseline for InstancePacking: the per-frame data the renderer uploaded before AtomInstance, a world
+	// matrix per atom pre-transposed the way the old instanced vertex shader read it, rows (r 0 0 x) (0 r 0 y)
+	// (0 0 r z) (0 0 0 1), plus a separate material index. Nothing outside this file uses it.
+	void WriteWorldMatrices(const ParticleArrays& particles, float* matrices, unsigned int* materialIndices) noexcept
+	{
+		for (size_t iii = 0; iii < particles.Size(); ++iii)
+		{
+			const float r = particles.radius[iii];
+			float* m = matrices + 16 * iii;
+			m[0] = r;		m[1] = 0.0f;	m[2] = 0.0f;	m[3] = particles.x[iii];
+			m[4] = 0.0f;	m[5] = r;		m[6] = 0.0f;	m[7] = particles.y[iii];
+			m[8] = 0.0f;	m[9] = 0.0f;	m[10] = r;		m[11] = particles.z[iii];
+			m[12] = 0.0f;	m[13] = 0.0f;	m[14] = 0.0f;	m[15] = 1.0f;
+			materialIndices[iii] = static_cast<unsigned int>(particles.type[iii]) - 1;
+		}
+	}
+}
+
+std::vector<ThreadScalingSample> Benchmark::ThreadScaling(size_t atomCount, unsigned int maxThreads, unsigned int steps, size_t chunkSize)
+{
+	Simulation simulation;
+	FillLattice(simulation, atomCount);
+	simulation.SetChunkSize(chunkSize);
+
+	std::vector<ThreadScalingSample> samples;
+	for (unsigned int threads = 1; threads <= maxThreads; threads *= 2)
+	{
+		simulation.SetThreadCount(threads);
+
+		// Warm up: the first step builds the neighbor list and sizes the per-thread buffers
+		simulation.Step();
+
+		ThreadScalingSample sample;
+		sample.threadCount = threads;
+		sample.millisecondsPerStep = MillisecondsPerCall(steps, [&]() { simulation.Step(); });
+		sample.speedup = samples.empty() ? 1.0 : samples.front().millisecondsPerStep / sample.millisecondsPerStep;
+		sample.efficiency = sample.speedup / threads;
+		sample.nanosecondsPerDay = 0.001 * simulation.TimeStep() * (86400.0 * 1000.0 / sample.millisecondsPerStep);
+		samples.push_back(sample);
+	}
+
+	return samples;
+}
+
+std::vector<RespaStabilitySample> Benchmark::RespaStability(size_t atomCount, unsigned int maxMultiplier, unsigned int timesteps, float timeStepFemtoseconds)
+{
+	std::vector<RespaStabilitySample> samples;
+	for (unsigned int multiplier = 1; multiplier <= maxMultiplier; multiplier *= 2)
+	{
+		// Start every run from the same state. The bonds are the fast forces r-RESPA evaluates every timestep; with the
+		// nonbonded forces alone there would be nothing to split off and every multiplier would take the same steps.
+		// Thermal velocities, drawn from the fixed seed, set them vibrating.
+		Simulation simulation;
+		FillLattice(simulation, atomCount);
+		BondLatticeRows(simulation, atomCount);
+		simulation.AssignMaxwellBoltzmannVelocities(300.0f);
+		simulation.SetTimeStepFemtoseconds(timeStepFemtoseconds);
+		simulation.SetRespaMultiplier(multiplier);
+		simulation.SetEnergyDiagnostics(true);
+
+		const unsigned int outerSteps = std::max(1u, timesteps / multiplier);
+
+		RespaStabilitySample sample;
+		sample.multiplier = multiplier;
+		sample.millisecondsPerTimestep = MillisecondsPerCall(outerSteps, [&]() { simulation.Step(); }) / multiplier;
+		sample.drift = simulation.EnergyDrift();
+		samples.push_back(sample);
+	}
+
+	return samples;
+}
+
+std::vector<PmeAccuracySample> Benchmark::PmeAccuracy(size_t atomCount, unsigned int order, float cutoff, unsigned int threadCount)
+{
+	// Random, overall neutral charges in a cube at liquid density. Only the reciprocal part is compared, so overlapping
+	// atoms do not matter.
+	SimulationBox box;
+	box.boundaries = BoundaryConditions::Periodic;
+	const float halfExtent = std::max(cutoff, 0.5f * 0.3f * static_cast<float>(std::cbrt(static_cast<double>(atomCount))));
+	box.halfExtents = { halfExtent, halfExtent, halfExtent };
+
+	std::mt19937 generator(2024u);
+	std::uniform_real_distribution<float> uniform(-halfExtent, halfExtent);
+	ParticleArrays particles;
+	for (size_t iii = 0; iii < atomCount; ++iii)
+		particles.PushBack(Element::Oxygen, { uniform(generator), uniform(generator), uniform(generator) }, { 0.0f, 0.0f, 0.0f }, iii % 2 == 0 ? 0.5f : -0.5f);
+
+	ThreadPool pool(threadCount);
+	ParticleMeshEwald pme;
+	pme.SetInterpolationOrder(order);
+
+	std::vector<double> fx, fy, fz;
+	double directEnergy = 0.0;
+	const double directMilliseconds = MillisecondsPerCall(1, [&]()
+		{
+			directEnergy = DirectEwaldReciprocal(particles, box, ParticleMeshEwald::EwaldCoefficient(cutoff, pme.EwaldTolerance()), fx, fy, fz);
+		}
+	);
+
+	double forceNorm = 0.0;
+	for (size_t iii = 0; iii < atomCount; ++iii)
+		forceNorm += fx[iii] * fx[iii] + fy[iii] * fy[iii] + fz[iii] * fz[iii];
+
+	std::vector<PmeAccuracySample> samples;
+	for (float spacing : { 0.2f, 0.16f, 0.12f, 0.1f, 0.08f, 0.06f })
+	{
+		pme.SetGridSpacing(spacing);
+
+		// The first call builds the grid and the influence function
+		particles.ZeroForces();
+		pme.Compute(particles, box, cutoff, pool);
+
+		double forceError = 0.0;
+		for (size_t iii = 0; iii < atomCount; ++iii)
+		{
+			const double ex = particles.fx[iii] - fx[iii];
+			const double ey = particles.fy[iii] - fy[iii];
+			const double ez = particles.fz[iii] - fz[iii];
+			forceError += ex * ex + ey * ey + ez * ez;
+		}
+
+		PmeAccuracySample sample;
+		sample.gridSpacing = spacing;
+		sample.gridSize = pme.GridSize();
+		sample.pmeMilliseconds = MillisecondsPerCall(10, [&]() { pme.Compute(particles, box, cutoff, pool); });
+		sample.directEwaldMilliseconds = directMilliseconds;
+		sample.energyRelativeError = std::abs(pme.ReciprocalEnergy() - directEnergy) / std::abs(directEnergy);
+		sample.forceRmsRelativeError = std::sqrt(forceError / forceNorm);
+		samples.push_back(sample);
+	}
+
+	return samples;
+}
+
+std::vector<BarnesHutAccuracySample> Benchmark::BarnesHutAccuracy(size_t atomCount, unsigned int threadCount)
+{
+	// Random, overall neutral charges in a sphere at liquid density, roughly the shape of a folded protein
+	const float radius = 0.3f * static_cast<float>(std::cbrt(0.75 / 3.14159265358979323846 * static_cast<double>(atomCount)));
+	std::mt19937 generator(2024u);
+	std::uniform_real_distribution<float> uniform(-radius, radius);
+	ParticleArrays particles;
+	while (particles.Size() < atomCount)
+	{
+		const DirectX::XMFLOAT3 position = { uniform(generator), uniform(generator), uniform(generator) };
+		if (position.x * position.x + position.y * position.y + position.z * position.z <= radius * radius)
+			particles.PushBack(Element::Oxygen, position, { 0.0f, 0.0f, 0.0f }, particles.Size() % 2 == 0 ? 0.5f : -0.5f);
+	}
+
+	ThreadPool pool(threadCount);
+	BarnesHutTree tree;
+
+	tree.SetOpeningAngle(0.0f);
+	particles.ZeroForces();
+	float exactEnergy = 0.0f;
+	const double exactMilliseconds = MillisecondsPerCall(1, [&]() { exactEnergy = tree.Compute(particles, pool); });
+	const AlignedVector<float> fx = particles.fx;
+	const AlignedVector<float> fy = particles.fy;
+	const AlignedVector<float> fz = particles.fz;
+
+	double forceNorm = 0.0;
+	for (size_t iii = 0; iii < atomCount; ++iii)
+		forceNorm += static_cast<double>(fx[iii]) * fx[iii] + static_cast<double>(fy[iii]) * fy[iii] + static_cast<double>(fz[iii]) * fz[iii];
+
+	std::vector<BarnesHutAccuracySample> samples;
+	for (float theta : { 0.2f, 0.3f, 0.4f, 0.5f, 0.6f, 0.7f, 0.8f, 0.9f })
+	{
+		tree.SetOpeningAngle(theta);
+
+		particles.ZeroForces();
+		const float energy = tree.Compute(particles, pool);
+
+		double forceError = 0.0;
+		for (size_t iii = 0; iii < atomCount; ++iii)
+		{
+			const double ex = particles.fx[iii] - fx[iii];
+			const double ey = particles.fy[iii] - fy[iii];
+			const double ez = particles.fz[iii] - fz[iii];
+			forceError += ex * ex + ey * ey + ez * ez;
+		}
+
+		BarnesHutAccuracySample sample;
+		sample.openingAngle = theta;
+		sample.nodeCount = tree.NodeCount();
+		sample.milliseconds = MillisecondsPerCall(5, [&]() { tree.Compute(particles, pool); });
+		sample.exactMilliseconds = exactMilliseconds;
+		sample.energyRelativeError = std::abs(static_cast<double>(energy) - exactEnergy) / std::abs(static_cast<double>(exactEnergy));
+		sample.forceRmsRelativeError = std::sqrt(forceError / forceNorm);
+		samples.push_back(sample);
+	}
+
+	return samples;
+}
+
+std::vector<SpatialReorderSample> Benchmark::SpatialReorder(size_t atomCount, unsigned int steps, unsigned int threadCount)
+{
+	struct Ordering
+	{
+		const char* name;
+		bool reorder;
+		SpaceFillingCurve curve;
+	};
+	const Ordering orderings[] = {
+		{ "unordered", false, SpaceFillingCurve::Morton },
+		{ "Morton", true, SpaceFillingCurve::Morton },
+		{ "Hilbert", true, SpaceFillingCurve::Hilbert }
+	};
+
+	std::vector<SpatialReorderSample> samples;
+	for (const Ordering& ordering : orderings)
+	{
+		// Every ordering starts from the same shuffled system
+		Simulation simulation;
+		simulation.SetReorderInterval(0);
+		if (threadCount > 0)
+			simulation.SetThreadCount(threadCount);
+		FillLattice(simulation, atomCount, true);
+
+		SpatialReorderSample sample;
+		sample.ordering = ordering.name;
+		if (ordering.reorder)
+		{
+			simulation.SetReorderCurve(ordering.curve);
+			sample.reorderMilliseconds = MillisecondsPerCall(1, [&]() { simulation.ReorderAtoms(); });
+		}
+
+		// The first step builds the neighbor list and is not timed
+		simulation.Step();
+		MeasureNeighborLocality(simulation, sample);
+		sample.millisecondsPerStep = MillisecondsPerCall(steps, [&]() { simulation.Step(); });
+		sample.speedup = samples.empty() ? 1.0 : samples.front().millisecondsPerStep / sample.millisecondsPerStep;
+		samples.push_back(sample);
+	}
+
+	return samples;
+}
+
+std::vector<AtomEditingSample> Benchmark::AtomEditing(size_t maxAtomCount)
+{
+	std::vector<AtomEditingSample> samples;
+	for (size_t atomCount = 1000; atomCount <= maxAtomCount; atomCount *= 10)
+	{
+		std::vector<AtomDescription> atoms(atomCount);
+		for (size_t iii = 0; iii < atomCount; ++iii)
+		{
+			atoms[iii].element = Element::Carbon;
+			atoms[iii].position = { 0.15f * static_cast<float>(iii % 100), 0.15f * static_cast<float>((iii / 100) % 100), 0.15f * static_cast<float>(iii / 10000) };
+		}
+
+		AtomEditingSample sample;
+		sample.atomCount = atomCount;
+
+		Simulation oneAtATime;
+		sample.addOneAtATimeMilliseconds = MillisecondsPerCall(1, [&]() {
+			for (const AtomDescription& atom : atoms)
+				oneAtATime.Add(atom.element, atom.position, atom.velocity, atom.charge);
+		});
+
+		Simulation simulation;
+		std::vector<AtomHandle> handles(atomCount);
+		sample.addAtomsMilliseconds = MillisecondsPerCall(1, [&]() { simulation.AddAtoms(atoms.data(), atomCount, handles.data()); });
+
+		for (unsigned int iii = 0; iii + 1 < atomCount; ++iii)
+			simulation.Bonded().AddBond(iii, iii + 1, 0.15f, 200000.0f);
+		std::vector<AtomHandle> removed;
+		for (size_t iii = 0; iii < atomCount; iii += 2)
+			removed.push_back(handles[iii]);
+		sample.removeAtomsMilliseconds = MillisecondsPerCall(1, [&]() { simulation.RemoveAtoms(removed.data(), removed.size()); });
+
+		samples.push_back(sample);
+	}
+
+	return samples;
+}
+
+std::vector<InstancePackingSample> Benchmark::InstancePacking(size_t instanceCount, unsigned int frames, unsigned int threadCount)
+{
+	Simulation simulation;
+	FillLattice(simulation, instanceCount);
+	if (threadCount > 0)
+		simulation.SetThreadCount(threadCount);
+
+	const ParticleArrays& particles = simulation.Particles();
+	AlignedVector<float> matrices(16 * instanceCount);
+	std::vector<unsigned int> materialIndices(instanceCount);
+	AlignedVector<AtomInstance> instances(instanceCount);
+
+	std::vector<InstancePackingSample> samples;
+	for (int level = 0; level <= static_cast<int>(SimdKernels::DetectLevel()); ++level)
+	{
+		simulation.SetSimdLevel(static_cast<SimdLevel>(level));
+
+		InstancePackingSample sample;
+		sample.level = static_cast<SimdLevel>(level);
+		sample.worldMatrixMilliseconds = MillisecondsPerCall(frames, [&]() { WriteWorldMatrices(particles, matrices.data(), materialIndices.data()); });
+		sample.packedMilliseconds = MillisecondsPerCall(frames, [&]() { simulation.WriteInstances(0, instanceCount, instances.data()); });
+		sample.worldMatrixBytesPerInstance = 16 * sizeof(float) + sizeof(unsigned int);
+		sample.packedBytesPerInstance = sizeof(AtomInstance);
+		samples.push_back(sample);
+	}
+
+	return samples;
+}
+
+std::vector<InstanceUploadSample> Benchmark::InstanceUpload(size_t maxAtomCount, size_t atomsPerFrame)
+{
+	WINRT_ASSERT(atomsPerFrame > 0);
+
+	constexpr size_t BatchSize = 1024;
+	InstanceUploadTracker tracker(sizeof(AtomInstance));
+	auto frame = [&](size_t atomCount)
+		{
+			// RenderObjectInstanced::Update, then Render without the device calls
+			const bool created = tracker.BeginFrame(atomCount);
+			tracker.Submit(atomCount, [](size_t) {}, [](size_t) {});
+			return created;
+		};
+
+	std::vector<InstanceUploadSample> samples;
+	size_t atomCount = 0;
+	unsigned int bufferCreations = 0;
+	for (size_t target = 1000; target <= maxAtomCount; target *= 10)
+	{
+		while (atomCount < target)
+		{
+			atomCount = std::min(atomCount + atomsPerFrame, target);
+			bufferCreations += frame(atomCount) ? 1 : 0;
+		}
+
+		InstanceUploadSample sample;
+		sample.atomCount = atomCount;
+		sample.bufferCreations = bufferCreations;
+		for (size_t first = 0; first < atomCount; first += BatchSize)
+		{
+			const size_t count = std::min(BatchSize, atomCount - first);
+			sample.batched.maps += 2;
+			sample.batched.draws += 1;
+			sample.batched.bytes += count * (16 * sizeof(float) + sizeof(unsigned int));
+		}
+		frame(atomCount);
+		sample.growable = tracker.Frame();
+		samples.push_back(sample);
+	}
+
+	return samples;
+}
+
+std::vector<LodSelectionSample> Benchmark::LodSelection(size_t atomCount, unsigned int frames, unsigned int threadCount)
+{
+	Simulation simulation;
+	FillLattice(simulation, atomCount);
+	if (threadCount > 0)
+		simulation.SetThreadCount(threadCount);
+
+	// Camera::CreateProjectionMatrix: y scale of a 45 degree field of view
+	constexpr float ViewportHeight = 1080.0f;
+	const float pixelScale = 0.5f * ViewportHeight / std::tan(0.5f * 3.14159265f / 4.0f);
+
+	const ParticleArrays& particles = simulation.Particles();
+	LodSelector lods;
+	std::vector<LodSelectionSample> samples;
+	for (float distance : { 20.0f, 50.0f, 100.0f, 200.0f })
+	{
+		// Looking down +z at the center of the box from distance: the view matrix is a translation
+		DirectX::XMFLOAT4X4 view = {};
+		for (int iii = 0; iii < 4; ++iii)
+			view.m[iii][iii] = 1.0f;
+		view.m[3][2] = distance;
+
+		LodSelectionSample sample;
+		sample.cameraDistance = distance;
+		sample.milliseconds = MillisecondsPerCall(frames, [&]()
+			{
+				lods.Update(particles.x.data(), particles.y.data(), particles.z.data(), particles.radius.data(), nullptr, particles.Size(), view, pixelScale, simulation.Pool());
+			}
+		);
+		for (unsigned int level = 0; level < LodSelector::LevelCount; ++level)
+			sample.atomsPerLevel[level] = lods.Bucket(level).size();
+		sample.triangles = lods.TriangleCount();
+		sample.fixedLevelTriangles = particles.Size() * LodSelector::TriangleCount(3);
+		samples.push_back(sample);
+	}
+
+	return samples;
+}
+
+std::vector<FrustumCullingSample> Benchmark::FrustumCulling(size_t atomCount, unsigned int frames, unsigned int threadCount)
+{
+	Simulation simulation;
+	FillLattice(simulation, atomCount);
+	if (threadCount > 0)
+		simulation.SetThreadCount(threadCount);
+
+	// Camera::CreateProjectionMatrix (45 degree vertical field of view, 16:9, near 1, far 1000) behind a view matrix that
+	// only moves the eye a quarter of the box in front of its center, looking down +z
+	constexpr float NearZ = 1.0f;
+	constexpr float FarZ = 1000.0f;
+	const float yScale = 1.0f / std::tan(0.5f * 3.14159265f / 4.0f);
+	DirectX::XMFLOAT4X4 viewProjection = {};
+	viewProjection.m[0][0] = yScale * 9.0f / 16.0f;
+	viewProjection.m[1][1] = yScale;
+	viewProjection.m[2][2] = FarZ / (FarZ - NearZ);
+	viewProjection.m[2][3] = 1.0f;
+	viewProjection.m[3][2] = -NearZ * FarZ / (FarZ - NearZ);
+	const float eyeZ = -0.25f * simulation.BoxScaling().z;
+	viewProjection.m[3][2] -= eyeZ * viewProjection.m[2][2];
+	viewProjection.m[3][3] -= eyeZ * viewProjection.m[2][3];
+	const FrustumPlanes planes = FrustumCuller::ExtractPlanes(viewProjection);
+
+	const ParticleArrays& particles = simulation.Particles();
+	FrustumCuller culler;
+	AlignedVector<AtomInstance> instances(atomCount);
+
+	std::vector<FrustumCullingSample> samples;
+	for (int level = 0; level <= static_cast<int>(SimdKernels::DetectLevel()); ++level)
+	{
+		simulation.SetSimdLevel(static_cast<SimdLevel>(level));
+
+		FrustumCullingSample sample;
+		sample.level = static_cast<SimdLevel>(level);
+		sample.milliseconds = MillisecondsPerCall(frames, [&]()
+			{
+				culler.Update(particles.x.data(), particles.y.data(), particles.z.data(), particles.radius.data(), particles.Size(),
+					planes, simulation.Kernels(), simulation.Pool());
+			}
+		);
+		sample.visible = culler.VisibleCount();
+		sample.culled = culler.CulledCount();
+		sample.speedup = samples.empty() ? 1.0 : samples.front().milliseconds / sample.milliseconds;
+		sample.uploadMilliseconds = MillisecondsPerCall(frames, [&]()
+			{
+				simulation.GatherInstances(culler.Visible().data(), culler.VisibleCount(), instances.data());
+			}
+		);
+		sample.unculledUploadMilliseconds = MillisecondsPerCall(frames, [&]() { simulation.WriteInstances(0, atomCount, instances.data()); });
+		samples.push_back(sample);
+	}
+
+	return samples;
+}
+
+std::vector<OcclusionCullingSample> Benchmark::OcclusionCulling(size_t atomCount, float cameraDistance, unsigned int frames, unsigned int threadCount)
+{
+	Simulation simulation;
+	FillLattice(simulation, atomCount);
+	if (threadCount > 0)
+		simulation.SetThreadCount(threadCount);
+
+	// Camera::CreateProjectionMatrix (45 degree vertical field of view, 16:9) looking down +z at the center of the box
+	// from cameraDistance: the view matrix is a translation
+	const float yScale = 1.0f / std::tan(0.5f * 3.14159265f / 4.0f);
+	const float xScale = yScale * 9.0f / 16.0f;
+	DirectX::XMFLOAT4X4 view = {};
+	for (int iii = 0; iii < 4; ++iii)
+		view.m[iii][iii] = 1.0f;
+	view.m[3][2] = cameraDistance;
+
+	// As the renderer, only the atoms inside the frustum are tested
+	DirectX::XMFLOAT4X4 viewProjection = {};
+	viewProjection.m[0][0] = xScale;
+	viewProjection.m[1][1] = yScale;
+	viewProjection.m[2][2] = 1000.0f / 999.0f;
+	viewProjection.m[2][3] = 1.0f;
+	viewProjection.m[3][2] = cameraDistance * viewProjection.m[2][2] - 1000.0f / 999.0f;
+	viewProjection.m[3][3] = cameraDistance;
+
+	const ParticleArrays& particles = simulation.Particles();
+	FrustumCuller frustum;
+	frustum.Update(particles.x.data(), particles.y.data(), particles.z.data(), particles.radius.data(), particles.Size(),
+		FrustumCuller::ExtractPlanes(viewProjection), simulation.Kernels(), simulation.Pool());
+
+	std::vector<OcclusionCullingSample> samples;
+	for (unsigned int width : { 256u, 320u, 512u })
+	{
+		OcclusionCuller occlusion;
+		occlusion.SetResolution(width, width * 9 / 16);
+		occlusion.SetNearPlane(1.0f);
+
+		OcclusionCullingSample sample;
+		sample.width = occlusion.Width();
+		sample.height = occlusion.Height();
+		sample.milliseconds = MillisecondsPerCall(frames, [&]()
+			{
+				occlusion.Update(particles.x.data(), particles.y.data(), particles.z.data(), particles.radius.data(), frustum.Visible().data(),
+					frustum.VisibleCount(), view, xScale, yScale, simulation.Pool());
+			}
+		);
+		sample.tested = occlusion.TestedCount();
+		sample.occluded = occlusion.OccludedCount();
+		sample.occludedFraction = occlusion.OccludedFraction();
+		sample.occluders = occlusion.OccluderCount();
+		samples.push_back(sample);
+	}
+
+	return samples;
+}
@@ -0,0 +1,168 @@
+#pragma once
+#include "pch.h"
+#include "EnergyMonitor.h"
+#include "SimdKernels.h"
+#include "FrustumCuller.h"
+#include "InstanceUploadTracker.h"
+#include "LodSelector.h"
+#include "OcclusionCuller.h"
+
+// Headless timing harnesses for the simulation core. None of these touch the renderer or the UI, so they can be run
+// from a debugger or a test host to compare configurations on a given machine.
+
+struct ThreadScalingSample
+{
+	unsigned int threadCount = 0;
+	double millisecondsPerStep = 0.0;
+	double speedup = 0.0;		// relative to the single-thread run
+	double efficiency = 0.0;	// speedup / threadCount
+	double nanosecondsPerDay = 0.0;
+};
+
+struct RespaStabilitySample
+{
+	unsigned int multiplier = 0;
+	double millisecondsPerTimestep = 0.0;
+	EnergyDriftStatistics drift;
+};
+
+struct PmeAccuracySample
+{
+	float gridSpacing = 0.0f;
+	std::array<unsigned int, 3> gridSize = { 0, 0, 0 };
+	double pmeMilliseconds = 0.0;			// whole PME evaluation (splines, spreading, FFTs, interpolation)
+	double directEwaldMilliseconds = 0.0;	// reference reciprocal sum
+	double energyRelativeError = 0.0;		// of the reciprocal-space energy
+	double forceRmsRelativeError = 0.0;		// rms |F_pme - F_ewald| / rms |F_ewald|
+};
+
+struct BarnesHutAccuracySample
+{
+	float openingAngle = 0.0f;
+	size_t nodeCount = 0;
+	double milliseconds = 0.0;				// tree build plus traversal
+	double exactMilliseconds = 0.0;			// reference all-pairs sum (the tree with theta = 0)
+	double energyRelativeError = 0.0;
+	double forceRmsRelativeError = 0.0;		// rms |F_tree - F_exact| / rms |F_exact|
+};
+
+struct SpatialReorderSample
+{
+	const char* ordering = "";
+	double millisecondsPerStep = 0.0;
+	double reorderMilliseconds = 0.0;		// one ReorderAtoms call
+	double cacheLinesPerRow = 0.0;			// distinct 64-byte lines of a coordinate array touched per neighbor list row
+	double modelledMissesPerPair = 0.0;		// misses of a 32 KB, 8-way LRU cache replaying the neighbor coordinate loads
+	double speedup = 0.0;					// step time relative to the unordered run
+};
+
+struct AtomEditingSample
+{
+	size_t atomCount = 0;
+	double addOneAtATimeMilliseconds = 0.0;		// Simulation::Add per atom
+	double addAtomsMilliseconds = 0.0;			// a single AddAtoms call
+	double removeAtomsMilliseconds = 0.0;		// RemoveAtoms of every other atom of a bonded chain
+};
+
+struct InstancePackingSample
+{
+	SimdLevel level = SimdLevel::Scalar;
+	double worldMatrixMilliseconds = 0.0;	// world matrices plus the separate material indices (the same baseline at every level)
+	double packedMilliseconds = 0.0;		// AtomInstances
+	size_t worldMatrixBytesPerInstance = 0;
+	size_t packedBytesPerInstance = 0;
+};
+
+struct InstanceUploadSample
+{
+	size_t atomCount = 0;
+	UploadStats batched;					// a frame of the former MAX_INSTANCES batches
+	UploadStats growable;					// a frame of the growable instance buffer
+	unsigned int bufferCreations = 0;		// growable buffers created while the system was built up to atomCount
+};
+
+struct LodSelectionSample
+{
+	float cameraDistance = 0.0f;			// nm from the center of the system
+	std::array<size_t, LodSelector::LevelCount> atomsPerLevel = {};
+	size_t triangles = 0;
+	size_t fixedLevelTriangles = 0;			// every atom at subdivision 3, as before levels of detail
+	double milliseconds = 0.0;				// LodSelector::Update
+};
+
+struct FrustumCullingSample
+{
+	SimdLevel level = SimdLevel::Scalar;
+	size_t visible = 0;
+	size_t culled = 0;
+	double milliseconds = 0.0;				// FrustumCuller::Update
+	double speedup = 0.0;					// relative to the scalar kernel
+	double uploadMilliseconds = 0.0;		// instances of the visible atoms, gathered through the visible list
+	double unculledUploadMilliseconds = 0.0;	// instances of every atom, as without culling
+};
+
+struct OcclusionCullingSample
+{
+	unsigned int width = 0;					// occlusion buffer
+	unsigned int height = 0;
+	size_t tested = 0;						// atoms inside the frustum
+	size_t occluded = 0;
+	double occludedFraction = 0.0;
+	size_t occluders = 0;
+	double milliseconds = 0.0;				// OcclusionCuller::Update
+};
+
+class Benchmark
+{
+public:
+	// Times Simulation::Step on a dense Lennard-Jones lattice of atomCount atoms for 1, 2, 4, ... maxThreads threads
+	ND static std::vector<ThreadScalingSample> ThreadScaling(size_t atomCount = 100000, unsigned int maxThreads = 64, unsigned int steps = 20, size_t chunkSize = 256);
+
+	// Runs the same system, a lattice whose rows are bonded into chains, for the same simulated time with r-RESPA
+	// multipliers 1, 2, 4, ... maxMultiplier and reports the cost per inner timestep together with the energy drift, so the
+	// largest stable multiplier can be picked
+	ND static std::vector<RespaStabilitySample> RespaStability(size_t atomCount = 4000, unsigned int maxMultiplier = 8, unsigned int timesteps = 2000, float timeStepFemtoseconds = 2.0f);
+
+	// Compares the reciprocal-space energy and forces of PME against a converged direct Ewald sum for a small box of
+	// random charges, at grid spacings from 0.2 nm down to 0.06 nm, with the given interpolation order and cutoff
+	ND static std::vector<PmeAccuracySample> PmeAccuracy(size_t atomCount = 1000, unsigned int order = 4, float cutoff = 1.0f, unsigned int threadCount = 0);
+
+	// Compares the Barnes-Hut Coulomb energy and forces against the exact pairwise sum for a globule of random charges
+	// at opening angles from 0.2 to 0.9, so the angle can be picked for a given accuracy and frame budget
+	ND static std::vector<BarnesHutAccuracySample> BarnesHutAccuracy(size_t atomCount = 20000, unsigned int threadCount = 0);
+
+	// Times Simulation::Step on a lattice whose atoms were added in random order, as a long-diffused system ends up,
+	// then again after reordering along the Morton and the Hilbert curve. Hardware cache counters are not portable, so
+	// the locality of each ordering is reported from its neighbor list: the lines touched per row and the misses of a
+	// modelled L1 data cache.
+	ND static std::vector<SpatialReorderSample> SpatialReorder(size_t atomCount = 100000, unsigned int steps = 20, unsigned int threadCount = 0);
+
+	// Loads atomCount atoms (1000, 10000, ... up to maxAtomCount) one at a time and in bulk, then bonds them into a chain
+	// and removes every other atom in one batch, which drops half the bonds and renumbers the rest
+	ND static std::vector<AtomEditingSample> AtomEditing(size_t maxAtomCount = 100000);
+
+	// Compares the renderer's per-frame instance data before and after packing: the former world matrices with a
+	// separate material buffer, rebuilt here on one thread as a baseline, against Simulation::WriteInstances at every
+	// SIMD level this machine supports, in time and bytes uploaded
+	ND static std::vector<InstancePackingSample> InstancePacking(size_t instanceCount = 1000000, unsigned int frames = 20, unsigned int threadCount = 0);
+
+	// Counts the maps, draws and bytes of one frame of atom instances at atomCount atoms (1000, 10000, ... up to
+	// maxAtomCount), for the former upload in batches of 1024 world matrices plus materials and for the growable buffer
+	// of RenderObjectInstanced, which goes through the same InstanceUploadTracker::Submit as when rendering. The
+	// system is built up atomsPerFrame atoms at a time, so the buffer is recreated as often as it would be while loading.
+	ND static std::vector<InstanceUploadSample> InstanceUpload(size_t maxAtomCount = 1000000, size_t atomsPerFrame = 1000);
+
+	// Selects geosphere levels of detail for a lattice of atomCount atoms seen by the default camera (45 degree vertical
+	// field of view, 1080 pixel viewport) from 20, 50, 100 and 200 nm, and reports the triangles drawn against a fixed
+	// subdivision together with the cost of the selection
+	ND static std::vector<LodSelectionSample> LodSelection(size_t atomCount = 1000000, unsigned int frames = 20, unsigned int threadCount = 0);
+
+	// Culls a lattice of atomCount atoms against the frustum of the default camera placed inside it, so most atoms are
+	// off screen, at every SIMD level this machine supports, and compares writing the visible atoms' instances with
+	// writing every atom's
+	ND static std::vector<FrustumCullingSample> FrustumCulling(size_t atomCount = 1000000, unsigned int frames = 20, unsigned int threadCount = 0);
+
+	// Culls the atoms of a lattice of atomCount atoms hidden behind its front layers, as the default camera sees it from
+	// cameraDistance nm in front of its center, with occlusion buffers of 256 x 144, 320 x 180 and 512 x 288 pixels
+	ND static std::vector<OcclusionCullingSample> OcclusionCulling(size_t atomCount = 1000000, float cameraDistance = 50.0f, unsigned int frames = 20, unsigned int threadCount = 0);
+};
@@ -0,0 +1,46 @@
+#include "pch.h"
+#include "CellList.h"
+
+
+CellList::CellList() noexcept :
+	m_cellsPerDimension({ 1, 1, 1 }),
+	m_boxMin({ 0.0f, 0.0f, 0.0f }),
+	m_inverseCellSize({ 0.0f, 0.0f, 0.0f }),
+	m_periodic(false),
+	m_allPairs(false),
+	m_count(0)
+{}
+
+void CellList::Build(const float* x, const float* y, const float* z, size_t count, const SimulationBox& box, float cutoff)
+{
+	WINRT_ASSERT(box.MinHalfExtent() > 0.0f);
+	WINRT_ASSERT(cutoff > 0.0f);
+
+	m_periodic = box.IsPeriodic();
+	m_count = count;
+
+	const float halfExtents[3] = { box.halfExtents.x, box.halfExtents.y, box.halfExtents.z };
+	for (unsigned int axis = 0; axis < 3; ++axis)
+	{
+		// Cells must be at least as wide as the cutoff, so round the cell count down
+		float boxLength = 2.0f * halfExtents[axis];
+		m_cellsPerDimension[axis] = std::max(1u, static_cast<unsigned int>(boxLength / cutoff));
+		m_boxMin[axis] = -halfExtents[axis];
+		m_inverseCellSize[axis] = static_cast<float>(m_cellsPerDimension[axis]) / boxLength;
+	}
+
+	m_allPairs = m_periodic && *std::min_element(m_cellsPerDimension.begin(), m_cellsPerDimension.end()) < 3;
+	if (m_allPairs)
+		return;
+
+	m_head.assign(static_cast<size_t>(m_cellsPerDimension[0]) * m_cellsPerDimension[1] * m_cellsPerDimension[2], -1);
+	m_next.resize(count);
+
+	for (unsigned int iii = 0; iii < count; ++iii)
+	{
+		unsigned int cell = FlatIndex(CellCoordinate(x[iii], 0), CellCoordinate(y[iii], 1), CellCoordinate(z[iii], 2));
+
+		m_next[iii] = m_head[cell];
+		m_head[cell] = static_cast<int>(iii);
+	}
+}
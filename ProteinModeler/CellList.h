@@ -0,0 +1,115 @@
+#pragma once
+#include "pch.h"
+#include "SimulationBox.h"
+
+// Linked-cell spatial grid. The box is split into cells whose edge length is at least the interaction cutoff, so every
+// pair within the cutoff lives either in the same cell or in one of the 26 cells surrounding it. Each cell stores the
+// index of its first atom in m_head and each atom stores the index of the next atom in the same cell in m_next (-1
+// terminates a chain). Building the grid and visiting all candidate pairs are both O(N) for a fixed density.
+//
+// In a periodic box the neighbors of the edge cells wrap around to the opposite face. That only yields each pair of
+// cells once if there are at least three cells along every axis; smaller periodic boxes fall back to visiting every pair.
+class CellList
+{
+public:
+	CellList() noexcept;
+
+	void Build(const float* x, const float* y, const float* z, size_t count, const SimulationBox& box, float cutoff);
+
+	// Calls fn(i, j) exactly once for every pair of atoms that share a cell or sit in adjacent cells. The caller is
+	// still responsible for testing the actual (minimum image) distance against the cutoff.
+	template<typename F>
+	void ForEachCandidatePair(F&& fn) const;
+
+	ND inline const std::array<unsigned int, 3>& CellsPerDimension() const noexcept { return m_cellsPerDimension; }
+	ND inline size_t CellCount() const noexcept { return m_head.size(); }
+
+private:
+	ND inline unsigned int CellCoordinate(float value, unsigned int axis) const noexcept
+	{
+		const int cells = static_cast<int>(m_cellsPerDimension[axis]);
+		int c = static_cast<int>(std::floor((value - m_boxMin[axis]) * m_inverseCellSize[axis]));
+
+		// Periodic boxes wrap atoms that have drifted out since they were last wrapped. Reflective boxes clamp atoms
+		// that sit slightly outside until the wall reflection catches them.
+		if (m_periodic)
+			return static_cast<unsigned int>(((c % cells) + cells) % cells);
+		return static_cast<unsigned int>(std::clamp(c, 0, cells - 1));
+	}
+	ND inline unsigned int FlatIndex(unsigned int x, unsigned int y, unsigned int z) const noexcept
+	{
+		return (z * m_cellsPerDimension[1] + y) * m_cellsPerDimension[0] + x;
+	}
+
+	std::vector<int> m_head;
+	std::vector<int> m_next;
+
+	std::array<unsigned int, 3> m_cellsPerDimension;
+	std::array<float, 3> m_boxMin;
+	std::array<float, 3> m_inverseCellSize;
+	bool m_periodic;
+	bool m_allPairs;
+	size_t m_count;
+};
+
+template<typename F>
+void CellList::ForEachCandidatePair(F&& fn) const
+{
+	if (m_allPairs)
+	{
+		for (unsigned int iii = 0; iii < m_count; ++iii)
+			for (unsigned int jjj = iii + 1; jjj < m_count; ++jjj)
+				fn(iii, jjj);
+		return;
+	}
+
+	// Half shell of neighbor offsets. Visiting only these 13 neighbors (plus the cell itself) guarantees each pair
+	// of cells is considered once.
+	static constexpr int offsets[13][3] = {
+		{ 1, 0, 0 }, { -1, 1, 0 }, { 0, 1, 0 }, { 1, 1, 0 },
+		{ -1, -1, 1 }, { 0, -1, 1 }, { 1, -1, 1 },
+		{ -1, 0, 1 }, { 0, 0, 1 }, { 1, 0, 1 },
+		{ -1, 1, 1 }, { 0, 1, 1 }, { 1, 1, 1 }
+	};
+
+	const int nx = static_cast<int>(m_cellsPerDimension[0]);
+	const int ny = static_cast<int>(m_cellsPerDimension[1]);
+	const int nz = static_cast<int>(m_cellsPerDimension[2]);
+
+	for (int z = 0; z < nz; ++z)
+	{
+		for (int y = 0; y < ny; ++y)
+		{
+			for (int x = 0; x < nx; ++x)
+			{
+				int cell = static_cast<int>(FlatIndex(x, y, z));
+
+				// Pairs within the same cell
+				for (int iii = m_head[cell]; iii != -1; iii = m_next[iii])
+					for (int jjj = m_next[iii]; jjj != -1; jjj = m_next[jjj])
+						fn(static_cast<unsigned int>(iii), static_cast<unsigned int>(jjj));
+
+				// Pairs with the neighboring cells
+				for (const auto& offset : offsets)
+				{
+					int cx = x + offset[0];
+					int cy = y + offset[1];
+					int cz = z + offset[2];
+					if (m_periodic)
+					{
+						cx = (cx + nx) % nx;
+						cy = (cy + ny) % ny;
+						cz = (cz + nz) % nz;
+					}
+					else if (cx < 0 || cy < 0 || cz < 0 || cx >= nx || cy >= ny || cz >= nz)
+						continue;
+
+					int neighbor = static_cast<int>(FlatIndex(cx, cy, cz));
+					for (int iii = m_head[cell]; iii != -1; iii = m_next[iii])
+						for (int jjj = m_head[neighbor]; jjj != -1; jjj = m_next[jjj])
+							fn(static_cast<unsigned int>(iii), static_cast<unsigned int>(jjj));
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,520 @@
+#include "pch.h"
+#include "Constraints.h"
+
+
+Constraints::Constraints() noexcept :
+	m_algorithm(ConstraintAlgorithm::LINCS),
+	m_lincsOrder(4),
+	m_lincsIterations(1),
+	m_shakeTolerance(1e-4f),
+	m_shakeMaxIterations(1000),
+	m_solveCount(0),
+	m_lastMaxDeviation(0.0f),
+	m_lastRmsDeviation(0.0f)
+{}
+
+void Constraints::Clear() noexcept
+{
+	m_atomA.clear();
+	m_atomB.clear();
+	m_length.clear();
+	m_inverseMassA.clear();
+	m_inverseMassB.clear();
+	m_scale.clear();
+	m_groupOffsets.clear();
+	m_couplingOffsets.clear();
+	m_coupling.clear();
+	m_couplingCoefficient.clear();
+	m_couplingMatrix.clear();
+}
+
+void Constraints::Build(const Topology& topology, const ParticleArrays& particles, ConstraintTargets targets)
+{
+	Clear();
+	if (targets == ConstraintTargets::None)
+		return;
+
+	const BondTerms& bonds = topology.Bonds();
+	const size_t atomCount = particles.Size();
+
+	struct Candidate
+	{
+		unsigned int a;
+		unsigned int b;
+		float length;
+		unsigned int group;
+	};
+	std::vector<Candidate> candidates;
+
+	for (size_t iii = 0; iii < bonds.Size(); ++iii)
+	{
+		const unsigned int a = bonds.atoms[0][iii];
+		const unsigned int b = bonds.atoms[1][iii];
+		if (a >= atomCount || b >= atomCount)
+			continue;
+
+		const bool hydrogen = particles.type[a] == Element::Hydrogen || particles.type[b] == Element::Hydrogen;
+		if (targets == ConstraintTargets::AllBonds || hydrogen)
+			candidates.push_back({ a, b, bonds.parameters[0][iii], 0 });
+	}
+
+	if (candidates.empty())
+		return;
+
+	// Union-find over the atoms to get the connected components of the constraint graph
+	std::vector<unsigned int> parent(atomCount);
+	for (unsigned int iii = 0; iii < atomCount; ++iii)
+		parent[iii] = iii;
+
+	auto find = [&parent](unsigned int atom)
+	{
+		while (parent[atom] != atom)
+		{
+			parent[atom] = parent[parent[atom]];
+			atom = parent[atom];
+		}
+		return atom;
+	};
+
+	for (const Candidate& candidate : candidates)
+	{
+		const unsigned int rootA = find(candidate.a);
+		const unsigned int rootB = find(candidate.b);
+		if (rootA != rootB)
+			parent[std::max(rootA, rootB)] = std::min(rootA, rootB);
+	}
+
+	// Roots are the lowest atom of each component, so sorting by root keeps the groups in atom order
+	for (Candidate& candidate : candidates)
+		candidate.group = find(candidate.a);
+
+	std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate& lhs, const Candidate& rhs)
+		{
+			return lhs.group != rhs.group ? lhs.group < rhs.group : std::min(lhs.a, lhs.b) < std::min(rhs.a, rhs.b);
+		}
+	);
+
+	const size_t count = candidates.size();
+	m_atomA.resize(count);
+	m_atomB.resize(count);
+	m_length.resize(count);
+	m_inverseMassA.resize(count);
+	m_inverseMassB.resize(count);
+	m_scale.resize(count);
+
+	for (size_t iii = 0; iii < count; ++iii)
+	{
+		const Candidate& candidate = candidates[iii];
+		m_atomA[iii] = candidate.a;
+		m_atomB[iii] = candidate.b;
+		m_length[iii] = candidate.length;
+		m_inverseMassA[iii] = particles.inverseMass[candidate.a];
+		m_inverseMassB[iii] = particles.inverseMass[candidate.b];
+		m_scale[iii] = 1.0f / std::sqrt(m_inverseMassA[iii] + m_inverseMassB[iii]);
+
+		if (iii == 0 || candidate.group != candidates[iii - 1].group)
+			m_groupOffsets.push_back(static_cast<unsigned int>(iii));
+	}
+	m_groupOffsets.push_back(static_cast<unsigned int>(count));
+
+	// Constraints touching each atom, then the couplings between constraints that share an atom. The LINCS matrix
+	// element is -sigma / m_shared * S_n * S_m * (B_n . B_m), where sigma is +1 when the shared atom sits at the same end
+	// of both constraints; everything but the dot product is fixed here.
+	std::vector<std::vector<unsigned int>> constraintsOfAtom(atomCount);
+	for (unsigned int iii = 0; iii < count; ++iii)
+	{
+		constraintsOfAtom[m_atomA[iii]].push_back(iii);
+		constraintsOfAtom[m_atomB[iii]].push_back(iii);
+	}
+
+	m_couplingOffsets.assign(count + 1, 0u);
+	for (unsigned int iii = 0; iii < count; ++iii)
+	{
+		for (unsigned int end = 0; end < 2; ++end)
+		{
+			const unsigned int shared = end == 0 ? m_atomA[iii] : m_atomB[iii];
+			const float signN = end == 0 ? 1.0f : -1.0f;
+
+			for (unsigned int other : constraintsOfAtom[shared])
+			{
+				if (other == iii)
+					continue;
+
+				const float signM = m_atomA[other] == shared ? 1.0f : -1.0f;
+				m_coupling.push_back(other);
+				m_couplingCoefficient.push_back(-signN * signM * particles.inverseMass[shared] * m_scale[iii] * m_scale[other]);
+			}
+		}
+		m_couplingOffsets[iii + 1] = static_cast<unsigned int>(m_coupling.size());
+	}
+	m_couplingMatrix.resize(m_coupling.size());
+
+	m_referenceX.resize(count);
+	m_referenceY.resize(count);
+	m_referenceZ.resize(count);
+	m_directionX.resize(count);
+	m_directionY.resize(count);
+	m_directionZ.resize(count);
+	m_rightHandSide.resize(count);
+	m_solution.resize(count);
+	m_expansionScratch.resize(count);
+}
+
+void Constraints::SaveReference(const ParticleArrays& particles, ThreadPool& pool)
+{
+	pool.ParallelFor(0, Count(), [&](unsigned int, size_t begin, size_t end)
+		{
+			for (size_t iii = begin; iii < end; ++iii)
+			{
+				const unsigned int a = m_atomA[iii];
+				const unsigned int b = m_atomB[iii];
+				Displacement(particles, a, b, m_referenceX[iii], m_referenceY[iii], m_referenceZ[iii]);
+			}
+		}
+	);
+}
+
+void Constraints::ApplyPositions(ParticleArrays& particles, ThreadPool& pool, float timeStep)
+{
+	if (Count() == 0)
+		return;
+
+	if (m_threadStatistics.size() < pool.ThreadCount())
+		m_threadStatistics.resize(pool.ThreadCount());
+
+	pool.ParallelFor(0, GroupCount(), [&](unsigned int threadIndex, size_t groupBegin, size_t groupEnd)
+		{
+			ThreadStatistics& statistics = m_threadStatistics[threadIndex];
+			for (size_t group = groupBegin; group < groupEnd; ++group)
+			{
+				const size_t begin = m_groupOffsets[group];
+				const size_t end = m_groupOffsets[group + 1];
+
+				unsigned int iterations;
+				if (m_algorithm == ConstraintAlgorithm::SHAKE)
+				{
+					iterations = ShakePositions(particles, begin, end, timeStep);
+					if (iterations >= m_shakeMaxIterations)
+						++statistics.unconverged;
+				}
+				else
+				{
+					LincsPositions(particles, begin, end, timeStep);
+					iterations = m_lincsOrder * (1 + m_lincsIterations);
+				}
+
+				++statistics.groupSolves;
+				statistics.iterations += iterations;
+				statistics.maxIterations = std::max(statistics.maxIterations, iterations);
+			}
+		},
+		GroupChunkSize
+	);
+
+	++m_solveCount;
+	RecordDeviations(particles, pool);
+}
+
+void Constraints::ApplyVelocities(ParticleArrays& particles, ThreadPool& pool)
+{
+	if (Count() == 0)
+		return;
+
+	if (m_threadStatistics.size() < pool.ThreadCount())
+		m_threadStatistics.resize(pool.ThreadCount());
+
+	pool.ParallelFor(0, GroupCount(), [&](unsigned int threadIndex, size_t groupBegin, size_t groupEnd)
+		{
+			ThreadStatistics& statistics = m_threadStatistics[threadIndex];
+			for (size_t group = groupBegin; group < groupEnd; ++group)
+			{
+				const size_t begin = m_groupOffsets[group];
+				const size_t end = m_groupOffsets[group + 1];
+
+				unsigned int iterations;
+				if (m_algorithm == ConstraintAlgorithm::SHAKE)
+				{
+					iterations = RattleVelocities(particles, begin, end);
+					if (iterations >= m_shakeMaxIterations)
+						++statistics.unconverged;
+				}
+				else
+				{
+					LincsVelocities(particles, begin, end);
+					iterations = m_lincsOrder;
+				}
+
+				++statistics.groupSolves;
+				statistics.iterations += iterations;
+				statistics.maxIterations = std::max(statistics.maxIterations, iterations);
+			}
+		},
+		GroupChunkSize
+	);
+}
+
+void Constraints::LincsCouplings(size_t begin, size_t end) noexcept
+{
+	for (size_t n = begin; n < end; ++n)
+	{
+		for (unsigned int iii = m_couplingOffsets[n]; iii < m_couplingOffsets[n + 1]; ++iii)
+		{
+			const unsigned int m = m_coupling[iii];
+			const float dot = m_directionX[n] * m_directionX[m] + m_directionY[n] * m_directionY[m] + m_directionZ[n] * m_directionZ[m];
+			m_couplingMatrix[iii] = m_couplingCoefficient[iii] * dot;
+		}
+	}
+}
+
+void Constraints::LincsExpand(size_t begin, size_t end) noexcept
+{
+	// sol = (I - A)^-1 rhs ~ (I + A + A^2 + ... + A^order) rhs
+	for (size_t n = begin; n < end; ++n)
+		m_solution[n] = m_rightHandSide[n];
+
+	for (unsigned int order = 0; order < m_lincsOrder; ++order)
+	{
+		for (size_t n = begin; n < end; ++n)
+		{
+			float sum = 0.0f;
+			for (unsigned int iii = m_couplingOffsets[n]; iii < m_couplingOffsets[n + 1]; ++iii)
+				sum += m_couplingMatrix[iii] * m_rightHandSide[m_coupling[iii]];
+			m_expansionScratch[n] = sum;
+		}
+
+		for (size_t n = begin; n < end; ++n)
+		{
+			m_rightHandSide[n] = m_expansionScratch[n];
+			m_solution[n] += m_expansionScratch[n];
+		}
+	}
+}
+
+void Constraints::LincsApply(ParticleArrays& particles, size_t begin, size_t end, float timeStep, bool positions) noexcept
+{
+	const float velocityScale = timeStep > 0.0f ? 1.0f / timeStep : 0.0f;
+
+	for (size_t n = begin; n < end; ++n)
+	{
+		const unsigned int a = m_atomA[n];
+		const unsigned int b = m_atomB[n];
+		const float correction = m_scale[n] * m_solution[n];
+		const float cx = correction * m_directionX[n];
+		const float cy = correction * m_directionY[n];
+		const float cz = correction * m_directionZ[n];
+
+		if (positions)
+		{
+			particles.x[a] -= m_inverseMassA[n] * cx; particles.y[a] -= m_inverseMassA[n] * cy; particles.z[a] -= m_inverseMassA[n] * cz;
+			particles.x[b] += m_inverseMassB[n] * cx; particles.y[b] += m_inverseMassB[n] * cy; particles.z[b] += m_inverseMassB[n] * cz;
+		}
+
+		const float scale = positions ? velocityScale : 1.0f;
+		particles.vx[a] -= scale * m_inverseMassA[n] * cx; particles.vy[a] -= scale * m_inverseMassA[n] * cy; particles.vz[a] -= scale * m_inverseMassA[n] * cz;
+		particles.vx[b] += scale * m_inverseMassB[n] * cx; particles.vy[b] += scale * m_inverseMassB[n] * cy; particles.vz[b] += scale * m_inverseMassB[n] * cz;
+	}
+}
+
+void Constraints::LincsPositions(ParticleArrays& particles, size_t begin, size_t end, float timeStep) noexcept
+{
+	// Directions from the positions before the drift
+	for (size_t n = begin; n < end; ++n)
+	{
+		const float inverseLength = 1.0f / std::sqrt(m_referenceX[n] * m_referenceX[n] + m_referenceY[n] * m_referenceY[n] + m_referenceZ[n] * m_referenceZ[n]);
+		m_directionX[n] = m_referenceX[n] * inverseLength;
+		m_directionY[n] = m_referenceY[n] * inverseLength;
+		m_directionZ[n] = m_referenceZ[n] * inverseLength;
+	}
+	LincsCouplings(begin, end);
+
+	// Project the new constraint vectors onto the old directions
+	for (size_t n = begin; n < end; ++n)
+	{
+		const unsigned int a = m_atomA[n];
+		const unsigned int b = m_atomB[n];
+		float dx, dy, dz;
+		Displacement(particles, a, b, dx, dy, dz);
+		const float projection = m_directionX[n] * dx + m_directionY[n] * dy + m_directionZ[n] * dz;
+		m_rightHandSide[n] = m_scale[n] * (projection - m_length[n]);
+	}
+	LincsExpand(begin, end);
+	LincsApply(particles, begin, end, timeStep, true);
+
+	// Correct for the lengthening caused by rotation: the projection should be p = sqrt(2 d^2 - |r|^2)
+	for (unsigned int iteration = 0; iteration < m_lincsIterations; ++iteration)
+	{
+		for (size_t n = begin; n < end; ++n)
+		{
+			const unsigned int a = m_atomA[n];
+			const unsigned int b = m_atomB[n];
+			float dx, dy, dz;
+			Displacement(particles, a, b, dx, dy, dz);
+			const float p = std::sqrt(std::max(2.0f * m_length[n] * m_length[n] - (dx * dx + dy * dy + dz * dz), 0.0f));
+			m_rightHandSide[n] = m_scale[n] * (m_length[n] - p);
+		}
+		LincsExpand(begin, end);
+		LincsApply(particles, begin, end, timeStep, true);
+	}
+}
+
+void Constraints::LincsVelocities(ParticleArrays& particles, size_t begin, size_t end) noexcept
+{
+	// Directions from the constrained positions
+	for (size_t n = begin; n < end; ++n)
+	{
+		const unsigned int a = m_atomA[n];
+		const unsigned int b = m_atomB[n];
+		float dx, dy, dz;
+		Displacement(particles, a, b, dx, dy, dz);
+		const float inverseLength = 1.0f / std::sqrt(dx * dx + dy * dy + dz * dz);
+		m_directionX[n] = dx * inverseLength;
+		m_directionY[n] = dy * inverseLength;
+		m_directionZ[n] = dz * inverseLength;
+
+		const float projection = m_directionX[n] * (particles.vx[a] - particles.vx[b]) + m_directionY[n] * (particles.vy[a] - particles.vy[b]) + m_directionZ[n] * (particles.vz[a] - particles.vz[b]);
+		m_rightHandSide[n] = m_scale[n] * projection;
+	}
+	LincsCouplings(begin, end);
+	LincsExpand(begin, end);
+	LincsApply(particles, begin, end, 0.0f, false);
+}
+
+unsigned int Constraints::ShakePositions(ParticleArrays& particles, size_t begin, size_t end, float timeStep) noexcept
+{
+	const float velocityScale = timeStep > 0.0f ? 1.0f / timeStep : 0.0f;
+
+	unsigned int iteration = 0;
+	bool converged = false;
+	while (!converged && iteration < m_shakeMaxIterations)
+	{
+		++iteration;
+		converged = true;
+
+		for (size_t n = begin; n < end; ++n)
+		{
+			const unsigned int a = m_atomA[n];
+			const unsigned int b = m_atomB[n];
+			float dx, dy, dz;
+			Displacement(particles, a, b, dx, dy, dz);
+			const float length2 = m_length[n] * m_length[n];
+			const float difference = length2 - (dx * dx + dy * dy + dz * dz);
+
+			if (std::abs(difference) <= 2.0f * length2 * m_shakeTolerance)
+				continue;
+
+			converged = false;
+
+			// The correction acts along the constraint vector from before the drift
+			const float dot = m_referenceX[n] * dx + m_referenceY[n] * dy + m_referenceZ[n] * dz;
+			if (dot < 1e-6f * length2)
+				continue;
+
+			const float g = difference / (2.0f * (m_inverseMassA[n] + m_inverseMassB[n]) * dot);
+			const float cx = g * m_referenceX[n];
+			const float cy = g * m_referenceY[n];
+			const float cz = g * m_referenceZ[n];
+
+			particles.x[a] += m_inverseMassA[n] * cx; particles.y[a] += m_inverseMassA[n] * cy; particles.z[a] += m_inverseMassA[n] * cz;
+			particles.x[b] -= m_inverseMassB[n] * cx; particles.y[b] -= m_inverseMassB[n] * cy; particles.z[b] -= m_inverseMassB[n] * cz;
+			particles.vx[a] += velocityScale * m_inverseMassA[n] * cx; particles.vy[a] += velocityScale * m_inverseMassA[n] * cy; particles.vz[a] += velocityScale * m_inverseMassA[n] * cz;
+			particles.vx[b] -= velocityScale * m_inverseMassB[n] * cx; particles.vy[b] -= velocityScale * m_inverseMassB[n] * cy; particles.vz[b] -= velocityScale * m_inverseMassB[n] * cz;
+		}
+	}
+	return converged ? iteration : m_shakeMaxIterations;
+}
+
+unsigned int Constraints::RattleVelocities(ParticleArrays& particles, size_t begin, size_t end) noexcept
+{
+	unsigned int iteration = 0;
+	bool converged = false;
+	while (!converged && iteration < m_shakeMaxIterations)
+	{
+		++iteration;
+		converged = true;
+
+		for (size_t n = begin; n < end; ++n)
+		{
+			const unsigned int a = m_atomA[n];
+			const unsigned int b = m_atomB[n];
+			float dx, dy, dz;
+			Displacement(particles, a, b, dx, dy, dz);
+			const float dot = dx * (particles.vx[a] - particles.vx[b]) + dy * (particles.vy[a] - particles.vy[b]) + dz * (particles.vz[a] - particles.vz[b]);
+			const float length2 = m_length[n] * m_length[n];
+
+			if (std::abs(dot) <= length2 * m_shakeTolerance)
+				continue;
+
+			converged = false;
+
+			const float k = dot / (length2 * (m_inverseMassA[n] + m_inverseMassB[n]));
+			particles.vx[a] -= k * m_inverseMassA[n] * dx; particles.vy[a] -= k * m_inverseMassA[n] * dy; particles.vz[a] -= k * m_inverseMassA[n] * dz;
+			particles.vx[b] += k * m_inverseMassB[n] * dx; particles.vy[b] += k * m_inverseMassB[n] * dy; particles.vz[b] += k * m_inverseMassB[n] * dz;
+		}
+	}
+	return converged ? iteration : m_shakeMaxIterations;
+}
+
+void Constraints::RecordDeviations(const ParticleArrays& particles, ThreadPool& pool)
+{
+	struct alignas(64) Deviation
+	{
+		float max = 0.0f;
+		double sum2 = 0.0;
+	};
+	std::vector<Deviation> deviations(pool.ThreadCount());
+
+	pool.ParallelFor(0, Count(), [&](unsigned int threadIndex, size_t begin, size_t end)
+		{
+			Deviation& deviation = deviations[threadIndex];
+			for (size_t n = begin; n < end; ++n)
+			{
+				const unsigned int a = m_atomA[n];
+				const unsigned int b = m_atomB[n];
+				float dx, dy, dz;
+				Displacement(particles, a, b, dx, dy, dz);
+				const float relative = std::abs(std::sqrt(dx * dx + dy * dy + dz * dz) - m_length[n]) / m_length[n];
+				deviation.max = std::max(deviation.max, relative);
+				deviation.sum2 += static_cast<double>(relative) * relative;
+			}
+		}
+	);
+
+	float maxDeviation = 0.0f;
+	double sum2 = 0.0;
+	for (const Deviation& deviation : deviations)
+	{
+		maxDeviation = std::max(maxDeviation, deviation.max);
+		sum2 += deviation.sum2;
+	}
+
+	m_lastMaxDeviation = maxDeviation;
+	m_lastRmsDeviation = static_cast<float>(std::sqrt(sum2 / Count()));
+}
+
+ConstraintStatistics Constraints::Statistics() const noexcept
+{
+	ConstraintStatistics statistics;
+	statistics.solveCount = m_solveCount;
+
+	uint64_t iterations = 0;
+	for (const ThreadStatistics& thread : m_threadStatistics)
+	{
+		statistics.groupSolves += thread.groupSolves;
+		statistics.unconvergedGroups += thread.unconverged;
+		statistics.maxIterations = std::max(statistics.maxIterations, thread.maxIterations);
+		iterations += thread.iterations;
+	}
+
+	statistics.averageIterations = statistics.groupSolves > 0 ? static_cast<double>(iterations) / statistics.groupSolves : 0.0;
+	statistics.maxRelativeDeviation = m_lastMaxDeviation;
+	statistics.rmsRelativeDeviation = m_lastRmsDeviation;
+	return statistics;
+}
+
+void Constraints::ResetStatistics() noexcept
+{
+	m_threadStatistics.clear();
+	m_solveCount = 0;
+	m_lastMaxDeviation = 0.0f;
+	m_lastRmsDeviation = 0.0f;
+}
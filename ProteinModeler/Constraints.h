@@ -0,0 +1,147 @@
+#pragma once
+#include "pch.h"
+#include "AlignedAllocator.h"
+#include "ParticleArrays.h"
+#include "ThreadPool.h"
+#include "Topology.h"
+#include "SimulationBox.h"
+
+// Which bonds of the topology are replaced by fixed-length constraints
+enum class ConstraintTargets
+{
+	None,
+	HydrogenBonds,	// bonds with a hydrogen at either end, enough to move from ~0.5 fs to 2 fs timesteps
+	AllBonds
+};
+
+enum class ConstraintAlgorithm
+{
+	LINCS,	// fixed cost, non-iterative; the default
+	SHAKE	// iterative SHAKE for positions, RATTLE for velocities; the reference the LINCS results are checked against
+};
+
+struct ConstraintStatistics
+{
+	uint64_t solveCount = 0;			// position solves since the last reset
+	uint64_t groupSolves = 0;			// group solves (positions and velocities) since the last reset
+	double averageIterations = 0.0;		// per group solve (SHAKE/RATTLE); LINCS reports its fixed expansion cost
+	unsigned int maxIterations = 0;
+	uint64_t unconvergedGroups = 0;		// SHAKE/RATTLE group solves that hit the iteration limit
+	float maxRelativeDeviation = 0.0f;	// | |r| - d | / d after the last position solve
+	float rmsRelativeDeviation = 0.0f;
+};
+
+// Holonomic bond-length constraints. Constraints are split into groups, the connected components of the constraint
+// graph (e.g. each X-H bond on its own, a CH3 group as three coupled constraints). Groups share no atoms, so they are
+// spread over the thread pool and each group is solved by one thread with no synchronization.
+//
+// Usage within a step: SaveReference before the drift, ApplyPositions after it (which also corrects the velocities by
+// the displacement / dt), and ApplyVelocities after the closing half kick.
+class Constraints
+{
+public:
+	Constraints() noexcept;
+
+	// Builds the constraints from the bonds of the topology, with the bond's equilibrium length as the constraint length
+	void Build(const Topology& topology, const ParticleArrays& particles, ConstraintTargets targets);
+	void Clear() noexcept;
+
+	ND inline size_t Count() const noexcept { return m_atomA.size(); }
+	ND inline size_t GroupCount() const noexcept { return m_groupOffsets.empty() ? 0 : m_groupOffsets.size() - 1; }
+	ND inline const std::vector<unsigned int>& GroupOffsets() const noexcept { return m_groupOffsets; }
+
+	inline void SetAlgorithm(ConstraintAlgorithm algorithm) noexcept { m_algorithm = algorithm; }
+	ND inline ConstraintAlgorithm Algorithm() const noexcept { return m_algorithm; }
+
+	// LINCS: terms of the matrix expansion and number of corrections for rotational lengthening
+	inline void SetLincsOrder(unsigned int order) noexcept { m_lincsOrder = order; }
+	inline void SetLincsIterations(unsigned int iterations) noexcept { m_lincsIterations = iterations; }
+
+	// SHAKE/RATTLE: relative tolerance on the constraint lengths (and on r.v / d^2 for velocities) and iteration limit
+	inline void SetShakeTolerance(float tolerance) noexcept { WINRT_ASSERT(tolerance > 0.0f); m_shakeTolerance = tolerance; }
+	inline void SetShakeMaxIterations(unsigned int iterations) noexcept { m_shakeMaxIterations = iterations; }
+
+	// Constraint vectors are taken between the nearest periodic images of the two atoms
+	inline void SetImage(const MinimumImage& image) noexcept { m_image = image; }
+
+	void SaveReference(const ParticleArrays& particles, ThreadPool& pool);
+
+	// Moves the atoms back onto the constraints. With timeStep > 0 the velocities receive the same correction / timeStep.
+	void ApplyPositions(ParticleArrays& particles, ThreadPool& pool, float timeStep);
+
+	// Removes the velocity components along the constraints
+	void ApplyVelocities(ParticleArrays& particles, ThreadPool& pool);
+
+	ND ConstraintStatistics Statistics() const noexcept;
+	void ResetStatistics() noexcept;
+
+	// Groups handed to a thread at a time. Most groups are single X-H bonds, so chunks are larger than the pool default.
+	static constexpr size_t GroupChunkSize = 64;
+
+private:
+	void LincsPositions(ParticleArrays& particles, size_t begin, size_t end, float timeStep) noexcept;
+	void LincsVelocities(ParticleArrays& particles, size_t begin, size_t end) noexcept;
+	void LincsExpand(size_t begin, size_t end) noexcept;
+	void LincsCouplings(size_t begin, size_t end) noexcept;
+	void LincsApply(ParticleArrays& particles, size_t begin, size_t end, float timeStep, bool positions) noexcept;
+
+	ND unsigned int ShakePositions(ParticleArrays& particles, size_t begin, size_t end, float timeStep) noexcept;
+	ND unsigned int RattleVelocities(ParticleArrays& particles, size_t begin, size_t end) noexcept;
+
+	void RecordDeviations(const ParticleArrays& particles, ThreadPool& pool);
+
+	inline void Displacement(const ParticleArrays& particles, unsigned int a, unsigned int b, float& dx, float& dy, float& dz) const noexcept
+	{
+		dx = particles.x[a] - particles.x[b];
+		dy = particles.y[a] - particles.y[b];
+		dz = particles.z[a] - particles.z[b];
+		m_image.Apply(dx, dy, dz);
+	}
+
+	// Constraints ordered by group: group g is constraints [m_groupOffsets[g], m_groupOffsets[g + 1])
+	AlignedVector<unsigned int> m_atomA;
+	AlignedVector<unsigned int> m_atomB;
+	AlignedVector<float> m_length;
+	AlignedVector<float> m_inverseMassA;
+	AlignedVector<float> m_inverseMassB;
+	AlignedVector<float> m_scale;	// 1 / sqrt(1/m_a + 1/m_b)
+	std::vector<unsigned int> m_groupOffsets;
+
+	// Coupled constraints (sharing an atom) in compressed rows, with the mass-dependent part of the LINCS matrix element
+	std::vector<unsigned int> m_couplingOffsets;
+	std::vector<unsigned int> m_coupling;
+	AlignedVector<float> m_couplingCoefficient;
+	AlignedVector<float> m_couplingMatrix;
+
+	// Constraint vectors before the drift (SHAKE) and their directions (LINCS)
+	AlignedVector<float> m_referenceX;
+	AlignedVector<float> m_referenceY;
+	AlignedVector<float> m_referenceZ;
+	AlignedVector<float> m_directionX;
+	AlignedVector<float> m_directionY;
+	AlignedVector<float> m_directionZ;
+
+	AlignedVector<float> m_rightHandSide;
+	AlignedVector<float> m_solution;
+	AlignedVector<float> m_expansionScratch;
+
+	MinimumImage m_image;
+
+	ConstraintAlgorithm m_algorithm;
+	unsigned int m_lincsOrder;
+	unsigned int m_lincsIterations;
+	float m_shakeTolerance;
+	unsigned int m_shakeMaxIterations;
+
+	struct alignas(64) ThreadStatistics
+	{
+		uint64_t groupSolves = 0;
+		uint64_t iterations = 0;
+		unsigned int maxIterations = 0;
+		uint64_t unconverged = 0;
+	};
+	std::vector<ThreadStatistics> m_threadStatistics;
+	uint64_t m_solveCount;
+	float m_lastMaxDeviation;
+	float m_lastRmsDeviation;
+};
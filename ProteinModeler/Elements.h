@@ -0,0 +1,94 @@
+#pragma once
+#include "pch.h"
+
+// All per-element tables below are indexed by static_cast<int>(Element). Simulation units follow the usual
+// molecular dynamics convention: nm, ps, amu, kJ/mol and elementary charge.
+
+enum class Element
+{
+	Null = 0,
+	Hydrogen = 1,
+	Helium = 2,
+	Lithium = 3,
+	Beryllium = 4,
+	Boron = 5,
+	Carbon = 6,
+	Nitrogen = 7,
+	Oxygen = 8,
+	Flourine = 9,
+	Neon = 10
+};
+
+constexpr unsigned int ElementCount = 11;
+
+constexpr std::array<float, ElementCount> AtomicRadii{
+	{
+		0.0f,	// Invalid value to take up the 0 index spot
+		0.025f,	// Hydrogen
+		0.120f,	// Helium
+		0.145f,	// Lithium
+		0.105f, // Beryllium
+		0.085f, // Boron
+		0.070f, // Carbon
+		0.065f, // Nitrogen
+		0.060f, // Oxygen
+		0.050f, // Flourine
+		0.160f  // Neon
+	}
+};
+
+// amu
+constexpr std::array<float, ElementCount> AtomicMasses{
+	{
+		0.0f,		// Invalid value to take up the 0 index spot
+		1.008f,		// Hydrogen
+		4.0026f,	// Helium
+		6.94f,		// Lithium
+		9.0122f,	// Beryllium
+		10.81f,		// Boron
+		12.011f,	// Carbon
+		14.007f,	// Nitrogen
+		15.999f,	// Oxygen
+		18.998f,	// Flourine
+		20.180f		// Neon
+	}
+};
+
+// Lennard-Jones parameters taken from the Universal Force Field (sigma in nm, epsilon in kJ/mol)
+constexpr std::array<float, ElementCount> LennardJonesSigma{
+	{
+		0.0f,		// Invalid value to take up the 0 index spot
+		0.2571f,	// Hydrogen
+		0.2104f,	// Helium
+		0.2184f,	// Lithium
+		0.2446f,	// Beryllium
+		0.3638f,	// Boron
+		0.3431f,	// Carbon
+		0.3261f,	// Nitrogen
+		0.3118f,	// Oxygen
+		0.2997f,	// Flourine
+		0.2889f		// Neon
+	}
+};
+
+constexpr std::array<float, ElementCount> LennardJonesEpsilon{
+	{
+		0.0f,		// Invalid value to take up the 0 index spot
+		0.1841f,	// Hydrogen
+		0.2343f,	// Helium
+		0.1046f,	// Lithium
+		0.3598f,	// Beryllium
+		0.7531f,	// Boron
+		0.4393f,	// Carbon
+		0.2887f,	// Nitrogen
+		0.2510f,	// Oxygen
+		0.2092f,	// Flourine
+		0.1757f		// Neon
+	}
+};
+
+// Coulomb's constant in kJ mol^-1 nm e^-2
+constexpr float CoulombConstant = 138.935458f;
+
+// Boltzmann's constant per mole (the gas constant) in kJ mol^-1 K^-1, so kB T is an energy in the simulation's units
+constexpr float BoltzmannConstant = 0.0083144626f;
@@ -0,0 +1,65 @@
+#include "pch.h"
+#include "EnergyMonitor.h"
+
+
+void EnergyMonitor::Reset() noexcept
+{
+	m_count = 0;
+	m_firstTime = 0.0;
+	m_firstEnergy = 0.0;
+	m_lastEnergy = 0.0;
+	m_sumT = 0.0;
+	m_sumE = 0.0;
+	m_sumTT = 0.0;
+	m_sumTE = 0.0;
+	m_sumEE = 0.0;
+}
+
+void EnergyMonitor::AddSample(double picoseconds, double energy) noexcept
+{
+	if (m_count == 0)
+	{
+		m_firstTime = picoseconds;
+		m_firstEnergy = energy;
+	}
+
+	// Center both quantities on the first sample to keep the sums well conditioned
+	const double t = picoseconds - m_firstTime;
+	const double e = energy - m_firstEnergy;
+
+	++m_count;
+	m_lastEnergy = energy;
+	m_sumT += t;
+	m_sumE += e;
+	m_sumTT += t * t;
+	m_sumTE += t * e;
+	m_sumEE += e * e;
+}
+
+EnergyDriftStatistics EnergyMonitor::Statistics(size_t atomCount) const noexcept
+{
+	EnergyDriftStatistics statistics;
+	statistics.sampleCount = m_count;
+	statistics.initialEnergy = m_firstEnergy;
+	statistics.lastEnergy = m_lastEnergy;
+
+	if (m_count < 2)
+		return statistics;
+
+	const double n = static_cast<double>(m_count);
+	const double varianceT = m_sumTT - m_sumT * m_sumT / n;
+	const double covarianceTE = m_sumTE - m_sumT * m_sumE / n;
+	const double varianceE = m_sumEE - m_sumE * m_sumE / n;
+
+	// Slope in kJ/mol/ps
+	const double slope = varianceT > 0.0 ? covarianceTE / varianceT : 0.0;
+
+	statistics.driftPerNanosecond = 1000.0 * slope;
+	statistics.driftPerAtomPerNanosecond = atomCount > 0 ? statistics.driftPerNanosecond / atomCount : 0.0;
+
+	// Residual variance of the fit
+	const double residual = varianceE - slope * covarianceTE;
+	statistics.rmsFluctuation = residual > 0.0 ? std::sqrt(residual / n) : 0.0;
+
+	return statistics;
+}
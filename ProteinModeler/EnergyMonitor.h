@@ -0,0 +1,37 @@
+#pragma once
+#include "pch.h"
+
+struct EnergyDriftStatistics
+{
+	uint64_t sampleCount = 0;
+	double initialEnergy = 0.0;			// kJ/mol
+	double lastEnergy = 0.0;			// kJ/mol
+	double driftPerNanosecond = 0.0;	// least-squares slope of total energy, kJ/mol/ns
+	double driftPerAtomPerNanosecond = 0.0;
+	double rmsFluctuation = 0.0;		// about the fitted line, kJ/mol
+};
+
+// Accumulates (time, total energy) samples and fits a line through them. A stable integrator shows a slope close to zero
+// with small fluctuations; a timestep (or RESPA multiplier) that is too large shows up as a systematic drift.
+class EnergyMonitor
+{
+public:
+	EnergyMonitor() noexcept { Reset(); }
+
+	void Reset() noexcept;
+	void AddSample(double picoseconds, double energy) noexcept;
+
+	ND EnergyDriftStatistics Statistics(size_t atomCount) const noexcept;
+
+private:
+	// Running sums in double so long runs do not lose precision. Times are taken relative to the first sample.
+	uint64_t m_count;
+	double m_firstTime;
+	double m_firstEnergy;
+	double m_lastEnergy;
+	double m_sumT;
+	double m_sumE;
+	double m_sumTT;
+	double m_sumTE;
+	double m_sumEE;
+};
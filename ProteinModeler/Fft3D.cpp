@@ -0,0 +1,160 @@
+#include "pch.h"
+#include "Fft3D.h"
+
+
+void Fft3D::Plan::Build(unsigned int n)
+{
+	WINRT_ASSERT(n > 0);
+	size = n;
+
+	// Radix 4 first, it does the work of two radix 2 passes with fewer twiddle multiplications
+	factors.clear();
+	for (unsigned int radix : { 4u, 2u, 3u, 5u, 7u })
+	{
+		while (n % radix == 0)
+		{
+			factors.push_back(radix);
+			n /= radix;
+		}
+	}
+	WINRT_ASSERT(n == 1);	// use NextFastSize for the grid dimensions
+
+	twiddles.resize(size);
+	for (unsigned int iii = 0; iii < size; ++iii)
+	{
+		const double angle = -2.0 * 3.14159265358979323846 * iii / size;
+		twiddles[iii] = Complex(static_cast<float>(std::cos(angle)), static_cast<float>(std::sin(angle)));
+	}
+}
+
+void Fft3D::Plan::Execute(const Complex* in, size_t stride, Complex* out, bool inverse) const noexcept
+{
+	if (size == 1)
+		out[0] = in[0];
+	else
+		Recurse(in, stride, out, size, 0, inverse);
+}
+
+void Fft3D::Plan::Recurse(const Complex* in, size_t stride, Complex* out, size_t n, size_t factor, bool inverse) const noexcept
+{
+	// Decimation in time: p interleaved sub-sequences of length m are transformed into consecutive blocks of out, then
+	// X[k + r m] = sum_q w_n^(q k) w_p^(q r) Y_q[k] combines them in place
+	const unsigned int p = factors[factor];
+	const size_t m = n / p;
+	if (m == 1)
+	{
+		for (unsigned int q = 0; q < p; ++q)
+			out[q] = in[q * stride];
+	}
+	else
+	{
+		for (unsigned int q = 0; q < p; ++q)
+			Recurse(in + q * stride, stride * p, out + q * m, m, factor + 1, inverse);
+	}
+
+	// w_n^j = twiddles[j * size / n], and w_p^j = twiddles[j * size / p]
+	const size_t twiddleStride = size / n;
+	const size_t radixStride = m * twiddleStride;
+	auto twiddle = [&](size_t index) {
+		const Complex& w = twiddles[index];
+		return inverse ? std::conj(w) : w;
+	};
+
+	// The butterflies multiply by hand: std::complex operator* handles inf/nan cases, which keeps it from being inlined
+	// without -ffast-math
+	auto multiply = [](const Complex& a, const Complex& b) {
+		return Complex(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+	};
+
+	Complex t[MaxRadix];
+	for (size_t k = 0; k < m; ++k)
+	{
+		t[0] = out[k];
+		for (unsigned int q = 1; q < p; ++q)
+			t[q] = multiply(out[q * m + k], twiddle(q * k * twiddleStride));
+
+		if (p == 2)
+		{
+			out[k] = t[0] + t[1];
+			out[m + k] = t[0] - t[1];
+		}
+		else if (p == 4)
+		{
+			// w_4 = -i forward, +i inverse
+			const Complex a = t[0] + t[2];
+			const Complex b = t[0] - t[2];
+			const Complex c = t[1] + t[3];
+			const Complex d = inverse ? Complex(-(t[1] - t[3]).imag(), (t[1] - t[3]).real()) : Complex((t[1] - t[3]).imag(), -(t[1] - t[3]).real());
+			out[k] = a + c;
+			out[m + k] = b + d;
+			out[2 * m + k] = a - c;
+			out[3 * m + k] = b - d;
+		}
+		else
+		{
+			for (unsigned int r = 0; r < p; ++r)
+			{
+				Complex sum = t[0];
+				for (unsigned int q = 1; q < p; ++q)
+					sum += multiply(t[q], twiddle((q * r % p) * radixStride));
+				out[r * m + k] = sum;
+			}
+		}
+	}
+}
+
+void Fft3D::Resize(unsigned int nx, unsigned int ny, unsigned int nz)
+{
+	if (m_plans[0].size != nx)
+		m_plans[0].Build(nx);
+	if (m_plans[1].size != ny)
+		m_plans[1].Build(ny);
+	if (m_plans[2].size != nz)
+		m_plans[2].Build(nz);
+}
+
+unsigned int Fft3D::NextFastSize(unsigned int n) noexcept
+{
+	for (n = std::max(n, 1u); ; ++n)
+	{
+		unsigned int remainder = n;
+		for (unsigned int radix : { 2u, 3u, 5u, 7u })
+			while (remainder % radix == 0)
+				remainder /= radix;
+		if (remainder == 1)
+			return n;
+	}
+}
+
+template<typename TLineStart>
+void Fft3D::TransformLines(const Plan& plan, Complex* grid, size_t count, size_t stride, const TLineStart& lineStart, ThreadPool& pool, bool inverse)
+{
+	pool.ParallelFor(0, count, [&](unsigned int threadIndex, size_t begin, size_t end)
+		{
+			Complex* line = m_scratch[threadIndex].line.data();
+			for (size_t iii = begin; iii < end; ++iii)
+			{
+				Complex* start = grid + lineStart(iii);
+				plan.Execute(start, stride, line, inverse);
+				for (size_t k = 0; k < plan.size; ++k)
+					start[k * stride] = line[k];
+			}
+		}
+	);
+}
+
+void Fft3D::Transform(Complex* grid, ThreadPool& pool, bool inverse)
+{
+	const size_t nx = m_plans[0].size;
+	const size_t ny = m_plans[1].size;
+	const size_t nz = m_plans[2].size;
+
+	m_scratch.resize(pool.ThreadCount());
+	for (ThreadScratch& scratch : m_scratch)
+		scratch.line.resize(std::max({ nx, ny, nz }));
+
+	// z lines are contiguous; y and x lines are strided by nz and ny * nz
+	TransformLines(m_plans[2], grid, nx * ny, 1, [=](size_t line) { return line * nz; }, pool, inverse);
+	TransformLines(m_plans[1], grid, nx * nz, nz, [=](size_t line) { return (line / nz) * ny * nz + line % nz; }, pool, inverse);
+	TransformLines(m_plans[0], grid, ny * nz, ny * nz, [=](size_t line) { return line; }, pool, inverse);
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "pch.h"
+#include "AlignedAllocator.h"
+#include "ThreadPool.h"
+#include <complex>
+
+// Complex-to-complex 3D FFT on a grid stored with z fastest: index (ix * ny + iy) * nz + iz. Each axis is a mixed-radix
+// (2, 3, 4, 5, 7) Cooley-Tukey transform, and the lines of every pass are spread over the thread pool. The inverse
+// transform is not normalized, so Backward(Forward(g)) = nx * ny * nz * g.
+class Fft3D
+{
+public:
+	using Complex = std::complex<float>;
+
+	void Resize(unsigned int nx, unsigned int ny, unsigned int nz);
+	ND inline std::array<unsigned int, 3> Size() const noexcept { return { m_plans[0].size, m_plans[1].size, m_plans[2].size }; }
+
+	void Forward(Complex* grid, ThreadPool& pool) { Transform(grid, pool, false); }
+	void Backward(Complex* grid, ThreadPool& pool) { Transform(grid, pool, true); }
+
+	// Smallest n' >= n with no prime factor above 7, the sizes this FFT handles efficiently
+	ND static unsigned int NextFastSize(unsigned int n) noexcept;
+
+private:
+	// One axis: the factorization of its length and exp(-2 pi i k / size) for k in [0, size)
+	struct Plan
+	{
+		unsigned int size = 0;
+		std::vector<unsigned int> factors;
+		std::vector<Complex> twiddles;
+
+		void Build(unsigned int n);
+
+		// Transforms size elements read from in with the given stride into contiguous out
+		void Execute(const Complex* in, size_t stride, Complex* out, bool inverse) const noexcept;
+		void Recurse(const Complex* in, size_t stride, Complex* out, size_t n, size_t factor, bool inverse) const noexcept;
+	};
+
+	static constexpr unsigned int MaxRadix = 7;
+
+	void Transform(Complex* grid, ThreadPool& pool, bool inverse);
+
+	// Transforms count lines of plan.size elements, element k of line l at grid[lineStart(l) + k * stride]
+	template<typename TLineStart>
+	void TransformLines(const Plan& plan, Complex* grid, size_t count, size_t stride, const TLineStart& lineStart, ThreadPool& pool, bool inverse);
+
+	std::array<Plan, 3> m_plans;
+
+	// Per-thread line buffer
+	struct alignas(64) ThreadScratch
+	{
+		AlignedVector<Complex> line;
+	};
+	std::vector<ThreadScratch> m_scratch;
+};
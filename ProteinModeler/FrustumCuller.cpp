@@ -0,0 +1,71 @@
+#include "pch.h"
+#include "FrustumCuller.h"
+
+
+FrustumPlanes FrustumCuller::ExtractPlanes(const DirectX::XMFLOAT4X4& viewProjection) noexcept
+{
+	// Gribb and Hartmann: with clip = (p, 1) * M, every clip inequality is a plane whose coefficients are a sum or
+	// difference of the matrix columns. In order: left, right, bottom, top, near, far.
+	const float signs[6] = { 1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f };
+	const int columns[6] = { 0, 0, 1, 1, 2, 2 };
+	const bool addW[6] = { true, true, true, true, false, true };
+
+	FrustumPlanes planes;
+	for (int p = 0; p < 6; ++p)
+	{
+		float plane[4];
+		for (int row = 0; row < 4; ++row)
+			plane[row] = (addW[p] ? viewProjection.m[row][3] : 0.0f) + signs[p] * viewProjection.m[row][columns[p]];
+
+		const float inverseLength = 1.0f / std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+		planes.a[p] = plane[0] * inverseLength;
+		planes.b[p] = plane[1] * inverseLength;
+		planes.c[p] = plane[2] * inverseLength;
+		planes.d[p] = plane[3] * inverseLength;
+	}
+	return planes;
+}
+
+void FrustumCuller::Update(const float* x, const float* y, const float* z, const float* radius, size_t count, const FrustumPlanes& planes, const SimdKernelTable& kernels, ThreadPool& pool)
+{
+	WINRT_ASSERT(count <= std::numeric_limits<uint32_t>::max());
+
+	// Fixed blocks, one per thread, as in SpatialSort. Each block writes its visible indices to the start of its own
+	// stretch of m_scratch, which is as long as the block.
+	const unsigned int blockCount = pool.ThreadCount();
+	auto blockBegin = [=](size_t block) { return count * block / blockCount; };
+
+	m_count = count;
+	m_scratch.resize(count);
+	m_blockCounts.resize(blockCount);
+	pool.ParallelFor(0, blockCount, [&](unsigned int, size_t first, size_t last)
+		{
+			for (size_t block = first; block < last; ++block)
+			{
+				const size_t begin = blockBegin(block);
+				m_blockCounts[block].count = kernels.CullSpheres(x + begin, y + begin, z + begin, radius + begin, blockBegin(block + 1) - begin,
+					static_cast<uint32_t>(begin), planes, m_scratch.data() + begin);
+			}
+		}, 1
+	);
+
+	size_t offset = 0;
+	for (BlockCount& counts : m_blockCounts)
+	{
+		const size_t visibleCount = counts.count;
+		counts.count = offset;
+		offset += visibleCount;
+	}
+	m_visible.resize(offset);
+
+	pool.ParallelFor(0, blockCount, [&](unsigned int, size_t first, size_t last)
+		{
+			for (size_t block = first; block < last; ++block)
+			{
+				const size_t begin = m_blockCounts[block].count;
+				const size_t end = block + 1 < blockCount ? m_blockCounts[block + 1].count : m_visible.size();
+				std::copy(m_scratch.begin() + blockBegin(block), m_scratch.begin() + blockBegin(block) + (end - begin), m_visible.begin() + begin);
+			}
+		}, 1
+	);
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "pch.h"
+#include "AlignedAllocator.h"
+#include "SimdKernels.h"
+#include "ThreadPool.h"
+
+// Culls the atoms whose spheres lie entirely outside the view frustum and keeps the indices of the rest, in order, so
+// only visible atoms are selected a level of detail for and uploaded. Every thread culls a fixed block of atoms with the
+// SIMD kernel into its own stretch of a scratch list; an exclusive scan of the block counts then gives every block its
+// offset in the compacted list, and the blocks copy there concurrently.
+class FrustumCuller
+{
+public:
+	// Planes of the frustum of a row-vector view-projection matrix with the Direct3D clip volume (-w <= x, y <= w,
+	// 0 <= z <= w), normalized so they give distances in world units
+	ND static FrustumPlanes ExtractPlanes(const DirectX::XMFLOAT4X4& viewProjection) noexcept;
+
+	// Culls count spheres against the planes, in parallel
+	void Update(const float* x, const float* y, const float* z, const float* radius, size_t count, const FrustumPlanes& planes, const SimdKernelTable& kernels, ThreadPool& pool);
+
+	// Indices of the atoms at least partly inside the frustum, in increasing order
+	ND inline const AlignedVector<uint32_t>& Visible() const noexcept { return m_visible; }
+	ND inline size_t VisibleCount() const noexcept { return m_visible.size(); }
+	ND inline size_t CulledCount() const noexcept { return m_count - m_visible.size(); }
+
+private:
+	size_t m_count = 0;
+	AlignedVector<uint32_t> m_visible;
+	AlignedVector<uint32_t> m_scratch;
+
+	// Visible atoms of each block, turned into the block's offset in m_visible; padded so blocks do not false-share
+	struct alignas(64) BlockCount
+	{
+		size_t count;
+	};
+	std::vector<BlockCount> m_blockCounts;
+};
@@ -0,0 +1,59 @@
+#include "pch.h"
+#include "InstanceUploadTracker.h"
+#include "SimdKernels.h"
+
+
+bool InstanceUploadTracker::SelfTest()
+{
+	InstanceUploadTracker tracker(sizeof(AtomInstance));
+	std::vector<AtomInstance> buffer;
+	unsigned int creations = 0;
+
+	auto frame = [&](size_t instanceCount)
+		{
+			// RenderObjectInstanced::Update, then Render with the buffer standing in for the mapped instance buffer
+			if (tracker.BeginFrame(instanceCount))
+			{
+				buffer.resize(tracker.Capacity());
+				++creations;
+			}
+			if (tracker.Capacity() < instanceCount || tracker.CapacityBytes() != buffer.size() * sizeof(AtomInstance))
+				return false;
+
+			unsigned int writes = 0;
+			unsigned int draws = 0;
+			bool drawnComplete = true;
+			tracker.Submit(instanceCount,
+				[&](size_t count)
+				{
+					++writes;
+					for (size_t iii = 0; iii < count; ++iii)
+						buffer[iii].material = static_cast<uint32_t>(iii);
+				},
+				[&](size_t count)
+				{
+					// Every instance must be in the buffer by the time it is drawn
+					++draws;
+					drawnComplete = count == instanceCount && writes == 1 && buffer[count - 1].material == static_cast<uint32_t>(count - 1);
+				}
+			);
+
+			const UploadStats& stats = tracker.Frame();
+			const unsigned int expected = instanceCount > 0 ? 1u : 0u;
+			return drawnComplete && writes == expected && draws == expected && stats.maps == expected && stats.draws == expected &&
+				stats.bytes == instanceCount * sizeof(AtomInstance);
+		};
+
+	// Built up a few atoms at a time, then a whole protein at once, then cleared and rebuilt
+	size_t instanceCount = 0;
+	for (; instanceCount <= 100000; instanceCount += 37)
+	{
+		if (!frame(instanceCount))
+			return false;
+	}
+	if (!frame(250000) || !frame(1) || !frame(0) || !frame(0) || !frame(250000))
+		return false;
+
+	// Growing by half again from MinimumCapacity, 250000 instances take at most 15 buffers
+	return creations > 0 && creations <= 15 && tracker.Capacity() >= 250000;
+}
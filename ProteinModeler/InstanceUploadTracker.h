@@ -0,0 +1,73 @@
+#pragma once
+#include "pch.h"
+
+// Uploads of one frame
+struct UploadStats
+{
+	unsigned int maps = 0;
+	unsigned int draws = 0;
+	unsigned int bufferCreations = 0;
+	size_t bytes = 0;
+};
+
+// Sizing and per-frame accounting of a growable instance buffer that holds every instance of a frame, so the instances
+// are uploaded with one map and drawn with one call however many there are. The capacity grows by half again whenever
+// it is exceeded and never shrinks, so a system that is being built up atom by atom only recreates the buffer a
+// logarithmic number of times. Kept free of Direct3D, with the map and draw sequencing in Submit, so
+// RenderObjectInstanced and the headless checks (SelfTest and Benchmark::InstanceUpload) run the same code.
+class InstanceUploadTracker
+{
+public:
+	static constexpr size_t MinimumCapacity = 1024;
+
+	InstanceUploadTracker(size_t bytesPerInstance) noexcept :
+		m_bytesPerInstance(bytesPerInstance),
+		m_capacity(0)
+	{
+		WINRT_ASSERT(bytesPerInstance > 0);
+	}
+
+	// Starts a frame of instanceCount instances. Returns true if the buffer must be (re)created with Capacity() instances.
+	ND bool BeginFrame(size_t instanceCount) noexcept
+	{
+		m_frame = UploadStats();
+		if (instanceCount <= m_capacity)
+			return false;
+
+		m_capacity = std::max({ instanceCount, m_capacity + m_capacity / 2, MinimumCapacity });
+		++m_frame.bufferCreations;
+		return true;
+	}
+
+	// Uploads and draws a frame of instanceCount instances, which BeginFrame must already have made room for: write(count)
+	// fills the mapped buffer with every instance and draw(count) draws them all with one call. Nothing happens for
+	// an empty frame.
+	template<typename WriteFn, typename DrawFn>
+	void Submit(size_t instanceCount, WriteFn&& write, DrawFn&& draw)
+	{
+		WINRT_ASSERT(instanceCount <= m_capacity);
+		if (instanceCount == 0)
+			return;
+
+		write(instanceCount);
+		++m_frame.maps;
+		m_frame.bytes += instanceCount * m_bytesPerInstance;
+
+		draw(instanceCount);
+		++m_frame.draws;
+	}
+
+	ND inline size_t Capacity() const noexcept { return m_capacity; }
+	ND inline size_t CapacityBytes() const noexcept { return m_capacity * m_bytesPerInstance; }
+	ND inline const UploadStats& Frame() const noexcept { return m_frame; }
+
+	// Builds a system of AtomInstances up, down to nothing and up again, frame by frame, and checks that every frame with
+	// instances writes and draws them with exactly one map of count * sizeof(AtomInstance) bytes and one draw, that empty
+	// frames do neither, and that the buffer always holds the frame and is recreated a logarithmic number of times
+	ND static bool SelfTest();
+
+private:
+	size_t		m_bytesPerInstance;
+	size_t		m_capacity;
+	UploadStats m_frame;
+};
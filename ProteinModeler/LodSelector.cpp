@@ -0,0 +1,95 @@
+#include "pch.h"
+#include "LodSelector.h"
+
+
+float LodSelector::RelativeError(unsigned int level) noexcept
+{
+	WINRT_ASSERT(level < LevelCount);
+	constexpr float IcosahedronError = 1.0f - 0.7946545f;
+	return IcosahedronError / static_cast<float>(1u << (2 * level));
+}
+
+void LodSelector::SetMaxError(float pixels) noexcept
+{
+	WINRT_ASSERT(pixels > 0.0f);
+	m_maxError = pixels;
+	for (unsigned int level = 0; level < LevelCount - 1; ++level)
+		m_maxProjectedRadius[level] = pixels / RelativeError(level);
+}
+
+unsigned int LodSelector::Select(float radius, float viewZ, float pixelScale) const noexcept
+{
+	if (viewZ <= radius)
+		return viewZ < -radius ? 0 : LevelCount - 1;
+
+	// The first level whose deviation stays within the budget is the number of levels the radius on screen is too large
+	// for; the thresholds increase with the level, so this needs neither a loop exit nor a division per level
+	const float projectedRadius = radius * pixelScale / viewZ;
+	unsigned int level = 0;
+	for (float maxProjectedRadius : m_maxProjectedRadius)
+		level += projectedRadius > maxProjectedRadius ? 1u : 0u;
+	return level;
+}
+
+void LodSelector::Update(const float* x, const float* y, const float* z, const float* radius, const uint32_t* indices, size_t count, const DirectX::XMFLOAT4X4& view, float pixelScale, ThreadPool& pool)
+{
+	// Fixed blocks, one per thread, as in SpatialSort: each block counts its levels, an exclusive scan over (level, block)
+	// gives every block its offsets in the buckets, and the blocks then scatter concurrently
+	const unsigned int blockCount = pool.ThreadCount();
+	auto blockBegin = [=](size_t block) { return count * block / blockCount; };
+	auto atom = [=](size_t iii) { return indices != nullptr ? indices[iii] : static_cast<uint32_t>(iii); };
+
+	m_levels.resize(count);
+	m_blockCounts.resize(blockCount);
+	pool.ParallelFor(0, blockCount, [&](unsigned int, size_t first, size_t last)
+		{
+			for (size_t block = first; block < last; ++block)
+			{
+				uint32_t* counts = m_blockCounts[block].count;
+				std::fill(counts, counts + LevelCount, 0u);
+				for (size_t iii = blockBegin(block); iii < blockBegin(block + 1); ++iii)
+				{
+					const uint32_t a = atom(iii);
+					const float viewZ = x[a] * view.m[0][2] + y[a] * view.m[1][2] + z[a] * view.m[2][2] + view.m[3][2];
+					const unsigned int level = Select(radius[a], viewZ, pixelScale);
+					m_levels[iii] = static_cast<uint8_t>(level);
+					++counts[level];
+				}
+			}
+		}, 1
+	);
+
+	for (unsigned int level = 0; level < LevelCount; ++level)
+	{
+		uint32_t offset = 0;
+		for (BlockCounts& counts : m_blockCounts)
+		{
+			const uint32_t blockLevelCount = counts.count[level];
+			counts.count[level] = offset;
+			offset += blockLevelCount;
+		}
+		m_buckets[level].resize(offset);
+	}
+
+	pool.ParallelFor(0, blockCount, [&](unsigned int, size_t first, size_t last)
+		{
+			for (size_t block = first; block < last; ++block)
+			{
+				uint32_t* offsets = m_blockCounts[block].count;
+				for (size_t iii = blockBegin(block); iii < blockBegin(block + 1); ++iii)
+				{
+					const unsigned int level = m_levels[iii];
+					m_buckets[level][offsets[level]++] = atom(iii);
+				}
+			}
+		}, 1
+	);
+}
+
+size_t LodSelector::TriangleCount() const noexcept
+{
+	size_t triangles = 0;
+	for (unsigned int level = 0; level < LevelCount; ++level)
+		triangles += m_buckets[level].size() * TriangleCount(level);
+	return triangles;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "pch.h"
+#include "AlignedAllocator.h"
+#include "ThreadPool.h"
+
+// Picks a geosphere subdivision level for every atom from the size of its sphere on screen, and buckets the atoms by
+// level so each level is one instanced draw. A level is good enough for an atom when its mesh deviates from the sphere
+// by no more than MaxError() pixels, so atoms far away are drawn with 20 triangles and only those close to the camera
+// with thousands.
+class LodSelector
+{
+public:
+	// Subdivisions 0 (icosahedron, 20 triangles) to LevelCount - 1 (5120 triangles)
+	static constexpr unsigned int LevelCount = 5;
+
+	LodSelector() noexcept { SetMaxError(0.5f); }
+
+	// Largest tolerated deviation in pixels between an atom's mesh and its sphere
+	void SetMaxError(float pixels) noexcept;
+	ND inline float MaxError() const noexcept { return m_maxError; }
+
+	// Largest deviation of a unit geosphere from the unit sphere. The faces of an icosahedron lie 1 - 0.7947 inside its
+	// circumsphere, and every subdivision halves the edges, which quarters the deviation.
+	ND static float RelativeError(unsigned int level) noexcept;
+	ND static inline size_t TriangleCount(unsigned int level) noexcept { return size_t{ 20 } << (2 * level); }
+
+	// Level for a sphere of the given radius whose center is at depth viewZ in view space. pixelScale converts a length
+	// at unit depth to pixels: the projection's y scale (_22) times half the viewport height. Spheres reaching the eye
+	// get the finest level and spheres entirely behind it the coarsest.
+	ND unsigned int Select(float radius, float viewZ, float pixelScale) const noexcept;
+
+	// Selects the level of count atoms for the row-vector view matrix and buckets their indices by level, in parallel.
+	// indices lists the atoms to consider (such as those FrustumCuller found visible); nullptr means atoms [0, count).
+	// Indices keep their order within a bucket.
+	void Update(const float* x, const float* y, const float* z, const float* radius, const uint32_t* indices, size_t count, const DirectX::XMFLOAT4X4& view, float pixelScale, ThreadPool& pool);
+
+	ND inline const AlignedVector<uint32_t>& Bucket(unsigned int level) const noexcept { return m_buckets[level]; }
+
+	// Triangles drawn for the current buckets
+	ND size_t TriangleCount() const noexcept;
+
+private:
+	float m_maxError;
+
+	// Largest projected radius in pixels each level but the finest is good enough for
+	std::array<float, LevelCount - 1> m_maxProjectedRadius;
+
+	AlignedVector<uint8_t> m_levels;
+	std::array<AlignedVector<uint32_t>, LevelCount> m_buckets;
+
+	// Per-block counts of every level, turned into each block's output offsets; padded so blocks do not false-share
+	struct alignas(64) BlockCounts
+	{
+		uint32_t count[LevelCount];
+	};
+	std::vector<BlockCounts> m_blockCounts;
+};
@@ -2,12 +2,21 @@
 #include "MathHelper.h"
 #include <float.h>
 #include <cmath>
+#include <atomic>
 
 using namespace DirectX;
 
 const float MathHelper::Infinity = FLT_MAX;
 const float MathHelper::Pi = 3.1415926535f;
 
+PhiloxStream& MathHelper::ThreadRandom() noexcept
+{
+	// Same seed everywhere, a distinct stream per thread in the order threads first ask for one
+	static std::atomic<uint64_t> nextStream{ 0 };
+	thread_local PhiloxStream generator(0x5EED5EED5EED5EEDull, nextStream.fetch_add(1, std::memory_order_relaxed));
+	return generator;
+}
+
 float MathHelper::AngleFromXY(float x, float y)
 {
 	float theta = 0.0f;
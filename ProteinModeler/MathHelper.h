@@ -1,14 +1,19 @@
 #pragma once
 #include "pch.h"
 #include <cstdint>
+#include "Philox.h"
 
 class MathHelper
 {
 public:
+	// Generator behind RandF/Rand. Every thread gets its own Philox stream, so these are safe to call concurrently;
+	// code that must be reproducible keys Philox by (seed, step, atom) instead.
+	static PhiloxStream& ThreadRandom() noexcept;
+
 	// Returns random float in [0, 1).
 	static float RandF()
 	{
-		return (float)(rand()) / (float)RAND_MAX;
+		return ThreadRandom().NextFloat();
 	}
 
 	// Returns random float in [a, b).
@@ -17,9 +22,10 @@ public:
 		return a + RandF() * (b - a);
 	}
 
+	// Returns random int in [a, b].
 	static int Rand(int a, int b)
 	{
-		return a + rand() % ((b - a) + 1);
+		return a + static_cast<int>(ThreadRandom().NextBelow(static_cast<uint32_t>(b - a) + 1u));
 	}
 
 	template<typename T>
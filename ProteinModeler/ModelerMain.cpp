@@ -88,7 +88,11 @@ void ModelerMain::StartRenderLoop()
     // Create a task that will be run on a background thread.
     auto workItemHandler = WorkItemHandler([this](IAsyncAction action)
         {
+            // The simulation advances a fixed number of fixed-size timesteps per Update, so Update must be called at a
+            // steady rate rather than once per (variable length) frame
             Timer timer;
+            timer.SetFixedTimeStep(true);
+            timer.SetTargetElapsedSeconds(1.0 / 60.0);
  
             // Start the simulation
             m_simulation->Play();            
@@ -99,12 +103,15 @@ void ModelerMain::StartRenderLoop()
                 concurrency::critical_section::scoped_lock lock(m_criticalSection);
 
                 // Update =========================================================================
+                // Only the simulation is gated on the fixed tick, which may run zero times in an iteration. The renderer
+                // rebuilds its instance counts and index lists every frame, under the same lock as Render, so Render never
+                // reads atoms by an index computed before atoms were added or removed.
                 timer.Tick([&]()
                     {
                         m_simulation->Update(timer);
-                        m_renderer->Update(timer);
                     }
                 );
+                m_renderer->Update(timer);
  
                 // Render =========================================================================
                 m_renderer->Render();
@@ -124,7 +131,7 @@ void ModelerMain::StartRenderLoop()
         });
  
     // Run task on a dedicated high priority background thread.
-    m_renderLoopWorker = ThreadPool::RunAsync(workItemHandler, WorkItemPriority::High, WorkItemOptions::TimeSliced);
+    m_renderLoopWorker = winrt::Windows::System::Threading::ThreadPool::RunAsync(workItemHandler, WorkItemPriority::High, WorkItemOptions::TimeSliced);
 }
 void ModelerMain::StopRenderLoop() 
 {
@@ -30,13 +30,34 @@ public:
 
     // Rendering Stuff
     inline void SetViewport(float top, float left, float height, float width) const { m_renderer->SetViewport(top, left, height, width); }
+    inline void SetAtomRenderMode(AtomRenderMode mode) noexcept { m_renderer->SetAtomRenderMode(mode); }
+    ND inline AtomRenderMode GetAtomRenderMode() const noexcept { return m_renderer->GetAtomRenderMode(); }
+    inline void SetOcclusionCulling(bool enabled) noexcept { m_renderer->SetOcclusionCulling(enabled); }
 
     // Modification Methods
-    void AddAtom(Element element, const DirectX::XMFLOAT3& position, const DirectX::XMFLOAT3& velocity) noexcept 
-    { 
-        size_t index = m_simulation->Add(element, position, velocity); 
-        m_renderer->AddInstance(element, &m_simulation->Positions()[index]);
+    // The renderer picks up the change on its next frame; it reads every atom from the simulation's arrays
+    AtomHandle AddAtom(Element element, const DirectX::XMFLOAT3& position, const DirectX::XMFLOAT3& velocity)
+    {
+        return m_simulation->Add(element, position, velocity);
     }
+    void RemoveAtom(AtomHandle atom)
+    {
+        if (m_simulation->Contains(atom))
+            m_simulation->Remove(atom);
+    }
+    void AddAtoms(const std::vector<AtomDescription>& atoms, std::vector<AtomHandle>& handles)
+    {
+        handles.resize(atoms.size());
+        m_simulation->AddAtoms(atoms.data(), atoms.size(), handles.data());
+    }
+    // Stale and repeated handles are ignored, as by RemoveAtom
+    void RemoveAtoms(const std::vector<AtomHandle>& atoms)
+    {
+        m_simulation->RemoveAtoms(atoms.data(), atoms.size());
+    }
+
+    inline void SetCoulombMethod(CoulombMethod method) noexcept { m_simulation->SetCoulombMethod(method); }
+    ND inline CoulombMethod GetCoulombMethod() const noexcept { return m_simulation->Coulomb(); }
 
 private:
     void UpdateLayoutState();
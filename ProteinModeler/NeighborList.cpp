@@ -0,0 +1,154 @@
+#include "pch.h"
+#include "NeighborList.h"
+
+
+NeighborList::NeighborList() noexcept :
+	m_builtCutoff(0.0f),
+	m_skin(0.2f),
+	m_valid(false),
+	m_rebuildCount(0),
+	m_updateCount(0)
+{}
+
+void NeighborList::SetExclusions(std::vector<unsigned int> offsets, std::vector<unsigned int> excluded) noexcept
+{
+	m_exclusionOffsets = std::move(offsets);
+	m_exclusions = std::move(excluded);
+	m_valid = false;
+}
+
+void NeighborList::MirrorExclusions(const std::vector<unsigned int>& offsets, const std::vector<unsigned int>& excluded,
+	std::vector<unsigned int>& mirroredOffsets, std::vector<unsigned int>& mirrored)
+{
+	const size_t rowCount = offsets.empty() ? 0 : offsets.size() - 1;
+
+	std::vector<unsigned int> degree(rowCount, 0u);
+	for (size_t iii = 0; iii < rowCount; ++iii)
+	{
+		for (unsigned int n = offsets[iii]; n < offsets[iii + 1]; ++n)
+		{
+			++degree[iii];
+			++degree[excluded[n]];
+		}
+	}
+
+	mirroredOffsets.assign(rowCount + 1, 0u);
+	for (size_t iii = 0; iii < rowCount; ++iii)
+		mirroredOffsets[iii + 1] = mirroredOffsets[iii] + degree[iii];
+
+	mirrored.resize(mirroredOffsets[rowCount]);
+	std::vector<unsigned int> cursor(mirroredOffsets.begin(), mirroredOffsets.end() - 1);
+	for (size_t iii = 0; iii < rowCount; ++iii)
+	{
+		for (unsigned int n = offsets[iii]; n < offsets[iii + 1]; ++n)
+		{
+			const unsigned int j = excluded[n];
+			mirrored[cursor[iii]++] = j;
+			mirrored[cursor[j]++] = static_cast<unsigned int>(iii);
+		}
+	}
+}
+
+bool NeighborList::IsExcluded(unsigned int i, unsigned int j) const noexcept
+{
+	if (i > j)
+		std::swap(i, j);
+
+	// Atoms added after the exclusions were set have none
+	if (static_cast<size_t>(i) + 1 >= m_exclusionOffsets.size())
+		return false;
+
+	const auto rowBegin = m_exclusions.begin() + m_exclusionOffsets[i];
+	const auto rowEnd = m_exclusions.begin() + m_exclusionOffsets[i + 1];
+	return std::binary_search(rowBegin, rowEnd, j);
+}
+
+bool NeighborList::NeedsRebuild(const ParticleArrays& particles, float cutoff) const noexcept
+{
+	if (!m_valid || particles.Size() != m_referenceX.size() || cutoff != m_builtCutoff)
+		return true;
+
+	const float* x = particles.x.data();
+	const float* y = particles.y.data();
+	const float* z = particles.z.data();
+	const float* rx = m_referenceX.data();
+	const float* ry = m_referenceY.data();
+	const float* rz = m_referenceZ.data();
+
+	// Atoms wrapped back into a periodic box have not really jumped a box length
+	const MinimumImage image = m_builtBox.Image();
+
+	// Branch-free max reduction so the loop vectorizes
+	const size_t count = particles.Size();
+	float maxDisplacement2 = 0.0f;
+	for (size_t iii = 0; iii < count; ++iii)
+	{
+		float dx = x[iii] - rx[iii];
+		float dy = y[iii] - ry[iii];
+		float dz = z[iii] - rz[iii];
+		image.Apply(dx, dy, dz);
+		maxDisplacement2 = std::max(maxDisplacement2, dx * dx + dy * dy + dz * dz);
+	}
+
+	return maxDisplacement2 > 0.25f * m_skin * m_skin;
+}
+
+bool NeighborList::Update(const ParticleArrays& particles, const SimulationBox& box, float cutoff)
+{
+	++m_updateCount;
+
+	if (box != m_builtBox || NeedsRebuild(particles, cutoff))
+	{
+		Build(particles, box, cutoff);
+		return true;
+	}
+	return false;
+}
+
+void NeighborList::Build(const ParticleArrays& particles, const SimulationBox& box, float cutoff)
+{
+	const float* x = particles.x.data();
+	const float* y = particles.y.data();
+	const float* z = particles.z.data();
+	const size_t count = particles.Size();
+
+	const float listCutoff = cutoff + m_skin;
+	const float listCutoff2 = listCutoff * listCutoff;
+
+	m_cellList.Build(x, y, z, count, box, listCutoff);
+	const MinimumImage image = box.Image();
+
+	// Gather all pairs inside the list cutoff, keyed by the lower index
+	m_pairScratch.clear();
+	m_cellList.ForEachCandidatePair([&](unsigned int i, unsigned int j)
+		{
+			float dx = x[i] - x[j];
+			float dy = y[i] - y[j];
+			float dz = z[i] - z[j];
+			image.Apply(dx, dy, dz);
+			if (dx * dx + dy * dy + dz * dz < listCutoff2 && !IsExcluded(i, j))
+				m_pairScratch.push_back(i < j ? std::make_pair(i, j) : std::make_pair(j, i));
+		}
+	);
+
+	// Counting sort into compressed rows
+	m_offsets.assign(count + 1, 0u);
+	for (const auto& pair : m_pairScratch)
+		++m_offsets[pair.first + 1];
+
+	for (size_t iii = 0; iii < count; ++iii)
+		m_offsets[iii + 1] += m_offsets[iii];
+
+	m_neighbors.resize(m_pairScratch.size());
+	std::vector<unsigned int> cursor(m_offsets.begin(), m_offsets.end() - 1);
+	for (const auto& pair : m_pairScratch)
+		m_neighbors[cursor[pair.first]++] = pair.second;
+
+	m_referenceX.assign(particles.x.begin(), particles.x.end());
+	m_referenceY.assign(particles.y.begin(), particles.y.end());
+	m_referenceZ.assign(particles.z.begin(), particles.z.end());
+	m_builtCutoff = cutoff;
+	m_builtBox = box;
+	m_valid = true;
+	++m_rebuildCount;
+}
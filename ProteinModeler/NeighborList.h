@@ -0,0 +1,76 @@
+#pragma once
+#include "pch.h"
+#include "CellList.h"
+#include "ParticleArrays.h"
+
+// Verlet pair list. Every pair closer than cutoff + skin is stored when the list is built, so the list stays valid
+// until some atom has moved more than half the skin since that build (two atoms each moving skin/2 toward each other
+// is the worst case). Pairs are stored as a half list in compressed rows: the partners of atom i are
+// m_neighbors[m_offsets[i] .. m_offsets[i + 1]). In a periodic box distances and displacements use the minimum image.
+class NeighborList
+{
+public:
+	NeighborList() noexcept;
+
+	// Rebuilds the list if it is stale and returns true if a rebuild happened
+	bool Update(const ParticleArrays& particles, const SimulationBox& box, float cutoff);
+
+	ND bool NeedsRebuild(const ParticleArrays& particles, float cutoff) const noexcept;
+	inline void Invalidate() noexcept { m_valid = false; }
+
+	void SetSkin(float skin) noexcept { WINRT_ASSERT(skin >= 0.0f); m_skin = skin; m_valid = false; }
+	ND inline float Skin() const noexcept { return m_skin; }
+
+	// Pairs that never interact through the nonbonded terms (e.g. atoms close together in the bond graph), as compressed
+	// rows with the same layout as the list itself. The rows must be sorted.
+	void SetExclusions(std::vector<unsigned int> offsets, std::vector<unsigned int> excluded) noexcept;
+	ND bool IsExcluded(unsigned int i, unsigned int j) const noexcept;
+
+	// Expands exclusions given in the half-list layout into rows holding both directions of every pair, for force terms
+	// where each atom walks its own exclusions and writes only its own force
+	static void MirrorExclusions(const std::vector<unsigned int>& offsets, const std::vector<unsigned int>& excluded,
+		std::vector<unsigned int>& mirroredOffsets, std::vector<unsigned int>& mirrored);
+
+	ND inline const std::vector<unsigned int>& Offsets() const noexcept { return m_offsets; }
+	ND inline const std::vector<unsigned int>& Neighbors() const noexcept { return m_neighbors; }
+
+	// Statistics for tuning the skin
+	ND inline uint64_t RebuildCount() const noexcept { return m_rebuildCount; }
+	ND inline uint64_t UpdateCount() const noexcept { return m_updateCount; }
+	ND inline float AveragePairsPerAtom() const noexcept
+	{
+		return m_offsets.size() > 1 ? static_cast<float>(m_neighbors.size()) / static_cast<float>(m_offsets.size() - 1) : 0.0f;
+	}
+	ND inline float AverageStepsPerRebuild() const noexcept
+	{
+		return m_rebuildCount > 0 ? static_cast<float>(m_updateCount) / static_cast<float>(m_rebuildCount) : 0.0f;
+	}
+	inline void ResetStatistics() noexcept { m_rebuildCount = 0; m_updateCount = 0; }
+
+private:
+	void Build(const ParticleArrays& particles, const SimulationBox& box, float cutoff);
+
+	CellList m_cellList;
+
+	std::vector<unsigned int> m_offsets;
+	std::vector<unsigned int> m_neighbors;
+
+	std::vector<unsigned int> m_exclusionOffsets;
+	std::vector<unsigned int> m_exclusions;
+
+	// Positions at the time of the last build, used to detect when the list has gone stale
+	AlignedVector<float> m_referenceX;
+	AlignedVector<float> m_referenceY;
+	AlignedVector<float> m_referenceZ;
+	float m_builtCutoff;
+	SimulationBox m_builtBox;
+
+	float m_skin;
+	bool m_valid;
+
+	uint64_t m_rebuildCount;
+	uint64_t m_updateCount;
+
+	// Scratch storage reused between builds so a rebuild does not allocate
+	std::vector<std::pair<unsigned int, unsigned int>> m_pairScratch;
+};
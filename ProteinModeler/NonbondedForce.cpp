@@ -0,0 +1,162 @@
+#include "pch.h"
+#include "NonbondedForce.h"
+
+
+NonbondedForce::NonbondedForce() noexcept :
+	m_cutoff(1.0f),
+	m_coulombMethod(CoulombMethod::Cutoff),
+	m_reactionFieldDielectric(78.5f),
+	m_kernels(&SimdKernels::Best())
+{
+	for (unsigned int iii = 0; iii < ElementCount; ++iii)
+	{
+		for (unsigned int jjj = 0; jjj < ElementCount; ++jjj)
+		{
+			float sigma = 0.5f * (LennardJonesSigma[iii] + LennardJonesSigma[jjj]);
+			float epsilon = std::sqrt(LennardJonesEpsilon[iii] * LennardJonesEpsilon[jjj]);
+			float sigma6 = sigma * sigma * sigma * sigma * sigma * sigma;
+
+			m_c6[iii * ElementCount + jjj] = 4.0f * epsilon * sigma6;
+			m_c12[iii * ElementCount + jjj] = 4.0f * epsilon * sigma6 * sigma6;
+
+			// At 0.7 sigma the repulsion is already about 255 epsilon, over 10 kT at 300 K for every element here, so
+			// capping there only matters for atoms that were placed overlapping. Closer caps release so much energy that
+			// the overlapping atoms leave at millions of kelvin.
+			constexpr float SoftCoreSigmaFraction = 0.7f;
+			m_softCoreR2[iii * ElementCount + jjj] = SoftCoreSigmaFraction * SoftCoreSigmaFraction * sigma * sigma;
+		}
+	}
+	SetCutoff(m_cutoff);
+}
+
+void NonbondedForce::SetCutoff(float cutoff) noexcept
+{
+	WINRT_ASSERT(cutoff > 0.0f);
+	m_cutoff = cutoff;
+
+	const float invCutoff2 = 1.0f / (cutoff * cutoff);
+	const float invCutoff6 = invCutoff2 * invCutoff2 * invCutoff2;
+	for (size_t iii = 0; iii < m_ljShift.size(); ++iii)
+		m_ljShift[iii] = m_c12[iii] * invCutoff6 * invCutoff6 - m_c6[iii] * invCutoff6;
+}
+
+void NonbondedForce::SetExclusions(std::vector<unsigned int> offsets, std::vector<unsigned int> excluded)
+{
+	m_pme.SetExclusions(offsets, excluded);
+	m_octree.SetExclusions(offsets, excluded);
+	m_neighborList.SetExclusions(std::move(offsets), std::move(excluded));
+}
+
+float NonbondedForce::Compute(ParticleArrays& particles, const SimulationBox& box, ThreadPool& pool)
+{
+	WINRT_ASSERT(!box.IsPeriodic() || m_cutoff + m_neighborList.Skin() <= box.MinHalfExtent());
+	m_neighborList.Update(particles, box, m_cutoff);
+
+	switch (m_coulombMethod)
+	{
+	case CoulombMethod::ReactionField:
+		return ComputeDirect(particles, box, pool, CoulombKernel::ReactionField);
+
+	case CoulombMethod::ShiftedForce:
+		return ComputeDirect(particles, box, pool, CoulombKernel::ShiftedForce);
+
+	case CoulombMethod::PME:
+		WINRT_ASSERT(box.IsPeriodic());
+		return ComputeDirect(particles, box, pool, CoulombKernel::Ewald, ParticleMeshEwald::EwaldCoefficient(m_cutoff, m_pme.EwaldTolerance())) +
+			m_pme.Compute(particles, box, m_cutoff, pool);
+
+	case CoulombMethod::BarnesHut:
+		WINRT_ASSERT(!box.IsPeriodic());
+		return ComputeDirect(particles, box, pool, CoulombKernel::None) + m_octree.Compute(particles, pool);
+
+	default:
+		return ComputeDirect(particles, box, pool, CoulombKernel::Cutoff);
+	}
+}
+
+float NonbondedForce::ComputeDirect(ParticleArrays& particles, const SimulationBox& box, ThreadPool& pool, CoulombKernel coulomb, float ewaldCoefficient)
+{
+	NonbondedKernelArgs args;
+	args.x = particles.x.data();
+	args.y = particles.y.data();
+	args.z = particles.z.data();
+	args.charge = particles.charge.data();
+	args.type = particles.type.data();
+	args.offsets = m_neighborList.Offsets().data();
+	args.neighbors = m_neighborList.Neighbors().data();
+	args.c6 = m_c6.data();
+	args.c12 = m_c12.data();
+	args.softCoreR2 = m_softCoreR2.data();
+	args.ljShift = m_ljShift.data();
+	args.cutoff2 = m_cutoff * m_cutoff;
+	args.coulombConstant = CoulombConstant;
+	args.image = box.Image();
+	args.coulomb = coulomb;
+	args.ewaldCoefficient = ewaldCoefficient;
+
+	// k_rf = (eps - 1) / ((2 eps + 1) rc^3) is the field reflected by the continuum, and c_rf = 1 / rc + k_rf rc^2
+	// shifts the pair energy to zero at the cutoff
+	const float dielectricRatio = std::isinf(m_reactionFieldDielectric) ? 0.5f : (m_reactionFieldDielectric - 1.0f) / (2.0f * m_reactionFieldDielectric + 1.0f);
+	args.reactionFieldK = dielectricRatio / (m_cutoff * m_cutoff * m_cutoff);
+	args.reactionFieldC = 1.0f / m_cutoff + args.reactionFieldK * m_cutoff * m_cutoff;
+
+	const size_t count = particles.Size();
+	const unsigned int threadCount = pool.ThreadCount();
+
+	if (threadCount == 1)
+	{
+		args.fx = particles.fx.data();
+		args.fy = particles.fy.data();
+		args.fz = particles.fz.data();
+		return m_kernels->Nonbonded(args, 0u, static_cast<unsigned int>(count));
+	}
+
+	m_threadForces.resize(threadCount);
+	for (ThreadForces& buffer : m_threadForces)
+	{
+		if (buffer.fx.size() != count)
+		{
+			buffer.fx.assign(count, 0.0f);
+			buffer.fy.assign(count, 0.0f);
+			buffer.fz.assign(count, 0.0f);
+		}
+		buffer.energy = 0.0f;
+	}
+
+	pool.ParallelFor(0, count, [&](unsigned int thread, size_t rowBegin, size_t rowEnd)
+		{
+			ThreadForces& buffer = m_threadForces[thread];
+
+			NonbondedKernelArgs threadArgs = args;
+			threadArgs.fx = buffer.fx.data();
+			threadArgs.fy = buffer.fy.data();
+			threadArgs.fz = buffer.fz.data();
+
+			buffer.energy += m_kernels->Nonbonded(threadArgs, static_cast<unsigned int>(rowBegin), static_cast<unsigned int>(rowEnd));
+		}
+	);
+
+	// Reduce the per-thread buffers into the particle forces, clearing them for the next call
+	pool.ParallelFor(0, count, [&](unsigned int, size_t begin, size_t end)
+		{
+			for (ThreadForces& buffer : m_threadForces)
+			{
+				for (size_t iii = begin; iii < end; ++iii)
+				{
+					particles.fx[iii] += buffer.fx[iii];
+					particles.fy[iii] += buffer.fy[iii];
+					particles.fz[iii] += buffer.fz[iii];
+					buffer.fx[iii] = 0.0f;
+					buffer.fy[iii] = 0.0f;
+					buffer.fz[iii] = 0.0f;
+				}
+			}
+		}
+	);
+
+	float energy = 0.0f;
+	for (const ThreadForces& buffer : m_threadForces)
+		energy += buffer.energy;
+
+	return energy;
+}
\ No newline at end of file
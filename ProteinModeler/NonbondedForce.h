@@ -0,0 +1,100 @@
+#pragma once
+#include "pch.h"
+#include "NeighborList.h"
+#include "Elements.h"
+#include "SimdKernels.h"
+#include "SimulationBox.h"
+#include "ThreadPool.h"
+#include "ParticleMeshEwald.h"
+#include "BarnesHutTree.h"
+
+enum class CoulombMethod
+{
+	Cutoff,			// plain Coulomb truncated at the cutoff
+	ReactionField,	// cutoff Coulomb with the medium beyond the cutoff treated as a dielectric continuum
+	ShiftedForce,	// cutoff Coulomb shifted so the force and energy both vanish at the cutoff
+	PME,			// Ewald real space inside the cutoff plus smooth particle-mesh Ewald for the rest; needs a periodic box
+	BarnesHut		// every pair through the Barnes-Hut octree, with no cutoff; open boundaries only
+};
+
+// Lennard-Jones plus Coulomb between every pair of atoms closer than the cutoff. Pairs come from a Verlet list (built
+// from a linked-cell grid) so the cost scales with the number of atoms rather than the number of pairs, and the grid is
+// only rebuilt once atoms have moved far enough to invalidate the list. With PME the long-range electrostatics beyond
+// the cutoff are added from the reciprocal-space grid; with BarnesHut the pair list only carries Lennard-Jones and all
+// of the electrostatics come from the octree.
+class NonbondedForce
+{
+public:
+	NonbondedForce() noexcept;
+
+	// Adds the nonbonded force on each atom to particles.fx/fy/fz and returns the total potential energy (kJ/mol).
+	// Rows of the neighbor list are spread over the pool; each thread accumulates into its own force buffer and the
+	// buffers are summed into particles at the end, so no atomics are needed. In a periodic box every pair interacts
+	// through its nearest image, which requires cutoff + skin to be at most half the shortest box length.
+	float Compute(ParticleArrays& particles, const SimulationBox& box, ThreadPool& pool);
+
+	// The Lennard-Jones energy is shifted to zero at the cutoff, so changing it also changes the energy
+	void SetCutoff(float cutoff) noexcept;
+	ND inline float Cutoff() const noexcept { return m_cutoff; }
+
+	// Switching methods keeps the state of the others (the PME grid, the octree buffers), so going back and forth
+	// between them does not reallocate
+	inline void SetCoulombMethod(CoulombMethod method) noexcept { m_coulombMethod = method; }
+	ND inline CoulombMethod Coulomb() const noexcept { return m_coulombMethod; }
+
+	// Relative permittivity of the continuum beyond the cutoff for CoulombMethod::ReactionField. Infinity is a
+	// conducting boundary.
+	void SetReactionFieldDielectric(float dielectric) noexcept { WINRT_ASSERT(dielectric >= 1.0f); m_reactionFieldDielectric = dielectric; }
+	ND inline float ReactionFieldDielectric() const noexcept { return m_reactionFieldDielectric; }
+
+	ND inline ParticleMeshEwald& Pme() noexcept { return m_pme; }
+	ND inline const ParticleMeshEwald& Pme() const noexcept { return m_pme; }
+	ND inline BarnesHutTree& Octree() noexcept { return m_octree; }
+	ND inline const BarnesHutTree& Octree() const noexcept { return m_octree; }
+
+	// Pairs of atoms with no nonbonded interaction (see NeighborList::SetExclusions)
+	void SetExclusions(std::vector<unsigned int> offsets, std::vector<unsigned int> excluded);
+
+	void SetSkin(float skin) noexcept { m_neighborList.SetSkin(skin); }
+	ND inline float Skin() const noexcept { return m_neighborList.Skin(); }
+
+	inline void SetKernels(const SimdKernelTable& kernels) noexcept { m_kernels = &kernels; }
+
+	ND inline NeighborList& Neighbors() noexcept { return m_neighborList; }
+	ND inline const NeighborList& Neighbors() const noexcept { return m_neighborList; }
+
+private:
+	// Pairs inside the cutoff from the neighbor list, with the given Coulomb form (beta is only used by Ewald)
+	float ComputeDirect(ParticleArrays& particles, const SimulationBox& box, ThreadPool& pool, CoulombKernel coulomb, float ewaldCoefficient = 0.0f);
+
+	// Lorentz-Berthelot mixed parameters for every pair of elements, pre-multiplied into the C6/C12 form and
+	// flattened so the SIMD kernels can gather from them with (type_i * ElementCount + type_j)
+	std::array<float, ElementCount * ElementCount> m_c6;
+	std::array<float, ElementCount * ElementCount> m_c12;
+
+	// (SoftCoreSigmaFraction * sigma)^2 of every pair, see NonbondedKernelArgs::softCoreR2
+	std::array<float, ElementCount * ElementCount> m_softCoreR2;
+
+	// Lennard-Jones energy of every pair at m_cutoff, see NonbondedKernelArgs::ljShift
+	std::array<float, ElementCount * ElementCount> m_ljShift;
+
+	float m_cutoff;
+	CoulombMethod m_coulombMethod;
+	float m_reactionFieldDielectric;
+
+	const SimdKernelTable* m_kernels;
+
+	NeighborList m_neighborList;
+	ParticleMeshEwald m_pme;
+	BarnesHutTree m_octree;
+
+	// Per-thread force accumulators. They are zeroed as they are reduced, so they are ready for the next call.
+	struct alignas(64) ThreadForces
+	{
+		AlignedVector<float> fx;
+		AlignedVector<float> fy;
+		AlignedVector<float> fz;
+		float energy = 0.0f;
+	};
+	std::vector<ThreadForces> m_threadForces;
+};
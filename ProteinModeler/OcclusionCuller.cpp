@@ -0,0 +1,313 @@
+#include "pch.h"
+#include "OcclusionCuller.h"
+#include "SphereImpostor.h"
+#include <numeric>
+#include <random>
+
+
+namespace
+{
+	// Spheres must stay this far in front of the eye's plane to be projected
+	constexpr float MinDepth = 1e-4f;
+
+	// Rows of the depth buffer per rasterization task
+	constexpr size_t BandHeight = 8;
+
+	inline DirectX::XMFLOAT3 ToView(float x, float y, float z, const DirectX::XMFLOAT4X4& view) noexcept
+	{
+		return {
+			x * view.m[0][0] + y * view.m[1][0] + z * view.m[2][0] + view.m[3][0],
+			x * view.m[0][1] + y * view.m[1][1] + z * view.m[2][1] + view.m[3][1],
+			x * view.m[0][2] + y * view.m[1][2] + z * view.m[2][2] + view.m[3][2]
+		};
+	}
+}
+
+void OcclusionCuller::SetResolution(unsigned int width, unsigned int height)
+{
+	WINRT_ASSERT(width > 0 && height > 0);
+	if (width == m_width && height == m_height)
+		return;
+
+	m_width = width;
+	m_height = height;
+	m_depth.assign(static_cast<size_t>(width) * height, std::numeric_limits<float>::infinity());
+}
+
+bool OcclusionCuller::SphereBounds(float x, float y, float z, float radius, Bounds& bounds) const noexcept
+{
+	if (z - radius <= MinDepth)
+		return false;
+
+	// The sphere lies within its bounding box, whose x / z and y / z are extreme at its corners
+	const float nearZ = z - radius;
+	const float inverseNear = 1.0f / nearZ;
+	const float inverseFar = 1.0f / (z + radius);
+	const float minX = std::min((x - radius) * inverseNear, (x - radius) * inverseFar);
+	const float maxX = std::max((x + radius) * inverseNear, (x + radius) * inverseFar);
+	const float minY = std::min((y - radius) * inverseNear, (y - radius) * inverseFar);
+	const float maxY = std::max((y + radius) * inverseNear, (y + radius) * inverseFar);
+
+	// Clamped while still floats, so spheres just in front of the eye cannot overflow the conversion
+	const float width = static_cast<float>(m_width);
+	const float height = static_cast<float>(m_height);
+	auto pixel = [](float coordinate, float size) { return static_cast<int>(std::floor(std::clamp(coordinate, -1.0f, size))); };
+	bounds.left = std::max(pixel(0.5f * width + minX * m_xScale, width), 0);
+	bounds.right = std::min(pixel(0.5f * width + maxX * m_xScale, width), static_cast<int>(m_width) - 1);
+	bounds.top = std::max(pixel(0.5f * height - maxY * m_yScale, height), 0);
+	bounds.bottom = std::min(pixel(0.5f * height - minY * m_yScale, height), static_cast<int>(m_height) - 1);
+	bounds.nearest = nearZ;
+	return bounds.left <= bounds.right && bounds.top <= bounds.bottom;
+}
+
+bool OcclusionCuller::IsOccluded(float x, float y, float z, float radius) const noexcept
+{
+	Bounds bounds;
+	if (!SphereBounds(x, y, z, radius, bounds))
+		return false;
+
+	for (int row = bounds.top; row <= bounds.bottom; ++row)
+	{
+		const float* depth = m_depth.data() + static_cast<size_t>(row) * m_width;
+		for (int column = bounds.left; column <= bounds.right; ++column)
+		{
+			if (depth[column] >= bounds.nearest)
+				return false;
+		}
+	}
+	return true;
+}
+
+void OcclusionCuller::Update(const float* x, const float* y, const float* z, const float* radius, const uint32_t* indices, size_t count,
+	const DirectX::XMFLOAT4X4& view, float xScale, float yScale, ThreadPool& pool)
+{
+	WINRT_ASSERT(count <= std::numeric_limits<uint32_t>::max());
+
+	m_xScale = 0.5f * xScale * m_width;
+	m_yScale = 0.5f * yScale * m_height;
+	const float discScale = std::min(m_xScale, m_yScale);
+	const float nearPlane = std::max(m_nearPlane, MinDepth);
+	const float width = static_cast<float>(m_width);
+	const float height = static_cast<float>(m_height);
+
+	// Fixed blocks, one per thread, as in SpatialSort
+	const unsigned int blockCount = pool.ThreadCount();
+	auto blockBegin = [=](size_t block) { return count * block / blockCount; };
+	auto atom = [=](size_t iii) { return indices != nullptr ? indices[iii] : static_cast<uint32_t>(iii); };
+
+	// Occluders: every block keeps its largest discs, then the largest of those are kept overall. Atoms of similar size
+	// are largest when nearest, and those hide the most.
+	auto larger = [](const Occluder& a, const Occluder& b) { return a.radius > b.radius; };
+	auto keepLargest = [&](std::vector<Occluder>& occluders) {
+		if (occluders.size() > m_maxOccluders)
+		{
+			std::nth_element(occluders.begin(), occluders.begin() + m_maxOccluders, occluders.end(), larger);
+			occluders.resize(m_maxOccluders);
+		}
+	};
+
+	m_blockOccluders.resize(blockCount);
+	pool.ParallelFor(0, blockCount, [&](unsigned int, size_t first, size_t last)
+		{
+			for (size_t block = first; block < last; ++block)
+			{
+				std::vector<Occluder>& occluders = m_blockOccluders[block];
+				occluders.clear();
+				for (size_t iii = blockBegin(block); iii < blockBegin(block + 1); ++iii)
+				{
+					// An atom reaching the near plane is clipped by the renderer, or not drawn at all with the eye inside it,
+					// so it hides nothing
+					const uint32_t a = atom(iii);
+					const DirectX::XMFLOAT3 p = ToView(x[a], y[a], z[a], view);
+					if (p.z - radius[a] <= nearPlane)
+						continue;
+
+					const float disc = radius[a] * discScale / p.z;
+					const float discX = 0.5f * m_width + p.x * m_xScale / p.z;
+					const float discY = 0.5f * m_height - p.y * m_yScale / p.z;
+					if (disc >= m_minOccluderRadius && discX + disc > 0.0f && discX - disc < width && discY + disc > 0.0f && discY - disc < height)
+						occluders.push_back({ discX, discY, disc, p.z });
+				}
+				keepLargest(occluders);
+			}
+		}, 1
+	);
+
+	m_occluders.clear();
+	for (const std::vector<Occluder>& occluders : m_blockOccluders)
+		m_occluders.insert(m_occluders.end(), occluders.begin(), occluders.end());
+	keepLargest(m_occluders);
+
+	// With nothing to rasterize no atom can be hidden, so neither the raster nor the tests are worth running
+	m_tested = count;
+	if (m_occluders.empty())
+	{
+		std::fill(m_depth.begin(), m_depth.end(), std::numeric_limits<float>::infinity());
+		m_visible.resize(count);
+		if (indices != nullptr)
+			std::copy(indices, indices + count, m_visible.begin());
+		else
+			std::iota(m_visible.begin(), m_visible.end(), 0u);
+		return;
+	}
+
+	// Each band of rows is cleared and rasterized by one task, so no two tasks write the same pixel
+	pool.ParallelFor(0, m_height, [&](unsigned int, size_t first, size_t last)
+		{
+			std::fill(m_depth.begin() + first * m_width, m_depth.begin() + last * m_width, std::numeric_limits<float>::infinity());
+			for (const Occluder& occluder : m_occluders)
+			{
+				// Pixels whose centers (column + 0.5, row + 0.5) lie inside the disc. The extents are clamped to the buffer
+				// while still floats, as in SphereBounds, so a disc far larger than the buffer cannot overflow the conversion.
+				const int firstRow = std::max(static_cast<int>(std::ceil(std::clamp(occluder.y - occluder.radius - 0.5f, -1.0f, height))), static_cast<int>(first));
+				const int lastRow = std::min(static_cast<int>(std::floor(std::clamp(occluder.y + occluder.radius - 0.5f, -1.0f, height))), static_cast<int>(last) - 1);
+				for (int row = firstRow; row <= lastRow; ++row)
+				{
+					const float dy = row + 0.5f - occluder.y;
+					const float halfWidth = std::sqrt(std::max(occluder.radius * occluder.radius - dy * dy, 0.0f));
+					const int firstColumn = std::max(static_cast<int>(std::ceil(std::clamp(occluder.x - halfWidth - 0.5f, -1.0f, width))), 0);
+					const int lastColumn = std::min(static_cast<int>(std::floor(std::clamp(occluder.x + halfWidth - 0.5f, -1.0f, width))), static_cast<int>(m_width) - 1);
+
+					float* depth = m_depth.data() + static_cast<size_t>(row) * m_width;
+					for (int column = firstColumn; column <= lastColumn; ++column)
+						depth[column] = std::min(depth[column], occluder.depth);
+				}
+			}
+		}, BandHeight
+	);
+
+	// Test every atom, then compact the unoccluded ones as FrustumCuller does: each block writes to the start of its own
+	// stretch of m_scratch, and an exclusive scan of the block counts gives its offset in m_visible
+	m_scratch.resize(count);
+	m_blockCounts.resize(blockCount);
+	pool.ParallelFor(0, blockCount, [&](unsigned int, size_t first, size_t last)
+		{
+			for (size_t block = first; block < last; ++block)
+			{
+				uint32_t* visible = m_scratch.data() + blockBegin(block);
+				size_t visibleCount = 0;
+				for (size_t iii = blockBegin(block); iii < blockBegin(block + 1); ++iii)
+				{
+					const uint32_t a = atom(iii);
+					const DirectX::XMFLOAT3 p = ToView(x[a], y[a], z[a], view);
+					visible[visibleCount] = a;
+					visibleCount += IsOccluded(p.x, p.y, p.z, radius[a]) ? 0 : 1;
+				}
+				m_blockCounts[block].count = visibleCount;
+			}
+		}, 1
+	);
+
+	size_t offset = 0;
+	for (BlockCount& counts : m_blockCounts)
+	{
+		const size_t visibleCount = counts.count;
+		counts.count = offset;
+		offset += visibleCount;
+	}
+	m_visible.resize(offset);
+
+	pool.ParallelFor(0, blockCount, [&](unsigned int, size_t first, size_t last)
+		{
+			for (size_t block = first; block < last; ++block)
+			{
+				const size_t begin = m_blockCounts[block].count;
+				const size_t end = block + 1 < blockCount ? m_blockCounts[block + 1].count : m_visible.size();
+				std::copy(m_scratch.begin() + blockBegin(block), m_scratch.begin() + blockBegin(block) + (end - begin), m_visible.begin() + begin);
+			}
+		}, 1
+	);
+}
+
+bool OcclusionCuller::SelfTest(unsigned int sphereCount)
+{
+	std::mt19937 generator(777u);
+	std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	// A dense wall of large spheres in front of a scattered cloud of small ones, seen down +z from the origin
+	std::vector<float> x(sphereCount), y(sphereCount), z(sphereCount), radius(sphereCount);
+	for (unsigned int iii = 0; iii < sphereCount; ++iii)
+	{
+		const bool wall = iii % 2 == 0;
+		x[iii] = (wall ? 3.0f : 6.0f) * uniform(generator);
+		y[iii] = (wall ? 3.0f : 6.0f) * uniform(generator);
+		z[iii] = wall ? 5.0f + unit(generator) : 7.0f + 13.0f * unit(generator);
+		radius[iii] = wall ? 0.3f + 0.3f * unit(generator) : 0.05f + 0.45f * unit(generator);
+	}
+
+	DirectX::XMFLOAT4X4 view = {};
+	for (int iii = 0; iii < 4; ++iii)
+		view.m[iii][iii] = 1.0f;
+
+	ThreadPool pool(4);
+	OcclusionCuller culler;
+	culler.SetResolution(96, 64);
+	culler.Update(x.data(), y.data(), z.data(), radius.data(), nullptr, sphereCount, view, 1.0f, 1.5f, pool);
+	if (culler.OccludedCount() == 0 || culler.OccludedCount() == sphereCount)
+		return false;
+
+	std::vector<bool> visible(sphereCount, false);
+	for (size_t iii = 0; iii < culler.Visible().size(); ++iii)
+	{
+		if (iii > 0 && culler.Visible()[iii] <= culler.Visible()[iii - 1])
+			return false;
+		visible[culler.Visible()[iii]] = true;
+	}
+
+	const DirectX::XMFLOAT3 eye(0.0f, 0.0f, 0.0f);
+	for (unsigned int s = 0; s < sphereCount; ++s)
+	{
+		const DirectX::XMFLOAT3 center(x[s], y[s], z[s]);
+		// Spheres off the buffer are never occluded
+		Bounds bounds;
+		if (!culler.SphereBounds(x[s], y[s], z[s], radius[s], bounds))
+		{
+			if (!visible[s])
+				return false;
+			continue;
+		}
+
+		// The rectangle must hold every point of the sphere that lands on the buffer
+		for (int k = 0; k < 32; ++k)
+		{
+			DirectX::XMFLOAT3 direction(uniform(generator), uniform(generator), uniform(generator));
+			const float length = std::sqrt(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z);
+			const float px = x[s] + radius[s] * direction.x / length;
+			const float py = y[s] + radius[s] * direction.y / length;
+			const float pz = z[s] + radius[s] * direction.z / length;
+			const float column = std::floor(0.5f * culler.m_width + px / pz * culler.m_xScale);
+			const float row = std::floor(0.5f * culler.m_height - py / pz * culler.m_yScale);
+			if (column >= 0.0f && column < culler.m_width && row >= 0.0f && row < culler.m_height &&
+				(column < bounds.left || column > bounds.right || row < bounds.top || row > bounds.bottom))
+				return false;
+		}
+
+		if (visible[s])
+			continue;
+
+		// Every ray through a pixel center that hits an occluded sphere meets another sphere first
+		for (int row = bounds.top; row <= bounds.bottom; ++row)
+		{
+			for (int column = bounds.left; column <= bounds.right; ++column)
+			{
+				const DirectX::XMFLOAT3 pointOnRay((column + 0.5f - 0.5f * culler.m_width) / culler.m_xScale, (0.5f * culler.m_height - row - 0.5f) / culler.m_yScale, 1.0f);
+				ImpostorHit hit;
+				if (!SphereImpostor::Intersect(eye, pointOnRay, center, radius[s], hit))
+					continue;
+
+				bool hidden = false;
+				for (unsigned int o = 0; o < sphereCount && !hidden; ++o)
+				{
+					ImpostorHit occluderHit;
+					hidden = o != s && SphereImpostor::Intersect(eye, pointOnRay, DirectX::XMFLOAT3(x[o], y[o], z[o]), radius[o], occluderHit) &&
+						occluderHit.distance < hit.distance;
+				}
+				if (!hidden)
+					return false;
+			}
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include "pch.h"
+#include "AlignedAllocator.h"
+#include "ThreadPool.h"
+
+// Culls atoms hidden behind other atoms with a low-resolution depth buffer rasterized on the CPU, so the interior of a
+// folded protein is neither selected a level of detail for nor uploaded. The nearest large atoms on screen are the
+// occluders: each covers the pixels whose centers fall inside the disc of its cross section through the center, at the
+// depth of that disc, which no ray through the disc can hit the sphere behind. The rows of the buffer are rasterized
+// in parallel bands. Every atom is then tested by its bounding sphere: it is occluded if all pixels its screen rectangle
+// touches hold an occluder nearer than its nearest point.
+//
+// As with a GPU rasterizer, coverage is decided at pixel centers, so the test is exact for rays through the centers of
+// this buffer's pixels; at screen resolution a sliver smaller than one of its pixels may be culled at an occluder's rim.
+// Kept free of Direct3D so it can be tested and benchmarked headless (see SelfTest and Benchmark::OcclusionCulling).
+class OcclusionCuller
+{
+public:
+	OcclusionCuller() noexcept { SetResolution(256, 144); }
+
+	// Size of the depth buffer in pixels; a fraction of the viewport is enough
+	void SetResolution(unsigned int width, unsigned int height);
+	ND inline unsigned int Width() const noexcept { return m_width; }
+	ND inline unsigned int Height() const noexcept { return m_height; }
+
+	// At most maxOccluders atoms, the largest on screen, are rasterized, and none smaller than minRadius pixels
+	inline void SetMaxOccluders(size_t maxOccluders) noexcept { m_maxOccluders = maxOccluders; }
+	inline void SetMinOccluderRadius(float pixels) noexcept { m_minOccluderRadius = pixels; }
+
+	// View space depth of the camera's near plane. Atoms reaching it are clipped when drawn, so they never occlude.
+	inline void SetNearPlane(float depth) noexcept { WINRT_ASSERT(depth >= 0.0f); m_nearPlane = depth; }
+
+	// Rasterizes the occluders among count atoms and tests every one of them, in parallel. indices lists the atoms to
+	// consider (such as those FrustumCuller found visible); nullptr means atoms [0, count). view is the row-vector view
+	// matrix and xScale, yScale the projection's _11 and _22. Without any occluder every atom is visible and the raster
+	// and tests are skipped.
+	void Update(const float* x, const float* y, const float* z, const float* radius, const uint32_t* indices, size_t count,
+		const DirectX::XMFLOAT4X4& view, float xScale, float yScale, ThreadPool& pool);
+
+	// Indices of the atoms that are not occluded, in the order they were given
+	ND inline const AlignedVector<uint32_t>& Visible() const noexcept { return m_visible; }
+	ND inline size_t TestedCount() const noexcept { return m_tested; }
+	ND inline size_t OccludedCount() const noexcept { return m_tested - m_visible.size(); }
+	ND inline double OccludedFraction() const noexcept { return m_tested > 0 ? static_cast<double>(OccludedCount()) / m_tested : 0.0; }
+	ND inline size_t OccluderCount() const noexcept { return m_occluders.size(); }
+
+	// View space depth of the nearest occluder at each pixel, row by row; infinity where there is none
+	ND inline const AlignedVector<float>& DepthBuffer() const noexcept { return m_depth; }
+
+	// Culls sphereCount random spheres packed in front of the camera and checks every occluded one against the spheres
+	// themselves: each ray through a pixel center that hits it must hit another sphere nearer to the eye first
+	ND static bool SelfTest(unsigned int sphereCount = 2000);
+
+private:
+	// An occluder's disc in pixels and its view space depth
+	struct Occluder
+	{
+		float x;
+		float y;
+		float radius;
+		float depth;
+	};
+
+	// Screen rectangle in pixels of the view space sphere (center, radius) and its nearest depth. Returns false if the
+	// sphere reaches the eye's plane, where it cannot be occluded.
+	struct Bounds
+	{
+		int left;
+		int top;
+		int right;
+		int bottom;
+		float nearest;
+	};
+	ND bool SphereBounds(float x, float y, float z, float radius, Bounds& bounds) const noexcept;
+	ND bool IsOccluded(float x, float y, float z, float radius) const noexcept;
+
+	unsigned int m_width = 0;
+	unsigned int m_height = 0;
+	size_t m_maxOccluders = 1u << 16;
+	float m_minOccluderRadius = 0.5f;
+	float m_nearPlane = 0.0f;
+
+	// Per-frame projection from view space to pixels
+	float m_xScale = 1.0f;
+	float m_yScale = 1.0f;
+
+	AlignedVector<float> m_depth;
+	std::vector<Occluder> m_occluders;
+	std::vector<std::vector<Occluder>> m_blockOccluders;
+
+	size_t m_tested = 0;
+	AlignedVector<uint32_t> m_visible;
+	AlignedVector<uint32_t> m_scratch;
+
+	// Unoccluded atoms of each block, turned into the block's offset in m_visible; padded so blocks do not false-share
+	struct alignas(64) BlockCount
+	{
+		size_t count;
+	};
+	std::vector<BlockCount> m_blockCounts;
+};
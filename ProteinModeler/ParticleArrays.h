@@ -0,0 +1,105 @@
+#pragma once
+#include "pch.h"
+#include "AlignedAllocator.h"
+#include "Elements.h"
+
+// Structure-of-arrays storage for all per-atom state. Every array has the same length and index i in each array
+// refers to the same atom. Per-element constants (radius, mass) are cached per atom so hot loops can stream through
+// contiguous memory instead of gathering from the element tables.
+struct ParticleArrays
+{
+	AlignedVector<float> x;
+	AlignedVector<float> y;
+	AlignedVector<float> z;
+
+	AlignedVector<float> vx;
+	AlignedVector<float> vy;
+	AlignedVector<float> vz;
+
+	AlignedVector<float> fx;
+	AlignedVector<float> fy;
+	AlignedVector<float> fz;
+
+	AlignedVector<float> radius;
+	AlignedVector<float> mass;
+	AlignedVector<float> inverseMass;
+	AlignedVector<float> charge;
+	AlignedVector<Element> type;
+
+	ND inline size_t Size() const noexcept { return x.size(); }
+
+	void Reserve(size_t count)
+	{
+		for (auto* a : { &x, &y, &z, &vx, &vy, &vz, &fx, &fy, &fz, &radius, &mass, &inverseMass, &charge })
+			a->reserve(count);
+		type.reserve(count);
+	}
+
+	void PushBack(Element element, const DirectX::XMFLOAT3& position, const DirectX::XMFLOAT3& velocity, float q)
+	{
+		const int e = static_cast<int>(element);
+
+		x.push_back(position.x);
+		y.push_back(position.y);
+		z.push_back(position.z);
+		vx.push_back(velocity.x);
+		vy.push_back(velocity.y);
+		vz.push_back(velocity.z);
+		fx.push_back(0.0f);
+		fy.push_back(0.0f);
+		fz.push_back(0.0f);
+		radius.push_back(AtomicRadii[e]);
+		mass.push_back(AtomicMasses[e]);
+		inverseMass.push_back(AtomicMasses[e] > 0.0f ? 1.0f / AtomicMasses[e] : 0.0f);
+		charge.push_back(q);
+		type.push_back(element);
+	}
+
+	// Grows every array to count atoms; the new atoms are filled in with Set
+	void Resize(size_t count)
+	{
+		for (auto* a : { &x, &y, &z, &vx, &vy, &vz, &fx, &fy, &fz, &radius, &mass, &inverseMass, &charge })
+			a->resize(count, 0.0f);
+		type.resize(count);
+	}
+
+	void Set(size_t index, Element element, const DirectX::XMFLOAT3& position, const DirectX::XMFLOAT3& velocity, float q) noexcept
+	{
+		const int e = static_cast<int>(element);
+
+		x[index] = position.x;
+		y[index] = position.y;
+		z[index] = position.z;
+		vx[index] = velocity.x;
+		vy[index] = velocity.y;
+		vz[index] = velocity.z;
+		fx[index] = 0.0f;
+		fy[index] = 0.0f;
+		fz[index] = 0.0f;
+		radius[index] = AtomicRadii[e];
+		mass[index] = AtomicMasses[e];
+		inverseMass[index] = AtomicMasses[e] > 0.0f ? 1.0f / AtomicMasses[e] : 0.0f;
+		charge[index] = q;
+		type[index] = element;
+	}
+
+	// Removes atom index by moving the last atom into its place
+	void SwapAndPop(size_t index) noexcept
+	{
+		WINRT_ASSERT(index < Size());
+		for (auto* a : { &x, &y, &z, &vx, &vy, &vz, &fx, &fy, &fz, &radius, &mass, &inverseMass, &charge })
+		{
+			(*a)[index] = a->back();
+			a->pop_back();
+		}
+		type[index] = type.back();
+		type.pop_back();
+	}
+
+	void ZeroForces() noexcept
+	{
+		std::fill(fx.begin(), fx.end(), 0.0f);
+		std::fill(fy.begin(), fy.end(), 0.0f);
+		std::fill(fz.begin(), fz.end(), 0.0f);
+	}
+};
@@ -0,0 +1,478 @@
+#include "pch.h"
+#include "ParticleMeshEwald.h"
+
+
+namespace
+{
+	constexpr double Pi = 3.14159265358979323846;
+	constexpr float TwoOverSqrtPi = 1.1283791671f;
+
+	// Weights of the order grid points an atom at fractional offset w in [0, 1) from its first grid point is spread
+	// onto, theta[k] = M_order(w + order - 1 - k), and their derivatives with respect to w (Essmann et al. eq. 4.1)
+	void BSplineWeights(float w, unsigned int order, float* theta, float* dtheta) noexcept
+	{
+		theta[order - 1] = 0.0f;
+		theta[1] = w;
+		theta[0] = 1.0f - w;
+		for (unsigned int j = 3; j < order; ++j)
+		{
+			const float div = 1.0f / static_cast<float>(j - 1);
+			theta[j - 1] = div * w * theta[j - 2];
+			for (unsigned int k = 1; k < j - 1; ++k)
+				theta[j - k - 1] = div * ((w + k) * theta[j - k - 2] + (j - k - w) * theta[j - k - 1]);
+			theta[0] = div * (1.0f - w) * theta[0];
+		}
+
+		// The derivative of an order n spline is the difference of two order n - 1 splines
+		dtheta[0] = -theta[0];
+		for (unsigned int j = 1; j < order; ++j)
+			dtheta[j] = theta[j - 1] - theta[j];
+
+		const float div = 1.0f / static_cast<float>(order - 1);
+		theta[order - 1] = div * w * theta[order - 2];
+		for (unsigned int k = 1; k < order - 1; ++k)
+			theta[order - k - 1] = div * ((w + k) * theta[order - k - 2] + (order - k - w) * theta[order - k - 1]);
+		theta[0] = div * (1.0f - w) * theta[0];
+	}
+
+	// |b(m)|^-2 of the smooth PME paper: the squared modulus of the discrete Fourier transform of the spline weights
+	std::vector<double> BSplineModuli(unsigned int size, unsigned int order)
+	{
+		float theta[ParticleMeshEwald::MaxOrder];
+		float dtheta[ParticleMeshEwald::MaxOrder];
+		BSplineWeights(0.0f, order, theta, dtheta);
+
+		std::vector<double> moduli(size);
+		for (unsigned int m = 0; m < size; ++m)
+		{
+			double real = 0.0;
+			double imaginary = 0.0;
+			for (unsigned int k = 0; k < order; ++k)
+			{
+				const double angle = 2.0 * Pi * m * k / size;
+				real += theta[k] * std::cos(angle);
+				imaginary += theta[k] * std::sin(angle);
+			}
+			moduli[m] = real * real + imaginary * imaginary;
+		}
+
+		// Odd orders have zeros at the Nyquist frequency; interpolate over them
+		for (unsigned int m = 0; m < size; ++m)
+			if (moduli[m] < 1e-7)
+				moduli[m] = 0.5 * (moduli[(m + size - 1) % size] + moduli[(m + 1) % size]);
+
+		return moduli;
+	}
+}
+
+ParticleMeshEwald::ParticleMeshEwald() noexcept :
+	m_gridSpacing(0.12f),
+	m_order(4),
+	m_ewaldTolerance(1e-5f),
+	m_gridSize({ 0, 0, 0 }),
+	m_beta(0.0f),
+	m_builtOrder(0),
+	m_reciprocalEnergy(0.0f),
+	m_selfEnergy(0.0f),
+	m_exclusionEnergy(0.0f)
+{}
+
+float ParticleMeshEwald::EwaldCoefficient(float cutoff, float tolerance) noexcept
+{
+	// erfc(beta * cutoff) decreases with beta: bracket the root by doubling, then bisect
+	double high = 1.0;
+	while (std::erfc(high * cutoff) > tolerance)
+		high *= 2.0;
+
+	double low = 0.0;
+	for (int iteration = 0; iteration < 60; ++iteration)
+	{
+		const double middle = 0.5 * (low + high);
+		if (std::erfc(middle * cutoff) > tolerance)
+			low = middle;
+		else
+			high = middle;
+	}
+	return static_cast<float>(0.5 * (low + high));
+}
+
+void ParticleMeshEwald::SetExclusions(const std::vector<unsigned int>& offsets, const std::vector<unsigned int>& excluded)
+{
+	NeighborList::MirrorExclusions(offsets, excluded, m_exclusionOffsets, m_exclusions);
+}
+
+void ParticleMeshEwald::Setup(const SimulationBox& box, float beta)
+{
+	const DirectX::XMFLOAT3 lengths = box.Lengths();
+	const std::array<float, 3> length = { lengths.x, lengths.y, lengths.z };
+
+	std::array<unsigned int, 3> gridSize;
+	for (size_t d = 0; d < 3; ++d)
+		gridSize[d] = Fft3D::NextFastSize(std::max(m_order, static_cast<unsigned int>(std::ceil(length[d] / m_gridSpacing))));
+
+	if (gridSize == m_gridSize && box == m_box && beta == m_beta && m_order == m_builtOrder)
+		return;
+
+	m_gridSize = gridSize;
+	m_box = box;
+	m_beta = beta;
+	m_builtOrder = m_order;
+
+	const unsigned int nx = gridSize[0];
+	const unsigned int ny = gridSize[1];
+	const unsigned int nz = gridSize[2];
+	m_fft.Resize(nx, ny, nz);
+	m_grid.resize(static_cast<size_t>(nx) * ny * nz);
+	m_influence.resize(m_grid.size());
+
+	const std::vector<double> moduliX = BSplineModuli(nx, m_order);
+	const std::vector<double> moduliY = BSplineModuli(ny, m_order);
+	const std::vector<double> moduliZ = BSplineModuli(nz, m_order);
+
+	const double volume = static_cast<double>(length[0]) * length[1] * length[2];
+	const double exponentScale = Pi * Pi / (static_cast<double>(beta) * beta);
+
+	// Reciprocal vectors m = k / L with k wrapped into (-n/2, n/2]
+	auto frequency = [](unsigned int k, unsigned int n, float l) {
+		return (k <= n / 2 ? static_cast<double>(k) : static_cast<double>(k) - n) / l;
+	};
+	for (unsigned int ix = 0; ix < nx; ++ix)
+	{
+		const double mx = frequency(ix, nx, length[0]);
+		for (unsigned int iy = 0; iy < ny; ++iy)
+		{
+			const double my = frequency(iy, ny, length[1]);
+			for (unsigned int iz = 0; iz < nz; ++iz)
+			{
+				const double mz = frequency(iz, nz, length[2]);
+				const double m2 = mx * mx + my * my + mz * mz;
+				const size_t index = (static_cast<size_t>(ix) * ny + iy) * nz + iz;
+
+				m_influence[index] = m2 == 0.0 ? 0.0f : static_cast<float>(CoulombConstant * std::exp(-exponentScale * m2) /
+					(Pi * volume * m2 * moduliX[ix] * moduliY[iy] * moduliZ[iz]));
+			}
+		}
+	}
+}
+
+void ParticleMeshEwald::ComputeSplines(const ParticleArrays& particles, ThreadPool& pool)
+{
+	const size_t count = particles.Size();
+	const unsigned int order = m_order;
+	for (size_t d = 0; d < 3; ++d)
+	{
+		m_gridIndex[d].resize(count);
+		m_theta[d].resize(count * order);
+		m_dtheta[d].resize(count * order);
+	}
+
+	const DirectX::XMFLOAT3& half = m_box.halfExtents;
+	const std::array<float, 3> offset = { half.x, half.y, half.z };
+	const std::array<float, 3> scale = {
+		m_gridSize[0] / (2.0f * half.x),
+		m_gridSize[1] / (2.0f * half.y),
+		m_gridSize[2] / (2.0f * half.z)
+	};
+	const std::array<const float*, 3> position = { particles.x.data(), particles.y.data(), particles.z.data() };
+
+	pool.ParallelFor(0, count, [&](unsigned int threadIndex, size_t begin, size_t end)
+		{
+			double charge = 0.0;
+			double squares = 0.0;
+			for (size_t iii = begin; iii < end; ++iii)
+			{
+				charge += particles.charge[iii];
+				squares += static_cast<double>(particles.charge[iii]) * particles.charge[iii];
+
+				for (size_t d = 0; d < 3; ++d)
+				{
+					// Fractional grid coordinate wrapped into [0, n), whether or not the position itself was wrapped
+					const float n = static_cast<float>(m_gridSize[d]);
+					float u = (position[d][iii] + offset[d]) * scale[d];
+					u -= n * std::floor(u / n);
+
+					const int first = std::min(static_cast<int>(u), static_cast<int>(m_gridSize[d]) - 1);
+					m_gridIndex[d][iii] = first;
+					BSplineWeights(u - static_cast<float>(first), order, m_theta[d].data() + iii * order, m_dtheta[d].data() + iii * order);
+				}
+			}
+			m_threadSums[threadIndex].value += charge;
+			m_threadSums[threadIndex].squares += squares;
+		}
+	);
+}
+
+void ParticleMeshEwald::SpreadCharges(const ParticleArrays& particles, ThreadPool& pool)
+{
+	const unsigned int nx = m_gridSize[0];
+	const unsigned int ny = m_gridSize[1];
+	const unsigned int nz = m_gridSize[2];
+	const unsigned int order = m_order;
+
+	// An even number of slabs, so the last (odd) slab wrapping into slab 0 never races with another slab of its color
+	unsigned int slabCount = nx / order;
+	if (slabCount > 1 && slabCount % 2 == 1)
+		--slabCount;
+	slabCount = std::max(slabCount, 1u);
+
+	m_planeSlab.resize(nx);
+	for (unsigned int slab = 0; slab < slabCount; ++slab)
+		for (unsigned int plane = slab * nx / slabCount; plane < (slab + 1) * nx / slabCount; ++plane)
+			m_planeSlab[plane] = slab;
+
+	// Counting sort of the charged atoms by slab
+	const size_t count = particles.Size();
+	m_slabOffsets.assign(slabCount + 1, 0u);
+	for (size_t iii = 0; iii < count; ++iii)
+		if (particles.charge[iii] != 0.0f)
+			++m_slabOffsets[m_planeSlab[m_gridIndex[0][iii]] + 1];
+	for (unsigned int slab = 0; slab < slabCount; ++slab)
+		m_slabOffsets[slab + 1] += m_slabOffsets[slab];
+
+	m_slabAtoms.resize(m_slabOffsets[slabCount]);
+	std::vector<unsigned int> cursor(m_slabOffsets.begin(), m_slabOffsets.end() - 1);
+	for (size_t iii = 0; iii < count; ++iii)
+		if (particles.charge[iii] != 0.0f)
+			m_slabAtoms[cursor[m_planeSlab[m_gridIndex[0][iii]]]++] = static_cast<unsigned int>(iii);
+
+	// std::complex is guaranteed to be laid out as {real, imaginary}
+	float* grid = reinterpret_cast<float*>(m_grid.data());
+	pool.ParallelFor(0, m_grid.size(), [&](unsigned int, size_t begin, size_t end)
+		{
+			std::fill(grid + 2 * begin, grid + 2 * end, 0.0f);
+		},
+		4096
+	);
+
+	auto spreadSlab = [&](unsigned int slab)
+	{
+		for (unsigned int n = m_slabOffsets[slab]; n < m_slabOffsets[slab + 1]; ++n)
+		{
+			const unsigned int atom = m_slabAtoms[n];
+			const float q = particles.charge[atom];
+			const float* thetaX = m_theta[0].data() + atom * order;
+			const float* thetaY = m_theta[1].data() + atom * order;
+			const float* thetaZ = m_theta[2].data() + atom * order;
+
+			for (unsigned int ix = 0; ix < order; ++ix)
+			{
+				const unsigned int gx = (m_gridIndex[0][atom] + ix) % nx;
+				const float qx = q * thetaX[ix];
+				for (unsigned int iy = 0; iy < order; ++iy)
+				{
+					const unsigned int gy = (m_gridIndex[1][atom] + iy) % ny;
+					const float qxy = qx * thetaY[iy];
+					float* row = grid + 2 * ((static_cast<size_t>(gx) * ny + gy) * nz);
+					for (unsigned int iz = 0; iz < order; ++iz)
+						row[2 * ((m_gridIndex[2][atom] + iz) % nz)] += qxy * thetaZ[iz];
+				}
+			}
+		}
+	};
+
+	if (slabCount == 1)
+	{
+		spreadSlab(0);
+		return;
+	}
+
+	for (unsigned int color = 0; color < 2; ++color)
+	{
+		pool.ParallelFor(0, slabCount / 2, [&](unsigned int, size_t begin, size_t end)
+			{
+				for (size_t iii = begin; iii < end; ++iii)
+					spreadSlab(static_cast<unsigned int>(2 * iii + color));
+			},
+			1
+		);
+	}
+}
+
+float ParticleMeshEwald::Convolve(ThreadPool& pool)
+{
+	for (ThreadSum& sum : m_threadSums)
+		sum.value = 0.0;
+
+	pool.ParallelFor(0, m_grid.size(), [&](unsigned int threadIndex, size_t begin, size_t end)
+		{
+			double energy = 0.0;
+			for (size_t iii = begin; iii < end; ++iii)
+			{
+				energy += static_cast<double>(m_influence[iii]) * std::norm(m_grid[iii]);
+				m_grid[iii] *= m_influence[iii];
+			}
+			m_threadSums[threadIndex].value += energy;
+		},
+		4096
+	);
+
+	double energy = 0.0;
+	for (const ThreadSum& sum : m_threadSums)
+		energy += sum.value;
+
+	return static_cast<float>(0.5 * energy);
+}
+
+void ParticleMeshEwald::InterpolateForces(ParticleArrays& particles, ThreadPool& pool)
+{
+	const unsigned int nx = m_gridSize[0];
+	const unsigned int ny = m_gridSize[1];
+	const unsigned int nz = m_gridSize[2];
+	const unsigned int order = m_order;
+
+	// Derivatives are taken with respect to the fractional grid coordinate; scale them back to nm
+	const float scaleX = nx / (2.0f * m_box.halfExtents.x);
+	const float scaleY = ny / (2.0f * m_box.halfExtents.y);
+	const float scaleZ = nz / (2.0f * m_box.halfExtents.z);
+
+	const float* grid = reinterpret_cast<const float*>(m_grid.data());
+	pool.ParallelFor(0, particles.Size(), [&](unsigned int, size_t begin, size_t end)
+		{
+			for (size_t atom = begin; atom < end; ++atom)
+			{
+				const float q = particles.charge[atom];
+				if (q == 0.0f)
+					continue;
+
+				const float* thetaX = m_theta[0].data() + atom * order;
+				const float* thetaY = m_theta[1].data() + atom * order;
+				const float* thetaZ = m_theta[2].data() + atom * order;
+				const float* dthetaX = m_dtheta[0].data() + atom * order;
+				const float* dthetaY = m_dtheta[1].data() + atom * order;
+				const float* dthetaZ = m_dtheta[2].data() + atom * order;
+
+				float fx = 0.0f;
+				float fy = 0.0f;
+				float fz = 0.0f;
+				for (unsigned int ix = 0; ix < order; ++ix)
+				{
+					const unsigned int gx = (m_gridIndex[0][atom] + ix) % nx;
+					for (unsigned int iy = 0; iy < order; ++iy)
+					{
+						const unsigned int gy = (m_gridIndex[1][atom] + iy) % ny;
+						const float* row = grid + 2 * ((static_cast<size_t>(gx) * ny + gy) * nz);
+
+						float sum = 0.0f;
+						float sumDz = 0.0f;
+						for (unsigned int iz = 0; iz < order; ++iz)
+						{
+							const float value = row[2 * ((m_gridIndex[2][atom] + iz) % nz)];
+							sum += thetaZ[iz] * value;
+							sumDz += dthetaZ[iz] * value;
+						}
+						fx += dthetaX[ix] * thetaY[iy] * sum;
+						fy += thetaX[ix] * dthetaY[iy] * sum;
+						fz += thetaX[ix] * thetaY[iy] * sumDz;
+					}
+				}
+
+				particles.fx[atom] -= q * scaleX * fx;
+				particles.fy[atom] -= q * scaleY * fy;
+				particles.fz[atom] -= q * scaleZ * fz;
+			}
+		}
+	);
+}
+
+float ParticleMeshEwald::ExcludedPairs(ParticleArrays& particles, ThreadPool& pool)
+{
+	const size_t rowCount = std::min(particles.Size(), m_exclusionOffsets.empty() ? size_t(0) : m_exclusionOffsets.size() - 1);
+	if (rowCount == 0 || m_exclusions.empty())
+		return 0.0f;
+
+	for (ThreadSum& sum : m_threadSums)
+		sum.value = 0.0;
+
+	const MinimumImage image = m_box.Image();
+	const float beta = m_beta;
+
+	// -k q_i q_j erf(beta r) / r for every excluded pair. Each atom walks its full row and only updates its own force,
+	// so every pair is visited twice and the energy is halved.
+	pool.ParallelFor(0, rowCount, [&](unsigned int threadIndex, size_t begin, size_t end)
+		{
+			double energy = 0.0;
+			for (size_t i = begin; i < end; ++i)
+			{
+				const float qi = CoulombConstant * particles.charge[i];
+				if (qi == 0.0f)
+					continue;
+
+				float fxi = 0.0f;
+				float fyi = 0.0f;
+				float fzi = 0.0f;
+				for (unsigned int n = m_exclusionOffsets[i]; n < m_exclusionOffsets[i + 1]; ++n)
+				{
+					const unsigned int j = m_exclusions[n];
+					const float qq = qi * particles.charge[j];
+
+					float dx = particles.x[i] - particles.x[j];
+					float dy = particles.y[i] - particles.y[j];
+					float dz = particles.z[i] - particles.z[j];
+					image.Apply(dx, dy, dz);
+					const float r2 = dx * dx + dy * dy + dz * dz;
+
+					// erf(beta r) / r tends to 2 beta / sqrt(pi) with no force for coincident atoms
+					if (r2 < 1e-12f)
+					{
+						energy -= 0.5 * qq * TwoOverSqrtPi * beta;
+						continue;
+					}
+
+					const float r = std::sqrt(r2);
+					const float erfOverR = std::erf(beta * r) / r;
+					energy -= 0.5 * qq * erfOverR;
+
+					const float fScalar = qq * (TwoOverSqrtPi * beta * std::exp(-beta * beta * r2) - erfOverR) / r2;
+					fxi += fScalar * dx;
+					fyi += fScalar * dy;
+					fzi += fScalar * dz;
+				}
+
+				particles.fx[i] += fxi;
+				particles.fy[i] += fyi;
+				particles.fz[i] += fzi;
+			}
+			m_threadSums[threadIndex].value += energy;
+		}
+	);
+
+	double energy = 0.0;
+	for (const ThreadSum& sum : m_threadSums)
+		energy += sum.value;
+
+	return static_cast<float>(energy);
+}
+
+float ParticleMeshEwald::Compute(ParticleArrays& particles, const SimulationBox& box, float cutoff, ThreadPool& pool)
+{
+	WINRT_ASSERT(box.IsPeriodic());
+
+	Setup(box, EwaldCoefficient(cutoff, m_ewaldTolerance));
+	m_threadSums.assign(pool.ThreadCount(), ThreadSum());
+
+	ComputeSplines(particles, pool);
+
+	double netCharge = 0.0;
+	double chargeSquares = 0.0;
+	for (const ThreadSum& sum : m_threadSums)
+	{
+		netCharge += sum.value;
+		chargeSquares += sum.squares;
+	}
+
+	// Interaction of every charge with its own screening Gaussian, and the uniform background that neutralizes a net charge
+	const DirectX::XMFLOAT3 lengths = box.Lengths();
+	const double volume = static_cast<double>(lengths.x) * lengths.y * lengths.z;
+	m_selfEnergy = static_cast<float>(-CoulombConstant * m_beta / std::sqrt(Pi) * chargeSquares -
+		CoulombConstant * Pi * netCharge * netCharge / (2.0 * volume * m_beta * m_beta));
+
+	SpreadCharges(particles, pool);
+	m_fft.Forward(m_grid.data(), pool);
+	m_reciprocalEnergy = Convolve(pool);
+	m_fft.Backward(m_grid.data(), pool);
+	InterpolateForces(particles, pool);
+
+	m_exclusionEnergy = ExcludedPairs(particles, pool);
+
+	return m_reciprocalEnergy + m_selfEnergy + m_exclusionEnergy;
+}
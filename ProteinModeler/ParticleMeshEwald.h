@@ -0,0 +1,106 @@
+#pragma once
+#include "pch.h"
+#include "AlignedAllocator.h"
+#include "Elements.h"
+#include "ParticleArrays.h"
+#include "SimulationBox.h"
+#include "ThreadPool.h"
+#include "Fft3D.h"
+#include "NeighborList.h"
+
+// Reciprocal-space part of smooth particle-mesh Ewald (Essmann et al. 1995). Charges are spread onto a periodic grid
+// with cardinal B-splines, the grid is convolved with the Ewald influence function through a 3D FFT, and the forces are
+// interpolated back with the spline derivatives. The real-space part, q_i q_j erfc(beta r) / r inside the cutoff, is
+// evaluated by the nonbonded kernels (see NonbondedForce).
+//
+// Accuracy is set by three knobs: the Ewald tolerance (the relative size of erfc(beta r) at the cutoff, which fixes
+// the splitting parameter beta), the grid spacing and the interpolation order. Finer grids and higher orders reduce
+// the reciprocal-space error at the cost of a larger FFT and more grid points per atom. See Benchmark::PmeAccuracy.
+class ParticleMeshEwald
+{
+public:
+	ParticleMeshEwald() noexcept;
+
+	// Adds the reciprocal-space, self and excluded-pair forces to particles.fx/fy/fz and returns their energy (kJ/mol).
+	// The box must be periodic.
+	float Compute(ParticleArrays& particles, const SimulationBox& box, float cutoff, ThreadPool& pool);
+
+	// Pairs excluded from the nonbonded interactions, in the compressed-row form of NeighborList::SetExclusions. The
+	// reciprocal sum includes every pair, so the part of their interaction it contains is subtracted again.
+	void SetExclusions(const std::vector<unsigned int>& offsets, const std::vector<unsigned int>& excluded);
+
+	// Upper bound on the grid spacing in nm; each dimension is rounded up to a size the FFT handles efficiently
+	void SetGridSpacing(float spacing) noexcept { WINRT_ASSERT(spacing > 0.0f); m_gridSpacing = spacing; }
+	ND inline float GridSpacing() const noexcept { return m_gridSpacing; }
+
+	// B-spline order: 4 is cubic interpolation over 4^3 grid points per atom
+	void SetInterpolationOrder(unsigned int order) noexcept { WINRT_ASSERT(order >= 3 && order <= MaxOrder); m_order = order; }
+	ND inline unsigned int InterpolationOrder() const noexcept { return m_order; }
+
+	void SetEwaldTolerance(float tolerance) noexcept { WINRT_ASSERT(tolerance > 0.0f && tolerance < 1.0f); m_ewaldTolerance = tolerance; }
+	ND inline float EwaldTolerance() const noexcept { return m_ewaldTolerance; }
+
+	// beta (1/nm) such that erfc(beta * cutoff) = tolerance
+	ND static float EwaldCoefficient(float cutoff, float tolerance) noexcept;
+
+	// Grid and splitting parameter of the last Compute call
+	ND inline std::array<unsigned int, 3> GridSize() const noexcept { return m_gridSize; }
+	ND inline float EwaldCoefficient() const noexcept { return m_beta; }
+
+	// Energy breakdown of the last Compute call
+	ND inline float ReciprocalEnergy() const noexcept { return m_reciprocalEnergy; }
+	ND inline float SelfEnergy() const noexcept { return m_selfEnergy; }
+	ND inline float ExclusionEnergy() const noexcept { return m_exclusionEnergy; }
+
+	static constexpr unsigned int MaxOrder = 8;
+
+private:
+	void Setup(const SimulationBox& box, float beta);
+	void ComputeSplines(const ParticleArrays& particles, ThreadPool& pool);
+	void SpreadCharges(const ParticleArrays& particles, ThreadPool& pool);
+	ND float Convolve(ThreadPool& pool);
+	void InterpolateForces(ParticleArrays& particles, ThreadPool& pool);
+	ND float ExcludedPairs(ParticleArrays& particles, ThreadPool& pool);
+
+	float m_gridSpacing;
+	unsigned int m_order;
+	float m_ewaldTolerance;
+
+	// Grid, box and beta the influence function was built for
+	std::array<unsigned int, 3> m_gridSize;
+	SimulationBox m_box;
+	float m_beta;
+	unsigned int m_builtOrder;
+
+	Fft3D m_fft;
+	AlignedVector<Fft3D::Complex> m_grid;
+
+	// exp(-pi^2 m^2 / beta^2) / (pi V m^2 |b(m)|^2), times Coulomb's constant, for every reciprocal vector m
+	AlignedVector<float> m_influence;
+
+	// Per atom and axis: first grid index and the order spline weights and derivatives (atom-major)
+	std::array<AlignedVector<int>, 3> m_gridIndex;
+	std::array<AlignedVector<float>, 3> m_theta;
+	std::array<AlignedVector<float>, 3> m_dtheta;
+
+	// Atoms bucketed by the x slab of their first grid plane. Slabs are at least m_order planes wide, so an atom only
+	// writes into its own slab and the next one, and all even (then all odd) slabs can be spread concurrently.
+	std::vector<unsigned int> m_planeSlab;
+	std::vector<unsigned int> m_slabOffsets;
+	std::vector<unsigned int> m_slabAtoms;
+
+	// Both directions of every excluded pair, so each thread only writes the forces of its own atoms
+	std::vector<unsigned int> m_exclusionOffsets;
+	std::vector<unsigned int> m_exclusions;
+
+	float m_reciprocalEnergy;
+	float m_selfEnergy;
+	float m_exclusionEnergy;
+
+	struct alignas(64) ThreadSum
+	{
+		double value = 0.0;
+		double squares = 0.0;
+	};
+	std::vector<ThreadSum> m_threadSums;
+};
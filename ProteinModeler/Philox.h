@@ -0,0 +1,108 @@
+#pragma once
+#include "pch.h"
+#include <cstdint>
+
+// Consumers of random numbers within one simulation. Each draws from its own stream, so adding draws to one never
+// shifts the numbers another sees.
+enum class RandomStream : uint32_t
+{
+	MaxwellBoltzmann = 1,
+	Langevin = 2,
+	MonteCarlo = 3
+};
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", SC 2011). A
+// block of four random words is a pure function of a 128-bit counter and a 64-bit key, so there is no state to share
+// between threads: every (seed, step, atom) gets its own block, results do not depend on how the atoms are split over
+// threads or SIMD lanes, and a run can be reproduced from its seed. The SIMD batches live in SimdKernelTable::Gaussian.
+struct Philox
+{
+	using Counter = std::array<uint32_t, 4>;
+	using Key = std::array<uint32_t, 2>;
+
+	static constexpr uint32_t Multiplier0 = 0xD2511F53u;
+	static constexpr uint32_t Multiplier1 = 0xCD9E8D57u;
+	static constexpr uint32_t Weyl0 = 0x9E3779B9u;
+	static constexpr uint32_t Weyl1 = 0xBB67AE85u;
+	static constexpr unsigned int Rounds = 10;
+
+	ND static inline Key KeyFromSeed(uint64_t seed) noexcept { return { static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32) }; }
+
+	// Counter layout used by the simulation: (atom, step low, step high, stream)
+	ND static inline Counter AtomCounter(uint32_t atom, uint64_t step, uint32_t stream) noexcept
+	{
+		return { atom, static_cast<uint32_t>(step), static_cast<uint32_t>(step >> 32), stream };
+	}
+
+	ND static inline Counter Generate(Counter counter, Key key) noexcept
+	{
+		for (unsigned int round = 0; round < Rounds; ++round)
+		{
+			const uint64_t product0 = static_cast<uint64_t>(Multiplier0) * counter[0];
+			const uint64_t product1 = static_cast<uint64_t>(Multiplier1) * counter[2];
+			counter = {
+				static_cast<uint32_t>(product1 >> 32) ^ counter[1] ^ key[0],
+				static_cast<uint32_t>(product1),
+				static_cast<uint32_t>(product0 >> 32) ^ counter[3] ^ key[1],
+				static_cast<uint32_t>(product0)
+			};
+			key[0] += Weyl0;
+			key[1] += Weyl1;
+		}
+		return counter;
+	}
+
+	// The top 24 bits as a float in [0, 1), or in (0, 1] for the logarithm of Box-Muller
+	ND static inline float Uniform(uint32_t word) noexcept { return static_cast<float>(word >> 8) * (1.0f / 16777216.0f); }
+	ND static inline float UniformOpenZero(uint32_t word) noexcept { return static_cast<float>((word >> 8) + 1) * (1.0f / 16777216.0f); }
+
+	// Four standard normal deviates from one block: Box-Muller on words (0, 1) and (2, 3)
+	static inline void Normal(const Counter& block, float* normal) noexcept
+	{
+		constexpr float TwoPi = 6.28318530718f;
+		for (unsigned int pair = 0; pair < 2; ++pair)
+		{
+			const float radius = std::sqrt(-2.0f * std::log(UniformOpenZero(block[2 * pair])));
+			const float angle = TwoPi * Uniform(block[2 * pair + 1]);
+			normal[2 * pair] = radius * std::cos(angle);
+			normal[2 * pair + 1] = radius * std::sin(angle);
+		}
+	}
+};
+
+// Sequential generator over consecutive Philox blocks, for the serial, non-reproducible uses (UI placement, test
+// data). Each instance is an independent stream, so give every thread its own.
+class PhiloxStream
+{
+public:
+	explicit PhiloxStream(uint64_t seed = 0, uint64_t stream = 0) noexcept :
+		m_key(Philox::KeyFromSeed(seed)),
+		m_counter({ 0u, 0u, static_cast<uint32_t>(stream), static_cast<uint32_t>(stream >> 32) }),
+		m_block(),
+		m_used(4)
+	{}
+
+	ND inline uint32_t Next() noexcept
+	{
+		if (m_used == 4)
+		{
+			m_block = Philox::Generate(m_counter, m_key);
+			if (++m_counter[0] == 0)
+				++m_counter[1];
+			m_used = 0;
+		}
+		return m_block[m_used++];
+	}
+
+	// [0, 1)
+	ND inline float NextFloat() noexcept { return Philox::Uniform(Next()); }
+
+	// Uniform integer in [0, range) by multiply-shift, which avoids the bias of a modulo
+	ND inline uint32_t NextBelow(uint32_t range) noexcept { return static_cast<uint32_t>((static_cast<uint64_t>(Next()) * range) >> 32); }
+
+private:
+	Philox::Key m_key;
+	Philox::Counter m_counter;
+	Philox::Counter m_block;
+	unsigned int m_used;
+};
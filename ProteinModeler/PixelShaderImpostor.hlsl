@@ -0,0 +1,108 @@
+// Defaults for number of lights.
+#ifndef NUM_DIR_LIGHTS
+#define NUM_DIR_LIGHTS 1
+#endif
+
+#ifndef NUM_POINT_LIGHTS
+#define NUM_POINT_LIGHTS 0
+#endif
+
+#ifndef NUM_SPOT_LIGHTS
+#define NUM_SPOT_LIGHTS 0
+#endif
+
+#define NUM_MATERIALS 10
+
+// Include structures and functions for lighting.
+#include "Lighting.hlsli"
+
+cbuffer cbPass : register(b0)
+{
+    float4x4 gView;
+    float4x4 gInvView;
+    float4x4 gProj;
+    float4x4 gInvProj;
+    float4x4 gViewProj;
+    float4x4 gInvViewProj;
+    float3 gEyePosW;
+    float cbPerObjectPad1;
+    float2 gRenderTargetSize;
+    float2 gInvRenderTargetSize;
+    float gNearZ;
+    float gFarZ;
+    float gTotalTime;
+    float gDeltaTime;
+    float4 gAmbientLight;
+    
+    // Indices [0, NUM_DIR_LIGHTS) are directional lights;
+    // indices [NUM_DIR_LIGHTS, NUM_DIR_LIGHTS+NUM_POINT_LIGHTS) are point lights;
+    // indices [NUM_DIR_LIGHTS+NUM_POINT_LIGHTS, NUM_DIR_LIGHTS+NUM_POINT_LIGHT+NUM_SPOT_LIGHTS)
+    // are spot lights for a maximum of MaxLights per object.
+    Light gLights[MaxLights];
+};
+
+cbuffer cbMaterial : register(b1)
+{
+    Material gMaterials[NUM_MATERIALS];
+}
+
+struct VSOut
+{
+    float4 PosH : SV_POSITION;
+    float3 PosW : POSITION;
+    nointerpolation float4 CenterRadius : CENTER_RADIUS;
+    nointerpolation uint MaterialIndex : MATERIAL_INDEX;
+};
+
+struct PSOut
+{
+    float4 Color : SV_Target;
+
+    // The impostor quad lies entirely in front of its sphere, so the ray-cast depth is never less than the rasterized
+    // one. Declaring that keeps early depth rejection against what is already drawn.
+    float Depth : SV_DepthGreaterEqual;
+};
+
+// Ray-casts the sphere through this pixel of its impostor quad. Mirrors SphereImpostor::Intersect, which must be kept in
+// step with it.
+PSOut main(VSOut pin)
+{
+    PSOut pout;
+
+    float3 center = pin.CenterRadius.xyz;
+    float radius = pin.CenterRadius.w;
+    float3 direction = normalize(pin.PosW - gEyePosW);
+
+    // Squared distance of the ray from the center, taken from the closest approach rather than as b^2 - c, which cancels
+    // catastrophically for small spheres far from the eye
+    float3 toCenter = center - gEyePosW;
+    float along = dot(toCenter, direction);
+    float3 offset = toCenter - direction * along;
+    float h = radius * radius - dot(offset, offset);
+    clip(h);
+
+    float3 posW = gEyePosW + direction * (along - sqrt(h));
+    float3 normalW = (posW - center) / radius;
+
+    float4 posH = mul(float4(posW, 1.0f), gViewProj);
+    pout.Depth = posH.z / posH.w;
+
+    Material material = gMaterials[pin.MaterialIndex];
+
+    // Vector from point being lit to eye. 
+    float3 toEyeW = -direction;
+
+    // Indirect lighting.
+    float4 ambient = gAmbientLight * material.DiffuseAlbedo;
+
+    float3 shadowFactor = 1.0f;
+    float4 directLight = ComputeLighting(gLights, material, posW, normalW, toEyeW, shadowFactor);
+
+    float4 litColor = ambient + directLight;
+
+    // Common convention to take alpha from diffuse material.
+    litColor.a = material.DiffuseAlbedo.a;
+
+    pout.Color = litColor;
+    return pout;
+}
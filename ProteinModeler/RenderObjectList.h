@@ -3,8 +3,7 @@
 #include "DeviceResources.h"
 #include "MeshSet.h"
 #include "Timer.h"
-
-#define MAX_INSTANCES 1024 // TODO: Why is this defined at 1024 and why is it used in the RenderObjectList constructor
+#include "InstanceUploadTracker.h"
 
 class RenderableBase
 {
@@ -108,39 +107,40 @@ class RenderObjectInstanced : public RenderableBase
 {
 public:
 	RenderObjectInstanced(std::shared_ptr<DeviceResources> deviceResources, const MeshInstance& mesh) noexcept :
-		RenderableBase(deviceResources, mesh)
-	{
-		CreateInstanceBuffer();
-	}
+		RenderableBase(deviceResources, mesh),
+		m_uploads(sizeof(T))
+	{}
 	// Must implement copy constructor because it is required when stored in std::vector. 
 	// See https://stackoverflow.com/questions/40457302/c-vector-emplace-back-calls-copy-constructor
+	// The copy starts without an instance buffer; its first Update creates one.
 	RenderObjectInstanced(const RenderObjectInstanced& rhs) noexcept :
 		RenderableBase(rhs),
-		m_renderObjects(rhs.m_renderObjects),
-		m_materialIndices(rhs.m_materialIndices),
-		m_worldMatrices(rhs.m_worldMatrices)
-	{
-		CreateInstanceBuffer();
-	}
+		m_BufferUpdateFn(rhs.m_BufferUpdateFn),
+		m_InstanceCountFn(rhs.m_InstanceCountFn),
+		m_InstanceWriteFn(rhs.m_InstanceWriteFn),
+		m_instanceCount(0),
+		m_uploads(sizeof(T))
+	{}
 	RenderObjectInstanced& operator=(RenderObjectInstanced& rhs) noexcept
 	{
 		RenderableBase::operator=(rhs);
 
-		m_renderObjects.assign(rhs.m_renderObjects.begin(), rhs.m_renderObjects.end());
-		m_materialIndices.assign(rhs.m_materialIndices.begin(), rhs.m_materialIndices.end());
-		m_worldMatrices.assign(rhs.m_worldMatrices.begin(), rhs.m_worldMatrices.end());
-
-		CreateInstanceBuffer();		
+		m_instanceCount = 0;
+		m_uploads = InstanceUploadTracker(sizeof(T));
+		m_instanceBuffer = nullptr;
+		return *this;
 	}
 	virtual ~RenderObjectInstanced() noexcept override {};
 
 	virtual void Render() const override
 	{
 		WINRT_ASSERT(m_deviceResources != nullptr); 
-		WINRT_ASSERT(m_renderObjects.size() > 0); // Must have a non-zero number of objects to render 
-		WINRT_ASSERT(m_worldMatrices.size() == m_renderObjects.size()); 
-		WINRT_ASSERT(m_instanceBuffer != nullptr);
 
+		// Every atom may have been removed
+		if (m_instanceCount == 0)
+			return;
+
+		WINRT_ASSERT(m_instanceBuffer != nullptr);
 		auto context = m_deviceResources->GetD3DDeviceContext();
 
 		UINT strides[1] = { sizeof(T) }; 
@@ -149,43 +149,36 @@ public:
 		// TODO: Wrap this in a THROW_INFO_ONLY macro
 		context->IASetVertexBuffers(1u, 1u, vertInstBuffers, strides, offsets); 
 
-		// Loop over the world matrices and draw up to MAX_INSTANCES at a time
-		size_t endIndex = 0;
-		for (size_t startIndex = 0; startIndex < m_worldMatrices.size(); startIndex += MAX_INSTANCES)
-		{
-			endIndex = std::min(startIndex + MAX_INSTANCES, m_worldMatrices.size()) - 1;
-
-			// Need to assign lambda that will update pipeline constant buffers 
-			m_BufferUpdateFn(this, startIndex, endIndex);
-
-			// TODO: Wrap this in THROW_INFO_ONLY macro
-			context->DrawIndexedInstanced(m_mesh.IndexCount, static_cast<UINT>(endIndex - startIndex + 1), m_mesh.StartIndexLocation, m_mesh.BaseVertexLocation, 0u);
-		}
-
-	}
-	inline void AddInstance(const DirectX::XMFLOAT3& scaling, const DirectX::XMFLOAT3* translation, unsigned int materialIndex)
-	{
-		m_renderObjects.emplace_back(m_deviceResources, m_mesh, scaling, translation, materialIndex);
-		m_worldMatrices.push_back(m_renderObjects.back().WorldMatrix4X4());
-		m_materialIndices.push_back(materialIndex);
+		// The buffer holds every instance, so they are all written with one map and drawn with one call
+		m_uploads.Submit(m_instanceCount,
+			[this](size_t count) { m_BufferUpdateFn(this, 0, count - 1); },
+			[&](size_t count)
+			{
+				// TODO: Wrap this in THROW_INFO_ONLY macro
+				context->DrawIndexedInstanced(m_mesh.IndexCount, static_cast<UINT>(count), m_mesh.StartIndexLocation, m_mesh.BaseVertexLocation, 0u);
+			}
+		);
 	}
-
-	inline virtual void Update(const Timer&) noexcept override
+	inline virtual void Update(const Timer&) override
 	{
-		WINRT_ASSERT(m_worldMatrices.size() == m_renderObjects.size()); // Number of world matrices and render objects should match
-
-		// Re-compute all world matrices every frame because their positions will be changing
-		for (unsigned int iii = 0; iii < m_renderObjects.size(); ++iii)
-			m_worldMatrices[iii] = m_renderObjects[iii].WorldMatrix4X4();
+		// The owner reports its instance count every frame, so instances never hold pointers into storage that may be
+		// reallocated or compacted. The instance data is not kept here at all: m_InstanceWriteFn produces it straight into
+		// the mapped buffer when the frame is drawn.
+		m_instanceCount = m_InstanceCountFn();
+		if (m_uploads.BeginFrame(m_instanceCount))
+			CreateInstanceBuffer();
 	}
 
 	ND inline std::shared_ptr<DeviceResources> GetDeviceResources() const noexcept { return m_deviceResources; }
-	ND inline const std::vector<DirectX::XMFLOAT4X4>& GetWorldMatrices() const noexcept { return m_worldMatrices; }
-	ND inline const std::vector<unsigned int>& GetMaterialIndices() const noexcept { return m_materialIndices; }
 	ND inline winrt::com_ptr<ID3D11Buffer> GetInstanceBuffer() const noexcept { return m_instanceBuffer; }
-	ND inline size_t InstanceCount() const noexcept { return m_renderObjects.size(); }
+	ND inline size_t InstanceCount() const noexcept { return m_instanceCount; }
+	// Maps, draws and bytes uploaded by the last frame
+	ND inline const UploadStats& LastFrameUploads() const noexcept { return m_uploads.Frame(); }
 
 	std::function<void(const RenderObjectInstanced*, size_t, size_t)> m_BufferUpdateFn = [](const RenderObjectInstanced*, size_t, size_t) {};
+	std::function<size_t()> m_InstanceCountFn = []() { return size_t{ 0 }; };
+	// Writes instances [first, first + count) to destination
+	std::function<void(size_t, size_t, T*)> m_InstanceWriteFn = [](size_t, size_t, T*) {};
 
 private:
 	void CreateInstanceBuffer()
@@ -197,7 +190,7 @@ private:
 		bd.Usage = D3D11_USAGE_DYNAMIC;
 		bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
 		bd.MiscFlags = 0u;
-		bd.ByteWidth = static_cast<UINT>(MAX_INSTANCES * sizeof(T)); // Size of buffer in bytes
+		bd.ByteWidth = static_cast<UINT>(m_uploads.CapacityBytes()); // Size of buffer in bytes
 		bd.StructureByteStride = sizeof(T);
 
 		m_instanceBuffer = nullptr; // Release
@@ -206,10 +199,10 @@ private:
 		);
 	}
 
-	std::vector<RenderObject>		 m_renderObjects;
-	std::vector<DirectX::XMFLOAT4X4> m_worldMatrices;
-	std::vector<unsigned int>		 m_materialIndices;
+	size_t m_instanceCount = 0;
+
+	// Render is const but still counts its uploads
+	mutable InstanceUploadTracker m_uploads;
 
-	// Right now, each instance just requires an index into the materials array
 	winrt::com_ptr<ID3D11Buffer> m_instanceBuffer;
 };
@@ -9,7 +9,13 @@ Renderer::Renderer(std::shared_ptr<DeviceResources> deviceResources, Simulation*
     m_initialized(false),
     m_gameResourcesLoaded(false),
     m_viewport(CD3D11_VIEWPORT(0.0f, 0.0f, 100.0f, 100.0f)), // Assign dummy values for the viewport - this will be updated when the UI is created and triggers ViewportGrid_SizeChanged
-    m_camera(nullptr)
+    m_camera(nullptr),
+    m_atomRenderMode(AtomRenderMode::Geosphere),
+    m_geosphereConfig(0),
+    m_impostorConfig(0),
+    m_occlusionCulling(true),
+    m_geosphereAtoms{},
+    m_impostorAtoms(nullptr)
 {
     WINRT_ASSERT(simulation != nullptr);
 
@@ -22,6 +28,7 @@ Renderer::Renderer(std::shared_ptr<DeviceResources> deviceResources, Simulation*
     CreateMaterials();
 
     CreateMainPipelineConfig();
+    CreateImpostorPipelineConfig();
     CreateBoxPipelineConfig();
 }
 
@@ -69,7 +76,9 @@ void Renderer::CreateMainPipelineConfig()
     inputElements.push_back({ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0,                            0, D3D11_INPUT_PER_VERTEX_DATA, 0 });
     inputElements.push_back({ "NORMAL",   0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 });
     // Instance Data ---------------------------------------------
-    inputElements.push_back({ "MATERIAL_INDEX", 0, DXGI_FORMAT_R32_UINT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 });
+    // Sphere center and radius, then the material (see AtomInstance); the vertex shader builds the transform from them
+    inputElements.push_back({ "INSTANCE_POSITION_RADIUS", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1,                            0, D3D11_INPUT_PER_INSTANCE_DATA, 1 });
+    inputElements.push_back({ "MATERIAL_INDEX",           0, DXGI_FORMAT_R32_UINT,           1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 });
     std::unique_ptr<InputLayout> il = std::make_unique<InputLayout>(m_deviceResources, inputElements, vs.get());
 
     // Create Rasterizer State
@@ -128,12 +137,6 @@ void Renderer::CreateMainPipelineConfig()
     m_vsPerPassConstantsBuffers.push_back(vsPassConstantsBuffer); // The Scene must keep track of this buffer because it is responsible for updating it
     vsCBA->AddBuffer(vsPassConstantsBuffer);
 
-    // Buffer #2: WorldMatrixInstances - Will be updated by each RenderObjectList before each Draw call
-    std::shared_ptr<ConstantBuffer<WorldMatrixInstances>> vsWorldMatrixInstancesBuffer = 
-        std::make_shared<ConstantBuffer<WorldMatrixInstances>>(m_deviceResources, D3D11_USAGE_DYNAMIC, D3D11_CPU_ACCESS_WRITE, 0u, 0u);
-
-    vsCBA->AddBuffer(vsWorldMatrixInstancesBuffer);
-
     // PS Buffers --------------
     std::unique_ptr<ConstantBufferArray> psCBA = std::make_unique<ConstantBufferArray>(m_deviceResources);
 
@@ -177,72 +180,183 @@ void Renderer::CreateMainPipelineConfig()
             return output;
         }
     );
-    MeshInstance mi = ms->AddGeosphere(1.0f, 3);
+    // Every level of detail shares the mesh set's buffers
+    std::array<MeshInstance, LodSelector::LevelCount> lodMeshes;
+    for (unsigned int level = 0; level < LodSelector::LevelCount; ++level)
+        lodMeshes[level] = ms->AddGeosphere(1.0f, level);
     ms->Finalize();
 
     // RenderObjectLists ----------------------------------------------------------------------------
-    std::vector<DirectX::XMFLOAT3>& positions = m_simulation->Positions();
-    //std::vector<DirectX::XMFLOAT3>& velocities = m_simulation->Velocities(); Not needed right now
-    std::vector<Element>& elementTypes = m_simulation->ElementTypes();
 
-    // NOTE: Template parameter specifies the data type used by the instance buffer
-    std::unique_ptr<RenderObjectInstanced<unsigned int>> instancedObject = std::make_unique<RenderObjectInstanced<unsigned int>>(m_deviceResources, mi);
-
-    float r;
-    unsigned int elementType;
-    for (unsigned int iii = 0; iii < positions.size(); ++iii)
+    // One instanced object per level, each drawing the atoms Update bucketed into that level
+    std::vector<std::unique_ptr<RenderableBase>> objects;
+    for (unsigned int level = 0; level < LodSelector::LevelCount; ++level)
     {
-        elementType = static_cast<int>(elementTypes[iii]);
-        r = AtomicRadii[elementType];
-        instancedObject->AddInstance({ r, r, r }, &positions.data()[iii], elementType - 1); // must subtract one because Hydrogen is 1, but its material is at index 0, etc.
+        std::unique_ptr<RenderObjectInstanced<AtomInstance>> instancedObject = CreateAtomInstances(lodMeshes[level]);
+        instancedObject->m_InstanceCountFn = [this, level]() { return m_lods.Bucket(level).size(); };
+        instancedObject->m_InstanceWriteFn = [this, level](size_t first, size_t count, AtomInstance* destination)
+            {
+                m_simulation->GatherInstances(m_lods.Bucket(level).data() + first, count, destination);
+            };
+
+        m_geosphereAtoms[level] = instancedObject.get();
+        objects.push_back(std::move(instancedObject));
     }
 
-    instancedObject->m_BufferUpdateFn = [](const RenderObjectInstanced<unsigned int>* instancedObject, size_t startIndex, size_t endIndex)
+    std::vector<MeshSetAndObjectList> meshSetAndObjectLists;
+    meshSetAndObjectLists.push_back(std::make_tuple(std::move(ms), std::move(objects)));
+
+    m_geosphereConfig = m_configsAndObjectLists.size();
+    m_configsAndObjectLists.push_back(std::make_tuple(std::move(config), std::move(meshSetAndObjectLists)));
+}
+void Renderer::CreateImpostorPipelineConfig()
+{
+    // Shaders
+    std::unique_ptr<PixelShader> ps = std::make_unique<PixelShader>(m_deviceResources, L"PixelShaderImpostor.cso");
+    std::unique_ptr<VertexShader> vs = std::make_unique<VertexShader>(m_deviceResources, L"VertexShaderImpostor.cso");
+
+    // Input Layout - the same instance data as the geosphere pipeline; of the quad's vertices only the corner is used
+    std::vector<D3D11_INPUT_ELEMENT_DESC> inputElements;
+    inputElements.push_back({ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 });
+    // Instance Data ---------------------------------------------
+    inputElements.push_back({ "INSTANCE_POSITION_RADIUS", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1,                            0, D3D11_INPUT_PER_INSTANCE_DATA, 1 });
+    inputElements.push_back({ "MATERIAL_INDEX",           0, DXGI_FORMAT_R32_UINT,           1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 });
+    std::unique_ptr<InputLayout> il = std::make_unique<InputLayout>(m_deviceResources, inputElements, vs.get());
+
+    // Create Rasterizer State
+    D3D11_RASTERIZER_DESC rasterDesc;
+    rasterDesc.AntialiasedLineEnable = false;
+    rasterDesc.CullMode = D3D11_CULL_NONE; // The quads always face the eye, so there is nothing to cull
+    rasterDesc.DepthBias = 0;
+    rasterDesc.DepthBiasClamp = 0.0f;
+    rasterDesc.DepthClipEnable = true;
+    rasterDesc.FillMode = D3D11_FILL_SOLID;
+    rasterDesc.FrontCounterClockwise = false;
+    rasterDesc.MultisampleEnable = false;
+    rasterDesc.ScissorEnable = false;
+    rasterDesc.SlopeScaledDepthBias = 0.0f;
+    std::unique_ptr<RasterizerState> rs = std::make_unique<RasterizerState>(m_deviceResources, rasterDesc);
+
+    // Blend State
+    D3D11_BLEND_DESC blendDesc;
+    blendDesc.AlphaToCoverageEnable = false;
+    blendDesc.IndependentBlendEnable = false;
+    blendDesc.RenderTarget[0].BlendEnable = false;
+    blendDesc.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
+    blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
+    blendDesc.RenderTarget[0].DestBlend = D3D11_BLEND_ZERO;
+    blendDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_ZERO;
+    blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+    blendDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_ONE;
+    blendDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ONE;
+    std::unique_ptr<BlendState> bs = std::make_unique<BlendState>(m_deviceResources, blendDesc);
+
+    // Depth Stencil State
+    D3D11_DEPTH_STENCIL_DESC depthStencilDesc;
+    depthStencilDesc.DepthEnable = true;
+    depthStencilDesc.DepthFunc = D3D11_COMPARISON_LESS;
+    depthStencilDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
+    depthStencilDesc.StencilEnable = false;
+    depthStencilDesc.StencilReadMask = D3D11_DEFAULT_STENCIL_READ_MASK;
+    depthStencilDesc.StencilWriteMask = D3D11_DEFAULT_STENCIL_WRITE_MASK;
+    depthStencilDesc.FrontFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
+    depthStencilDesc.FrontFace.StencilDepthFailOp = D3D11_STENCIL_OP_KEEP;
+    depthStencilDesc.FrontFace.StencilFailOp = D3D11_STENCIL_OP_KEEP;
+    depthStencilDesc.FrontFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
+    depthStencilDesc.BackFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
+    depthStencilDesc.BackFace.StencilDepthFailOp = D3D11_STENCIL_OP_KEEP;
+    depthStencilDesc.BackFace.StencilFailOp = D3D11_STENCIL_OP_KEEP;
+    depthStencilDesc.BackFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
+    std::unique_ptr<DepthStencilState> dss = std::make_unique<DepthStencilState>(m_deviceResources, depthStencilDesc);
+
+    // Constant Buffers - shared with the geosphere pipeline, which creates them and whose buffers Update refreshes
+    WINRT_ASSERT(!m_vsPerPassConstantsBuffers.empty() && !m_psPerPassConstantsBuffers.empty() && m_materialsBuffer != nullptr);
+
+    std::unique_ptr<ConstantBufferArray> vsCBA = std::make_unique<ConstantBufferArray>(m_deviceResources);
+    vsCBA->AddBuffer(m_vsPerPassConstantsBuffers[0]);
+
+    std::unique_ptr<ConstantBufferArray> psCBA = std::make_unique<ConstantBufferArray>(m_deviceResources);
+    psCBA->AddBuffer(m_psPerPassConstantsBuffers[0]);
+    psCBA->AddBuffer(m_materialsBuffer);
+
+    // Pipeline Configuration 
+    std::unique_ptr<PipelineConfig> config = std::make_unique<PipelineConfig>(m_deviceResources,
+        std::move(vs),
+        std::move(ps),
+        std::move(il),
+        std::move(rs),
+        std::move(bs),
+        std::move(dss),
+        std::move(vsCBA),
+        std::move(psCBA)
+    );
+
+    // -------------------------------------------------
+    // Mesh Set - a single quad with corners at (+/-1, +/-1); the vertex shader expands it around each atom
+    std::unique_ptr<MeshSet<Vertex>> ms = std::make_unique<MeshSet<Vertex>>(m_deviceResources);
+    ms->SetVertexConversionFunction([](std::vector<GenericVertex> input) -> std::vector<Vertex>
         {
-            auto context = instancedObject->GetDeviceResources()->GetD3DDeviceContext();
+            std::vector<Vertex> output(input.size());
+            for (unsigned int iii = 0; iii < input.size(); ++iii)
+            {
+                output[iii].Pos = input[iii].Position;
+                output[iii].Normal = input[iii].Normal;
+            }
+            return output;
+        }
+    );
+    MeshInstance mi = ms->AddQuad(-1.0f, 1.0f, 2.0f, 2.0f, 0.0f);
+    ms->Finalize();
 
-            const std::vector<DirectX::XMFLOAT4X4>& worldMatrices = instancedObject->GetWorldMatrices();
-            const std::vector<unsigned int>& materialIndices = instancedObject->GetMaterialIndices();
+    // RenderObjectLists ----------------------------------------------------------------------------
+    std::unique_ptr<RenderObjectInstanced<AtomInstance>> instancedObject = CreateAtomInstances(mi);
+    m_impostorAtoms = instancedObject.get();
 
-            D3D11_MAPPED_SUBRESOURCE ms;
+    std::vector<std::unique_ptr<RenderableBase>> objects;
+    objects.push_back(std::move(instancedObject));
 
-            // Update the World buffers at VS slot 1 ------------------------------------------------------
-            ZeroMemory(&ms, sizeof(D3D11_MAPPED_SUBRESOURCE));
-            winrt::com_ptr<ID3D11Buffer> buffer = nullptr;
+    std::vector<MeshSetAndObjectList> meshSetAndObjectLists;
+    meshSetAndObjectLists.push_back(std::make_tuple(std::move(ms), std::move(objects)));
 
-            // TODO: Wrap this in a THROW_INFO_ONLY macro
-            context->VSGetConstantBuffers(1, 1, buffer.put());
-            winrt::check_hresult(
-                context->Map(buffer.get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &ms)
-            );
-            // Only copy the elements between the start and end indices
-            memcpy(ms.pData, &worldMatrices.data()[startIndex], sizeof(DirectX::XMFLOAT4X4) * (endIndex - startIndex + 1));
-            // TODO: Wrap this in a THROW_INFO_ONLY macro
-            context->Unmap(buffer.get(), 0);
+    m_impostorConfig = m_configsAndObjectLists.size();
+    m_configsAndObjectLists.push_back(std::make_tuple(std::move(config), std::move(meshSetAndObjectLists)));
+}
+std::unique_ptr<RenderObjectInstanced<AtomInstance>> Renderer::CreateAtomInstances(const MeshInstance& mesh)
+{
+    // NOTE: Template parameter specifies the data type used by the instance buffer
+    std::unique_ptr<RenderObjectInstanced<AtomInstance>> instancedObject = std::make_unique<RenderObjectInstanced<AtomInstance>>(m_deviceResources, mesh);
+
+    // One instance per visible atom, read straight from the simulation's SoA arrays every frame through the list Update
+    // built. Nothing holds on to an atom between frames, so atoms can be added, removed or reordered by the simulation
+    // at any time.
+    instancedObject->m_InstanceCountFn = [this]() { return VisibleAtoms().size(); };
 
-            // --------------------------------------------------------------------------------------------
-            // Update the instance buffer and then bind it to the IA
+    // Center, radius and material are gathered straight into the mapped buffer, split over the simulation's thread
+    // pool (the simulation is not stepping while the frame is rendered)
+    instancedObject->m_InstanceWriteFn = [this](size_t first, size_t count, AtomInstance* destination)
+        {
+            m_simulation->GatherInstances(VisibleAtoms().data() + first, count, destination);
+        };
 
+    instancedObject->m_BufferUpdateFn = [](const RenderObjectInstanced<AtomInstance>* instancedObject, size_t startIndex, size_t endIndex)
+        {
+            auto context = instancedObject->GetDeviceResources()->GetD3DDeviceContext();
+
+            // Update the instance buffer, which is already bound to the IA and holds every instance ------
             winrt::com_ptr<ID3D11Buffer> instanceBuffer = instancedObject->GetInstanceBuffer();
 
+            D3D11_MAPPED_SUBRESOURCE ms;
             ZeroMemory(&ms, sizeof(D3D11_MAPPED_SUBRESOURCE));
 
             winrt::check_hresult(
                 context->Map(instanceBuffer.get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &ms)
             );
-            // Only copy the elements between the start and end indices
-            memcpy(ms.pData, &materialIndices.data()[startIndex], sizeof(unsigned int) * (endIndex - startIndex + 1));
+            instancedObject->m_InstanceWriteFn(startIndex, endIndex - startIndex + 1, static_cast<AtomInstance*>(ms.pData));
             // TODO: Wrap this in a THROW_INFO_ONLY macro
             context->Unmap(instanceBuffer.get(), 0);
         };
 
-    std::vector<std::unique_ptr<RenderableBase>> objects;
-    objects.push_back(std::move(instancedObject));
-
-    std::vector<MeshSetAndObjectList> meshSetAndObjectLists;
-    meshSetAndObjectLists.push_back(std::make_tuple(std::move(ms), std::move(objects)));
-
-    m_configsAndObjectLists.push_back(std::make_tuple(std::move(config), std::move(meshSetAndObjectLists)));
+    return instancedObject;
 }
 void Renderer::CreateBoxPipelineConfig()
 {
@@ -483,10 +597,48 @@ void Renderer::Update(const Timer& timer)
     // TODO: Wrap next line in THROW_INFO_ONLY macro
     context->Unmap(m_psPerPassConstantsBuffers[0]->GetRawBufferPointer(), 0);
 
-    for (auto& configAndObjectList : m_configsAndObjectLists)
+    // Atoms inside the view frustum, then those of them not hidden behind others, then their levels of detail, before
+    // the atom objects read the lists
+    const ParticleArrays& particles = m_simulation->Particles();
+    XMFLOAT4X4 view4x4;
+    XMFLOAT4X4 proj4x4;
+    XMFLOAT4X4 viewProj4x4;
+    DirectX::XMStoreFloat4x4(&view4x4, view);
+    DirectX::XMStoreFloat4x4(&proj4x4, proj);
+    DirectX::XMStoreFloat4x4(&viewProj4x4, viewProj);
+    m_culler.Update(particles.x.data(), particles.y.data(), particles.z.data(), particles.radius.data(), particles.Size(),
+        FrustumCuller::ExtractPlanes(viewProj4x4), m_simulation->Kernels(), m_simulation->Pool());
+
+    if (m_occlusionCulling)
     {
+        // A quarter of the viewport in each direction, but never narrower than MinOcclusionWidth with the viewport's aspect
+        // ratio: in a coarser buffer the atoms of a protein filling the screen project below the occluder threshold
+        constexpr unsigned int MinOcclusionWidth = 256;
+        const float viewportWidth = std::max(m_viewport.Width, 1.0f);
+        const unsigned int occlusionWidth = std::max(static_cast<unsigned int>(viewportWidth) / 4, MinOcclusionWidth);
+        const unsigned int occlusionHeight = std::max(1u, static_cast<unsigned int>(occlusionWidth * m_viewport.Height / viewportWidth));
+        m_occlusion.SetResolution(occlusionWidth, occlusionHeight);
+
+        // The perspective projection maps z to (z - n) f / ((f - n) z), so n = -_43 / _33
+        m_occlusion.SetNearPlane(-proj4x4._43 / proj4x4._33);
+        m_occlusion.Update(particles.x.data(), particles.y.data(), particles.z.data(), particles.radius.data(), m_culler.Visible().data(),
+            m_culler.VisibleCount(), view4x4, proj4x4._11, proj4x4._22, m_simulation->Pool());
+    }
+
+    if (m_atomRenderMode == AtomRenderMode::Geosphere)
+    {
+        const AlignedVector<uint32_t>& visible = VisibleAtoms();
+        m_lods.Update(particles.x.data(), particles.y.data(), particles.z.data(), particles.radius.data(), visible.data(),
+            visible.size(), view4x4, proj4x4._22 * 0.5f * m_viewport.Height, m_simulation->Pool());
+    }
+
+    for (size_t config = 0; config < m_configsAndObjectLists.size(); ++config)
+    {
+        if (!IsConfigActive(config))
+            continue;
+
         // Iterate over vector of MeshSet & ObjectList tuple
-        for (auto& meshSetAndObjectList : std::get<1>(configAndObjectList))
+        for (auto& meshSetAndObjectList : std::get<1>(m_configsAndObjectLists[config]))
         {
             // List of RenderObjects
             std::vector<std::unique_ptr<RenderableBase>>& objectLists = std::get<1>(meshSetAndObjectList);
@@ -513,13 +665,16 @@ void Renderer::Render()
     // TODO: Wrap this in THROW_INFO_ONLY macro
     context->RSSetViewports(1, &m_viewport);
 
-    for (auto& configAndObjectList : m_configsAndObjectLists)
+    for (size_t config = 0; config < m_configsAndObjectLists.size(); ++config)
     {
+        if (!IsConfigActive(config))
+            continue;
+
         // Pipeline config
-        std::get<0>(configAndObjectList)->ApplyConfig();
+        std::get<0>(m_configsAndObjectLists[config])->ApplyConfig();
 
         // Iterate over vector of MeshSet & ObjectList tuple
-        for (auto& meshSetAndObjectList : std::get<1>(configAndObjectList))
+        for (auto& meshSetAndObjectList : std::get<1>(m_configsAndObjectLists[config]))
         {
             // MeshSet
             std::get<0>(meshSetAndObjectList)->BindToIA();
@@ -542,4 +697,34 @@ void Renderer::SetViewport(float top, float left, float height, float width) noe
     m_viewport.Height = height;
 
     m_camera->SetViewport(m_viewport);
+}
+
+UploadStats Renderer::AtomUploads() const noexcept
+{
+    if (m_atomRenderMode == AtomRenderMode::Impostor)
+    {
+        WINRT_ASSERT(m_impostorAtoms != nullptr);
+        return m_impostorAtoms->LastFrameUploads();
+    }
+
+    UploadStats uploads;
+    for (const RenderObjectInstanced<AtomInstance>* atoms : m_geosphereAtoms)
+    {
+        WINRT_ASSERT(atoms != nullptr);
+        const UploadStats& level = atoms->LastFrameUploads();
+        uploads.maps += level.maps;
+        uploads.draws += level.draws;
+        uploads.bufferCreations += level.bufferCreations;
+        uploads.bytes += level.bytes;
+    }
+    return uploads;
+}
+
+bool Renderer::IsConfigActive(size_t config) const noexcept
+{
+    if (config == m_geosphereConfig)
+        return m_atomRenderMode == AtomRenderMode::Geosphere;
+    if (config == m_impostorConfig)
+        return m_atomRenderMode == AtomRenderMode::Impostor;
+    return true;
 }
\ No newline at end of file
@@ -11,10 +11,19 @@
 #include "MeshSet.h"
 #include "RenderObjectList.h"
 #include "Camera.h"
+#include "FrustumCuller.h"
+#include "LodSelector.h"
+#include "OcclusionCuller.h"
 #include "Simulation.h"
 #include "Structs.h"
 #include "Timer.h"
 
+enum class AtomRenderMode
+{
+	Geosphere,		// a geosphere mesh per atom, its subdivision picked from its size on screen (see LodSelector)
+	Impostor		// a camera-facing quad per atom, ray-cast per pixel (see SphereImpostor)
+};
+
 class Renderer 
 {
 	// The idea here is as follows: We want to be able to render as much as possible using a single pipeline configuration.
@@ -38,16 +47,35 @@ public:
 
 	void SetViewport(float top, float left, float height, float width) noexcept;
 
-	void AddInstance(Element element, DirectX::XMFLOAT3* position)
-	{
-		float r = AtomicRadii[static_cast<int>(element)];
-		static_cast<RenderObjectInstanced<unsigned int>*>(std::get<1>(std::get<1>(m_configsAndObjectLists[0])[0])[0].get())->AddInstance({ r, r, r }, position, static_cast<int>(element) - 1);
-	}
+	// Maps, draws and bytes the atom instances cost in the last frame
+	ND UploadStats AtomUploads() const noexcept;
+
+	// Geosphere levels of detail of the last frame
+	inline void SetLodMaxError(float pixels) noexcept { m_lods.SetMaxError(pixels); }
+	ND inline const LodSelector& Lods() const noexcept { return m_lods; }
+
+	// Atoms inside and outside the view frustum in the last frame; only the visible ones are uploaded
+	ND inline const FrustumCuller& Culling() const noexcept { return m_culler; }
+
+	// Atoms inside the frustum hidden behind others in the last frame (see OcclusionCuller::OccludedFraction)
+	inline void SetOcclusionCulling(bool enabled) noexcept { m_occlusionCulling = enabled; }
+	ND inline bool OcclusionCulling() const noexcept { return m_occlusionCulling; }
+	ND inline const OcclusionCuller& Occlusion() const noexcept { return m_occlusion; }
 
+	inline void SetAtomRenderMode(AtomRenderMode mode) noexcept { m_atomRenderMode = mode; }
+	ND inline AtomRenderMode GetAtomRenderMode() const noexcept { return m_atomRenderMode; }
 
 private:
 	void CreateMainPipelineConfig();
+	void CreateImpostorPipelineConfig();
 	void CreateBoxPipelineConfig();
+	ND std::unique_ptr<RenderObjectInstanced<AtomInstance>> CreateAtomInstances(const MeshInstance& mesh);
+
+	// Only the pipeline config of the current atom render mode is updated and drawn
+	ND bool IsConfigActive(size_t config) const noexcept;
+
+	// Atoms to draw this frame: inside the frustum and, with occlusion culling, not hidden
+	ND inline const AlignedVector<uint32_t>& VisibleAtoms() const noexcept { return m_occlusionCulling ? m_occlusion.Visible() : m_culler.Visible(); }
 	void CreateMaterials();
 
 
@@ -62,6 +90,18 @@ private:
 	std::unique_ptr<Camera> m_camera;
 	Simulation* m_simulation;
 
+	AtomRenderMode m_atomRenderMode;
+	size_t m_geosphereConfig;
+	size_t m_impostorConfig;
+	FrustumCuller m_culler;
+	bool m_occlusionCulling;
+	OcclusionCuller m_occlusion;
+	LodSelector m_lods;
+
+	// Owned by m_configsAndObjectLists; one geosphere object per level of detail
+	std::array<RenderObjectInstanced<AtomInstance>*, LodSelector::LevelCount> m_geosphereAtoms;
+	RenderObjectInstanced<AtomInstance>* m_impostorAtoms;
+
 	// Pass Constants that will be updated/bound only once per pass
 	// NOTE: the ConstantBuffer is a shared_ptr so that it can be shared with EVERY PipelineConfig
 	PassConstants m_passConstants;
@@ -0,0 +1,1726 @@
+#include "pch.h"
+#include "SimdKernels.h"
+#include "AlignedAllocator.h"
+#include <random>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_KERNELS_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// MSVC lets any function use any intrinsic, GCC/Clang need the instruction set enabled per function
+#if defined(__GNUC__) || defined(__clang__)
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define SIMD_TARGET_AVX512 __attribute__((target("avx512f,avx2,fma")))
+#else
+#define SIMD_TARGET_AVX2
+#define SIMD_TARGET_AVX512
+#endif
+
+// ========================================================================================================================================
+// Scalar reference kernels
+
+namespace
+{
+	constexpr float TwoOverSqrtPi = 1.1283791671f;
+
+	// Coulomb policies. A policy is built once per kernel call from the arguments, then maps qq (already scaled by
+	// Coulomb's constant) at a distance r inside the cutoff to the pair energy, and sets forceTimesR to the force
+	// magnitude times r. Enabled == false drops the charges from the kernel altogether.
+	struct NoCoulomb
+	{
+		static constexpr bool Enabled = false;
+		explicit NoCoulomb(const NonbondedKernelArgs&) noexcept {}
+		inline float operator()(float, float, float, float& forceTimesR) const noexcept { forceTimesR = 0.0f; return 0.0f; }
+	};
+
+	struct CutoffCoulomb
+	{
+		static constexpr bool Enabled = true;
+		explicit CutoffCoulomb(const NonbondedKernelArgs&) noexcept {}
+		inline float operator()(float qq, float, float invR, float& forceTimesR) const noexcept
+		{
+			forceTimesR = qq * invR;
+			return forceTimesR;
+		}
+	};
+
+	struct ReactionFieldCoulomb
+	{
+		static constexpr bool Enabled = true;
+		float k;
+		float c;
+
+		explicit ReactionFieldCoulomb(const NonbondedKernelArgs& a) noexcept : k(a.reactionFieldK), c(a.reactionFieldC) {}
+		inline float operator()(float qq, float r2, float invR, float& forceTimesR) const noexcept
+		{
+			forceTimesR = qq * (invR - 2.0f * k * r2);
+			return qq * (invR + k * r2 - c);
+		}
+	};
+
+	struct ShiftedForceCoulomb
+	{
+		static constexpr bool Enabled = true;
+		float invCutoff;
+		float invCutoff2;
+
+		explicit ShiftedForceCoulomb(const NonbondedKernelArgs& a) noexcept : invCutoff(1.0f / std::sqrt(a.cutoff2)), invCutoff2(1.0f / a.cutoff2) {}
+		inline float operator()(float qq, float r2, float invR, float& forceTimesR) const noexcept
+		{
+			const float rOverCutoff2 = r2 * invR * invCutoff2;
+			forceTimesR = qq * (invR - rOverCutoff2);
+			return qq * (invR - 2.0f * invCutoff + rOverCutoff2);
+		}
+	};
+
+	struct EwaldCoulomb
+	{
+		static constexpr bool Enabled = true;
+		float beta;
+
+		explicit EwaldCoulomb(const NonbondedKernelArgs& a) noexcept : beta(a.ewaldCoefficient) {}
+		inline float operator()(float qq, float r2, float invR, float& forceTimesR) const noexcept
+		{
+			const float betaR = beta * r2 * invR;
+			const float coulomb = qq * std::erfc(betaR) * invR;
+			forceTimesR = coulomb + qq * TwoOverSqrtPi * beta * std::exp(-betaR * betaR);
+			return coulomb;
+		}
+	};
+
+	// Interaction of atom i (whose per-row values are passed in) with atom j. The force on j is applied immediately, the
+	// force on i is accumulated into fxi/fyi/fzi so the caller can write it back once per row.
+	template<bool Periodic, typename Coulomb>
+	inline float PairInteraction(const NonbondedKernelArgs& a, const Coulomb& coulomb, unsigned int typeRow, float qi, float xi, float yi, float zi,
+								 unsigned int j, float& fxi, float& fyi, float& fzi) noexcept
+	{
+		float dx = xi - a.x[j];
+		float dy = yi - a.y[j];
+		float dz = zi - a.z[j];
+		if constexpr (Periodic)
+			a.image.Apply(dx, dy, dz);
+		float r2 = dx * dx + dy * dy + dz * dz;
+
+		// The list holds pairs out to cutoff + skin, so the cutoff test is still needed. Coincident atoms have no
+		// defined force direction (e.g. two atoms added at the same spot), so skip them
+		if (r2 >= a.cutoff2 || r2 < 1e-12f)
+			return 0.0f;
+
+		unsigned int pairIndex = typeRow + static_cast<unsigned int>(a.type[j]);
+
+		// Closer than the soft core the force magnitude / r stays at its value there, so the force fades linearly to zero
+		// at r = 0 rather than diverging. The energy follows as its integral, U(rs) + 1/2 (F(rs) / rs) (rs^2 - r^2).
+		const float coreR2 = std::max(r2, a.softCoreR2[pairIndex]);
+
+		float invR2 = 1.0f / coreR2;
+		float invR6 = invR2 * invR2 * invR2;
+		float lj12 = a.c12[pairIndex] * invR6 * invR6;
+		float lj6 = a.c6[pairIndex] * invR6;
+		float coulombEnergy = 0.0f;
+		float coulombForce = 0.0f;
+		if constexpr (Coulomb::Enabled)
+			coulombEnergy = coulomb(qi * a.charge[j], coreR2, std::sqrt(invR2), coulombForce);
+
+		// Force magnitude divided by r, so multiplying by the displacement gives the force vector
+		float fScalar = (12.0f * lj12 - 6.0f * lj6 + coulombForce) * invR2;
+
+		fxi += fScalar * dx;
+		fyi += fScalar * dy;
+		fzi += fScalar * dz;
+		a.fx[j] -= fScalar * dx;
+		a.fy[j] -= fScalar * dy;
+		a.fz[j] -= fScalar * dz;
+
+		return lj12 - lj6 - a.ljShift[pairIndex] + coulombEnergy + 0.5f * fScalar * (coreR2 - r2);
+	}
+
+	void KickScalar(float* v, const float* f, const float* inverseMass, size_t count, float dt) noexcept
+	{
+		for (size_t iii = 0; iii < count; ++iii)
+			v[iii] += f[iii] * (inverseMass[iii] * dt);
+	}
+
+	void DriftScalar(float* x, const float* v, size_t count, float dt) noexcept
+	{
+		for (size_t iii = 0; iii < count; ++iii)
+			x[iii] += v[iii] * dt;
+	}
+
+	void ScaleScalar(float* v, size_t count, float scale) noexcept
+	{
+		for (size_t iii = 0; iii < count; ++iii)
+			v[iii] *= scale;
+	}
+
+	float LangevinDriftScalar(float* x, float* v, const float* gaussian, const float* inverseMass, const float* mass, size_t count,
+							  float halfDt, float friction, float noise) noexcept
+	{
+		float heat = 0.0f;
+		for (size_t iii = 0; iii < count; ++iii)
+		{
+			const float before = v[iii];
+			const float after = friction * before + noise * std::sqrt(inverseMass[iii]) * gaussian[iii];
+			x[iii] += (before + after) * halfDt;
+			v[iii] = after;
+			heat += mass[iii] * (after * after - before * before);
+		}
+		return heat;
+	}
+
+	float KineticSumScalar(const float* vx, const float* vy, const float* vz, const float* mass, size_t count) noexcept
+	{
+		float sum = 0.0f;
+		for (size_t iii = 0; iii < count; ++iii)
+			sum += mass[iii] * (vx[iii] * vx[iii] + vy[iii] * vy[iii] + vz[iii] * vz[iii]);
+		return sum;
+	}
+
+	void ReflectScalar(const float* x, float* v, const float* radius, size_t count, float wallMin, float wallMax) noexcept
+	{
+		for (size_t iii = 0; iii < count; ++iii)
+			v[iii] = (x[iii] + radius[iii] > wallMax || x[iii] - radius[iii] < wallMin) ? -v[iii] : v[iii];
+	}
+
+	void WrapScalar(float* x, size_t count, float boxMin, float boxMax) noexcept
+	{
+		const float length = boxMax - boxMin;
+		const float inverseLength = 1.0f / length;
+		for (size_t iii = 0; iii < count; ++iii)
+			x[iii] -= length * std::floor((x[iii] - boxMin) * inverseLength);
+	}
+
+	void GaussianScalar(Philox::Key key, uint64_t step, uint32_t stream, uint32_t first, size_t count, float* x, float* y, float* z) noexcept
+	{
+		for (size_t iii = 0; iii < count; ++iii)
+		{
+			float normal[4];
+			Philox::Normal(Philox::Generate(Philox::AtomCounter(first + static_cast<uint32_t>(iii), step, stream), key), normal);
+			x[iii] = normal[0];
+			y[iii] = normal[1];
+			z[iii] = normal[2];
+		}
+	}
+
+	void PackInstancesScalar(const float* x, const float* y, const float* z, const float* radius, const Element* type, size_t count, AtomInstance* instances) noexcept
+	{
+		for (size_t iii = 0; iii < count; ++iii)
+			instances[iii] = { x[iii], y[iii], z[iii], radius[iii], static_cast<uint32_t>(type[iii]) - 1u };
+	}
+
+	size_t CullSpheresScalar(const float* x, const float* y, const float* z, const float* radius, size_t count, uint32_t firstIndex, const FrustumPlanes& planes, uint32_t* visible) noexcept
+	{
+		// Every index is stored and only kept by advancing past it, which leaves no branch to mispredict
+		size_t visibleCount = 0;
+		for (size_t iii = 0; iii < count; ++iii)
+		{
+			bool inside = true;
+			for (int p = 0; p < 6; ++p)
+				inside &= planes.a[p] * x[iii] + planes.b[p] * y[iii] + planes.c[p] * z[iii] + planes.d[p] >= -radius[iii];
+			visible[visibleCount] = firstIndex + static_cast<uint32_t>(iii);
+			visibleCount += inside ? 1 : 0;
+		}
+		return visibleCount;
+	}
+
+	// For every 8-bit lane mask, the lanes that are set moved to the front, and how many there are. Used to compact the
+	// indices of visible spheres with a single permute.
+	struct CompactTable
+	{
+		alignas(32) uint32_t permutation[256][8];
+		uint8_t count[256];
+	};
+	constexpr CompactTable MakeCompactTable() noexcept
+	{
+		CompactTable table = {};
+		for (unsigned int mask = 0; mask < 256; ++mask)
+		{
+			uint8_t count = 0;
+			for (uint32_t lane = 0; lane < 8; ++lane)
+			{
+				if (mask & (1u << lane))
+					table.permutation[mask][count++] = lane;
+			}
+			table.count[mask] = count;
+		}
+		return table;
+	}
+	constexpr CompactTable CompactLanes = MakeCompactTable();
+
+	template<bool Periodic, typename Coulomb>
+	float NonbondedScalarImpl(const NonbondedKernelArgs& a, unsigned int rowBegin, unsigned int rowEnd) noexcept
+	{
+		const Coulomb coulomb(a);
+
+		float energy = 0.0f;
+		for (unsigned int i = rowBegin; i < rowEnd; ++i)
+		{
+			const unsigned int typeRow = static_cast<unsigned int>(a.type[i]) * ElementCount;
+			const float qi = a.coulombConstant * a.charge[i];
+
+			float fxi = 0.0f;
+			float fyi = 0.0f;
+			float fzi = 0.0f;
+
+			for (unsigned int n = a.offsets[i]; n < a.offsets[i + 1]; ++n)
+				energy += PairInteraction<Periodic>(a, coulomb, typeRow, qi, a.x[i], a.y[i], a.z[i], a.neighbors[n], fxi, fyi, fzi);
+
+			a.fx[i] += fxi;
+			a.fy[i] += fyi;
+			a.fz[i] += fzi;
+		}
+		return energy;
+	}
+
+	// The Coulomb form is picked once per call; every combination is its own instantiation
+	template<bool Periodic>
+	float NonbondedScalarCoulomb(const NonbondedKernelArgs& a, unsigned int rowBegin, unsigned int rowEnd) noexcept
+	{
+		switch (a.coulomb)
+		{
+		case CoulombKernel::None:			return NonbondedScalarImpl<Periodic, NoCoulomb>(a, rowBegin, rowEnd);
+		case CoulombKernel::ReactionField:	return NonbondedScalarImpl<Periodic, ReactionFieldCoulomb>(a, rowBegin, rowEnd);
+		case CoulombKernel::ShiftedForce:	return NonbondedScalarImpl<Periodic, ShiftedForceCoulomb>(a, rowBegin, rowEnd);
+		case CoulombKernel::Ewald:			return NonbondedScalarImpl<Periodic, EwaldCoulomb>(a, rowBegin, rowEnd);
+		default:							return NonbondedScalarImpl<Periodic, CutoffCoulomb>(a, rowBegin, rowEnd);
+		}
+	}
+
+	float NonbondedScalar(const NonbondedKernelArgs& a, unsigned int rowBegin, unsigned int rowEnd) noexcept
+	{
+		return a.image.IsPeriodic() ? NonbondedScalarCoulomb<true>(a, rowBegin, rowEnd) : NonbondedScalarCoulomb<false>(a, rowBegin, rowEnd);
+	}
+
+	constexpr SimdKernelTable ScalarTable = { SimdLevel::Scalar, KickScalar, DriftScalar, ScaleScalar, LangevinDriftScalar, KineticSumScalar, ReflectScalar, WrapScalar, NonbondedScalar, GaussianScalar, PackInstancesScalar, CullSpheresScalar };
+}
+
+// ========================================================================================================================================
+// AVX2 kernels (8 lanes)
+
+#ifdef SIMD_KERNELS_X86
+namespace
+{
+	SIMD_TARGET_AVX2 inline float HorizontalSum(__m256 v) noexcept
+	{
+		__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		sum = _mm_hadd_ps(sum, sum);
+		sum = _mm_hadd_ps(sum, sum);
+		return _mm_cvtss_f32(sum);
+	}
+
+	SIMD_TARGET_AVX2 void KickAVX2(float* v, const float* f, const float* inverseMass, size_t count, float dt) noexcept
+	{
+		const __m256 dtv = _mm256_set1_ps(dt);
+		size_t iii = 0;
+		for (; iii + 8 <= count; iii += 8)
+		{
+			__m256 scale = _mm256_mul_ps(_mm256_loadu_ps(inverseMass + iii), dtv);
+			_mm256_storeu_ps(v + iii, _mm256_fmadd_ps(_mm256_loadu_ps(f + iii), scale, _mm256_loadu_ps(v + iii)));
+		}
+		KickScalar(v + iii, f + iii, inverseMass + iii, count - iii, dt);
+	}
+
+	SIMD_TARGET_AVX2 void DriftAVX2(float* x, const float* v, size_t count, float dt) noexcept
+	{
+		const __m256 dtv = _mm256_set1_ps(dt);
+		size_t iii = 0;
+		for (; iii + 8 <= count; iii += 8)
+			_mm256_storeu_ps(x + iii, _mm256_fmadd_ps(_mm256_loadu_ps(v + iii), dtv, _mm256_loadu_ps(x + iii)));
+
+		DriftScalar(x + iii, v + iii, count - iii, dt);
+	}
+
+	SIMD_TARGET_AVX2 void ScaleAVX2(float* v, size_t count, float scale) noexcept
+	{
+		const __m256 scalev = _mm256_set1_ps(scale);
+		size_t iii = 0;
+		for (; iii + 8 <= count; iii += 8)
+			_mm256_storeu_ps(v + iii, _mm256_mul_ps(_mm256_loadu_ps(v + iii), scalev));
+
+		ScaleScalar(v + iii, count - iii, scale);
+	}
+
+	SIMD_TARGET_AVX2 float LangevinDriftAVX2(float* x, float* v, const float* gaussian, const float* inverseMass, const float* mass, size_t count,
+											 float halfDt, float friction, float noise) noexcept
+	{
+		const __m256 halfDtv = _mm256_set1_ps(halfDt);
+		const __m256 frictionv = _mm256_set1_ps(friction);
+		const __m256 noisev = _mm256_set1_ps(noise);
+		__m256 heat = _mm256_setzero_ps();
+		size_t iii = 0;
+		for (; iii + 8 <= count; iii += 8)
+		{
+			const __m256 before = _mm256_loadu_ps(v + iii);
+			const __m256 kick = _mm256_mul_ps(_mm256_mul_ps(noisev, _mm256_sqrt_ps(_mm256_loadu_ps(inverseMass + iii))), _mm256_loadu_ps(gaussian + iii));
+			const __m256 after = _mm256_fmadd_ps(frictionv, before, kick);
+			_mm256_storeu_ps(x + iii, _mm256_fmadd_ps(_mm256_add_ps(before, after), halfDtv, _mm256_loadu_ps(x + iii)));
+			_mm256_storeu_ps(v + iii, after);
+			heat = _mm256_fmadd_ps(_mm256_loadu_ps(mass + iii), _mm256_fmsub_ps(after, after, _mm256_mul_ps(before, before)), heat);
+		}
+		return HorizontalSum(heat) + LangevinDriftScalar(x + iii, v + iii, gaussian + iii, inverseMass + iii, mass + iii, count - iii, halfDt, friction, noise);
+	}
+
+	SIMD_TARGET_AVX2 float KineticSumAVX2(const float* vx, const float* vy, const float* vz, const float* mass, size_t count) noexcept
+	{
+		__m256 sum = _mm256_setzero_ps();
+		size_t iii = 0;
+		for (; iii + 8 <= count; iii += 8)
+		{
+			const __m256 vxv = _mm256_loadu_ps(vx + iii);
+			const __m256 vyv = _mm256_loadu_ps(vy + iii);
+			const __m256 vzv = _mm256_loadu_ps(vz + iii);
+			const __m256 v2 = _mm256_fmadd_ps(vzv, vzv, _mm256_fmadd_ps(vyv, vyv, _mm256_mul_ps(vxv, vxv)));
+			sum = _mm256_fmadd_ps(_mm256_loadu_ps(mass + iii), v2, sum);
+		}
+		return HorizontalSum(sum) + KineticSumScalar(vx + iii, vy + iii, vz + iii, mass + iii, count - iii);
+	}
+
+	SIMD_TARGET_AVX2 void ReflectAVX2(const float* x, float* v, const float* radius, size_t count, float wallMin, float wallMax) noexcept
+	{
+		const __m256 minv = _mm256_set1_ps(wallMin);
+		const __m256 maxv = _mm256_set1_ps(wallMax);
+		const __m256 signBit = _mm256_set1_ps(-0.0f);
+		size_t iii = 0;
+		for (; iii + 8 <= count; iii += 8)
+		{
+			__m256 xv = _mm256_loadu_ps(x + iii);
+			__m256 r = _mm256_loadu_ps(radius + iii);
+			__m256 hit = _mm256_or_ps(
+				_mm256_cmp_ps(_mm256_add_ps(xv, r), maxv, _CMP_GT_OQ),
+				_mm256_cmp_ps(_mm256_sub_ps(xv, r), minv, _CMP_LT_OQ));
+
+			// Flip the sign bit only in the lanes that hit a wall
+			_mm256_storeu_ps(v + iii, _mm256_xor_ps(_mm256_loadu_ps(v + iii), _mm256_and_ps(hit, signBit)));
+		}
+		ReflectScalar(x + iii, v + iii, radius + iii, count - iii, wallMin, wallMax);
+	}
+
+	SIMD_TARGET_AVX2 void WrapAVX2(float* x, size_t count, float boxMin, float boxMax) noexcept
+	{
+		const __m256 minv = _mm256_set1_ps(boxMin);
+		const __m256 length = _mm256_set1_ps(boxMax - boxMin);
+		const __m256 inverseLength = _mm256_set1_ps(1.0f / (boxMax - boxMin));
+		size_t iii = 0;
+		for (; iii + 8 <= count; iii += 8)
+		{
+			__m256 xv = _mm256_loadu_ps(x + iii);
+			__m256 images = _mm256_floor_ps(_mm256_mul_ps(_mm256_sub_ps(xv, minv), inverseLength));
+			_mm256_storeu_ps(x + iii, _mm256_fnmadd_ps(length, images, xv));
+		}
+		WrapScalar(x + iii, count - iii, boxMin, boxMax);
+	}
+
+	// dx -= L * round(dx / L) on every lane
+	SIMD_TARGET_AVX2 inline __m256 MinimumImageAVX2(__m256 d, __m256 length, __m256 inverseLength) noexcept
+	{
+		return _mm256_fnmadd_ps(length, _mm256_round_ps(_mm256_mul_ps(d, inverseLength), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), d);
+	}
+
+	// Cephes expf: x = n ln2 + r with |r| <= ln2 / 2, e^r from a degree 6 polynomial and 2^n built in the exponent bits.
+	// Arguments are clamped to [-87, 88] so 2^n stays a normal float.
+	SIMD_TARGET_AVX2 inline __m256 ExpAVX2(__m256 x) noexcept
+	{
+		x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.0f)), _mm256_set1_ps(88.0f));
+		__m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		__m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+		r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+
+		__m256 p = _mm256_set1_ps(1.9875691500e-4f);
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+		p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+		__m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+		return _mm256_mul_ps(p, _mm256_castsi256_ps(exponent));
+	}
+
+	// Abramowitz & Stegun 7.1.26, absolute error below 1.5e-7, for x >= 0. Takes exp(-x^2), which the caller also
+	// needs for the force.
+	SIMD_TARGET_AVX2 inline __m256 ErfcAVX2(__m256 x, __m256 expMinusX2) noexcept
+	{
+		__m256 t = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_fmadd_ps(_mm256_set1_ps(0.3275911f), x, _mm256_set1_ps(1.0f)));
+		__m256 p = _mm256_set1_ps(1.061405429f);
+		p = _mm256_fmadd_ps(p, t, _mm256_set1_ps(-1.453152027f));
+		p = _mm256_fmadd_ps(p, t, _mm256_set1_ps(1.421413741f));
+		p = _mm256_fmadd_ps(p, t, _mm256_set1_ps(-0.284496736f));
+		p = _mm256_fmadd_ps(p, t, _mm256_set1_ps(0.254829592f));
+		return _mm256_mul_ps(_mm256_mul_ps(p, t), expMinusX2);
+	}
+
+	// Cephes logf for positive normal x: x = m 2^e with m in [sqrt(1/2), sqrt(2)), log(1 + (m - 1)) from a degree 9
+	// polynomial and e ln2 added back in two parts
+	SIMD_TARGET_AVX2 inline __m256 LogAVX2(__m256 x) noexcept
+	{
+		const __m256i bits = _mm256_castps_si256(x);
+		__m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+		__m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F000000)));
+
+		// m is in [0.5, 1): move the lower part up an octave
+		const __m256 low = _mm256_cmp_ps(m, _mm256_set1_ps(0.707106781f), _CMP_LT_OQ);
+		e = _mm256_sub_ps(e, _mm256_and_ps(low, _mm256_set1_ps(1.0f)));
+		m = _mm256_sub_ps(_mm256_add_ps(m, _mm256_and_ps(low, m)), _mm256_set1_ps(1.0f));
+
+		const __m256 m2 = _mm256_mul_ps(m, m);
+		__m256 p = _mm256_set1_ps(7.0376836292e-2f);
+		p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(-1.1514610310e-1f));
+		p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(1.1676998740e-1f));
+		p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(-1.2420140846e-1f));
+		p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(1.4249322787e-1f));
+		p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(-1.6668057665e-1f));
+		p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(2.0000714765e-1f));
+		p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(-2.4999993993e-1f));
+		p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(3.3333331174e-1f));
+		p = _mm256_mul_ps(_mm256_mul_ps(p, m), m2);
+		p = _mm256_fmadd_ps(e, _mm256_set1_ps(-2.12194440e-4f), p);
+		p = _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), m2, p);
+		return _mm256_fmadd_ps(e, _mm256_set1_ps(0.693359375f), _mm256_add_ps(m, p));
+	}
+
+	// sin and cos of 2 pi u for u in [0, 1). The reduction is exact: 4u = q + f with |f| <= 1/2, so the Cephes
+	// polynomials only see r = f pi/2 in [-pi/4, pi/4], and q quarter turns are applied by swapping and negating.
+	SIMD_TARGET_AVX2 inline void SinCosTurnsAVX2(__m256 u, __m256& sine, __m256& cosine) noexcept
+	{
+		const __m256 quarters = _mm256_mul_ps(u, _mm256_set1_ps(4.0f));
+		const __m256 q = _mm256_round_ps(quarters, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		const __m256 r = _mm256_mul_ps(_mm256_sub_ps(quarters, q), _mm256_set1_ps(1.57079632679f));
+		const __m256 r2 = _mm256_mul_ps(r, r);
+
+		__m256 s = _mm256_set1_ps(-1.9515295891e-4f);
+		s = _mm256_fmadd_ps(s, r2, _mm256_set1_ps(8.3321608736e-3f));
+		s = _mm256_fmadd_ps(s, r2, _mm256_set1_ps(-1.6666654611e-1f));
+		s = _mm256_fmadd_ps(_mm256_mul_ps(s, r2), r, r);
+
+		__m256 c = _mm256_set1_ps(2.443315711809948e-5f);
+		c = _mm256_fmadd_ps(c, r2, _mm256_set1_ps(-1.388731625493765e-3f));
+		c = _mm256_fmadd_ps(c, r2, _mm256_set1_ps(4.166664568298827e-2f));
+		c = _mm256_fmadd_ps(_mm256_mul_ps(c, r2), r2, _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), r2, _mm256_set1_ps(1.0f)));
+
+		// Odd quadrants swap sin and cos; sin is negated in quadrants 2 and 3, cos in quadrants 1 and 2
+		const __m256i quadrant = _mm256_and_si256(_mm256_cvtps_epi32(q), _mm256_set1_epi32(3));
+		const __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(quadrant, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+		const __m256 sineSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(quadrant, _mm256_set1_epi32(2)), 30));
+		const __m256 cosineSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(quadrant, _mm256_set1_epi32(1)), _mm256_set1_epi32(2)), 30));
+		sine = _mm256_xor_ps(_mm256_blendv_ps(s, c, swap), sineSign);
+		cosine = _mm256_xor_ps(_mm256_blendv_ps(c, s, swap), cosineSign);
+	}
+
+	// 32 x 32 -> 64 bit products of every lane. mul_epu32 only multiplies the even lanes, so the odd ones are shifted
+	// down for a second multiply and the halves are blended back together.
+	SIMD_TARGET_AVX2 inline void MulHiLoAVX2(__m256i a, __m256i multiplier, __m256i& hi, __m256i& lo) noexcept
+	{
+		const __m256i even = _mm256_mul_epu32(a, multiplier);
+		const __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), multiplier);
+		hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+		lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+	}
+
+	// Eight Philox blocks at once, one per lane, with the counter words in c[0..3]
+	SIMD_TARGET_AVX2 inline void PhiloxAVX2(__m256i c[4], Philox::Key key) noexcept
+	{
+		const __m256i multiplier0 = _mm256_set1_epi32(static_cast<int>(Philox::Multiplier0));
+		const __m256i multiplier1 = _mm256_set1_epi32(static_cast<int>(Philox::Multiplier1));
+		for (unsigned int round = 0; round < Philox::Rounds; ++round)
+		{
+			__m256i hi0, lo0, hi1, lo1;
+			MulHiLoAVX2(c[0], multiplier0, hi0, lo0);
+			MulHiLoAVX2(c[2], multiplier1, hi1, lo1);
+			c[0] = _mm256_xor_si256(_mm256_xor_si256(hi1, c[1]), _mm256_set1_epi32(static_cast<int>(key[0])));
+			c[1] = lo1;
+			c[2] = _mm256_xor_si256(_mm256_xor_si256(hi0, c[3]), _mm256_set1_epi32(static_cast<int>(key[1])));
+			c[3] = lo0;
+			key[0] += Philox::Weyl0;
+			key[1] += Philox::Weyl1;
+		}
+	}
+
+	// Philox::Uniform and Philox::UniformOpenZero
+	SIMD_TARGET_AVX2 inline __m256 UniformAVX2(__m256i word, int offset) noexcept
+	{
+		__m256i top = _mm256_add_epi32(_mm256_srli_epi32(word, 8), _mm256_set1_epi32(offset));
+		return _mm256_mul_ps(_mm256_cvtepi32_ps(top), _mm256_set1_ps(1.0f / 16777216.0f));
+	}
+
+	SIMD_TARGET_AVX2 void GaussianAVX2(Philox::Key key, uint64_t step, uint32_t stream, uint32_t first, size_t count, float* x, float* y, float* z) noexcept
+	{
+		const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		const Philox::Counter counter = Philox::AtomCounter(first, step, stream);
+		size_t iii = 0;
+		for (; iii + 8 <= count; iii += 8)
+		{
+			__m256i c[4] = {
+				_mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(counter[0] + static_cast<uint32_t>(iii))), lanes),
+				_mm256_set1_epi32(static_cast<int>(counter[1])),
+				_mm256_set1_epi32(static_cast<int>(counter[2])),
+				_mm256_set1_epi32(static_cast<int>(counter[3]))
+			};
+			PhiloxAVX2(c, key);
+
+			// Box-Muller on words (0, 1) and (2, 3); the fourth deviate is not needed
+			const __m256 minusTwo = _mm256_set1_ps(-2.0f);
+			const __m256 radius0 = _mm256_sqrt_ps(_mm256_mul_ps(minusTwo, LogAVX2(UniformAVX2(c[0], 1))));
+			const __m256 radius1 = _mm256_sqrt_ps(_mm256_mul_ps(minusTwo, LogAVX2(UniformAVX2(c[2], 1))));
+			__m256 sine0, cosine0, sine1, cosine1;
+			SinCosTurnsAVX2(UniformAVX2(c[1], 0), sine0, cosine0);
+			SinCosTurnsAVX2(UniformAVX2(c[3], 0), sine1, cosine1);
+
+			_mm256_storeu_ps(x + iii, _mm256_mul_ps(radius0, cosine0));
+			_mm256_storeu_ps(y + iii, _mm256_mul_ps(radius0, sine0));
+			_mm256_storeu_ps(z + iii, _mm256_mul_ps(radius1, cosine1));
+		}
+		GaussianScalar(key, step, stream, first + static_cast<uint32_t>(iii), count - iii, x + iii, y + iii, z + iii);
+	}
+
+	SIMD_TARGET_AVX2 void PackInstancesAVX2(const float* x, const float* y, const float* z, const float* radius, const Element* type, size_t count, AtomInstance* instances) noexcept
+	{
+		// Transpose to (x y z r) quads, each of which is then one 16-byte store: quads[k] holds instance k in its low and
+		// instance k + 4 in its high half
+		size_t iii = 0;
+		for (; iii + 8 <= count; iii += 8)
+		{
+			const __m256 xv = _mm256_loadu_ps(x + iii);
+			const __m256 yv = _mm256_loadu_ps(y + iii);
+			const __m256 zv = _mm256_loadu_ps(z + iii);
+			const __m256 rv = _mm256_loadu_ps(radius + iii);
+			const __m256 xy0 = _mm256_unpacklo_ps(xv, yv);
+			const __m256 xy1 = _mm256_unpackhi_ps(xv, yv);
+			const __m256 zr0 = _mm256_unpacklo_ps(zv, rv);
+			const __m256 zr1 = _mm256_unpackhi_ps(zv, rv);
+			const __m256 quads[4] = {
+				_mm256_shuffle_ps(xy0, zr0, 0x44), _mm256_shuffle_ps(xy0, zr0, 0xEE),
+				_mm256_shuffle_ps(xy1, zr1, 0x44), _mm256_shuffle_ps(xy1, zr1, 0xEE)
+			};
+
+			AtomInstance* out = instances + iii;
+			for (int k = 0; k < 4; ++k)
+			{
+				_mm_storeu_ps(&out[k].x, _mm256_castps256_ps128(quads[k]));
+				_mm_storeu_ps(&out[k + 4].x, _mm256_extractf128_ps(quads[k], 1));
+			}
+			for (int k = 0; k < 8; ++k)
+				out[k].material = static_cast<uint32_t>(type[iii + k]) - 1u;
+		}
+		PackInstancesScalar(x + iii, y + iii, z + iii, radius + iii, type + iii, count - iii, instances + iii);
+	}
+
+	SIMD_TARGET_AVX2 size_t CullSpheresAVX2(const float* x, const float* y, const float* z, const float* radius, size_t count, uint32_t firstIndex, const FrustumPlanes& planes, uint32_t* visible) noexcept
+	{
+		const __m256 signBit = _mm256_set1_ps(-0.0f);
+		const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+		size_t visibleCount = 0;
+		size_t iii = 0;
+		for (; iii + 8 <= count; iii += 8)
+		{
+			const __m256 xv = _mm256_loadu_ps(x + iii);
+			const __m256 yv = _mm256_loadu_ps(y + iii);
+			const __m256 zv = _mm256_loadu_ps(z + iii);
+			const __m256 negativeRadius = _mm256_xor_ps(_mm256_loadu_ps(radius + iii), signBit);
+
+			// Same operation order as the scalar kernel (no FMA), so both agree on spheres touching a plane
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int p = 0; p < 6; ++p)
+			{
+				__m256 distance = _mm256_mul_ps(_mm256_set1_ps(planes.a[p]), xv);
+				distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(planes.b[p]), yv));
+				distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(planes.c[p]), zv));
+				distance = _mm256_add_ps(distance, _mm256_set1_ps(planes.d[p]));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+			}
+
+			// All eight lanes are stored; the ones past the visible lanes are overwritten by the next block. The store ends
+			// at visibleCount + 8 <= iii + 8, so it never leaves the room for count indices.
+			const int mask = _mm256_movemask_ps(inside);
+			const __m256i indices = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(firstIndex + iii)), lanes);
+			const __m256i permutation = _mm256_load_si256(reinterpret_cast<const __m256i*>(CompactLanes.permutation[mask]));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(visible + visibleCount), _mm256_permutevar8x32_epi32(indices, permutation));
+			visibleCount += CompactLanes.count[mask];
+		}
+		return visibleCount + CullSpheresScalar(x + iii, y + iii, z + iii, radius + iii, count - iii, firstIndex + static_cast<uint32_t>(iii), planes, visible + visibleCount);
+	}
+
+	// Eight-lane versions of the Coulomb policies; Scalar names the policy the remainder loop uses
+	struct NoCoulombAVX2
+	{
+		using Scalar = NoCoulomb;
+		static constexpr bool Enabled = false;
+		explicit NoCoulombAVX2(const NonbondedKernelArgs&) noexcept {}
+		SIMD_TARGET_AVX2 inline __m256 operator()(__m256, __m256, __m256, __m256& forceTimesR) const noexcept
+		{
+			forceTimesR = _mm256_setzero_ps();
+			return forceTimesR;
+		}
+	};
+
+	struct CutoffCoulombAVX2
+	{
+		using Scalar = CutoffCoulomb;
+		static constexpr bool Enabled = true;
+		explicit CutoffCoulombAVX2(const NonbondedKernelArgs&) noexcept {}
+		SIMD_TARGET_AVX2 inline __m256 operator()(__m256 qq, __m256, __m256 invR, __m256& forceTimesR) const noexcept
+		{
+			forceTimesR = _mm256_mul_ps(qq, invR);
+			return forceTimesR;
+		}
+	};
+
+	struct ReactionFieldCoulombAVX2
+	{
+		using Scalar = ReactionFieldCoulomb;
+		static constexpr bool Enabled = true;
+		__m256 k;
+		__m256 c;
+
+		SIMD_TARGET_AVX2 explicit ReactionFieldCoulombAVX2(const NonbondedKernelArgs& a) noexcept :
+			k(_mm256_set1_ps(a.reactionFieldK)), c(_mm256_set1_ps(a.reactionFieldC)) {}
+		SIMD_TARGET_AVX2 inline __m256 operator()(__m256 qq, __m256 r2, __m256 invR, __m256& forceTimesR) const noexcept
+		{
+			const __m256 kr2 = _mm256_mul_ps(k, r2);
+			forceTimesR = _mm256_mul_ps(qq, _mm256_fnmadd_ps(_mm256_set1_ps(2.0f), kr2, invR));
+			return _mm256_mul_ps(qq, _mm256_sub_ps(_mm256_add_ps(invR, kr2), c));
+		}
+	};
+
+	struct ShiftedForceCoulombAVX2
+	{
+		using Scalar = ShiftedForceCoulomb;
+		static constexpr bool Enabled = true;
+		__m256 twoInvCutoff;
+		__m256 invCutoff2;
+
+		SIMD_TARGET_AVX2 explicit ShiftedForceCoulombAVX2(const NonbondedKernelArgs& a) noexcept :
+			twoInvCutoff(_mm256_set1_ps(2.0f / std::sqrt(a.cutoff2))), invCutoff2(_mm256_set1_ps(1.0f / a.cutoff2)) {}
+		SIMD_TARGET_AVX2 inline __m256 operator()(__m256 qq, __m256 r2, __m256 invR, __m256& forceTimesR) const noexcept
+		{
+			const __m256 rOverCutoff2 = _mm256_mul_ps(_mm256_mul_ps(r2, invR), invCutoff2);
+			forceTimesR = _mm256_mul_ps(qq, _mm256_sub_ps(invR, rOverCutoff2));
+			return _mm256_mul_ps(qq, _mm256_add_ps(_mm256_sub_ps(invR, twoInvCutoff), rOverCutoff2));
+		}
+	};
+
+	struct EwaldCoulombAVX2
+	{
+		using Scalar = EwaldCoulomb;
+		static constexpr bool Enabled = true;
+		__m256 beta;
+		__m256 twoBetaOverSqrtPi;
+
+		SIMD_TARGET_AVX2 explicit EwaldCoulombAVX2(const NonbondedKernelArgs& a) noexcept :
+			beta(_mm256_set1_ps(a.ewaldCoefficient)), twoBetaOverSqrtPi(_mm256_set1_ps(TwoOverSqrtPi * a.ewaldCoefficient)) {}
+		SIMD_TARGET_AVX2 inline __m256 operator()(__m256 qq, __m256 r2, __m256 invR, __m256& forceTimesR) const noexcept
+		{
+			const __m256 betaR = _mm256_mul_ps(beta, _mm256_mul_ps(r2, invR));
+			const __m256 expMinusBetaR2 = ExpAVX2(_mm256_mul_ps(_mm256_sub_ps(_mm256_setzero_ps(), betaR), betaR));
+			const __m256 coulomb = _mm256_mul_ps(_mm256_mul_ps(qq, invR), ErfcAVX2(betaR, expMinusBetaR2));
+			forceTimesR = _mm256_fmadd_ps(_mm256_mul_ps(qq, twoBetaOverSqrtPi), expMinusBetaR2, coulomb);
+			return coulomb;
+		}
+	};
+
+	template<bool Periodic, typename Coulomb>
+	SIMD_TARGET_AVX2 float NonbondedAVX2Impl(const NonbondedKernelArgs& a, unsigned int rowBegin, unsigned int rowEnd) noexcept
+	{
+		const __m256 lengthX = _mm256_set1_ps(a.image.lengthX);
+		const __m256 lengthY = _mm256_set1_ps(a.image.lengthY);
+		const __m256 lengthZ = _mm256_set1_ps(a.image.lengthZ);
+		const __m256 inverseLengthX = _mm256_set1_ps(a.image.inverseLengthX);
+		const __m256 inverseLengthY = _mm256_set1_ps(a.image.inverseLengthY);
+		const __m256 inverseLengthZ = _mm256_set1_ps(a.image.inverseLengthZ);
+		const __m256 cutoff2 = _mm256_set1_ps(a.cutoff2);
+		const __m256 minR2 = _mm256_set1_ps(1e-12f);
+		const __m256 one = _mm256_set1_ps(1.0f);
+		const __m256 six = _mm256_set1_ps(6.0f);
+		const __m256 half = _mm256_set1_ps(0.5f);
+		const __m256 twelve = _mm256_set1_ps(12.0f);
+		const int* types = reinterpret_cast<const int*>(a.type);
+		const Coulomb coulomb(a);
+		const typename Coulomb::Scalar scalarCoulomb(a);
+
+		__m256 energy = _mm256_setzero_ps();
+		float tailEnergy = 0.0f;
+
+		alignas(32) float fjx[8];
+		alignas(32) float fjy[8];
+		alignas(32) float fjz[8];
+
+		for (unsigned int i = rowBegin; i < rowEnd; ++i)
+		{
+			const unsigned int typeRow = static_cast<unsigned int>(a.type[i]) * ElementCount;
+			const float qiScalar = a.coulombConstant * a.charge[i];
+
+			const __m256 xi = _mm256_set1_ps(a.x[i]);
+			const __m256 yi = _mm256_set1_ps(a.y[i]);
+			const __m256 zi = _mm256_set1_ps(a.z[i]);
+			const __m256 qi = _mm256_set1_ps(qiScalar);
+			const __m256i typeRowv = _mm256_set1_epi32(static_cast<int>(typeRow));
+
+			__m256 fxi = _mm256_setzero_ps();
+			__m256 fyi = _mm256_setzero_ps();
+			__m256 fzi = _mm256_setzero_ps();
+
+			unsigned int n = a.offsets[i];
+			const unsigned int end = a.offsets[i + 1];
+			for (; n + 8 <= end; n += 8)
+			{
+				const unsigned int* jIndices = a.neighbors + n;
+				__m256i j = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(jIndices));
+
+				__m256 dx = _mm256_sub_ps(xi, _mm256_i32gather_ps(a.x, j, 4));
+				__m256 dy = _mm256_sub_ps(yi, _mm256_i32gather_ps(a.y, j, 4));
+				__m256 dz = _mm256_sub_ps(zi, _mm256_i32gather_ps(a.z, j, 4));
+				if constexpr (Periodic)
+				{
+					dx = MinimumImageAVX2(dx, lengthX, inverseLengthX);
+					dy = MinimumImageAVX2(dy, lengthY, inverseLengthY);
+					dz = MinimumImageAVX2(dz, lengthZ, inverseLengthZ);
+				}
+				__m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+
+				__m256 mask = _mm256_and_ps(_mm256_cmp_ps(r2, cutoff2, _CMP_LT_OQ), _mm256_cmp_ps(r2, minR2, _CMP_GE_OQ));
+
+				// Give lanes outside the cutoff a harmless r2 so they never produce inf/nan before being masked out
+				r2 = _mm256_blendv_ps(one, r2, mask);
+
+				// Soft core as in PairInteraction
+				__m256i pairIndex = _mm256_add_epi32(typeRowv, _mm256_i32gather_epi32(types, j, 4));
+				const __m256 coreR2 = _mm256_max_ps(r2, _mm256_i32gather_ps(a.softCoreR2, pairIndex, 4));
+
+				__m256 invR2 = _mm256_div_ps(one, coreR2);
+				__m256 invR6 = _mm256_mul_ps(_mm256_mul_ps(invR2, invR2), invR2);
+
+				__m256 lj12 = _mm256_mul_ps(_mm256_mul_ps(_mm256_i32gather_ps(a.c12, pairIndex, 4), invR6), invR6);
+				__m256 lj6 = _mm256_mul_ps(_mm256_i32gather_ps(a.c6, pairIndex, 4), invR6);
+				__m256 coulombEnergy = _mm256_setzero_ps();
+				__m256 coulombForce = _mm256_setzero_ps();
+				if constexpr (Coulomb::Enabled)
+					coulombEnergy = coulomb(_mm256_mul_ps(qi, _mm256_i32gather_ps(a.charge, j, 4)), coreR2, _mm256_sqrt_ps(invR2), coulombForce);
+
+				__m256 fScalar = _mm256_add_ps(_mm256_fmsub_ps(twelve, lj12, _mm256_mul_ps(six, lj6)), coulombForce);
+				fScalar = _mm256_mul_ps(fScalar, invR2);
+
+				__m256 pairEnergy = _mm256_add_ps(_mm256_sub_ps(_mm256_sub_ps(lj12, lj6), _mm256_i32gather_ps(a.ljShift, pairIndex, 4)), coulombEnergy);
+				pairEnergy = _mm256_fmadd_ps(_mm256_mul_ps(half, fScalar), _mm256_sub_ps(coreR2, r2), pairEnergy);
+				energy = _mm256_add_ps(energy, _mm256_and_ps(mask, pairEnergy));
+				fScalar = _mm256_and_ps(mask, fScalar);
+
+				__m256 fx = _mm256_mul_ps(fScalar, dx);
+				__m256 fy = _mm256_mul_ps(fScalar, dy);
+				__m256 fz = _mm256_mul_ps(fScalar, dz);
+				fxi = _mm256_add_ps(fxi, fx);
+				fyi = _mm256_add_ps(fyi, fy);
+				fzi = _mm256_add_ps(fzi, fz);
+
+				// AVX2 has no scatter, so apply the reaction forces lane by lane
+				_mm256_store_ps(fjx, fx);
+				_mm256_store_ps(fjy, fy);
+				_mm256_store_ps(fjz, fz);
+				for (unsigned int lane = 0; lane < 8; ++lane)
+				{
+					a.fx[jIndices[lane]] -= fjx[lane];
+					a.fy[jIndices[lane]] -= fjy[lane];
+					a.fz[jIndices[lane]] -= fjz[lane];
+				}
+			}
+
+			float fxiTail = 0.0f;
+			float fyiTail = 0.0f;
+			float fziTail = 0.0f;
+			for (; n < end; ++n)
+				tailEnergy += PairInteraction<Periodic>(a, scalarCoulomb, typeRow, qiScalar, a.x[i], a.y[i], a.z[i], a.neighbors[n], fxiTail, fyiTail, fziTail);
+
+			a.fx[i] += HorizontalSum(fxi) + fxiTail;
+			a.fy[i] += HorizontalSum(fyi) + fyiTail;
+			a.fz[i] += HorizontalSum(fzi) + fziTail;
+		}
+
+		return HorizontalSum(energy) + tailEnergy;
+	}
+
+	template<bool Periodic>
+	SIMD_TARGET_AVX2 float NonbondedAVX2Coulomb(const NonbondedKernelArgs& a, unsigned int rowBegin, unsigned int rowEnd) noexcept
+	{
+		switch (a.coulomb)
+		{
+		case CoulombKernel::None:			return NonbondedAVX2Impl<Periodic, NoCoulombAVX2>(a, rowBegin, rowEnd);
+		case CoulombKernel::ReactionField:	return NonbondedAVX2Impl<Periodic, ReactionFieldCoulombAVX2>(a, rowBegin, rowEnd);
+		case CoulombKernel::ShiftedForce:	return NonbondedAVX2Impl<Periodic, ShiftedForceCoulombAVX2>(a, rowBegin, rowEnd);
+		case CoulombKernel::Ewald:			return NonbondedAVX2Impl<Periodic, EwaldCoulombAVX2>(a, rowBegin, rowEnd);
+		default:							return NonbondedAVX2Impl<Periodic, CutoffCoulombAVX2>(a, rowBegin, rowEnd);
+		}
+	}
+
+	SIMD_TARGET_AVX2 float NonbondedAVX2(const NonbondedKernelArgs& a, unsigned int rowBegin, unsigned int rowEnd) noexcept
+	{
+		return a.image.IsPeriodic() ? NonbondedAVX2Coulomb<true>(a, rowBegin, rowEnd) : NonbondedAVX2Coulomb<false>(a, rowBegin, rowEnd);
+	}
+
+	constexpr SimdKernelTable AVX2Table = { SimdLevel::AVX2, KickAVX2, DriftAVX2, ScaleAVX2, LangevinDriftAVX2, KineticSumAVX2, ReflectAVX2, WrapAVX2, NonbondedAVX2, GaussianAVX2, PackInstancesAVX2, CullSpheresAVX2 };
+
+// ========================================================================================================================================
+// AVX-512 kernels (16 lanes). Tails are handled with lane masks instead of a scalar remainder loop.
+
+	SIMD_TARGET_AVX512 inline __mmask16 TailMask(size_t remaining) noexcept
+	{
+		return remaining >= 16 ? static_cast<__mmask16>(0xFFFF) : static_cast<__mmask16>((1u << remaining) - 1u);
+	}
+
+	SIMD_TARGET_AVX512 void KickAVX512(float* v, const float* f, const float* inverseMass, size_t count, float dt) noexcept
+	{
+		const __m512 dtv = _mm512_set1_ps(dt);
+		for (size_t iii = 0; iii < count; iii += 16)
+		{
+			__mmask16 m = TailMask(count - iii);
+			__m512 scale = _mm512_mul_ps(_mm512_maskz_loadu_ps(m, inverseMass + iii), dtv);
+			__m512 result = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, f + iii), scale, _mm512_maskz_loadu_ps(m, v + iii));
+			_mm512_mask_storeu_ps(v + iii, m, result);
+		}
+	}
+
+	SIMD_TARGET_AVX512 void DriftAVX512(float* x, const float* v, size_t count, float dt) noexcept
+	{
+		const __m512 dtv = _mm512_set1_ps(dt);
+		for (size_t iii = 0; iii < count; iii += 16)
+		{
+			__mmask16 m = TailMask(count - iii);
+			__m512 result = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, v + iii), dtv, _mm512_maskz_loadu_ps(m, x + iii));
+			_mm512_mask_storeu_ps(x + iii, m, result);
+		}
+	}
+
+	SIMD_TARGET_AVX512 void ScaleAVX512(float* v, size_t count, float scale) noexcept
+	{
+		const __m512 scalev = _mm512_set1_ps(scale);
+		for (size_t iii = 0; iii < count; iii += 16)
+		{
+			__mmask16 m = TailMask(count - iii);
+			_mm512_mask_storeu_ps(v + iii, m, _mm512_mul_ps(_mm512_maskz_loadu_ps(m, v + iii), scalev));
+		}
+	}
+
+	// Masked-off lanes load zero mass, so they add nothing to the heat
+	SIMD_TARGET_AVX512 float LangevinDriftAVX512(float* x, float* v, const float* gaussian, const float* inverseMass, const float* mass, size_t count,
+												 float halfDt, float friction, float noise) noexcept
+	{
+		const __m512 halfDtv = _mm512_set1_ps(halfDt);
+		const __m512 frictionv = _mm512_set1_ps(friction);
+		const __m512 noisev = _mm512_set1_ps(noise);
+		__m512 heat = _mm512_setzero_ps();
+		for (size_t iii = 0; iii < count; iii += 16)
+		{
+			__mmask16 m = TailMask(count - iii);
+			const __m512 before = _mm512_maskz_loadu_ps(m, v + iii);
+			const __m512 kick = _mm512_mul_ps(_mm512_mul_ps(noisev, _mm512_sqrt_ps(_mm512_maskz_loadu_ps(m, inverseMass + iii))), _mm512_maskz_loadu_ps(m, gaussian + iii));
+			const __m512 after = _mm512_fmadd_ps(frictionv, before, kick);
+			_mm512_mask_storeu_ps(x + iii, m, _mm512_fmadd_ps(_mm512_add_ps(before, after), halfDtv, _mm512_maskz_loadu_ps(m, x + iii)));
+			_mm512_mask_storeu_ps(v + iii, m, after);
+			heat = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, mass + iii), _mm512_fmsub_ps(after, after, _mm512_mul_ps(before, before)), heat);
+		}
+		return _mm512_reduce_add_ps(heat);
+	}
+
+	SIMD_TARGET_AVX512 float KineticSumAVX512(const float* vx, const float* vy, const float* vz, const float* mass, size_t count) noexcept
+	{
+		__m512 sum = _mm512_setzero_ps();
+		for (size_t iii = 0; iii < count; iii += 16)
+		{
+			__mmask16 m = TailMask(count - iii);
+			const __m512 vxv = _mm512_maskz_loadu_ps(m, vx + iii);
+			const __m512 vyv = _mm512_maskz_loadu_ps(m, vy + iii);
+			const __m512 vzv = _mm512_maskz_loadu_ps(m, vz + iii);
+			const __m512 v2 = _mm512_fmadd_ps(vzv, vzv, _mm512_fmadd_ps(vyv, vyv, _mm512_mul_ps(vxv, vxv)));
+			sum = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, mass + iii), v2, sum);
+		}
+		return _mm512_reduce_add_ps(sum);
+	}
+
+	SIMD_TARGET_AVX512 void ReflectAVX512(const float* x, float* v, const float* radius, size_t count, float wallMin, float wallMax) noexcept
+	{
+		const __m512 minv = _mm512_set1_ps(wallMin);
+		const __m512 maxv = _mm512_set1_ps(wallMax);
+		const __m512 zero = _mm512_setzero_ps();
+		for (size_t iii = 0; iii < count; iii += 16)
+		{
+			__mmask16 m = TailMask(count - iii);
+			__m512 xv = _mm512_maskz_loadu_ps(m, x + iii);
+			__m512 r = _mm512_maskz_loadu_ps(m, radius + iii);
+			__mmask16 hit = m & (_mm512_cmp_ps_mask(_mm512_add_ps(xv, r), maxv, _CMP_GT_OQ) |
+								 _mm512_cmp_ps_mask(_mm512_sub_ps(xv, r), minv, _CMP_LT_OQ));
+
+			__m512 vv = _mm512_maskz_loadu_ps(m, v + iii);
+			_mm512_mask_storeu_ps(v + iii, hit, _mm512_sub_ps(zero, vv));
+		}
+	}
+
+	SIMD_TARGET_AVX512 void WrapAVX512(float* x, size_t count, float boxMin, float boxMax) noexcept
+	{
+		const __m512 minv = _mm512_set1_ps(boxMin);
+		const __m512 length = _mm512_set1_ps(boxMax - boxMin);
+		const __m512 inverseLength = _mm512_set1_ps(1.0f / (boxMax - boxMin));
+		for (size_t iii = 0; iii < count; iii += 16)
+		{
+			__mmask16 m = TailMask(count - iii);
+			__m512 xv = _mm512_maskz_loadu_ps(m, x + iii);
+			__m512 images = _mm512_roundscale_ps(_mm512_mul_ps(_mm512_sub_ps(xv, minv), inverseLength), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+			_mm512_mask_storeu_ps(x + iii, m, _mm512_fnmadd_ps(length, images, xv));
+		}
+	}
+
+	SIMD_TARGET_AVX512 inline __m512 MinimumImageAVX512(__m512 d, __m512 length, __m512 inverseLength) noexcept
+	{
+		return _mm512_fnmadd_ps(length, _mm512_roundscale_ps(_mm512_mul_ps(d, inverseLength), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), d);
+	}
+
+	SIMD_TARGET_AVX512 inline __m512 ExpAVX512(__m512 x) noexcept
+	{
+		x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(-87.0f)), _mm512_set1_ps(88.0f));
+		__m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(1.44269504f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		__m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(0.693359375f), x);
+		r = _mm512_fnmadd_ps(n, _mm512_set1_ps(-2.12194440e-4f), r);
+
+		__m512 p = _mm512_set1_ps(1.9875691500e-4f);
+		p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.3981999507e-3f));
+		p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(8.3334519073e-3f));
+		p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(4.1665795894e-2f));
+		p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.6666665459e-1f));
+		p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(5.0000001201e-1f));
+		p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+
+		return _mm512_scalef_ps(p, n);
+	}
+
+	SIMD_TARGET_AVX512 inline __m512 ErfcAVX512(__m512 x, __m512 expMinusX2) noexcept
+	{
+		__m512 t = _mm512_div_ps(_mm512_set1_ps(1.0f), _mm512_fmadd_ps(_mm512_set1_ps(0.3275911f), x, _mm512_set1_ps(1.0f)));
+		__m512 p = _mm512_set1_ps(1.061405429f);
+		p = _mm512_fmadd_ps(p, t, _mm512_set1_ps(-1.453152027f));
+		p = _mm512_fmadd_ps(p, t, _mm512_set1_ps(1.421413741f));
+		p = _mm512_fmadd_ps(p, t, _mm512_set1_ps(-0.284496736f));
+		p = _mm512_fmadd_ps(p, t, _mm512_set1_ps(0.254829592f));
+		return _mm512_mul_ps(_mm512_mul_ps(p, t), expMinusX2);
+	}
+
+	// LogAVX2 with the exponent and mantissa split by getexp/getmant
+	SIMD_TARGET_AVX512 inline __m512 LogAVX512(__m512 x) noexcept
+	{
+		__m512 e = _mm512_add_ps(_mm512_getexp_ps(x), _mm512_set1_ps(1.0f));
+		__m512 m = _mm512_getmant_ps(x, _MM_MANT_NORM_p5_1, _MM_MANT_SIGN_src);
+
+		const __mmask16 low = _mm512_cmp_ps_mask(m, _mm512_set1_ps(0.707106781f), _CMP_LT_OQ);
+		e = _mm512_mask_sub_ps(e, low, e, _mm512_set1_ps(1.0f));
+		m = _mm512_sub_ps(_mm512_mask_add_ps(m, low, m, m), _mm512_set1_ps(1.0f));
+
+		const __m512 m2 = _mm512_mul_ps(m, m);
+		__m512 p = _mm512_set1_ps(7.0376836292e-2f);
+		p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(-1.1514610310e-1f));
+		p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(1.1676998740e-1f));
+		p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(-1.2420140846e-1f));
+		p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(1.4249322787e-1f));
+		p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(-1.6668057665e-1f));
+		p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(2.0000714765e-1f));
+		p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(-2.4999993993e-1f));
+		p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(3.3333331174e-1f));
+		p = _mm512_mul_ps(_mm512_mul_ps(p, m), m2);
+		p = _mm512_fmadd_ps(e, _mm512_set1_ps(-2.12194440e-4f), p);
+		p = _mm512_fnmadd_ps(_mm512_set1_ps(0.5f), m2, p);
+		return _mm512_fmadd_ps(e, _mm512_set1_ps(0.693359375f), _mm512_add_ps(m, p));
+	}
+
+	// See SinCosTurnsAVX2. The sign flips are integer xors since AVX-512F has no float xor.
+	SIMD_TARGET_AVX512 inline void SinCosTurnsAVX512(__m512 u, __m512& sine, __m512& cosine) noexcept
+	{
+		const __m512 quarters = _mm512_mul_ps(u, _mm512_set1_ps(4.0f));
+		const __m512 q = _mm512_roundscale_ps(quarters, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		const __m512 r = _mm512_mul_ps(_mm512_sub_ps(quarters, q), _mm512_set1_ps(1.57079632679f));
+		const __m512 r2 = _mm512_mul_ps(r, r);
+
+		__m512 s = _mm512_set1_ps(-1.9515295891e-4f);
+		s = _mm512_fmadd_ps(s, r2, _mm512_set1_ps(8.3321608736e-3f));
+		s = _mm512_fmadd_ps(s, r2, _mm512_set1_ps(-1.6666654611e-1f));
+		s = _mm512_fmadd_ps(_mm512_mul_ps(s, r2), r, r);
+
+		__m512 c = _mm512_set1_ps(2.443315711809948e-5f);
+		c = _mm512_fmadd_ps(c, r2, _mm512_set1_ps(-1.388731625493765e-3f));
+		c = _mm512_fmadd_ps(c, r2, _mm512_set1_ps(4.166664568298827e-2f));
+		c = _mm512_fmadd_ps(_mm512_mul_ps(c, r2), r2, _mm512_fnmadd_ps(_mm512_set1_ps(0.5f), r2, _mm512_set1_ps(1.0f)));
+
+		const __m512i quadrant = _mm512_and_si512(_mm512_cvtps_epi32(q), _mm512_set1_epi32(3));
+		const __mmask16 swap = _mm512_test_epi32_mask(quadrant, _mm512_set1_epi32(1));
+		const __m512i sineSign = _mm512_slli_epi32(_mm512_and_si512(quadrant, _mm512_set1_epi32(2)), 30);
+		const __m512i cosineSign = _mm512_slli_epi32(_mm512_and_si512(_mm512_add_epi32(quadrant, _mm512_set1_epi32(1)), _mm512_set1_epi32(2)), 30);
+		sine = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(_mm512_mask_blend_ps(swap, s, c)), sineSign));
+		cosine = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(_mm512_mask_blend_ps(swap, c, s)), cosineSign));
+	}
+
+	SIMD_TARGET_AVX512 inline void MulHiLoAVX512(__m512i a, __m512i multiplier, __m512i& hi, __m512i& lo) noexcept
+	{
+		const __m512i even = _mm512_mul_epu32(a, multiplier);
+		const __m512i odd = _mm512_mul_epu32(_mm512_srli_epi64(a, 32), multiplier);
+		hi = _mm512_mask_blend_epi32(0xAAAA, _mm512_srli_epi64(even, 32), odd);
+		lo = _mm512_mask_blend_epi32(0xAAAA, even, _mm512_slli_epi64(odd, 32));
+	}
+
+	SIMD_TARGET_AVX512 inline void PhiloxAVX512(__m512i c[4], Philox::Key key) noexcept
+	{
+		const __m512i multiplier0 = _mm512_set1_epi32(static_cast<int>(Philox::Multiplier0));
+		const __m512i multiplier1 = _mm512_set1_epi32(static_cast<int>(Philox::Multiplier1));
+		for (unsigned int round = 0; round < Philox::Rounds; ++round)
+		{
+			__m512i hi0, lo0, hi1, lo1;
+			MulHiLoAVX512(c[0], multiplier0, hi0, lo0);
+			MulHiLoAVX512(c[2], multiplier1, hi1, lo1);
+			c[0] = _mm512_xor_si512(_mm512_xor_si512(hi1, c[1]), _mm512_set1_epi32(static_cast<int>(key[0])));
+			c[1] = lo1;
+			c[2] = _mm512_xor_si512(_mm512_xor_si512(hi0, c[3]), _mm512_set1_epi32(static_cast<int>(key[1])));
+			c[3] = lo0;
+			key[0] += Philox::Weyl0;
+			key[1] += Philox::Weyl1;
+		}
+	}
+
+	SIMD_TARGET_AVX512 inline __m512 UniformAVX512(__m512i word, int offset) noexcept
+	{
+		__m512i top = _mm512_add_epi32(_mm512_srli_epi32(word, 8), _mm512_set1_epi32(offset));
+		return _mm512_mul_ps(_mm512_cvtepi32_ps(top), _mm512_set1_ps(1.0f / 16777216.0f));
+	}
+
+	SIMD_TARGET_AVX512 void GaussianAVX512(Philox::Key key, uint64_t step, uint32_t stream, uint32_t first, size_t count, float* x, float* y, float* z) noexcept
+	{
+		const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+		const Philox::Counter counter = Philox::AtomCounter(first, step, stream);
+		const __m512 minusTwo = _mm512_set1_ps(-2.0f);
+		for (size_t iii = 0; iii < count; iii += 16)
+		{
+			__mmask16 m = TailMask(count - iii);
+			__m512i c[4] = {
+				_mm512_add_epi32(_mm512_set1_epi32(static_cast<int>(counter[0] + static_cast<uint32_t>(iii))), lanes),
+				_mm512_set1_epi32(static_cast<int>(counter[1])),
+				_mm512_set1_epi32(static_cast<int>(counter[2])),
+				_mm512_set1_epi32(static_cast<int>(counter[3]))
+			};
+			PhiloxAVX512(c, key);
+
+			const __m512 radius0 = _mm512_sqrt_ps(_mm512_mul_ps(minusTwo, LogAVX512(UniformAVX512(c[0], 1))));
+			const __m512 radius1 = _mm512_sqrt_ps(_mm512_mul_ps(minusTwo, LogAVX512(UniformAVX512(c[2], 1))));
+			__m512 sine0, cosine0, sine1, cosine1;
+			SinCosTurnsAVX512(UniformAVX512(c[1], 0), sine0, cosine0);
+			SinCosTurnsAVX512(UniformAVX512(c[3], 0), sine1, cosine1);
+
+			_mm512_mask_storeu_ps(x + iii, m, _mm512_mul_ps(radius0, cosine0));
+			_mm512_mask_storeu_ps(y + iii, m, _mm512_mul_ps(radius0, sine0));
+			_mm512_mask_storeu_ps(z + iii, m, _mm512_mul_ps(radius1, cosine1));
+		}
+	}
+
+	SIMD_TARGET_AVX512 void PackInstancesAVX512(const float* x, const float* y, const float* z, const float* radius, const Element* type, size_t count, AtomInstance* instances) noexcept
+	{
+		// Lane extraction takes an immediate, so whole blocks are unrolled and the remainder goes to the scalar kernel
+		size_t iii = 0;
+		for (; iii + 16 <= count; iii += 16)
+		{
+			const __m512 xv = _mm512_loadu_ps(x + iii);
+			const __m512 yv = _mm512_loadu_ps(y + iii);
+			const __m512 zv = _mm512_loadu_ps(z + iii);
+			const __m512 rv = _mm512_loadu_ps(radius + iii);
+			const __m512 xy0 = _mm512_unpacklo_ps(xv, yv);
+			const __m512 xy1 = _mm512_unpackhi_ps(xv, yv);
+			const __m512 zr0 = _mm512_unpacklo_ps(zv, rv);
+			const __m512 zr1 = _mm512_unpackhi_ps(zv, rv);
+			const __m512 quads[4] = {
+				_mm512_shuffle_ps(xy0, zr0, 0x44), _mm512_shuffle_ps(xy0, zr0, 0xEE),
+				_mm512_shuffle_ps(xy1, zr1, 0x44), _mm512_shuffle_ps(xy1, zr1, 0xEE)
+			};
+
+			AtomInstance* out = instances + iii;
+			for (int k = 0; k < 4; ++k)
+			{
+				_mm_storeu_ps(&out[k].x, _mm512_castps512_ps128(quads[k]));
+				_mm_storeu_ps(&out[k + 4].x, _mm512_extractf32x4_ps(quads[k], 1));
+				_mm_storeu_ps(&out[k + 8].x, _mm512_extractf32x4_ps(quads[k], 2));
+				_mm_storeu_ps(&out[k + 12].x, _mm512_extractf32x4_ps(quads[k], 3));
+			}
+			for (int k = 0; k < 16; ++k)
+				out[k].material = static_cast<uint32_t>(type[iii + k]) - 1u;
+		}
+		PackInstancesScalar(x + iii, y + iii, z + iii, radius + iii, type + iii, count - iii, instances + iii);
+	}
+
+	SIMD_TARGET_AVX512 size_t CullSpheresAVX512(const float* x, const float* y, const float* z, const float* radius, size_t count, uint32_t firstIndex, const FrustumPlanes& planes, uint32_t* visible) noexcept
+	{
+		const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+		size_t visibleCount = 0;
+		for (size_t iii = 0; iii < count; iii += 16)
+		{
+			const __mmask16 m = TailMask(count - iii);
+			const __m512 xv = _mm512_maskz_loadu_ps(m, x + iii);
+			const __m512 yv = _mm512_maskz_loadu_ps(m, y + iii);
+			const __m512 zv = _mm512_maskz_loadu_ps(m, z + iii);
+			const __m512 negativeRadius = _mm512_sub_ps(_mm512_setzero_ps(), _mm512_maskz_loadu_ps(m, radius + iii));
+
+			__mmask16 inside = m;
+			for (int p = 0; p < 6; ++p)
+			{
+				__m512 distance = _mm512_mul_ps(_mm512_set1_ps(planes.a[p]), xv);
+				distance = _mm512_add_ps(distance, _mm512_mul_ps(_mm512_set1_ps(planes.b[p]), yv));
+				distance = _mm512_add_ps(distance, _mm512_mul_ps(_mm512_set1_ps(planes.c[p]), zv));
+				distance = _mm512_add_ps(distance, _mm512_set1_ps(planes.d[p]));
+				inside = _mm512_mask_cmp_ps_mask(inside, distance, negativeRadius, _CMP_GE_OQ);
+			}
+
+			// Compress-store writes exactly the visible lanes
+			const __m512i indices = _mm512_add_epi32(_mm512_set1_epi32(static_cast<int>(firstIndex + iii)), lanes);
+			_mm512_mask_compressstoreu_epi32(visible + visibleCount, inside, indices);
+			visibleCount += CompactLanes.count[inside & 0xFF] + CompactLanes.count[inside >> 8];
+		}
+		return visibleCount;
+	}
+
+	// Sixteen-lane Coulomb policies. Masked-off lanes arrive with qq = 0 and invR = 0, so every form yields zero there.
+	struct NoCoulombAVX512
+	{
+		static constexpr bool Enabled = false;
+		explicit NoCoulombAVX512(const NonbondedKernelArgs&) noexcept {}
+		SIMD_TARGET_AVX512 inline __m512 operator()(__m512, __m512, __m512, __m512& forceTimesR) const noexcept
+		{
+			forceTimesR = _mm512_setzero_ps();
+			return forceTimesR;
+		}
+	};
+
+	struct CutoffCoulombAVX512
+	{
+		static constexpr bool Enabled = true;
+		explicit CutoffCoulombAVX512(const NonbondedKernelArgs&) noexcept {}
+		SIMD_TARGET_AVX512 inline __m512 operator()(__m512 qq, __m512, __m512 invR, __m512& forceTimesR) const noexcept
+		{
+			forceTimesR = _mm512_mul_ps(qq, invR);
+			return forceTimesR;
+		}
+	};
+
+	struct ReactionFieldCoulombAVX512
+	{
+		static constexpr bool Enabled = true;
+		__m512 k;
+		__m512 c;
+
+		SIMD_TARGET_AVX512 explicit ReactionFieldCoulombAVX512(const NonbondedKernelArgs& a) noexcept :
+			k(_mm512_set1_ps(a.reactionFieldK)), c(_mm512_set1_ps(a.reactionFieldC)) {}
+		SIMD_TARGET_AVX512 inline __m512 operator()(__m512 qq, __m512 r2, __m512 invR, __m512& forceTimesR) const noexcept
+		{
+			const __m512 kr2 = _mm512_mul_ps(k, r2);
+			forceTimesR = _mm512_mul_ps(qq, _mm512_fnmadd_ps(_mm512_set1_ps(2.0f), kr2, invR));
+			return _mm512_mul_ps(qq, _mm512_sub_ps(_mm512_add_ps(invR, kr2), c));
+		}
+	};
+
+	struct ShiftedForceCoulombAVX512
+	{
+		static constexpr bool Enabled = true;
+		__m512 twoInvCutoff;
+		__m512 invCutoff2;
+
+		SIMD_TARGET_AVX512 explicit ShiftedForceCoulombAVX512(const NonbondedKernelArgs& a) noexcept :
+			twoInvCutoff(_mm512_set1_ps(2.0f / std::sqrt(a.cutoff2))), invCutoff2(_mm512_set1_ps(1.0f / a.cutoff2)) {}
+		SIMD_TARGET_AVX512 inline __m512 operator()(__m512 qq, __m512 r2, __m512 invR, __m512& forceTimesR) const noexcept
+		{
+			const __m512 rOverCutoff2 = _mm512_mul_ps(_mm512_mul_ps(r2, invR), invCutoff2);
+			forceTimesR = _mm512_mul_ps(qq, _mm512_sub_ps(invR, rOverCutoff2));
+			return _mm512_mul_ps(qq, _mm512_add_ps(_mm512_sub_ps(invR, twoInvCutoff), rOverCutoff2));
+		}
+	};
+
+	struct EwaldCoulombAVX512
+	{
+		static constexpr bool Enabled = true;
+		__m512 beta;
+		__m512 twoBetaOverSqrtPi;
+
+		SIMD_TARGET_AVX512 explicit EwaldCoulombAVX512(const NonbondedKernelArgs& a) noexcept :
+			beta(_mm512_set1_ps(a.ewaldCoefficient)), twoBetaOverSqrtPi(_mm512_set1_ps(TwoOverSqrtPi * a.ewaldCoefficient)) {}
+		SIMD_TARGET_AVX512 inline __m512 operator()(__m512 qq, __m512 r2, __m512 invR, __m512& forceTimesR) const noexcept
+		{
+			const __m512 betaR = _mm512_mul_ps(beta, _mm512_mul_ps(r2, invR));
+			const __m512 expMinusBetaR2 = ExpAVX512(_mm512_mul_ps(_mm512_sub_ps(_mm512_setzero_ps(), betaR), betaR));
+			const __m512 coulomb = _mm512_mul_ps(_mm512_mul_ps(qq, invR), ErfcAVX512(betaR, expMinusBetaR2));
+			forceTimesR = _mm512_fmadd_ps(_mm512_mul_ps(qq, twoBetaOverSqrtPi), expMinusBetaR2, coulomb);
+			return coulomb;
+		}
+	};
+
+	template<bool Periodic, typename Coulomb>
+	SIMD_TARGET_AVX512 float NonbondedAVX512Impl(const NonbondedKernelArgs& a, unsigned int rowBegin, unsigned int rowEnd) noexcept
+	{
+		const __m512 lengthX = _mm512_set1_ps(a.image.lengthX);
+		const __m512 lengthY = _mm512_set1_ps(a.image.lengthY);
+		const __m512 lengthZ = _mm512_set1_ps(a.image.lengthZ);
+		const __m512 inverseLengthX = _mm512_set1_ps(a.image.inverseLengthX);
+		const __m512 inverseLengthY = _mm512_set1_ps(a.image.inverseLengthY);
+		const __m512 inverseLengthZ = _mm512_set1_ps(a.image.inverseLengthZ);
+		const __m512 cutoff2 = _mm512_set1_ps(a.cutoff2);
+		const __m512 minR2 = _mm512_set1_ps(1e-12f);
+		const __m512 one = _mm512_set1_ps(1.0f);
+		const __m512 six = _mm512_set1_ps(6.0f);
+		const __m512 half = _mm512_set1_ps(0.5f);
+		const __m512 twelve = _mm512_set1_ps(12.0f);
+		const __m512 zero = _mm512_setzero_ps();
+		const int* types = reinterpret_cast<const int*>(a.type);
+		const Coulomb coulomb(a);
+
+		__m512 energy = _mm512_setzero_ps();
+
+		for (unsigned int i = rowBegin; i < rowEnd; ++i)
+		{
+			const __m512 xi = _mm512_set1_ps(a.x[i]);
+			const __m512 yi = _mm512_set1_ps(a.y[i]);
+			const __m512 zi = _mm512_set1_ps(a.z[i]);
+			const __m512 qi = _mm512_set1_ps(a.coulombConstant * a.charge[i]);
+			const __m512i typeRow = _mm512_set1_epi32(static_cast<int>(a.type[i]) * static_cast<int>(ElementCount));
+
+			__m512 fxi = _mm512_setzero_ps();
+			__m512 fyi = _mm512_setzero_ps();
+			__m512 fzi = _mm512_setzero_ps();
+
+			const unsigned int begin = a.offsets[i];
+			const unsigned int end = a.offsets[i + 1];
+			for (unsigned int n = begin; n < end; n += 16)
+			{
+				const __mmask16 lanes = TailMask(end - n);
+				__m512i j = _mm512_maskz_loadu_epi32(lanes, a.neighbors + n);
+
+				__m512 dx = _mm512_sub_ps(xi, _mm512_mask_i32gather_ps(zero, lanes, j, a.x, 4));
+				__m512 dy = _mm512_sub_ps(yi, _mm512_mask_i32gather_ps(zero, lanes, j, a.y, 4));
+				__m512 dz = _mm512_sub_ps(zi, _mm512_mask_i32gather_ps(zero, lanes, j, a.z, 4));
+				if constexpr (Periodic)
+				{
+					dx = MinimumImageAVX512(dx, lengthX, inverseLengthX);
+					dy = MinimumImageAVX512(dy, lengthY, inverseLengthY);
+					dz = MinimumImageAVX512(dz, lengthZ, inverseLengthZ);
+				}
+				__m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+
+				const __mmask16 mask = lanes &
+					_mm512_cmp_ps_mask(r2, cutoff2, _CMP_LT_OQ) &
+					_mm512_cmp_ps_mask(r2, minR2, _CMP_GE_OQ);
+
+				// Soft core as in PairInteraction
+				__m512i pairIndex = _mm512_add_epi32(typeRow, _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), mask, j, types, 4));
+				const __m512 coreR2 = _mm512_max_ps(r2, _mm512_mask_i32gather_ps(zero, mask, pairIndex, a.softCoreR2, 4));
+
+				// Masked-off lanes get invR2 = 0, which zeroes every term derived from it
+				__m512 invR2 = _mm512_maskz_div_ps(mask, one, coreR2);
+				__m512 invR6 = _mm512_mul_ps(_mm512_mul_ps(invR2, invR2), invR2);
+
+				__m512 lj12 = _mm512_mul_ps(_mm512_mul_ps(_mm512_mask_i32gather_ps(zero, mask, pairIndex, a.c12, 4), invR6), invR6);
+				__m512 lj6 = _mm512_mul_ps(_mm512_mask_i32gather_ps(zero, mask, pairIndex, a.c6, 4), invR6);
+				__m512 coulombEnergy = zero;
+				__m512 coulombForce = zero;
+				if constexpr (Coulomb::Enabled)
+					coulombEnergy = coulomb(_mm512_mul_ps(qi, _mm512_mask_i32gather_ps(zero, mask, j, a.charge, 4)), coreR2, _mm512_sqrt_ps(invR2), coulombForce);
+
+				__m512 fScalar = _mm512_add_ps(_mm512_fmsub_ps(twelve, lj12, _mm512_mul_ps(six, lj6)), coulombForce);
+				fScalar = _mm512_mul_ps(fScalar, invR2);
+
+				const __m512 ljShift = _mm512_mask_i32gather_ps(zero, mask, pairIndex, a.ljShift, 4);
+				const __m512 pairEnergy = _mm512_add_ps(_mm512_sub_ps(_mm512_sub_ps(lj12, lj6), ljShift), coulombEnergy);
+				energy = _mm512_add_ps(energy, _mm512_fmadd_ps(_mm512_mul_ps(half, fScalar), _mm512_sub_ps(coreR2, r2), pairEnergy));
+
+				__m512 fx = _mm512_mul_ps(fScalar, dx);
+				__m512 fy = _mm512_mul_ps(fScalar, dy);
+				__m512 fz = _mm512_mul_ps(fScalar, dz);
+				fxi = _mm512_add_ps(fxi, fx);
+				fyi = _mm512_add_ps(fyi, fy);
+				fzi = _mm512_add_ps(fzi, fz);
+
+				// Each j appears once per row, so gather-subtract-scatter cannot collide within a vector
+				_mm512_mask_i32scatter_ps(a.fx, mask, j, _mm512_sub_ps(_mm512_mask_i32gather_ps(zero, mask, j, a.fx, 4), fx), 4);
+				_mm512_mask_i32scatter_ps(a.fy, mask, j, _mm512_sub_ps(_mm512_mask_i32gather_ps(zero, mask, j, a.fy, 4), fy), 4);
+				_mm512_mask_i32scatter_ps(a.fz, mask, j, _mm512_sub_ps(_mm512_mask_i32gather_ps(zero, mask, j, a.fz, 4), fz), 4);
+			}
+
+			a.fx[i] += _mm512_reduce_add_ps(fxi);
+			a.fy[i] += _mm512_reduce_add_ps(fyi);
+			a.fz[i] += _mm512_reduce_add_ps(fzi);
+		}
+
+		return _mm512_reduce_add_ps(energy);
+	}
+
+	template<bool Periodic>
+	SIMD_TARGET_AVX512 float NonbondedAVX512Coulomb(const NonbondedKernelArgs& a, unsigned int rowBegin, unsigned int rowEnd) noexcept
+	{
+		switch (a.coulomb)
+		{
+		case CoulombKernel::None:			return NonbondedAVX512Impl<Periodic, NoCoulombAVX512>(a, rowBegin, rowEnd);
+		case CoulombKernel::ReactionField:	return NonbondedAVX512Impl<Periodic, ReactionFieldCoulombAVX512>(a, rowBegin, rowEnd);
+		case CoulombKernel::ShiftedForce:	return NonbondedAVX512Impl<Periodic, ShiftedForceCoulombAVX512>(a, rowBegin, rowEnd);
+		case CoulombKernel::Ewald:			return NonbondedAVX512Impl<Periodic, EwaldCoulombAVX512>(a, rowBegin, rowEnd);
+		default:							return NonbondedAVX512Impl<Periodic, CutoffCoulombAVX512>(a, rowBegin, rowEnd);
+		}
+	}
+
+	SIMD_TARGET_AVX512 float NonbondedAVX512(const NonbondedKernelArgs& a, unsigned int rowBegin, unsigned int rowEnd) noexcept
+	{
+		return a.image.IsPeriodic() ? NonbondedAVX512Coulomb<true>(a, rowBegin, rowEnd) : NonbondedAVX512Coulomb<false>(a, rowBegin, rowEnd);
+	}
+
+	constexpr SimdKernelTable AVX512Table = { SimdLevel::AVX512, KickAVX512, DriftAVX512, ScaleAVX512, LangevinDriftAVX512, KineticSumAVX512, ReflectAVX512, WrapAVX512, NonbondedAVX512, GaussianAVX512, PackInstancesAVX512, CullSpheresAVX512 };
+
+// ========================================================================================================================================
+// CPU feature detection
+
+	void Cpuid(int registers[4], int leaf, int subleaf) noexcept
+	{
+#if defined(_MSC_VER)
+		__cpuidex(registers, leaf, subleaf);
+#else
+		unsigned int eax, ebx, ecx, edx;
+		__cpuid_count(leaf, subleaf, eax, ebx, ecx, edx);
+		registers[0] = static_cast<int>(eax);
+		registers[1] = static_cast<int>(ebx);
+		registers[2] = static_cast<int>(ecx);
+		registers[3] = static_cast<int>(edx);
+#endif
+	}
+
+	unsigned long long ReadXCR0() noexcept
+	{
+#if defined(_MSC_VER)
+		return _xgetbv(0);
+#else
+		unsigned int eax, edx;
+		__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+	}
+}
+#endif // SIMD_KERNELS_X86
+
+// ========================================================================================================================================
+
+SimdLevel SimdKernels::DetectLevel() noexcept
+{
+#ifdef SIMD_KERNELS_X86
+	int registers[4];
+	Cpuid(registers, 0, 0);
+	const int maxLeaf = registers[0];
+	if (maxLeaf < 7)
+		return SimdLevel::Scalar;
+
+	Cpuid(registers, 1, 0);
+	const bool osxsave = (registers[2] & (1 << 27)) != 0;
+	const bool avx = (registers[2] & (1 << 28)) != 0;
+	const bool fma = (registers[2] & (1 << 12)) != 0;
+	if (!osxsave || !avx || !fma)
+		return SimdLevel::Scalar;
+
+	// The OS must save the YMM state (XCR0 bits 1-2) for AVX, and additionally opmask/ZMM state (bits 5-7) for AVX-512
+	const unsigned long long xcr0 = ReadXCR0();
+	if ((xcr0 & 0x6) != 0x6)
+		return SimdLevel::Scalar;
+
+	Cpuid(registers, 7, 0);
+	const bool avx2 = (registers[1] & (1 << 5)) != 0;
+	const bool avx512f = (registers[1] & (1 << 16)) != 0;
+
+	if (avx2 && avx512f && (xcr0 & 0xE6) == 0xE6)
+		return SimdLevel::AVX512;
+	if (avx2)
+		return SimdLevel::AVX2;
+#endif
+	return SimdLevel::Scalar;
+}
+
+const SimdKernelTable& SimdKernels::Get(SimdLevel level) noexcept
+{
+#ifdef SIMD_KERNELS_X86
+	switch (level)
+	{
+	case SimdLevel::AVX512: return AVX512Table;
+	case SimdLevel::AVX2:	return AVX2Table;
+	default: break;
+	}
+#else
+	(void)level;
+#endif
+	return ScalarTable;
+}
+
+const SimdKernelTable& SimdKernels::Best() noexcept
+{
+	static const SimdKernelTable& best = []() -> const SimdKernelTable&
+		{
+			// Walk down from the detected level until a table passes its self-test
+			for (int level = static_cast<int>(DetectLevel()); level > static_cast<int>(SimdLevel::Scalar); --level)
+			{
+				const SimdKernelTable& table = Get(static_cast<SimdLevel>(level));
+				if (table.level == static_cast<SimdLevel>(level) && SelfTest(table))
+					return table;
+			}
+			return ScalarTable;
+		}();
+
+	return best;
+}
+
+const char* SimdKernels::LevelName(SimdLevel level) noexcept
+{
+	switch (level)
+	{
+	case SimdLevel::AVX512: return "AVX-512";
+	case SimdLevel::AVX2:	return "AVX2";
+	default:				return "Scalar";
+	}
+}
+
+bool SimdKernels::SelfTest(const SimdKernelTable& table, float tolerance)
+{
+	std::mt19937 generator(12345u);
+	std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+
+	// Odd sizes so every kernel exercises its remainder path
+	const size_t count = 343 - 2;
+
+	auto maxAbs = [](const std::vector<float>& v) {
+		float m = 1.0f;
+		for (float value : v) m = std::max(m, std::abs(value));
+		return m;
+	};
+	auto matches = [&](const std::vector<float>& reference, const std::vector<float>& test) {
+		const float limit = tolerance * maxAbs(reference);
+		for (size_t iii = 0; iii < reference.size(); ++iii)
+			if (!(std::abs(reference[iii] - test[iii]) <= limit))
+				return false;
+		return true;
+	};
+
+	// Kick / Drift / Reflect ----------------------------------------------------------------------------
+	std::vector<float> x(count), v(count), f(count), inverseMass(count), radius(count);
+	for (size_t iii = 0; iii < count; ++iii)
+	{
+		x[iii] = 3.0f * uniform(generator);
+		v[iii] = uniform(generator);
+		f[iii] = 100.0f * uniform(generator);
+		inverseMass[iii] = 0.05f + 0.5f * (uniform(generator) + 1.0f);
+		radius[iii] = 0.1f + 0.05f * uniform(generator);
+	}
+
+	std::vector<float> vRef = v, vTest = v;
+	ScalarTable.Kick(vRef.data(), f.data(), inverseMass.data(), count, 0.002f);
+	table.Kick(vTest.data(), f.data(), inverseMass.data(), count, 0.002f);
+	if (!matches(vRef, vTest))
+		return false;
+
+	std::vector<float> xRef = x, xTest = x;
+	ScalarTable.Drift(xRef.data(), v.data(), count, 0.002f);
+	table.Drift(xTest.data(), v.data(), count, 0.002f);
+	if (!matches(xRef, xTest))
+		return false;
+
+	vRef = v;
+	vTest = v;
+	ScalarTable.Scale(vRef.data(), count, 0.997f);
+	table.Scale(vTest.data(), count, 0.997f);
+	if (!matches(vRef, vTest))
+		return false;
+
+	// v doubles as the Gaussian noise and inverseMass as the mass; every heat term is O(1)
+	xRef = x;
+	xTest = x;
+	vRef = v;
+	vTest = v;
+	const float heatRef = ScalarTable.LangevinDrift(xRef.data(), vRef.data(), v.data(), inverseMass.data(), inverseMass.data(), count, 0.001f, 0.998f, 0.06f);
+	const float heatTest = table.LangevinDrift(xTest.data(), vTest.data(), v.data(), inverseMass.data(), inverseMass.data(), count, 0.001f, 0.998f, 0.06f);
+	if (!(matches(xRef, xTest) && matches(vRef, vTest) && std::abs(heatRef - heatTest) <= tolerance * static_cast<float>(count)))
+		return false;
+
+	const float kineticRef = ScalarTable.KineticSum(v.data(), f.data(), x.data(), inverseMass.data(), count);
+	const float kineticTest = table.KineticSum(v.data(), f.data(), x.data(), inverseMass.data(), count);
+	if (!(std::abs(kineticRef - kineticTest) <= tolerance * kineticRef))
+		return false;
+
+	vRef = v;
+	vTest = v;
+	ScalarTable.Reflect(x.data(), vRef.data(), radius.data(), count, -2.5f, 2.5f);
+	table.Reflect(x.data(), vTest.data(), radius.data(), count, -2.5f, 2.5f);
+	if (vRef != vTest)
+		return false;
+
+	xRef = x;
+	xTest = x;
+	ScalarTable.Wrap(xRef.data(), count, -1.25f, 1.25f);
+	table.Wrap(xTest.data(), count, -1.25f, 1.25f);
+	if (!matches(xRef, xTest))
+		return false;
+
+	// Gaussian --------------------------------------------------------------------------------------------
+	// Philox known-answer vectors (Random123 kat_vectors), then the batches against the scalar reference. The step has
+	// bits in its high word and the first atom is odd so every counter word and lane offset is exercised.
+	if (Philox::Generate({ 0u, 0u, 0u, 0u }, { 0u, 0u }) != Philox::Counter{ 0x6627e8d5u, 0xe169c58du, 0xbc57ac4cu, 0x9b00dbd8u } ||
+		Philox::Generate({ 0x243f6a88u, 0x85a308d3u, 0x13198a2eu, 0x03707344u }, { 0xa4093822u, 0x299f31d0u }) != Philox::Counter{ 0xd16cfe09u, 0x94fdccebu, 0x5001e420u, 0x24126ea1u })
+		return false;
+
+	const Philox::Key key = Philox::KeyFromSeed(0x0123456789ABCDEFull);
+	const uint64_t step = 0x100000007ull;
+	std::vector<float> gxRef(count), gyRef(count), gzRef(count), gxTest(count), gyTest(count), gzTest(count);
+	ScalarTable.Gaussian(key, step, static_cast<uint32_t>(RandomStream::Langevin), 17u, count, gxRef.data(), gyRef.data(), gzRef.data());
+	table.Gaussian(key, step, static_cast<uint32_t>(RandomStream::Langevin), 17u, count, gxTest.data(), gyTest.data(), gzTest.data());
+	if (!(matches(gxRef, gxTest) && matches(gyRef, gyTest) && matches(gzRef, gzTest)))
+		return false;
+
+	// PackInstances --------------------------------------------------------------------------------------
+	// Also pure data movement; AtomInstance has no padding, so comparing bytes is exact
+	std::vector<Element> instanceType(count);
+	for (size_t iii = 0; iii < count; ++iii)
+		instanceType[iii] = static_cast<Element>(1 + iii % (ElementCount - 1));
+	std::vector<AtomInstance> instancesRef(count), instancesTest(count);
+	ScalarTable.PackInstances(x.data(), v.data(), f.data(), radius.data(), instanceType.data(), count, instancesRef.data());
+	table.PackInstances(x.data(), v.data(), f.data(), radius.data(), instanceType.data(), count, instancesTest.data());
+	if (std::memcmp(instancesRef.data(), instancesTest.data(), count * sizeof(AtomInstance)) != 0)
+		return false;
+
+	// CullSpheres ----------------------------------------------------------------------------------------
+	// x, v and f as positions inside a slanted box that cuts through them on every side. The kernels evaluate the planes
+	// in the same order without FMA, so the visible lists must agree exactly.
+	FrustumPlanes planes = {};
+	const float box[3] = { 2.0f, 0.6f, 60.0f };
+	for (int p = 0; p < 6; ++p)
+	{
+		const int axis = p / 2;
+		const float sign = (p % 2 == 0) ? 1.0f : -1.0f;
+		float normal[3] = { 0.1f, -0.2f, 0.003f };
+		normal[axis] = sign;
+		const float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		planes.a[p] = normal[0] / length;
+		planes.b[p] = normal[1] / length;
+		planes.c[p] = normal[2] / length;
+		planes.d[p] = box[axis] / length;
+	}
+	std::vector<uint32_t> visibleRef(count), visibleTest(count);
+	const size_t visibleCountRef = ScalarTable.CullSpheres(x.data(), v.data(), f.data(), radius.data(), count, 7, planes, visibleRef.data());
+	const size_t visibleCountTest = table.CullSpheres(x.data(), v.data(), f.data(), radius.data(), count, 7, planes, visibleTest.data());
+	if (visibleCountRef == 0 || visibleCountRef == count || visibleCountTest != visibleCountRef ||
+		!std::equal(visibleRef.begin(), visibleRef.begin() + visibleCountRef, visibleTest.begin()))
+		return false;
+
+	// Nonbonded ------------------------------------------------------------------------------------------
+	// Jittered lattice so no pair gets unphysically close, with random parameters for every element pair
+	std::vector<float> y(count), z(count), charge(count);
+	std::vector<Element> type(count);
+	for (size_t iii = 0; iii < count; ++iii)
+	{
+		x[iii] = 0.3f * static_cast<float>(iii % 7) + 0.03f * uniform(generator);
+		y[iii] = 0.3f * static_cast<float>((iii / 7) % 7) + 0.03f * uniform(generator);
+		z[iii] = 0.3f * static_cast<float>(iii / 49) + 0.03f * uniform(generator);
+		charge[iii] = 0.5f * uniform(generator);
+		type[iii] = static_cast<Element>(1 + iii % (ElementCount - 1));
+	}
+
+	// Soft cores around the lattice spacing, so some pairs are evaluated at the core and some at their distance
+	std::vector<float> c6(ElementCount * ElementCount), c12(ElementCount * ElementCount), softCoreR2(ElementCount * ElementCount);
+	std::vector<float> ljShift(ElementCount * ElementCount);
+	for (size_t iii = 0; iii < c6.size(); ++iii)
+	{
+		c6[iii] = 0.005f * (uniform(generator) + 1.5f);
+		c12[iii] = 0.00001f * (uniform(generator) + 1.5f);
+		const float softCore = 0.27f + 0.03f * uniform(generator);
+		softCoreR2[iii] = softCore * softCore;
+
+		// Shifted at the cutoff of 1 nm used below
+		ljShift[iii] = c12[iii] - c6[iii];
+	}
+
+	// Every Coulomb form, in open boundaries and in a periodic box slightly larger than the lattice so pairs across the
+	// faces interact through their images
+	const CoulombKernel coulombKernels[] = { CoulombKernel::None, CoulombKernel::Cutoff, CoulombKernel::ReactionField, CoulombKernel::ShiftedForce, CoulombKernel::Ewald };
+	for (int variant = 0; variant < 10; ++variant)
+	{
+		const bool periodic = variant % 2 == 1;
+		const CoulombKernel coulombKernel = coulombKernels[variant / 2];
+
+		SimulationBox box;
+		box.halfExtents = { 1.1f, 1.1f, 1.1f };
+		box.boundaries = periodic ? BoundaryConditions::Periodic : BoundaryConditions::Reflective;
+		const MinimumImage image = box.Image();
+
+		// Brute force half list of every pair inside the cutoff. Also sum the magnitude of every energy term, which is
+		// the natural scale for the rounding error of a sum taken in a different order.
+		const float cutoff = 1.0f;
+		const float coulombConstant = 138.935458f;
+		double energyScale = 1.0;
+		std::vector<unsigned int> offsets(count + 1, 0u), neighbors;
+		for (size_t iii = 0; iii < count; ++iii)
+		{
+			for (size_t jjj = iii + 1; jjj < count; ++jjj)
+			{
+				float dxf = x[iii] - x[jjj];
+				float dyf = y[iii] - y[jjj];
+				float dzf = z[iii] - z[jjj];
+				image.Apply(dxf, dyf, dzf);
+
+				double r2 = static_cast<double>(dxf) * dxf + static_cast<double>(dyf) * dyf + static_cast<double>(dzf) * dzf;
+				if (r2 >= cutoff * cutoff || r2 < 1e-12)
+					continue;
+
+				neighbors.push_back(static_cast<unsigned int>(jjj));
+
+				size_t pairIndex = static_cast<size_t>(type[iii]) * ElementCount + static_cast<size_t>(type[jjj]);
+				const double coreR2 = std::max(r2, static_cast<double>(softCoreR2[pairIndex]));
+				double invR6 = 1.0 / (coreR2 * coreR2 * coreR2);
+				const double lj12 = c12[pairIndex] * invR6 * invR6;
+				const double lj6 = c6[pairIndex] * invR6;
+				const double coulomb = std::abs(coulombConstant * charge[iii] * charge[jjj]) / std::sqrt(coreR2);
+
+				// Inside the soft core the energy also carries 1/2 (F / r) (rs^2 - r^2)
+				energyScale += lj12 + lj6 + std::abs(ljShift[pairIndex]) + coulomb + 0.5 * (12.0 * lj12 + 6.0 * lj6 + coulomb) / coreR2 * (coreR2 - r2);
+			}
+			offsets[iii + 1] = static_cast<unsigned int>(neighbors.size());
+		}
+
+		std::vector<float> fxRef(count, 0.0f), fyRef(count, 0.0f), fzRef(count, 0.0f);
+		std::vector<float> fxTest(count, 0.0f), fyTest(count, 0.0f), fzTest(count, 0.0f);
+
+		NonbondedKernelArgs args;
+		args.x = x.data();
+		args.y = y.data();
+		args.z = z.data();
+		args.charge = charge.data();
+		args.type = type.data();
+		args.offsets = offsets.data();
+		args.neighbors = neighbors.data();
+		args.c6 = c6.data();
+		args.c12 = c12.data();
+		args.softCoreR2 = softCoreR2.data();
+		args.ljShift = ljShift.data();
+		args.cutoff2 = cutoff * cutoff;
+		args.coulombConstant = coulombConstant;
+		args.image = image;
+		args.coulomb = coulombKernel;
+		args.ewaldCoefficient = 3.0f;
+		args.reactionFieldK = 0.49f / (cutoff * cutoff * cutoff);
+		args.reactionFieldC = 1.0f / cutoff + args.reactionFieldK * cutoff * cutoff;
+
+		args.fx = fxRef.data();
+		args.fy = fyRef.data();
+		args.fz = fzRef.data();
+		float energyRef = ScalarTable.Nonbonded(args, 0u, static_cast<unsigned int>(count));
+
+		args.fx = fxTest.data();
+		args.fy = fyTest.data();
+		args.fz = fzTest.data();
+		float energyTest = table.Nonbonded(args, 0u, static_cast<unsigned int>(count));
+
+		if (!(matches(fxRef, fxTest) && matches(fyRef, fyTest) && matches(fzRef, fzTest) &&
+			std::abs(energyRef - energyTest) <= tolerance * static_cast<float>(energyScale)))
+			return false;
+	}
+
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,156 @@
+#pragma once
+#include "pch.h"
+#include "Elements.h"
+#include "SimulationBox.h"
+#include "Philox.h"
+
+// Instruction set levels the simulation kernels are compiled for. The best level the CPU supports is picked once at
+// runtime, so a single binary runs on AVX2-only and AVX-512 hosts and falls back to scalar code everywhere else
+// (including ARM builds, where only the scalar kernels are compiled).
+enum class SimdLevel
+{
+	Scalar = 0,
+	AVX2 = 1,
+	AVX512 = 2
+};
+
+// Coulomb form of the nonbonded kernels. Every form is compiled into its own kernel instantiation, so the pair loop
+// carries no branch on it and switching forms between calls costs nothing.
+enum class CoulombKernel
+{
+	None,			// Lennard-Jones only; the electrostatics are computed elsewhere
+	Cutoff,			// q_i q_j / r, truncated at the cutoff
+	ReactionField,	// q_i q_j (1/r + k_rf r^2 - c_rf): the medium beyond the cutoff is a dielectric continuum
+	ShiftedForce,	// q_i q_j (1/r - 1/rc + (r - rc) / rc^2): energy and force both go smoothly to zero at the cutoff
+	Ewald			// q_i q_j erfc(beta r) / r, the real-space part of an Ewald sum
+};
+
+// Per-instance data of an atom as the instanced vertex shader reads it: the sphere's center and radius, from which the
+// shader rebuilds the world transform, and its material. 20 bytes against 64 for a world matrix.
+struct AtomInstance
+{
+	float x;
+	float y;
+	float z;
+	float radius;
+	uint32_t material;
+};
+static_assert(sizeof(AtomInstance) == 20, "AtomInstance must match the instance input layout");
+
+// The six planes a x + b y + c z + d = 0 bounding the view frustum, normals pointing inwards and of unit length, so
+// a x + b y + c z + d is the signed distance of a point from each plane
+struct FrustumPlanes
+{
+	float a[6];
+	float b[6];
+	float c[6];
+	float d[6];
+};
+
+// Everything the nonbonded kernel needs for one evaluation. Pair parameters are flattened ElementCount x ElementCount
+// tables indexed by (type_i * ElementCount + type_j). Forces are accumulated into fx/fy/fz (not overwritten).
+struct NonbondedKernelArgs
+{
+	const float* x = nullptr;
+	const float* y = nullptr;
+	const float* z = nullptr;
+	const float* charge = nullptr;
+	const Element* type = nullptr;
+
+	// Half neighbor list in compressed rows (see NeighborList)
+	const unsigned int* offsets = nullptr;
+	const unsigned int* neighbors = nullptr;
+
+	const float* c6 = nullptr;
+	const float* c12 = nullptr;
+
+	// Squared distance per element pair below which the pair is evaluated as if it were this far apart, so atoms placed
+	// on top of each other are pushed apart by a large but finite force instead of an infinite one
+	const float* softCoreR2 = nullptr;
+
+	// Lennard-Jones energy per element pair at the cutoff, c12 / rc^12 - c6 / rc^6. It is subtracted from the energy
+	// of every pair inside the cutoff so the energy does not jump as pairs cross it; the forces are unchanged.
+	const float* ljShift = nullptr;
+
+	float cutoff2 = 0.0f;
+	float coulombConstant = 0.0f;
+
+	// Displacements are wrapped to the nearest periodic image; the kernels use an unwrapped variant when not periodic
+	MinimumImage image;
+
+	CoulombKernel coulomb = CoulombKernel::Cutoff;
+
+	// beta in 1/nm for CoulombKernel::Ewald
+	float ewaldCoefficient = 0.0f;
+
+	// k_rf (1/nm^3) and c_rf (1/nm) for CoulombKernel::ReactionField
+	float reactionFieldK = 0.0f;
+	float reactionFieldC = 0.0f;
+
+	float* fx = nullptr;
+	float* fy = nullptr;
+	float* fz = nullptr;
+};
+
+// One implementation of every kernel for a given SimdLevel. The per-component kernels operate on a single x, y or z
+// array at a time so the same code serves all three dimensions.
+struct SimdKernelTable
+{
+	SimdLevel level;
+
+	// v += f * inverseMass * dt
+	void (*Kick)(float* v, const float* f, const float* inverseMass, size_t count, float dt) noexcept;
+
+	// x += v * dt
+	void (*Drift)(float* x, const float* v, size_t count, float dt) noexcept;
+
+	// v *= scale
+	void (*Scale)(float* v, size_t count, float scale) noexcept;
+
+	// The A-O-A middle of a BAOAB Langevin step: half drift, v = friction * v + noise * sqrt(inverseMass) * gaussian,
+	// half drift. Returns sum m (v'^2 - v^2), twice the kinetic energy the thermostat added.
+	float (*LangevinDrift)(float* x, float* v, const float* gaussian, const float* inverseMass, const float* mass, size_t count,
+						   float halfDt, float friction, float noise) noexcept;
+
+	// sum m (vx^2 + vy^2 + vz^2), twice the kinetic energy
+	float (*KineticSum)(const float* vx, const float* vy, const float* vz, const float* mass, size_t count) noexcept;
+
+	// Flips v wherever the sphere of the given radius pokes through either wall
+	void (*Reflect)(const float* x, float* v, const float* radius, size_t count, float wallMin, float wallMax) noexcept;
+
+	// Wraps coordinates into [boxMin, boxMax) for periodic boundaries
+	void (*Wrap)(float* x, size_t count, float boxMin, float boxMax) noexcept;
+
+	// Lennard-Jones + args.coulomb for the rows [rowBegin, rowEnd) of the neighbor list. Returns the potential energy.
+	float (*Nonbonded)(const NonbondedKernelArgs& args, unsigned int rowBegin, unsigned int rowEnd) noexcept;
+
+	// Three independent standard normal deviates for each atom first + i, i < count, from the Philox block at
+	// AtomCounter(first + i, step, stream). Every level draws the same numbers up to rounding.
+	void (*Gaussian)(Philox::Key key, uint64_t step, uint32_t stream, uint32_t first, size_t count, float* x, float* y, float* z) noexcept;
+
+	// Packs count atoms into AtomInstances; the material is the element's index into the renderer's materials (type - 1)
+	void (*PackInstances)(const float* x, const float* y, const float* z, const float* radius, const Element* type, size_t count, AtomInstance* instances) noexcept;
+
+	// Writes firstIndex + i for every sphere i of count that is at least partly inside the frustum to visible, in order,
+	// and returns how many there are. visible must have room for count indices.
+	size_t (*CullSpheres)(const float* x, const float* y, const float* z, const float* radius, size_t count, uint32_t firstIndex, const FrustumPlanes& planes, uint32_t* visible) noexcept;
+};
+
+class SimdKernels
+{
+public:
+	// Highest level supported by both the CPU/OS and this build
+	ND static SimdLevel DetectLevel() noexcept;
+
+	// Kernel table for a specific level. Requesting a level the build does not include returns the scalar table.
+	ND static const SimdKernelTable& Get(SimdLevel level) noexcept;
+
+	// Best table for this machine that also passes SelfTest. Detection and testing only happen on the first call.
+	ND static const SimdKernelTable& Best() noexcept;
+
+	// Runs every kernel of the table on synthetic data and compares against the scalar reference. Returns false if
+	// any result differs by more than the relative tolerance.
+	ND static bool SelfTest(const SimdKernelTable& table, float tolerance = 1e-4f);
+
+	ND static const char* LevelName(SimdLevel level) noexcept;
+};
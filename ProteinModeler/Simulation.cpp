@@ -1,51 +1,748 @@
 #include "pch.h"
 #include "Simulation.h"
+#include <numeric>
 
 
+namespace
+{
+	// values[k] = values[order[k]] for every k
+	template<typename T>
+	void PermuteArray(AlignedVector<T>& values, const uint32_t* order, AlignedVector<T>& scratch, ThreadPool& pool)
+	{
+		scratch.resize(values.size());
+		pool.ParallelFor(0, values.size(), [&](unsigned int, size_t begin, size_t end)
+			{
+				for (size_t iii = begin; iii < end; ++iii)
+					scratch[iii] = values[order[iii]];
+			}
+		);
+		std::swap(values, scratch);
+	}
+
+	// PME needs a periodic box and the octree open boundaries. Either one on the wrong box falls back to reaction field,
+	// the cutoff form that works with both.
+	CoulombMethod CompatibleCoulombMethod(CoulombMethod method, const SimulationBox& box) noexcept
+	{
+		if ((method == CoulombMethod::PME && !box.IsPeriodic()) || (method == CoulombMethod::BarnesHut && box.IsPeriodic()))
+			return CoulombMethod::ReactionField;
+		return method;
+	}
+}
 
-Simulation::Simulation() noexcept :
-	m_isPaused(true),
-	m_boxMax(3.0f)
+
+Simulation::Simulation() :
+	m_reorderInterval(1000),
+	m_stepsSinceReorder(0),
+	m_reorderCurve(SpaceFillingCurve::Hilbert),
+	m_reorderCount(0),
+	m_kernels(&SimdKernels::Best()),
+	m_threadPool(std::make_unique<ThreadPool>()),
+	m_coulombMethod(CoulombMethod::Cutoff),
+	m_constraintTargets(ConstraintTargets::None),
+	m_constraintsDirty(false),
+	m_potentialEnergy(0.0f),
+	m_fastPotentialEnergy(0.0f),
+	m_slowPotentialEnergy(0.0f),
+	m_forcesValid(false),
+	m_respaMultiplier(1),
+	m_energyDiagnostics(false),
+	m_timeStep(0.002f),
+	m_substepsPerFrame(10),
+	m_pendingTimesteps(0),
+	m_stepCount(0),
+	m_randomSeed(0),
+	m_thermostat(Thermostat::None),
+	m_targetTemperature(300.0f),
+	m_langevinFriction(1.0f),
+	m_thermostatEnergy(0.0),
+	m_kineticEnergy(0.0),
+	m_kineticEnergyValid(false),
+	m_throughputStepCount(0),
+	m_integrationWallSeconds(0.0),
+	m_isPaused(true)
 {}
 
-size_t Simulation::Add(Element element, const DirectX::XMFLOAT3& position, const DirectX::XMFLOAT3& velocity) noexcept
+AtomHandle Simulation::Add(Element element, const DirectX::XMFLOAT3& position, const DirectX::XMFLOAT3& velocity, float charge)
+{
+	AtomHandle handle;
+	const AtomDescription atom = { element, position, velocity, charge };
+	AddAtoms(&atom, 1, &handle);
+	return handle;
+}
+
+void Simulation::Remove(AtomHandle handle)
+{
+	RemoveAtoms(&handle, 1);
+}
+
+void Simulation::AddAtoms(const AtomDescription* atoms, size_t count, AtomHandle* handles)
+{
+	const size_t first = m_particles.Size();
+	m_particles.Resize(first + count);
+	m_atomSlots.resize(first + count);
+	m_atomHandles.Reserve(m_atomHandles.Size() + count);
+
+	for (size_t iii = 0; iii < count; ++iii)
+	{
+		const AtomHandle handle = m_atomHandles.Insert(static_cast<uint32_t>(first + iii));
+		m_atomSlots[first + iii] = handle.slot;
+		if (handles != nullptr)
+			handles[iii] = handle;
+	}
+
+	m_threadPool->ParallelFor(0, count, [&](unsigned int, size_t begin, size_t end)
+		{
+			for (size_t iii = begin; iii < end; ++iii)
+				m_particles.Set(first + iii, atoms[iii].element, atoms[iii].position, atoms[iii].velocity, atoms[iii].charge);
+		}
+	);
+
+	m_forcesValid = false;
+	m_kineticEnergyValid = false;
+}
+
+void Simulation::RemoveAtoms(const AtomHandle* handles, size_t count)
+{
+	// Stale handles are skipped, and so is every repeat of a handle because the first one erases it. Erasing a dead slot
+	// would flip its generation back to live and free whichever atom the slot is reused by.
+	std::vector<uint32_t> removed;
+	removed.reserve(count);
+	for (size_t iii = 0; iii < count; ++iii)
+	{
+		if (!m_atomHandles.Contains(handles[iii]))
+			continue;
+
+		removed.push_back(m_atomHandles.IndexOf(handles[iii]));
+		m_atomHandles.Erase(handles[iii]);
+	}
+	if (removed.empty())
+		return;
+
+	// Highest index first: every atom above the one being removed is then known to stay, so the last atom can always be
+	// moved into the gap. origin tracks where each remaining atom started, for renumbering the topology.
+	std::sort(removed.begin(), removed.end(), std::greater<uint32_t>());
+
+	const size_t atomCount = m_particles.Size();
+	const bool hasSlowForces = m_slowFx.size() == atomCount;
+	const bool hasTopology = !m_topology.Empty();
+	std::vector<uint32_t> origin;
+	if (hasTopology)
+	{
+		origin.resize(atomCount);
+		std::iota(origin.begin(), origin.end(), 0u);
+	}
+
+	for (uint32_t index : removed)
+	{
+		const uint32_t last = static_cast<uint32_t>(m_particles.Size() - 1);
+		m_particles.SwapAndPop(index);
+		if (hasSlowForces)
+		{
+			for (AlignedVector<float>* values : { &m_slowFx, &m_slowFy, &m_slowFz })
+			{
+				(*values)[index] = values->back();
+				values->pop_back();
+			}
+		}
+		m_atomSlots[index] = m_atomSlots[last];
+		m_atomSlots.pop_back();
+		if (index != last)
+			m_atomHandles.SetIndex(m_atomSlots[index], index);
+		if (hasTopology)
+		{
+			origin[index] = origin[last];
+			origin.pop_back();
+		}
+	}
+
+	if (hasTopology)
+	{
+		std::vector<uint32_t> newIndex(atomCount, Topology::RemovedAtom);
+		for (size_t iii = 0; iii < origin.size(); ++iii)
+			newIndex[origin[iii]] = static_cast<uint32_t>(iii);
+		m_topology.Remap(newIndex);
+		m_constraintsDirty = true;
+	}
+	m_nonbonded.Neighbors().Invalidate();
+
+	m_forcesValid = false;
+	m_kineticEnergyValid = false;
+}
+
+void Simulation::WriteInstances(size_t first, size_t count, AtomInstance* instances)
+{
+	WINRT_ASSERT(first + count <= m_particles.Size());
+	m_threadPool->ParallelFor(first, first + count, [&](unsigned int, size_t begin, size_t end)
+		{
+			m_kernels->PackInstances(m_particles.x.data() + begin, m_particles.y.data() + begin, m_particles.z.data() + begin,
+				m_particles.radius.data() + begin, m_particles.type.data() + begin, end - begin, instances + (begin - first));
+		}
+	);
+}
+
+void Simulation::GatherInstances(const uint32_t* indices, size_t count, AtomInstance* instances)
+{
+	// A gather, which the SIMD kernels would only do lane by lane, so it stays a plain loop. The renderer's index lists
+	// are built before the frame is drawn; should atoms have been removed since, indices past the end are written as
+	// zero-radius instances, which cover no pixels, instead of being read out of bounds.
+	const size_t atomCount = m_particles.Size();
+	m_threadPool->ParallelFor(0, count, [&](unsigned int, size_t begin, size_t end)
+		{
+			for (size_t iii = begin; iii < end; ++iii)
+			{
+				const uint32_t atom = indices[iii];
+				if (atom < atomCount)
+					instances[iii] = { m_particles.x[atom], m_particles.y[atom], m_particles.z[atom], m_particles.radius[atom], static_cast<uint32_t>(m_particles.type[atom]) - 1u };
+				else
+					instances[iii] = { 0.0f, 0.0f, 0.0f, 0.0f, 0u };
+			}
+		}
+	);
+}
+
+void Simulation::SetSimdLevel(SimdLevel level) noexcept
+{
+	m_kernels = &SimdKernels::Get(level);
+	m_nonbonded.SetKernels(*m_kernels);
+}
+
+void Simulation::SetTimeStepFemtoseconds(float femtoseconds) noexcept
+{
+	WINRT_ASSERT(femtoseconds > 0.0f);
+	m_timeStep = 0.001f * femtoseconds;
+}
+
+void Simulation::SetRespaMultiplier(unsigned int multiplier) noexcept
+{
+	WINRT_ASSERT(multiplier > 0);
+	m_respaMultiplier = multiplier;
+}
+
+void Simulation::SetFastForceFn(const std::function<float(ParticleArrays&, ThreadPool&)>& fn)
+{
+	m_fastForceFn = fn;
+	m_forcesValid = false;
+}
+
+void Simulation::SetConstraintTargets(ConstraintTargets targets) noexcept
+{
+	m_constraintTargets = targets;
+	m_constraintsDirty = true;
+}
+
+void Simulation::SetBox(const SimulationBox& box) noexcept
+{
+	WINRT_ASSERT(box.halfExtents.x > 0.0f && box.halfExtents.y > 0.0f && box.halfExtents.z > 0.0f);
+	m_box = box;
+	m_forcesValid = false;
+
+	// Switching the boundaries can rule out the requested Coulomb method, or allow it again
+	UpdateCoulombMethod();
+}
+
+void Simulation::SetBoundaryConditions(BoundaryConditions boundaries) noexcept
+{
+	SimulationBox box = m_box;
+	box.boundaries = boundaries;
+	SetBox(box);
+}
+
+void Simulation::SetBoxMax(float boxMax) noexcept
+{
+	SimulationBox box = m_box;
+	box.halfExtents = { boxMax, boxMax, boxMax };
+	SetBox(box);
+}
+
+void Simulation::SetCoulombMethod(CoulombMethod method) noexcept
+{
+	m_coulombMethod = method;
+	UpdateCoulombMethod();
+}
+
+void Simulation::UpdateCoulombMethod() noexcept
+{
+	const CoulombMethod method = CompatibleCoulombMethod(m_coulombMethod, m_box);
+	if (method == m_nonbonded.Coulomb())
+		return;
+
+	m_nonbonded.SetCoulombMethod(method);
+	m_forcesValid = false;
+	m_energyMonitor.Reset();
+}
+
+void Simulation::SetThermostat(Thermostat thermostat) noexcept
+{
+	m_thermostat = thermostat;
+	m_noseHoover.Reset();
+	m_thermostatEnergy = 0.0;
+	m_energyMonitor.Reset();
+}
+
+void Simulation::SetTargetTemperature(float kelvin) noexcept
+{
+	WINRT_ASSERT(kelvin >= 0.0f);
+	m_targetTemperature = kelvin;
+	m_energyMonitor.Reset();
+}
+
+void Simulation::SetEnergyDiagnostics(bool enabled) noexcept
+{
+	m_energyDiagnostics = enabled;
+	m_energyMonitor.Reset();
+}
+
+double Simulation::KineticEnergy()
+{
+	// One padded partial sum per thread so the reduction does not false-share. Each chunk is summed in float by the
+	// SIMD kernel and the chunks in double.
+	m_threadSums.assign(m_threadPool->ThreadCount(), ThreadSum());
+	m_threadPool->ParallelFor(0, m_particles.Size(), [&](unsigned int threadIndex, size_t begin, size_t end)
+		{
+			m_threadSums[threadIndex].kinetic += m_kernels->KineticSum(m_particles.vx.data() + begin, m_particles.vy.data() + begin,
+				m_particles.vz.data() + begin, m_particles.mass.data() + begin, end - begin);
+		}
+	);
+
+	double total = 0.0;
+	for (const ThreadSum& partial : m_threadSums)
+		total += partial.kinetic;
+
+	m_kineticEnergy = 0.5 * total;
+	m_kineticEnergyValid = true;
+	return m_kineticEnergy;
+}
+
+double Simulation::DegreesOfFreedom() const noexcept
+{
+	const double constrained = static_cast<double>(m_constraints.Count()) + (m_box.IsPeriodic() ? 3.0 : 0.0);
+	return std::max(0.0, 3.0 * static_cast<double>(m_particles.Size()) - constrained);
+}
+
+double Simulation::Temperature()
+{
+	const double degreesOfFreedom = DegreesOfFreedom();
+	if (degreesOfFreedom <= 0.0)
+		return 0.0;
+
+	return 2.0 * KineticEnergy() / (degreesOfFreedom * BoltzmannConstant);
+}
+
+void Simulation::AssignMaxwellBoltzmannVelocities(float kelvin)
 {
-	m_elementTypes.push_back(element);
-	m_positions.push_back(position);
-	m_velocities.push_back(velocity);
+	WINRT_ASSERT(kelvin >= 0.0f);
+
+	// Each velocity component is normal with variance kB T / m. The momentum and mass sums for the center of mass
+	// velocity are taken in the same pass.
+	struct alignas(64) PartialMomentum
+	{
+		double px = 0.0;
+		double py = 0.0;
+		double pz = 0.0;
+		double mass = 0.0;
+	};
+	std::vector<PartialMomentum> partials(m_threadPool->ThreadCount());
+
+	const Philox::Key key = Philox::KeyFromSeed(m_randomSeed);
+	const float kT = BoltzmannConstant * kelvin;
+	m_threadPool->ParallelFor(0, m_particles.Size(), [&](unsigned int threadIndex, size_t begin, size_t end)
+		{
+			float* vx = m_particles.vx.data();
+			float* vy = m_particles.vy.data();
+			float* vz = m_particles.vz.data();
+			m_kernels->Gaussian(key, m_stepCount, static_cast<uint32_t>(RandomStream::MaxwellBoltzmann), static_cast<uint32_t>(begin),
+				end - begin, vx + begin, vy + begin, vz + begin);
+
+			PartialMomentum sum;
+			for (size_t iii = begin; iii < end; ++iii)
+			{
+				const float scale = std::sqrt(kT * m_particles.inverseMass[iii]);
+				vx[iii] *= scale;
+				vy[iii] *= scale;
+				vz[iii] *= scale;
+
+				const float mass = m_particles.mass[iii];
+				sum.px += static_cast<double>(mass * vx[iii]);
+				sum.py += static_cast<double>(mass * vy[iii]);
+				sum.pz += static_cast<double>(mass * vz[iii]);
+				sum.mass += static_cast<double>(mass);
+			}
+			partials[threadIndex].px += sum.px;
+			partials[threadIndex].py += sum.py;
+			partials[threadIndex].pz += sum.pz;
+			partials[threadIndex].mass += sum.mass;
+		}
+	);
+
+	PartialMomentum total;
+	for (const PartialMomentum& partial : partials)
+	{
+		total.px += partial.px;
+		total.py += partial.py;
+		total.pz += partial.pz;
+		total.mass += partial.mass;
+	}
+
+	if (total.mass > 0.0)
+	{
+		const float comX = static_cast<float>(total.px / total.mass);
+		const float comY = static_cast<float>(total.py / total.mass);
+		const float comZ = static_cast<float>(total.pz / total.mass);
+		m_threadPool->ParallelFor(0, m_particles.Size(), [&](unsigned int, size_t begin, size_t end)
+			{
+				for (size_t iii = begin; iii < end; ++iii)
+				{
+					m_particles.vx[iii] -= comX;
+					m_particles.vy[iii] -= comY;
+					m_particles.vz[iii] -= comZ;
+				}
+			}
+		);
+	}
+
+	// Constraints that are not built yet project the velocities when they are, at the start of the next step
+	if (m_constraints.Count() > 0 && !m_constraintsDirty)
+		m_constraints.ApplyVelocities(m_particles, *m_threadPool);
 
-	// return the index of the most recent atom
-	return m_elementTypes.size() - 1;
+	m_kineticEnergyValid = false;
+	m_energyMonitor.Reset();
 }
 
-void Simulation::Update(const Timer& timer)
+void Simulation::SetSubstepsPerFrame(unsigned int substeps) noexcept
 {
-	WINRT_ASSERT(m_positions.size() == m_velocities.size());
-	WINRT_ASSERT(m_positions.size() == m_elementTypes.size());
+	WINRT_ASSERT(substeps > 0);
+	m_substepsPerFrame = substeps;
+}
+
+double Simulation::NanosecondsPerDay() const noexcept
+{
+	if (m_integrationWallSeconds <= 0.0)
+		return 0.0;
 
-	float timeDelta = static_cast<float>(timer.GetElapsedSeconds());
+	// (ps simulated / 1000) ns per wall second, times 86400 seconds per day
+	const double simulatedNanoseconds = 0.001 * static_cast<double>(m_timeStep) * m_throughputStepCount;
+	return simulatedNanoseconds * 86400.0 / m_integrationWallSeconds;
+}
+
+void Simulation::ResetThroughput() noexcept
+{
+	m_throughputStepCount = 0;
+	m_integrationWallSeconds = 0.0;
+}
 
+void Simulation::Update(const Timer& /* timer */)
+{
+	// The physical timestep is fixed and independent of the frame time, so trajectories are reproducible no matter how
+	// fast the app renders. The Timer should be in fixed timestep mode so that Update is called at a steady rate.
 	if (m_isPaused)
 		return;
 
-	if (timeDelta > 0.1)
+	auto start = std::chrono::steady_clock::now();
+
+	// With RESPA every Step covers m_respaMultiplier inner timesteps. The remainder is owed to the next frame, so every
+	// frame advances by m_substepsPerFrame timesteps on average whatever the multiplier.
+	const uint64_t firstStep = m_stepCount;
+	m_pendingTimesteps += m_substepsPerFrame;
+	while (m_pendingTimesteps >= m_respaMultiplier)
+	{
+		Step();
+		m_pendingTimesteps -= m_respaMultiplier;
+	}
+
+	m_integrationWallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	m_throughputStepCount += m_stepCount - firstStep;
+}
+
+void Simulation::Step()
+{
+	// Impulse r-RESPA. The slow (nonbonded) forces are applied as half kicks of k * dt / 2 around k inner velocity-Verlet
+	// steps that only see the fast forces. With k == 1 this reduces to plain velocity Verlet. Forces from the end of the
+	// previous step are reused for the opening half kicks, so both groups are evaluated once per outer step.
+	m_constraints.SetImage(m_box.Image());
+	if (!m_topology.IsFinalized() || m_constraintsDirty)
+		PrepareTopology();
+
+	if (m_reorderInterval > 0 && m_stepsSinceReorder >= m_reorderInterval)
+		ReorderAtoms();
+
+	if (!m_forcesValid)
+	{
+		ComputeFastForces();
+		ComputeSlowForces();
+		m_forcesValid = true;
+	}
+
+	const float innerHalfStep = 0.5f * m_timeStep;
+	const float outerHalfStep = innerHalfStep * m_respaMultiplier;
+	const float fastHalfStep = HasFastForces() ? innerHalfStep : 0.0f;
+	const bool constrained = m_constraints.Count() > 0;
+	const bool noseHoover = m_thermostat == Thermostat::NoseHooverChain;
+	const double kT = static_cast<double>(BoltzmannConstant) * m_targetTemperature;
+
+	// The whole Nose-Hoover chain step (both Trotter halves) is applied ahead of the Verlet part, against the kinetic
+	// energy summed at the end of the previous step; a cyclic shift of the symmetric splitting with the same dynamics
+	float velocityScale = 1.0f;
+	if (noseHoover)
+	{
+		const double kinetic = m_kineticEnergyValid ? m_kineticEnergy : KineticEnergy();
+		velocityScale = m_noseHoover.Propagate(kinetic, DegreesOfFreedom(), kT, 2.0 * outerHalfStep);
+	}
+	m_kineticEnergyValid = false;
+
+	// With constraints the closing velocity projection comes after the pass, so the kinetic energy is summed separately
+	const bool sumKinetic = (noseHoover || m_energyDiagnostics) && !constrained;
+	double kinetic = 0.0;
+
+	for (unsigned int iii = 0; iii < m_respaMultiplier; ++iii)
+	{
+		const bool first = iii == 0;
+		const bool last = iii == m_respaMultiplier - 1;
+
+		if (constrained)
+			m_constraints.SaveReference(m_particles, *m_threadPool);
+
+		Integrate(first ? outerHalfStep : 0.0f, fastHalfStep, m_timeStep, first ? velocityScale : 1.0f, m_stepCount + iii, false);
+
+		if (constrained)
+			m_constraints.ApplyPositions(m_particles, *m_threadPool, m_timeStep);
+
+		ComputeFastForces();
+		if (last)
+			ComputeSlowForces();
+
+		kinetic = Integrate(last ? outerHalfStep : 0.0f, fastHalfStep, 0.0f, 1.0f, 0, last && sumKinetic);
+
+		if (constrained)
+			m_constraints.ApplyVelocities(m_particles, *m_threadPool);
+	}
+
+	if (sumKinetic)
+	{
+		m_kineticEnergy = kinetic;
+		m_kineticEnergyValid = true;
+	}
+
+	m_stepCount += m_respaMultiplier;
+	m_stepsSinceReorder += m_respaMultiplier;
+	m_potentialEnergy = m_fastPotentialEnergy + m_slowPotentialEnergy;
+
+	if (noseHoover)
+		m_thermostatEnergy = m_noseHoover.Energy(DegreesOfFreedom(), kT);
+
+	// Both force groups and the velocities are synchronized here, so this is the only point where the total energy is meaningful
+	if (m_energyDiagnostics)
+		m_energyMonitor.AddSample(SimulatedPicoseconds(), (m_kineticEnergyValid ? m_kineticEnergy : KineticEnergy()) + m_potentialEnergy + m_thermostatEnergy);
+}
+
+double Simulation::Integrate(float slowKick, float fastKick, float drift, float velocityScale, uint64_t noiseStep, bool sumKinetic)
+{
+	// BAOAB: friction and noise for the inner timestep, with the noise scaled by sqrt(kB T / m) per atom in the kernel
+	const bool langevin = m_thermostat == Thermostat::Langevin && drift != 0.0f;
+	const float friction = std::exp(-m_langevinFriction * drift);
+	const float noise = std::sqrt((1.0f - friction * friction) * BoltzmannConstant * m_targetTemperature);
+	const Philox::Key key = Philox::KeyFromSeed(m_randomSeed);
+
+	m_threadSums.assign(m_threadPool->ThreadCount(), ThreadSum());
+	m_threadPool->ParallelFor(0, m_particles.Size(), [&](unsigned int threadIndex, size_t begin, size_t end)
+		{
+			const size_t count = end - begin;
+			const float* inverseMass = m_particles.inverseMass.data() + begin;
+
+			float* vx = m_particles.vx.data() + begin;
+			float* vy = m_particles.vy.data() + begin;
+			float* vz = m_particles.vz.data() + begin;
+
+			if (velocityScale != 1.0f)
+			{
+				m_kernels->Scale(vx, count, velocityScale);
+				m_kernels->Scale(vy, count, velocityScale);
+				m_kernels->Scale(vz, count, velocityScale);
+			}
+
+			if (slowKick != 0.0f)
+			{
+				m_kernels->Kick(vx, m_slowFx.data() + begin, inverseMass, count, slowKick);
+				m_kernels->Kick(vy, m_slowFy.data() + begin, inverseMass, count, slowKick);
+				m_kernels->Kick(vz, m_slowFz.data() + begin, inverseMass, count, slowKick);
+			}
+
+			if (fastKick != 0.0f)
+			{
+				m_kernels->Kick(vx, m_particles.fx.data() + begin, inverseMass, count, fastKick);
+				m_kernels->Kick(vy, m_particles.fy.data() + begin, inverseMass, count, fastKick);
+				m_kernels->Kick(vz, m_particles.fz.data() + begin, inverseMass, count, fastKick);
+			}
+
+			if (drift != 0.0f)
+			{
+				const float* radius = m_particles.radius.data() + begin;
+				float* x = m_particles.x.data() + begin;
+				float* y = m_particles.y.data() + begin;
+				float* z = m_particles.z.data() + begin;
+
+				if (langevin)
+				{
+					// Noise is drawn in blocks small enough to stay in L1 next to the chunk being integrated
+					const float* mass = m_particles.mass.data() + begin;
+					alignas(64) float gaussianX[NoiseBlockSize];
+					alignas(64) float gaussianY[NoiseBlockSize];
+					alignas(64) float gaussianZ[NoiseBlockSize];
+					double heat = 0.0;
+					for (size_t block = 0; block < count; block += NoiseBlockSize)
+					{
+						const size_t blockCount = std::min(NoiseBlockSize, count - block);
+						m_kernels->Gaussian(key, noiseStep, static_cast<uint32_t>(RandomStream::Langevin), static_cast<uint32_t>(begin + block),
+							blockCount, gaussianX, gaussianY, gaussianZ);
+
+						const float halfDrift = 0.5f * drift;
+						heat += m_kernels->LangevinDrift(x + block, vx + block, gaussianX, inverseMass + block, mass + block, blockCount, halfDrift, friction, noise);
+						heat += m_kernels->LangevinDrift(y + block, vy + block, gaussianY, inverseMass + block, mass + block, blockCount, halfDrift, friction, noise);
+						heat += m_kernels->LangevinDrift(z + block, vz + block, gaussianZ, inverseMass + block, mass + block, blockCount, halfDrift, friction, noise);
+					}
+					m_threadSums[threadIndex].heat += 0.5 * heat;
+				}
+				else
+				{
+					m_kernels->Drift(x, vx, count, drift);
+					m_kernels->Drift(y, vy, count, drift);
+					m_kernels->Drift(z, vz, count, drift);
+				}
+
+				const DirectX::XMFLOAT3& half = m_box.halfExtents;
+				if (m_box.IsPeriodic())
+				{
+					m_kernels->Wrap(x, count, -half.x, half.x);
+					m_kernels->Wrap(y, count, -half.y, half.y);
+					m_kernels->Wrap(z, count, -half.z, half.z);
+				}
+				else
+				{
+					m_kernels->Reflect(x, vx, radius, count, -half.x, half.x);
+					m_kernels->Reflect(y, vy, radius, count, -half.y, half.y);
+					m_kernels->Reflect(z, vz, radius, count, -half.z, half.z);
+				}
+			}
+
+			if (sumKinetic)
+				m_threadSums[threadIndex].kinetic += m_kernels->KineticSum(vx, vy, vz, m_particles.mass.data() + begin, count);
+		}
+	);
+
+	double kinetic = 0.0;
+	for (const ThreadSum& partial : m_threadSums)
+	{
+		kinetic += partial.kinetic;
+		m_thermostatEnergy -= partial.heat;
+	}
+	return 0.5 * kinetic;
+}
+
+void Simulation::ReorderAtoms()
+{
+	const size_t count = m_particles.Size();
+	m_stepsSinceReorder = 0;
+	if (count < 2)
 		return;
 
-	float radius = 0.0f;
-	for (unsigned int iii = 0; iii < m_positions.size(); ++iii)
+	m_spatialSort.Sort(m_particles.x.data(), m_particles.y.data(), m_particles.z.data(), count, m_reorderCurve, *m_threadPool);
+	const uint32_t* order = m_spatialSort.Order().data();
+
+	for (AlignedVector<float>* values : { &m_particles.x, &m_particles.y, &m_particles.z, &m_particles.vx, &m_particles.vy, &m_particles.vz,
+										  &m_particles.fx, &m_particles.fy, &m_particles.fz, &m_particles.radius, &m_particles.mass,
+										  &m_particles.inverseMass, &m_particles.charge })
+		PermuteArray(*values, order, m_reorderScratch, *m_threadPool);
+
+	// The slow forces are only allocated once they have been computed
+	if (m_slowFx.size() == count)
 	{
-		radius = AtomicRadii[static_cast<int>(m_elementTypes[iii])];
+		PermuteArray(m_slowFx, order, m_reorderScratch, *m_threadPool);
+		PermuteArray(m_slowFy, order, m_reorderScratch, *m_threadPool);
+		PermuteArray(m_slowFz, order, m_reorderScratch, *m_threadPool);
+	}
 
-		m_positions[iii].x += m_velocities[iii].x * timeDelta;
-		if (m_positions[iii].x + radius > m_boxMax || m_positions[iii].x - radius < -m_boxMax)
-			m_velocities[iii].x *= -1;
+	AlignedVector<Element> typeScratch;
+	PermuteArray(m_particles.type, order, typeScratch, *m_threadPool);
+	AlignedVector<uint32_t> slotScratch;
+	PermuteArray(m_atomSlots, order, slotScratch, *m_threadPool);
 
-		m_positions[iii].y += m_velocities[iii].y * timeDelta;
-		if (m_positions[iii].y + radius > m_boxMax || m_positions[iii].y - radius < -m_boxMax)
-			m_velocities[iii].y *= -1;
+	for (size_t iii = 0; iii < count; ++iii)
+		m_atomHandles.SetIndex(m_atomSlots[iii], static_cast<uint32_t>(iii));
 
-		m_positions[iii].z += m_velocities[iii].z * timeDelta;
-		if (m_positions[iii].z + radius > m_boxMax || m_positions[iii].z - radius < -m_boxMax)
-			m_velocities[iii].z *= -1;
+	// Everything that refers to atoms by index follows. The constraints are already satisfied, so they are only rebuilt.
+	if (!m_topology.Empty())
+	{
+		std::vector<uint32_t> newIndex(count);
+		for (size_t iii = 0; iii < count; ++iii)
+			newIndex[order[iii]] = static_cast<uint32_t>(iii);
+		m_topology.Remap(newIndex);
+
+		std::vector<unsigned int> offsets;
+		std::vector<unsigned int> excluded;
+		m_topology.BuildExclusions(count, ExclusionBondSeparation, offsets, excluded);
+		m_nonbonded.SetExclusions(std::move(offsets), std::move(excluded));
+
+		if (m_constraints.Count() > 0)
+			m_constraints.Build(m_topology, m_particles, m_constraintTargets);
+	}
+	m_nonbonded.Neighbors().Invalidate();
+
+	++m_reorderCount;
+}
+
+void Simulation::PrepareTopology()
+{
+	m_topology.Finalize();
+
+	std::vector<unsigned int> offsets;
+	std::vector<unsigned int> excluded;
+	m_topology.BuildExclusions(m_particles.Size(), ExclusionBondSeparation, offsets, excluded);
+	m_nonbonded.SetExclusions(std::move(offsets), std::move(excluded));
+
+	// Start from a state that satisfies the constraints, without turning the initial correction into velocity
+	m_constraints.Build(m_topology, m_particles, m_constraintTargets);
+	if (m_constraints.Count() > 0)
+	{
+		m_constraints.SaveReference(m_particles, *m_threadPool);
+		m_constraints.ApplyPositions(m_particles, *m_threadPool, 0.0f);
+		m_constraints.ApplyVelocities(m_particles, *m_threadPool);
 	}
+	m_constraintsDirty = false;
+
+	m_forcesValid = false;
+	m_kineticEnergyValid = false;
+}
+
+void Simulation::ComputeFastForces()
+{
+	// The fast group accumulates directly into the particle force arrays
+	m_fastPotentialEnergy = 0.0f;
+	if (!HasFastForces())
+		return;
+
+	m_particles.ZeroForces();
+
+	if (!m_topology.Empty())
+		m_fastPotentialEnergy += m_topology.Compute(m_particles, *m_threadPool, m_box.Image());
+
+	if (m_fastForceFn)
+		m_fastPotentialEnergy += m_fastForceFn(m_particles, *m_threadPool);
+}
+
+void Simulation::ComputeSlowForces()
+{
+	// Force terms accumulate into the particle force arrays, so swap the slow buffers in for the evaluation
+	std::swap(m_particles.fx, m_slowFx);
+	std::swap(m_particles.fy, m_slowFy);
+	std::swap(m_particles.fz, m_slowFz);
+
+	m_particles.fx.resize(m_particles.Size());
+	m_particles.fy.resize(m_particles.Size());
+	m_particles.fz.resize(m_particles.Size());
+	m_particles.ZeroForces();
+
+	m_slowPotentialEnergy = m_nonbonded.Compute(m_particles, m_box, *m_threadPool);
+
+	std::swap(m_particles.fx, m_slowFx);
+	std::swap(m_particles.fy, m_slowFy);
+	std::swap(m_particles.fz, m_slowFz);
 }
\ No newline at end of file
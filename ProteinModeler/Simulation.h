@@ -1,66 +1,276 @@
 #pragma once
 #include "pch.h"
 #include "Timer.h"
+#include "Elements.h"
+#include "ParticleArrays.h"
+#include "NonbondedForce.h"
+#include "SimdKernels.h"
+#include "ThreadPool.h"
+#include "EnergyMonitor.h"
+#include "Topology.h"
+#include "Constraints.h"
+#include "SimulationBox.h"
+#include "Thermostat.h"
+#include "SpatialSort.h"
+#include "SlotMap.h"
 
-enum class Element
-{
-	Null = 0,
-	Hydrogen = 1,
-	Helium = 2,
-	Lithium = 3,
-	Beryllium = 4,
-	Boron = 5,
-	Carbon = 6,
-	Nitrogen = 7,
-	Oxygen = 8,
-	Flourine = 9,
-	Neon = 10
-};
 
-constexpr std::array<float, 11> AtomicRadii{
-	{
-		0.0f,	// Invalid value to take up the 0 index spot
-		0.025f,	// Hydrogen
-		0.120f,	// Helium
-		0.145f,	// Lithium
-		0.105f, // Beryllium
-		0.085f, // Boron
-		0.070f, // Carbon
-		0.065f, // Nitrogen
-		0.060f, // Oxygen
-		0.050f, // Flourine
-		0.160f  // Neon
-	}
+// One atom for Simulation::AddAtoms
+struct AtomDescription
+{
+	Element element = Element::Hydrogen;
+	DirectX::XMFLOAT3 position = { 0.0f, 0.0f, 0.0f };
+	DirectX::XMFLOAT3 velocity = { 0.0f, 0.0f, 0.0f };
+	float charge = 0.0f;
 };
 
-
 class Simulation
 {
 public:
-	Simulation() noexcept;
+	Simulation();
 
 	void Play() noexcept { m_isPaused = false; }
 	void Pause() noexcept { m_isPaused = true; }
 
-	size_t Add(Element element, const DirectX::XMFLOAT3& position, const DirectX::XMFLOAT3& velocity) noexcept;
+	// Returns a handle that identifies the atom for its lifetime. Its index into Particles() changes whenever the
+	// arrays are reordered (see SetReorderInterval) or another atom is removed, so hold on to the handle, not the index.
+	AtomHandle Add(Element element, const DirectX::XMFLOAT3& position, const DirectX::XMFLOAT3& velocity, float charge = 0.0f);
+
+	// The last atom is moved into the removed atom's place. Bonded terms involving the atom are dropped; exclusions and
+	// constraints are rebuilt on the next step.
+	void Remove(AtomHandle handle);
 
+	// Bulk versions for loading and deleting whole molecules. AddAtoms grows every array once and fills the new atoms in
+	// parallel; handles, if given, receives one handle per atom. RemoveAtoms ignores handles that are no longer live and
+	// repeats of a handle, compacts with swap-and-pop and renumbers the topology once for the whole batch.
+	void AddAtoms(const AtomDescription* atoms, size_t count, AtomHandle* handles = nullptr);
+	void RemoveAtoms(const AtomHandle* handles, size_t count);
+
+	ND inline bool Contains(AtomHandle handle) const noexcept { return m_atomHandles.Contains(handle); }
+	ND inline size_t IndexOf(AtomHandle handle) const noexcept { return m_atomHandles.IndexOf(handle); }
+	ND inline AtomHandle HandleOf(size_t index) const noexcept { return m_atomHandles.HandleOf(m_atomSlots[index]); }
+
+	// As atoms diffuse, array order drifts away from spatial order and the neighbor list turns into random access.
+	// Every interval steps (0 disables) all per-atom arrays are permuted in place along a space-filling curve, and the
+	// topology, exclusions and constraints are renumbered to match. Forces are permuted with the atoms, so no
+	// evaluation is repeated; only the neighbor list is rebuilt.
+	void SetReorderInterval(unsigned int steps) noexcept { m_reorderInterval = steps; }
+	ND inline unsigned int ReorderInterval() const noexcept { return m_reorderInterval; }
+	inline void SetReorderCurve(SpaceFillingCurve curve) noexcept { m_reorderCurve = curve; }
+	ND inline SpaceFillingCurve ReorderCurve() const noexcept { return m_reorderCurve; }
+	void ReorderAtoms();
+	ND inline uint64_t ReorderCount() const noexcept { return m_reorderCount; }
+
+	// Runs SubstepsPerFrame() fixed timesteps. Call once per Timer tick with the Timer in fixed timestep mode. Steps come
+	// in whole outer r-RESPA steps, so timesteps that do not fill one are carried over to the next call.
 	void Update(const Timer& timer);
 
-	ND inline std::vector<DirectX::XMFLOAT3>& Positions() noexcept { return m_positions; }
-	ND inline std::vector<DirectX::XMFLOAT3>& Velocities() noexcept { return m_velocities; }
-	ND inline std::vector<Element>& ElementTypes() noexcept { return m_elementTypes; }
+	// Advances the simulation by one outer r-RESPA step (RespaMultiplier() timesteps) regardless of the paused state
+	void Step();
+
+	// The physical timestep is set in fs and stored in ps, the simulation's time unit
+	void SetTimeStepFemtoseconds(float femtoseconds) noexcept;
+	ND inline float TimeStepFemtoseconds() const noexcept { return 1000.0f * m_timeStep; }
+	ND inline float TimeStep() const noexcept { return m_timeStep; }
+	void SetSubstepsPerFrame(unsigned int substeps) noexcept;
+	ND inline unsigned int SubstepsPerFrame() const noexcept { return m_substepsPerFrame; }
+
+	// r-RESPA: fast forces (the bonded terms and SetFastForceFn) are evaluated every timestep, the nonbonded forces every
+	// multiplier timesteps. A multiplier of 1 is plain velocity Verlet.
+	void SetRespaMultiplier(unsigned int multiplier) noexcept;
+	ND inline unsigned int RespaMultiplier() const noexcept { return m_respaMultiplier; }
+
+	// Extension point for additional fast forces. The function accumulates into the particle force arrays and returns
+	// its potential energy.
+	void SetFastForceFn(const std::function<float(ParticleArrays&, ThreadPool&)>& fn);
+
+	// When enabled, the total energy is sampled after every outer step. Enabling (or re-enabling) resets the statistics.
+	void SetEnergyDiagnostics(bool enabled) noexcept;
+	ND inline bool EnergyDiagnostics() const noexcept { return m_energyDiagnostics; }
+	ND inline EnergyDriftStatistics EnergyDrift() const noexcept { return m_energyMonitor.Statistics(m_particles.Size()); }
+	ND double KineticEnergy();
+
+	// Instantaneous temperature in K, from the kinetic energy over the unconstrained degrees of freedom (less the
+	// three of the center of mass in a periodic box, where total momentum is conserved)
+	ND double Temperature();
+
+	// Seed of every stochastic part of the simulation. Random numbers are drawn from Philox blocks keyed by the seed and
+	// indexed by (atom, step, RandomStream), so a run is reproduced exactly by its seed whatever the thread count.
+	inline void SetRandomSeed(uint64_t seed) noexcept { m_randomSeed = seed; }
+	ND inline uint64_t RandomSeed() const noexcept { return m_randomSeed; }
+
+	// Replaces every velocity with a draw from the Maxwell-Boltzmann distribution at the given temperature, then
+	// removes the center of mass motion and projects out the velocity along constrained bonds. The draw depends on
+	// the seed and the current step count.
+	void AssignMaxwellBoltzmannVelocities(float kelvin);
+
+	// Temperature control, fused into the integration pass over the particle arrays. Langevin dynamics use the BAOAB
+	// splitting: the friction and noise act between the two half drifts, with a Gaussian draw per atom and step from
+	// RandomStream::Langevin. The Nose-Hoover chain is propagated once per outer step and its velocity scaling is
+	// folded into the opening kick. Changing the thermostat or its temperature restarts the energy statistics.
+	void SetThermostat(Thermostat thermostat) noexcept;
+	ND inline Thermostat ActiveThermostat() const noexcept { return m_thermostat; }
+	void SetTargetTemperature(float kelvin) noexcept;
+	ND inline float TargetTemperature() const noexcept { return m_targetTemperature; }
+
+	// Langevin friction coefficient in 1/ps
+	void SetLangevinFriction(float perPicosecond) noexcept { WINRT_ASSERT(perPicosecond >= 0.0f); m_langevinFriction = perPicosecond; }
+	ND inline float LangevinFriction() const noexcept { return m_langevinFriction; }
+
+	ND inline NoseHooverChain& NoseHoover() noexcept { return m_noseHoover; }
+
+	// Energy the thermostat has taken out of the system (the chain energy for Nose-Hoover, the accumulated heat for
+	// Langevin). Kinetic + potential + this is conserved, and is what the energy diagnostics track.
+	ND inline double ThermostatEnergy() const noexcept { return m_thermostatEnergy; }
+
+	ND inline uint64_t StepCount() const noexcept { return m_stepCount; }
+	ND inline double SimulatedPicoseconds() const noexcept { return static_cast<double>(m_timeStep) * m_stepCount; }
+
+	// Throughput of the steps run by Update since the last ResetThroughput, measured in wall-clock time
+	ND double NanosecondsPerDay() const noexcept;
+	void ResetThroughput() noexcept;
+
+	ND inline const ParticleArrays& Particles() const noexcept { return m_particles; }
+	ND inline size_t AtomCount() const noexcept { return m_particles.Size(); }
+
+	// Packed render instances of atoms [first, first + count), written in parallel. The renderer points this at its
+	// mapped instance buffer.
+	void WriteInstances(size_t first, size_t count, AtomInstance* instances);
+	// Same for the count atoms listed in indices, e.g. one level of detail's bucket. Indices at or past AtomCount() (a
+	// list built before atoms were removed) give zero-radius instances.
+	void GatherInstances(const uint32_t* indices, size_t count, AtomInstance* instances);
 
-	ND inline DirectX::XMFLOAT3 BoxScaling() const noexcept { return { m_boxMax, m_boxMax, m_boxMax }; }
+	// Kernels are picked automatically at construction; this allows forcing a lower level (e.g. scalar) for comparison
+	void SetSimdLevel(SimdLevel level) noexcept;
+	ND inline SimdLevel ActiveSimdLevel() const noexcept { return m_kernels->level; }
+	ND inline const SimdKernelTable& Kernels() const noexcept { return *m_kernels; }
+
+	// Force evaluation and integration are split over a work-stealing pool. threadCount == 0 uses every hardware thread.
+	inline void SetThreadCount(unsigned int threadCount) { m_threadPool->SetThreadCount(threadCount); }
+	ND inline unsigned int ThreadCount() const noexcept { return m_threadPool->ThreadCount(); }
+	inline void SetChunkSize(size_t chunkSize) noexcept { m_threadPool->SetChunkSize(chunkSize); }
+	ND inline size_t ChunkSize() const noexcept { return m_threadPool->ChunkSize(); }
+	// For per-frame work on the particle arrays between steps, such as the renderer's level of detail selection
+	ND inline ThreadPool& Pool() noexcept { return *m_threadPool; }
+
+	ND inline NonbondedForce& Nonbonded() noexcept { return m_nonbonded; }
+
+	// Electrostatics can be switched on a running simulation, e.g. to a cheap cutoff form while the user is building.
+	// Nothing is reallocated; the forces are re-evaluated with the new method at the start of the next step, and the
+	// energy statistics restart since the potential has changed. The requested method is kept, and the one in use is
+	// derived from it and the box: PME in an open box and Barnes-Hut in a periodic one run as reaction field until SetBox
+	// makes the requested method possible again.
+	void SetCoulombMethod(CoulombMethod method) noexcept;
+	ND inline CoulombMethod Coulomb() const noexcept { return m_coulombMethod; }
+	ND inline CoulombMethod ActiveCoulomb() const noexcept { return m_nonbonded.Coulomb(); }
+
+	// Bonds, angles and dihedrals between atoms, by particle index (IndexOf the handles returned from Add); reordering
+	// renumbers the terms. Changes are picked up on the next step; atoms up to ExclusionBondSeparation bonds apart are
+	// then excluded from the nonbonded interactions.
+	ND inline Topology& Bonded() noexcept { return m_topology; }
+	static constexpr unsigned int ExclusionBondSeparation = 3;
+
+	// Bonds of Bonded() replaced by fixed-length constraints, rebuilt on the next step. Constraining the bonds to
+	// hydrogen is what allows 2 fs timesteps for proteins.
+	void SetConstraintTargets(ConstraintTargets targets) noexcept;
+	ND inline ConstraintTargets ConstraintTargetBonds() const noexcept { return m_constraintTargets; }
+	ND inline Constraints& BondConstraints() noexcept { return m_constraints; }
+	ND inline float PotentialEnergy() const noexcept { return m_potentialEnergy; }
+
+	// The box spans [-halfExtents, halfExtents]. With periodic boundaries, atoms are wrapped back into the box as they
+	// drift and every interaction uses the nearest periodic image.
+	void SetBox(const SimulationBox& box) noexcept;
+	ND inline const SimulationBox& Box() const noexcept { return m_box; }
+	void SetBoundaryConditions(BoundaryConditions boundaries) noexcept;
+	ND inline BoundaryConditions Boundaries() const noexcept { return m_box.boundaries; }
+
+	// Cubic box with the given half extent
+	void SetBoxMax(float boxMax) noexcept;
+
+	ND inline DirectX::XMFLOAT3 BoxScaling() const noexcept { return m_box.halfExtents; }
 	ND inline const DirectX::XMFLOAT3* BoxTranslation() const noexcept { return &m_boxCenter; }
 
 private:
-	std::vector<DirectX::XMFLOAT3> m_positions;
-	std::vector<DirectX::XMFLOAT3> m_velocities;
-	std::vector<Element> m_elementTypes;
+	// One pass over the particle arrays: velocities scaled by velocityScale and kicked, then drifted by drift (with the
+	// Langevin O step between two half drifts when thermostatted, using noiseStep for the draws). Returns the kinetic
+	// energy after the pass when sumKinetic is set, and 0 otherwise.
+	double Integrate(float slowKick, float fastKick, float drift, float velocityScale, uint64_t noiseStep, bool sumKinetic);
+	ND double DegreesOfFreedom() const noexcept;
+	static constexpr size_t NoiseBlockSize = 256;
+	void PrepareTopology();
+	ND inline bool HasFastForces() const noexcept { return !m_topology.Empty() || m_fastForceFn; }
+	void ComputeFastForces();
+	void ComputeSlowForces();
+	void UpdateCoulombMethod() noexcept;
+
+	ParticleArrays m_particles;
+
+	// Handle slot of the atom at each index, permuted with the particle arrays, and the map from handles to indices
+	AlignedVector<uint32_t> m_atomSlots;
+	SlotMap m_atomHandles;
+
+	unsigned int m_reorderInterval;
+	unsigned int m_stepsSinceReorder;
+	SpaceFillingCurve m_reorderCurve;
+	uint64_t m_reorderCount;
+	SpatialSort m_spatialSort;
+	AlignedVector<float> m_reorderScratch;
+
+	const SimdKernelTable* m_kernels;
+	std::unique_ptr<ThreadPool> m_threadPool;
+
+	NonbondedForce m_nonbonded;
+	CoulombMethod m_coulombMethod;
+	Topology m_topology;
+	Constraints m_constraints;
+	ConstraintTargets m_constraintTargets;
+	bool m_constraintsDirty;
+
+	float m_potentialEnergy;
+	float m_fastPotentialEnergy;
+	float m_slowPotentialEnergy;
+	bool m_forcesValid;
+
+	// Slow forces are kept across the inner RESPA steps; the particle force arrays hold the fast forces
+	AlignedVector<float> m_slowFx;
+	AlignedVector<float> m_slowFy;
+	AlignedVector<float> m_slowFz;
+
+	unsigned int m_respaMultiplier;
+	std::function<float(ParticleArrays&, ThreadPool&)> m_fastForceFn = nullptr;
+
+	bool m_energyDiagnostics;
+	EnergyMonitor m_energyMonitor;
+
+	float m_timeStep;
+	unsigned int m_substepsPerFrame;
+	unsigned int m_pendingTimesteps;
+	uint64_t m_stepCount;
+	uint64_t m_randomSeed;
+
+	Thermostat m_thermostat;
+	float m_targetTemperature;
+	float m_langevinFriction;
+	NoseHooverChain m_noseHoover;
+	double m_thermostatEnergy;
+
+	// Kinetic energy summed by the closing pass of the last step, valid until the velocities change outside Step
+	double m_kineticEnergy;
+	bool m_kineticEnergyValid;
+
+	struct alignas(64) ThreadSum
+	{
+		double kinetic = 0.0;
+		double heat = 0.0;
+	};
+	std::vector<ThreadSum> m_threadSums;
+
+	uint64_t m_throughputStepCount;
+	double m_integrationWallSeconds;
 
 	bool m_isPaused;
 
-	float m_boxMax;
+	SimulationBox m_box;
 
 	// This is necessary so that we can pass a pointer to this when we create the Box RenderObject
 	const DirectX::XMFLOAT3 m_boxCenter = { 0.0f, 0.0f, 0.0f };
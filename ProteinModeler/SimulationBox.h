@@ -0,0 +1,64 @@
+#pragma once
+#include "pch.h"
+
+enum class BoundaryConditions
+{
+	Reflective,	// atoms bounce off the walls
+	Periodic	// atoms leaving one face re-enter through the opposite one and interact with the nearest periodic image
+};
+
+// Minimum-image convention for a displacement. Along axes that are not periodic the lengths and inverse lengths are
+// zero, which turns Apply into a no-op without a branch.
+struct MinimumImage
+{
+	float lengthX = 0.0f;
+	float lengthY = 0.0f;
+	float lengthZ = 0.0f;
+	float inverseLengthX = 0.0f;
+	float inverseLengthY = 0.0f;
+	float inverseLengthZ = 0.0f;
+
+	ND inline bool IsPeriodic() const noexcept { return lengthX > 0.0f || lengthY > 0.0f || lengthZ > 0.0f; }
+
+	// Round to nearest (ties to even) to match the SIMD kernels
+	inline void Apply(float& dx, float& dy, float& dz) const noexcept
+	{
+		dx -= lengthX * std::nearbyint(dx * inverseLengthX);
+		dy -= lengthY * std::nearbyint(dy * inverseLengthY);
+		dz -= lengthZ * std::nearbyint(dz * inverseLengthZ);
+	}
+};
+
+// Rectangular box centered on the origin, spanning [-halfExtents, halfExtents] along each axis. A cube is the special
+// case of equal half extents.
+struct SimulationBox
+{
+	DirectX::XMFLOAT3 halfExtents = { 3.0f, 3.0f, 3.0f };
+	BoundaryConditions boundaries = BoundaryConditions::Reflective;
+
+	ND inline bool IsPeriodic() const noexcept { return boundaries == BoundaryConditions::Periodic; }
+	ND inline DirectX::XMFLOAT3 Lengths() const noexcept { return { 2.0f * halfExtents.x, 2.0f * halfExtents.y, 2.0f * halfExtents.z }; }
+	ND inline float MinHalfExtent() const noexcept { return std::min({ halfExtents.x, halfExtents.y, halfExtents.z }); }
+
+	ND inline MinimumImage Image() const noexcept
+	{
+		MinimumImage image;
+		if (IsPeriodic())
+		{
+			image.lengthX = 2.0f * halfExtents.x;
+			image.lengthY = 2.0f * halfExtents.y;
+			image.lengthZ = 2.0f * halfExtents.z;
+			image.inverseLengthX = 1.0f / image.lengthX;
+			image.inverseLengthY = 1.0f / image.lengthY;
+			image.inverseLengthZ = 1.0f / image.lengthZ;
+		}
+		return image;
+	}
+
+	ND inline bool operator==(const SimulationBox& other) const noexcept
+	{
+		return halfExtents.x == other.halfExtents.x && halfExtents.y == other.halfExtents.y &&
+			halfExtents.z == other.halfExtents.z && boundaries == other.boundaries;
+	}
+	ND inline bool operator!=(const SimulationBox& other) const noexcept { return !(*this == other); }
+};
@@ -0,0 +1,97 @@
+#pragma once
+#include "pch.h"
+
+// Handle to an atom that stays valid while the atom exists, however the particle arrays are reordered or compacted.
+// The generation is bumped whenever a slot is freed, so a handle to a removed atom is recognised as stale even after
+// its slot has been reused.
+struct AtomHandle
+{
+	static constexpr uint32_t InvalidSlot = std::numeric_limits<uint32_t>::max();
+
+	uint32_t slot = InvalidSlot;
+	uint32_t generation = 0;
+
+	ND inline bool IsValid() const noexcept { return slot != InvalidSlot; }
+	ND inline bool operator==(const AtomHandle& rhs) const noexcept { return slot == rhs.slot && generation == rhs.generation; }
+	ND inline bool operator!=(const AtomHandle& rhs) const noexcept { return !(*this == rhs); }
+};
+
+// Maps handles to indices into densely packed arrays. Insert, Erase and IndexOf are O(1): each slot holds the dense
+// index of its element and freed slots are chained into a free list through the same field. The owner of the dense
+// arrays keeps the slot of every element alongside them and calls SetIndex whenever it moves one.
+class SlotMap
+{
+public:
+	SlotMap() noexcept : m_freeHead(AtomHandle::InvalidSlot), m_size(0) {}
+
+	// New handle for the element at dense index
+	ND AtomHandle Insert(uint32_t index)
+	{
+		uint32_t slot = m_freeHead;
+		if (slot != AtomHandle::InvalidSlot)
+		{
+			m_freeHead = m_slots[slot].index;
+			++m_slots[slot].generation;
+		}
+		else
+		{
+			slot = static_cast<uint32_t>(m_slots.size());
+			m_slots.push_back({ 0, 0 });
+		}
+
+		m_slots[slot].index = index;
+		++m_size;
+		return { slot, m_slots[slot].generation };
+	}
+
+	void Erase(AtomHandle handle) noexcept
+	{
+		WINRT_ASSERT(Contains(handle));
+		Slot& slot = m_slots[handle.slot];
+		++slot.generation;
+		slot.index = m_freeHead;
+		m_freeHead = handle.slot;
+		--m_size;
+	}
+
+	ND inline bool Contains(AtomHandle handle) const noexcept
+	{
+		return handle.slot < m_slots.size() && m_slots[handle.slot].generation == handle.generation && !IsFree(handle.slot);
+	}
+
+	ND inline uint32_t IndexOf(AtomHandle handle) const noexcept
+	{
+		WINRT_ASSERT(Contains(handle));
+		return m_slots[handle.slot].index;
+	}
+
+	// Current handle of a live slot
+	ND inline AtomHandle HandleOf(uint32_t slot) const noexcept { return { slot, m_slots[slot].generation }; }
+
+	// The element of a live slot moved to a new dense index
+	inline void SetIndex(uint32_t slot, uint32_t index) noexcept { m_slots[slot].index = index; }
+
+	// Grows geometrically, so reserving ahead of every small batch does not turn into a copy per batch
+	void Reserve(size_t count)
+	{
+		if (count > m_slots.capacity())
+			m_slots.reserve(std::max(count, 2 * m_slots.capacity()));
+	}
+
+	ND inline size_t Size() const noexcept { return m_size; }
+
+private:
+	// Free slots are told apart from live ones by an odd generation: Erase bumps it to odd, and Insert bumps it back to
+	// even when the slot is reused
+	ND inline bool IsFree(uint32_t slot) const noexcept { return (m_slots[slot].generation & 1u) != 0; }
+
+	struct Slot
+	{
+		uint32_t index;			// dense index while live, next free slot while free
+		uint32_t generation;
+	};
+
+	std::vector<Slot> m_slots;
+	uint32_t m_freeHead;
+	size_t m_size;
+};
@@ -0,0 +1,177 @@
+#include "pch.h"
+#include "SpatialSort.h"
+
+
+namespace
+{
+	constexpr unsigned int RadixBits = 8;
+	constexpr unsigned int RadixSize = 1u << RadixBits;
+
+	// Spreads the low 10 bits of v so that there are two zero bits between each of them
+	inline uint32_t SpreadBits(uint32_t v) noexcept
+	{
+		v = (v | (v << 16)) & 0x030000FFu;
+		v = (v | (v << 8)) & 0x0300F00Fu;
+		v = (v | (v << 4)) & 0x030C30C3u;
+		v = (v | (v << 2)) & 0x09249249u;
+		return v;
+	}
+}
+
+uint32_t SpatialSort::MortonCode(uint32_t x, uint32_t y, uint32_t z) noexcept
+{
+	return (SpreadBits(x) << 2) | (SpreadBits(y) << 1) | SpreadBits(z);
+}
+
+uint32_t SpatialSort::HilbertCode(uint32_t x, uint32_t y, uint32_t z, unsigned int bits) noexcept
+{
+	WINRT_ASSERT(bits >= 1 && bits <= BitsPerAxis);
+
+	// Skilling, "Programming the Hilbert curve" (2004): turn the coordinates into the transposed Hilbert index in place,
+	// whose bits interleaved (x most significant) are the index itself
+	uint32_t axes[3] = { x, y, z };
+	const uint32_t top = 1u << (bits - 1);
+
+	for (uint32_t q = top; q > 1; q >>= 1)
+	{
+		const uint32_t p = q - 1;
+		for (unsigned int d = 0; d < 3; ++d)
+		{
+			if (axes[d] & q)
+			{
+				axes[0] ^= p;
+			}
+			else
+			{
+				const uint32_t t = (axes[0] ^ axes[d]) & p;
+				axes[0] ^= t;
+				axes[d] ^= t;
+			}
+		}
+	}
+
+	// Gray encode
+	axes[1] ^= axes[0];
+	axes[2] ^= axes[1];
+	uint32_t t = 0;
+	for (uint32_t q = top; q > 1; q >>= 1)
+		if (axes[2] & q)
+			t ^= q - 1;
+	for (uint32_t& axis : axes)
+		axis ^= t;
+
+	return MortonCode(axes[0], axes[1], axes[2]);
+}
+
+void SpatialSort::Sort(const float* x, const float* y, const float* z, size_t count, SpaceFillingCurve curve, ThreadPool& pool)
+{
+	// Fixed blocks, one per thread, so the per-block histograms of the radix sort line up between its passes
+	const unsigned int blockCount = pool.ThreadCount();
+	auto blockBegin = [=](size_t block) { return count * block / blockCount; };
+
+	m_blockBounds.resize(blockCount);
+	pool.ParallelFor(0, blockCount, [&](unsigned int, size_t first, size_t last)
+		{
+			for (size_t block = first; block < last; ++block)
+			{
+				BlockBounds& bounds = m_blockBounds[block];
+				std::fill(std::begin(bounds.min), std::end(bounds.min), std::numeric_limits<float>::max());
+				std::fill(std::begin(bounds.max), std::end(bounds.max), std::numeric_limits<float>::lowest());
+				for (size_t iii = blockBegin(block); iii < blockBegin(block + 1); ++iii)
+				{
+					bounds.min[0] = std::min(bounds.min[0], x[iii]);
+					bounds.min[1] = std::min(bounds.min[1], y[iii]);
+					bounds.min[2] = std::min(bounds.min[2], z[iii]);
+					bounds.max[0] = std::max(bounds.max[0], x[iii]);
+					bounds.max[1] = std::max(bounds.max[1], y[iii]);
+					bounds.max[2] = std::max(bounds.max[2], z[iii]);
+				}
+			}
+		}, 1
+	);
+
+	float boundsMin[3] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+	float extent = 0.0f;
+	for (unsigned int d = 0; d < 3; ++d)
+	{
+		float boundsMax = std::numeric_limits<float>::lowest();
+		for (const BlockBounds& bounds : m_blockBounds)
+		{
+			boundsMin[d] = std::min(boundsMin[d], bounds.min[d]);
+			boundsMax = std::max(boundsMax, bounds.max[d]);
+		}
+		extent = std::max(extent, boundsMax - boundsMin[d]);
+	}
+
+	// Cubic root cell over the bounding box, divided into 2^BitsPerAxis cells per axis
+	constexpr uint32_t CellsPerAxis = 1u << BitsPerAxis;
+	const float scale = extent > 0.0f ? CellsPerAxis / extent : 0.0f;
+	auto cell = [=](float coordinate, unsigned int d) {
+		return std::min(CellsPerAxis - 1, static_cast<uint32_t>((coordinate - boundsMin[d]) * scale));
+	};
+
+	m_codes.resize(count);
+	m_codesScratch.resize(count);
+	m_order.resize(count);
+	m_orderScratch.resize(count);
+	pool.ParallelFor(0, count, [&](unsigned int, size_t begin, size_t end)
+		{
+			for (size_t iii = begin; iii < end; ++iii)
+			{
+				const uint32_t cx = cell(x[iii], 0);
+				const uint32_t cy = cell(y[iii], 1);
+				const uint32_t cz = cell(z[iii], 2);
+				m_codes[iii] = curve == SpaceFillingCurve::Hilbert ? HilbertCode(cx, cy, cz) : MortonCode(cx, cy, cz);
+				m_order[iii] = static_cast<uint32_t>(iii);
+			}
+		}
+	);
+
+	// Least significant digit radix sort. Each block counts its digits, an exclusive scan over (digit, block) gives every
+	// block its output offsets, and the blocks then scatter concurrently. Scanning in (digit, block) order keeps each pass
+	// stable, which the later passes rely on.
+	m_histograms.resize(static_cast<size_t>(blockCount) * RadixSize);
+	for (unsigned int shift = 0; shift < 3 * BitsPerAxis; shift += RadixBits)
+	{
+		pool.ParallelFor(0, blockCount, [&](unsigned int, size_t first, size_t last)
+			{
+				for (size_t block = first; block < last; ++block)
+				{
+					uint32_t* histogram = m_histograms.data() + block * RadixSize;
+					std::fill(histogram, histogram + RadixSize, 0u);
+					for (size_t iii = blockBegin(block); iii < blockBegin(block + 1); ++iii)
+						++histogram[(m_codes[iii] >> shift) & (RadixSize - 1)];
+				}
+			}, 1
+		);
+
+		uint32_t offset = 0;
+		for (unsigned int digit = 0; digit < RadixSize; ++digit)
+		{
+			for (unsigned int block = 0; block < blockCount; ++block)
+			{
+				const uint32_t digitCount = m_histograms[block * RadixSize + digit];
+				m_histograms[block * RadixSize + digit] = offset;
+				offset += digitCount;
+			}
+		}
+
+		pool.ParallelFor(0, blockCount, [&](unsigned int, size_t first, size_t last)
+			{
+				for (size_t block = first; block < last; ++block)
+				{
+					uint32_t* histogram = m_histograms.data() + block * RadixSize;
+					for (size_t iii = blockBegin(block); iii < blockBegin(block + 1); ++iii)
+					{
+						const uint32_t destination = histogram[(m_codes[iii] >> shift) & (RadixSize - 1)]++;
+						m_codesScratch[destination] = m_codes[iii];
+						m_orderScratch[destination] = m_order[iii];
+					}
+				}
+			}, 1
+		);
+
+		std::swap(m_codes, m_codesScratch);
+		std::swap(m_order, m_orderScratch);
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "pch.h"
+#include "AlignedAllocator.h"
+#include "ThreadPool.h"
+
+enum class SpaceFillingCurve
+{
+	Morton,		// bit interleaving: cheapest to compute, but jumps across the box between octants
+	Hilbert		// consecutive codes are always neighboring cells, so it keeps slightly more neighbors together
+};
+
+// Orders points along a space-filling curve over their cubic bounding box, resolved to 2^BitsPerAxis cells per axis.
+// Codes are computed in parallel and sorted with a stable parallel least significant digit radix sort. Used by the
+// Barnes-Hut octree, whose nodes are prefixes of the Morton codes, and for the periodic reordering of the atoms.
+class SpatialSort
+{
+public:
+	// Sorts the count points (x[i], y[i], z[i]). Afterwards Order()[k] is the index of the point at sorted position k,
+	// and Codes()[k] its code.
+	void Sort(const float* x, const float* y, const float* z, size_t count, SpaceFillingCurve curve, ThreadPool& pool);
+
+	ND inline const AlignedVector<uint32_t>& Order() const noexcept { return m_order; }
+	ND inline const AlignedVector<uint32_t>& Codes() const noexcept { return m_codes; }
+
+	// Codes of a cell; coordinates are in [0, 2^bits)
+	ND static uint32_t MortonCode(uint32_t x, uint32_t y, uint32_t z) noexcept;
+	ND static uint32_t HilbertCode(uint32_t x, uint32_t y, uint32_t z, unsigned int bits = BitsPerAxis) noexcept;
+
+	static constexpr unsigned int BitsPerAxis = 10;
+
+private:
+	AlignedVector<uint32_t> m_codes;
+	AlignedVector<uint32_t> m_codesScratch;
+	AlignedVector<uint32_t> m_order;
+	AlignedVector<uint32_t> m_orderScratch;
+	std::vector<uint32_t> m_histograms;
+
+	// Bounding box of each block of points; the same fixed blocks are used by the radix sort histograms
+	struct alignas(64) BlockBounds
+	{
+		float min[3];
+		float max[3];
+	};
+	std::vector<BlockBounds> m_blockBounds;
+};
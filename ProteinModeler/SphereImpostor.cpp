@@ -0,0 +1,186 @@
+#include "pch.h"
+#include "SphereImpostor.h"
+#include <random>
+
+using DirectX::XMFLOAT3;
+using DirectX::XMFLOAT4X4;
+
+namespace
+{
+	inline XMFLOAT3 Add(const XMFLOAT3& a, const XMFLOAT3& b) noexcept { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+	inline XMFLOAT3 Subtract(const XMFLOAT3& a, const XMFLOAT3& b) noexcept { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+	inline XMFLOAT3 Scale(const XMFLOAT3& a, float s) noexcept { return { a.x * s, a.y * s, a.z * s }; }
+	inline float Dot(const XMFLOAT3& a, const XMFLOAT3& b) noexcept { return a.x * b.x + a.y * b.y + a.z * b.z; }
+	inline float Length(const XMFLOAT3& a) noexcept { return std::sqrt(Dot(a, a)); }
+	inline XMFLOAT3 Cross(const XMFLOAT3& a, const XMFLOAT3& b) noexcept
+	{
+		return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+	}
+}
+
+bool SphereImpostor::ExpandQuad(const XMFLOAT3& eye, const XMFLOAT3& cameraUp, const XMFLOAT3& center, float radius, ImpostorQuad& quad) noexcept
+{
+	const XMFLOAT3 toCenter = Subtract(center, eye);
+	const float distance = Length(toCenter);
+	if (distance <= radius)
+	{
+		quad = { center, { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f } };
+		return false;
+	}
+
+	// Basis of the quad's plane. The camera's up vector is only parallel to the view axis for a sphere 90 degrees off the
+	// view direction, which is never on screen, but the basis must not degenerate there either.
+	const XMFLOAT3 axis = Scale(toCenter, 1.0f / distance);
+	XMFLOAT3 right = Cross(cameraUp, axis);
+	float rightLength = Length(right);
+	if (rightLength < 1e-6f)
+	{
+		right = Cross(std::abs(axis.x) < 0.9f ? XMFLOAT3(1.0f, 0.0f, 0.0f) : XMFLOAT3(0.0f, 1.0f, 0.0f), axis);
+		rightLength = Length(right);
+	}
+	right = Scale(right, 1.0f / rightLength);
+	const XMFLOAT3 up = Cross(axis, right);
+
+	// The plane touches the sphere at its nearest point; there the tangent cone (half angle asin(radius / distance)) has
+	// a cross section of radius planeDistance * tan(angle), which the quad's half size must reach
+	const float planeDistance = distance - radius;
+	const float halfSize = planeDistance * radius / std::sqrt((distance - radius) * (distance + radius));
+
+	quad.center = Add(eye, Scale(axis, planeDistance));
+	quad.right = Scale(right, halfSize);
+	quad.up = Scale(up, halfSize);
+	return true;
+}
+
+XMFLOAT3 SphereImpostor::Corner(const ImpostorQuad& quad, float u, float v) noexcept
+{
+	return Add(quad.center, Add(Scale(quad.right, u), Scale(quad.up, v)));
+}
+
+bool SphereImpostor::Intersect(const XMFLOAT3& eye, const XMFLOAT3& pointOnQuad, const XMFLOAT3& center, float radius, ImpostorHit& hit) noexcept
+{
+	const XMFLOAT3 toPoint = Subtract(pointOnQuad, eye);
+	const XMFLOAT3 direction = Scale(toPoint, 1.0f / Length(toPoint));
+
+	// Squared distance of the ray from the center, taken from the closest approach rather than as b^2 - c, which cancels
+	// catastrophically for small spheres far from the eye
+	const XMFLOAT3 toCenter = Subtract(center, eye);
+	const float along = Dot(toCenter, direction);
+	const XMFLOAT3 offset = Subtract(toCenter, Scale(direction, along));
+	const float h = radius * radius - Dot(offset, offset);
+	if (h < 0.0f)
+		return false;
+
+	hit.distance = along - std::sqrt(h);
+	hit.position = Add(eye, Scale(direction, hit.distance));
+	hit.normal = Scale(Subtract(hit.position, center), 1.0f / radius);
+	return true;
+}
+
+float SphereImpostor::Depth(const XMFLOAT4X4& viewProjection, const XMFLOAT3& position) noexcept
+{
+	const float p[4] = { position.x, position.y, position.z, 1.0f };
+	float z = 0.0f;
+	float w = 0.0f;
+	for (int iii = 0; iii < 4; ++iii)
+	{
+		z += p[iii] * viewProjection.m[iii][2];
+		w += p[iii] * viewProjection.m[iii][3];
+	}
+	return z / w;
+}
+
+bool SphereImpostor::SelfTest(unsigned int sphereCount)
+{
+	std::mt19937 generator(4242u);
+	std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	// Left-handed perspective looking down +z, as Camera builds it, behind a translation to the eye
+	constexpr float NearZ = 0.1f;
+	constexpr float FarZ = 1000.0f;
+	XMFLOAT4X4 projection = {};
+	projection.m[0][0] = 1.5f;
+	projection.m[1][1] = 1.5f;
+	projection.m[2][2] = FarZ / (FarZ - NearZ);
+	projection.m[2][3] = 1.0f;
+	projection.m[3][2] = -NearZ * FarZ / (FarZ - NearZ);
+
+	for (unsigned int sphere = 0; sphere < sphereCount; ++sphere)
+	{
+		const XMFLOAT3 eye(10.0f * uniform(generator), 10.0f * uniform(generator), 10.0f * uniform(generator));
+		XMFLOAT4X4 viewProjection = projection;
+		for (int jjj = 0; jjj < 4; ++jjj)
+			viewProjection.m[3][jjj] -= eye.x * projection.m[0][jjj] + eye.y * projection.m[1][jjj] + eye.z * projection.m[2][jjj];
+
+		XMFLOAT3 cameraUp(0.3f * uniform(generator), 1.0f, 0.3f * uniform(generator));
+		cameraUp = Scale(cameraUp, 1.0f / Length(cameraUp));
+		const XMFLOAT3 center = Add(eye, XMFLOAT3(4.0f * uniform(generator), 4.0f * uniform(generator), 2.0f + 48.0f * unit(generator)));
+		const float radius = 0.05f + 1.45f * unit(generator);
+
+		ImpostorQuad quad;
+		if (!SphereImpostor::ExpandQuad(eye, cameraUp, center, radius, quad))
+			return false;
+
+		// The quad must be a square perpendicular to the view axis, touching the sphere
+		const XMFLOAT3 toCenter = Subtract(center, eye);
+		const float distance = Length(toCenter);
+		const XMFLOAT3 axis = Scale(toCenter, 1.0f / distance);
+		const float halfSize = Length(quad.right);
+		if (std::abs(Dot(quad.right, axis)) > 1e-4f * halfSize || std::abs(Dot(quad.up, axis)) > 1e-4f * halfSize ||
+			std::abs(Dot(quad.right, quad.up)) > 1e-4f * halfSize * halfSize || std::abs(Length(quad.up) - halfSize) > 1e-4f * halfSize ||
+			std::abs(Dot(Subtract(quad.center, eye), axis) - (distance - radius)) > 1e-4f * distance)
+			return false;
+
+		// Points just inside the silhouette circle: their rays hit the sphere and cross the quad within its edges. Points
+		// just outside the circle, where it touches the middle of an edge, must miss.
+		const XMFLOAT3 e1 = Scale(quad.right, 1.0f / halfSize);
+		const XMFLOAT3 e2 = Scale(quad.up, 1.0f / halfSize);
+		const XMFLOAT3 silhouetteCenter = Add(eye, Scale(axis, distance - radius * radius / distance));
+		const float silhouetteRadius = radius * std::sqrt((distance - radius) * (distance + radius)) / distance;
+		for (int k = 0; k < 16; ++k)
+		{
+			const float angle = 2.0f * 3.14159265f * k / 16.0f;
+			const XMFLOAT3 onSilhouette = Add(silhouetteCenter, Scale(Add(Scale(e1, std::cos(angle)), Scale(e2, std::sin(angle))), 0.999f * silhouetteRadius));
+			const XMFLOAT3 direction = Subtract(onSilhouette, eye);
+			const XMFLOAT3 onQuad = Add(eye, Scale(direction, Dot(Subtract(quad.center, eye), axis) / Dot(direction, axis)));
+			const XMFLOAT3 local = Subtract(onQuad, quad.center);
+			if (std::abs(Dot(local, e1)) > 1.0001f * halfSize || std::abs(Dot(local, e2)) > 1.0001f * halfSize)
+				return false;
+
+			ImpostorHit hit;
+			if (!SphereImpostor::Intersect(eye, onQuad, center, radius, hit))
+				return false;
+		}
+
+		ImpostorHit outside;
+		if (SphereImpostor::Intersect(eye, SphereImpostor::Corner(quad, 1.01f, 0.0f), center, radius, outside) ||
+			SphereImpostor::Intersect(eye, SphereImpostor::Corner(quad, 0.0f, -1.01f), center, radius, outside))
+			return false;
+
+		// Rays through the quad: hits lie on the surface, face the eye, and are never in front of the quad
+		for (int k = 0; k < 16; ++k)
+		{
+			const XMFLOAT3 onQuad = SphereImpostor::Corner(quad, uniform(generator), uniform(generator));
+			ImpostorHit hit;
+			if (!SphereImpostor::Intersect(eye, onQuad, center, radius, hit))
+				continue;
+
+			const float quadDepth = SphereImpostor::Depth(viewProjection, onQuad);
+			const float hitDepth = SphereImpostor::Depth(viewProjection, hit.position);
+			if (std::abs(Length(Subtract(hit.position, center)) - radius) > 1e-3f * radius ||
+				std::abs(Length(hit.normal) - 1.0f) > 1e-3f ||
+				Dot(hit.normal, Subtract(eye, hit.position)) < -1e-4f * distance ||
+				hitDepth < quadDepth - 1e-6f || hitDepth < 0.0f || hitDepth > 1.0f)
+				return false;
+		}
+	}
+
+	// An eye inside the sphere gets a degenerate quad
+	ImpostorQuad quad;
+	const XMFLOAT3 origin(0.0f, 0.0f, 0.0f);
+	if (SphereImpostor::ExpandQuad(origin, XMFLOAT3(0.0f, 1.0f, 0.0f), XMFLOAT3(0.1f, 0.0f, 0.0f), 0.5f, quad) || Length(quad.right) != 0.0f)
+		return false;
+
+	return true;
+}
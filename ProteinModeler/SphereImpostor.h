@@ -0,0 +1,44 @@
+#pragma once
+#include "pch.h"
+
+// Billboard covering the silhouette of a sphere: its corners are center +/- right +/- up
+struct ImpostorQuad
+{
+	DirectX::XMFLOAT3 center;
+	DirectX::XMFLOAT3 right;
+	DirectX::XMFLOAT3 up;
+};
+
+// Point where a view ray first meets a sphere
+struct ImpostorHit
+{
+	DirectX::XMFLOAT3 position;
+	DirectX::XMFLOAT3 normal;
+	float distance;				// from the eye along the ray
+};
+
+// CPU reference of the sphere impostor math in VertexShaderImpostor.hlsl and PixelShaderImpostor.hlsl, which must be
+// kept in step with it. Each atom is drawn as a quad perpendicular to the line from the eye to its center, placed at
+// the sphere's nearest point and sized to the cross section of its tangent cone there, so the quad covers exactly the
+// silhouette and lies entirely in front of the sphere. Every pixel then ray-casts the sphere and writes the depth of the
+// hit, which can only be greater than the quad's own.
+class SphereImpostor
+{
+public:
+	// Quad for the sphere (center, radius) seen from eye. cameraUp only orients the quad within its plane. Returns false,
+	// with a degenerate quad, when the eye is inside the sphere.
+	ND static bool ExpandQuad(const DirectX::XMFLOAT3& eye, const DirectX::XMFLOAT3& cameraUp, const DirectX::XMFLOAT3& center, float radius, ImpostorQuad& quad) noexcept;
+
+	// Corner (u, v) of the quad, u and v in [-1, 1]; the quad mesh holds the four corners with u, v = +/-1
+	ND static DirectX::XMFLOAT3 Corner(const ImpostorQuad& quad, float u, float v) noexcept;
+
+	// Casts the ray from eye through pointOnQuad. Returns false if it misses the sphere.
+	ND static bool Intersect(const DirectX::XMFLOAT3& eye, const DirectX::XMFLOAT3& pointOnQuad, const DirectX::XMFLOAT3& center, float radius, ImpostorHit& hit) noexcept;
+
+	// Depth buffer value of a world space point for a row-vector view-projection matrix (as mul(float4(p, 1), gViewProj))
+	ND static float Depth(const DirectX::XMFLOAT4X4& viewProjection, const DirectX::XMFLOAT3& position) noexcept;
+
+	// Checks the math on sphereCount random spheres in front of a perspective camera: rays just inside each silhouette
+	// cross the quad, rays through the quad hit the surface, and every hit lies behind the quad in depth
+	ND static bool SelfTest(unsigned int sphereCount = 1000);
+};
@@ -59,7 +59,6 @@ struct PassConstants
 
 // ------------------------------------------------------------------------
 
-#define MAX_INSTANCES 1024
 #define NUM_MATERIALS 10
 
 struct Vertex
@@ -68,11 +67,6 @@ struct Vertex
     DirectX::XMFLOAT3 Normal;
 };
 
-struct WorldMatrixInstances
-{
-    DirectX::XMFLOAT4X4 worlds[MAX_INSTANCES];
-};
-
 struct MaterialsArray
 {
     Material materials[NUM_MATERIALS];
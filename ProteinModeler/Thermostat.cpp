@@ -0,0 +1,74 @@
+#include "pch.h"
+#include "Thermostat.h"
+
+NoseHooverChain::NoseHooverChain() noexcept :
+	m_period(0.5f),
+	m_length(3)
+{
+	Reset();
+}
+
+void NoseHooverChain::Reset() noexcept
+{
+	m_position.fill(0.0);
+	m_velocity.fill(0.0);
+}
+
+float NoseHooverChain::Propagate(double kineticEnergy, double degreesOfFreedom, double kT, double dt) noexcept
+{
+	if (degreesOfFreedom <= 0.0 || kT <= 0.0)
+		return 1.0f;
+
+	const unsigned int last = m_length - 1;
+	const double tau2 = static_cast<double>(m_period) * m_period;
+	auto mass = [&](unsigned int j) { return (j == 0 ? degreesOfFreedom : 1.0) * kT * tau2; };
+
+	// Force on thermostat j: the excess kinetic energy of whatever it is coupled to
+	double twiceKinetic = 2.0 * kineticEnergy;
+	auto force = [&](unsigned int j) {
+		return j == 0 ? (twiceKinetic - degreesOfFreedom * kT) / mass(0) :
+			(mass(j - 1) * m_velocity[j - 1] * m_velocity[j - 1] - kT) / mass(j);
+	};
+
+	// Velocity of thermostat j over h / 2, damped by the thermostat above it
+	auto kick = [&](unsigned int j, double h) {
+		const double damping = std::exp(-0.25 * h * m_velocity[j + 1]);
+		m_velocity[j] = m_velocity[j] * damping * damping + 0.5 * h * force(j) * damping;
+	};
+
+	constexpr double SuzukiYoshida0 = 1.3512071919596578;		// 1 / (2 - 2^(1/3))
+	constexpr double SuzukiYoshidaWeights[3] = { SuzukiYoshida0, 1.0 - 2.0 * SuzukiYoshida0, SuzukiYoshida0 };
+
+	double scale = 1.0;
+	for (double weight : SuzukiYoshidaWeights)
+	{
+		const double h = weight * dt;
+
+		m_velocity[last] += 0.5 * h * force(last);
+		for (unsigned int j = last; j-- > 0;)
+			kick(j, h);
+
+		const double factor = std::exp(-h * m_velocity[0]);
+		scale *= factor;
+		twiceKinetic *= factor * factor;
+		for (unsigned int j = 0; j < m_length; ++j)
+			m_position[j] += h * m_velocity[j];
+
+		for (unsigned int j = 0; j < last; ++j)
+			kick(j, h);
+		m_velocity[last] += 0.5 * h * force(last);
+	}
+	return static_cast<float>(scale);
+}
+
+double NoseHooverChain::Energy(double degreesOfFreedom, double kT) const noexcept
+{
+	const double tau2 = static_cast<double>(m_period) * m_period;
+	double energy = 0.0;
+	for (unsigned int j = 0; j < m_length; ++j)
+	{
+		const double mass = (j == 0 ? degreesOfFreedom : 1.0) * kT * tau2;
+		energy += 0.5 * mass * m_velocity[j] * m_velocity[j] + (j == 0 ? degreesOfFreedom : 1.0) * kT * m_position[j];
+	}
+	return energy;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "pch.h"
+
+enum class Thermostat
+{
+	None,				// constant energy
+	Langevin,			// BAOAB Langevin dynamics: friction and noise on every atom, robust from the first step
+	NoseHooverChain		// deterministic; samples the canonical ensemble without perturbing the dynamics locally
+};
+
+// Nose-Hoover chain of thermostats (Martyna, Klein & Tuckerman 1992) coupled to the kinetic energy of the whole system.
+// The chain is propagated with the Trotter factorization of Martyna, Tuckerman, Tobias & Klein (1996) and third-order
+// Suzuki-Yoshida weights; the result is the factor every velocity is scaled by, which the caller folds into its kick.
+class NoseHooverChain
+{
+public:
+	NoseHooverChain() noexcept;
+
+	// Back to rest: chain positions and velocities zeroed
+	void Reset() noexcept;
+
+	// Advances the chain by dt against the kinetic energy (kJ/mol) of the given degrees of freedom at temperature kT
+	// (kJ/mol) and returns the velocity scale factor over that interval
+	ND float Propagate(double kineticEnergy, double degreesOfFreedom, double kT, double dt) noexcept;
+
+	// Energy of the chain, which added to the system energy gives the conserved quantity
+	ND double Energy(double degreesOfFreedom, double kT) const noexcept;
+
+	// Oscillation period of the thermostat in ps; the chain masses follow from it as Q = Nf kT tau^2 for the first
+	// thermostat and kT tau^2 for the others
+	void SetPeriod(float picoseconds) noexcept { WINRT_ASSERT(picoseconds > 0.0f); m_period = picoseconds; }
+	ND inline float Period() const noexcept { return m_period; }
+
+	void SetLength(unsigned int length) noexcept { WINRT_ASSERT(length >= 1 && length <= MaxLength); m_length = length; }
+	ND inline unsigned int Length() const noexcept { return m_length; }
+
+	static constexpr unsigned int MaxLength = 10;
+
+private:
+	float m_period;
+	unsigned int m_length;
+	std::array<double, MaxLength> m_position;
+	std::array<double, MaxLength> m_velocity;
+};
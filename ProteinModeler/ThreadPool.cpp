@@ -0,0 +1,192 @@
+#include "pch.h"
+#include "ThreadPool.h"
+
+
+ThreadPool::ThreadPool(unsigned int threadCount, size_t chunkSize) :
+	m_chunkSize(std::max<size_t>(1, chunkSize)),
+	m_job(nullptr),
+	m_jobBegin(0),
+	m_jobEnd(0),
+	m_jobChunkSize(1),
+	m_pendingChunks(0),
+	m_busyWorkers(0),
+	m_stealCount(0),
+	m_generation(0),
+	m_stopping(false)
+{
+	SetThreadCount(threadCount);
+}
+
+ThreadPool::~ThreadPool() noexcept
+{
+	StopWorkers();
+}
+
+void ThreadPool::SetThreadCount(unsigned int threadCount)
+{
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	if (threadCount == ThreadCount() && m_queues != nullptr)
+		return;
+
+	StopWorkers();
+	StartWorkers(threadCount - 1);
+}
+
+void ThreadPool::StartWorkers(unsigned int workerCount)
+{
+	m_queues = std::make_unique<ChunkQueue[]>(workerCount + 1);
+	m_stopping = false;
+
+	m_workers.reserve(workerCount);
+	for (unsigned int iii = 0; iii < workerCount; ++iii)
+		m_workers.emplace_back(&ThreadPool::WorkerLoop, this, iii + 1);
+}
+
+void ThreadPool::StopWorkers() noexcept
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_wakeWorkers.notify_all();
+
+	for (std::thread& worker : m_workers)
+		worker.join();
+
+	m_workers.clear();
+}
+
+void ThreadPool::ParallelFor(size_t begin, size_t end, const std::function<void(unsigned int, size_t, size_t)>& fn, size_t chunkSize)
+{
+	if (begin >= end)
+		return;
+
+	const size_t chunk = chunkSize > 0 ? chunkSize : m_chunkSize;
+	const size_t chunkCount = (end - begin + chunk - 1) / chunk;
+	const unsigned int threadCount = ThreadCount();
+
+	// Nothing to share, so skip waking the workers
+	if (threadCount == 1 || chunkCount == 1)
+	{
+		fn(0u, begin, end);
+		return;
+	}
+
+	WINRT_ASSERT(chunkCount <= UINT32_MAX);
+
+	// Give each thread a contiguous block of chunks so neighboring indices tend to stay on the same core
+	for (unsigned int t = 0; t < threadCount; ++t)
+	{
+		uint32_t first = static_cast<uint32_t>(chunkCount * t / threadCount);
+		uint32_t last = static_cast<uint32_t>(chunkCount * (t + 1) / threadCount);
+		m_queues[t].range.store(Pack(first, last), std::memory_order_relaxed);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_job = &fn;
+		m_jobBegin = begin;
+		m_jobEnd = end;
+		m_jobChunkSize = chunk;
+		m_pendingChunks.store(chunkCount, std::memory_order_relaxed);
+		m_busyWorkers.store(static_cast<unsigned int>(m_workers.size()), std::memory_order_relaxed);
+		++m_generation;
+	}
+	m_wakeWorkers.notify_all();
+
+	RunChunks(0u);
+
+	// Wait for both the chunks and the workers: a worker may still be scanning for work to steal, and it must be done
+	// before the queues are reused by the next call
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_jobFinished.wait(lock, [this]() {
+		return m_pendingChunks.load(std::memory_order_acquire) == 0 && m_busyWorkers.load(std::memory_order_acquire) == 0;
+	});
+	m_job = nullptr;
+}
+
+void ThreadPool::WorkerLoop(unsigned int threadIndex)
+{
+	uint64_t seenGeneration = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wakeWorkers.wait(lock, [&]() { return m_stopping || m_generation != seenGeneration; });
+			if (m_stopping)
+				return;
+			seenGeneration = m_generation;
+		}
+
+		RunChunks(threadIndex);
+
+		if (m_busyWorkers.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_jobFinished.notify_all();
+		}
+	}
+}
+
+void ThreadPool::RunChunks(unsigned int threadIndex)
+{
+	const std::function<void(unsigned int, size_t, size_t)>& job = *m_job;
+
+	while (m_pendingChunks.load(std::memory_order_acquire) > 0)
+	{
+		uint32_t chunk;
+		if (PopFront(threadIndex, chunk))
+		{
+			size_t chunkBegin = m_jobBegin + static_cast<size_t>(chunk) * m_jobChunkSize;
+			size_t chunkEnd = std::min(chunkBegin + m_jobChunkSize, m_jobEnd);
+			job(threadIndex, chunkBegin, chunkEnd);
+
+			m_pendingChunks.fetch_sub(1, std::memory_order_acq_rel);
+		}
+		else if (!StealHalf(threadIndex))
+		{
+			// Everything left is already running on other threads
+			std::this_thread::yield();
+		}
+	}
+}
+
+bool ThreadPool::PopFront(unsigned int threadIndex, uint32_t& chunk) noexcept
+{
+	std::atomic<uint64_t>& range = m_queues[threadIndex].range;
+	uint64_t current = range.load(std::memory_order_acquire);
+	while (Begin(current) < End(current))
+	{
+		if (range.compare_exchange_weak(current, Pack(Begin(current) + 1, End(current)), std::memory_order_acq_rel))
+		{
+			chunk = Begin(current);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ThreadPool::StealHalf(unsigned int thiefIndex) noexcept
+{
+	const unsigned int threadCount = ThreadCount();
+	for (unsigned int offset = 1; offset < threadCount; ++offset)
+	{
+		std::atomic<uint64_t>& victim = m_queues[(thiefIndex + offset) % threadCount].range;
+		uint64_t current = victim.load(std::memory_order_acquire);
+		while (Begin(current) < End(current))
+		{
+			// Take the back half, rounding up so a single remaining chunk can still be stolen
+			uint32_t middle = Begin(current) + (End(current) - Begin(current)) / 2;
+			if (victim.compare_exchange_weak(current, Pack(Begin(current), middle), std::memory_order_acq_rel))
+			{
+				// Our own queue is empty (that is why we are stealing), and no one else ever grows it, so a plain store is safe
+				m_queues[thiefIndex].range.store(Pack(middle, End(current)), std::memory_order_release);
+				m_stealCount.fetch_add(End(current) - middle, std::memory_order_relaxed);
+				return true;
+			}
+		}
+	}
+	return false;
+}
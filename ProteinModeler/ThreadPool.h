@@ -0,0 +1,73 @@
+#pragma once
+#include "pch.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Fork-join work-stealing scheduler for the simulation core. ParallelFor splits an index range into chunks and hands
+// each thread (the calling thread included, as thread 0) a contiguous block of those chunks. A thread works through
+// its own block from the front; once it runs dry it steals the back half of another thread's remaining block. Each
+// block is a single packed atomic (begin, end) pair, so popping and stealing are lock-free compare-exchanges.
+class ThreadPool
+{
+public:
+	// threadCount == 0 uses one thread per hardware thread
+	explicit ThreadPool(unsigned int threadCount = 0, size_t chunkSize = 256);
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+	~ThreadPool() noexcept;
+
+	// fn(threadIndex, chunkBegin, chunkEnd) is called for disjoint sub-ranges covering [begin, end). threadIndex is in
+	// [0, ThreadCount()) and is stable for the duration of the call, so it can index per-thread scratch buffers.
+	// Blocks until every chunk has run. chunkSize == 0 uses the pool's default chunk size.
+	void ParallelFor(size_t begin, size_t end, const std::function<void(unsigned int, size_t, size_t)>& fn, size_t chunkSize = 0);
+
+	void SetThreadCount(unsigned int threadCount);
+	ND inline unsigned int ThreadCount() const noexcept { return static_cast<unsigned int>(m_workers.size()) + 1u; }
+
+	inline void SetChunkSize(size_t chunkSize) noexcept { m_chunkSize = std::max<size_t>(1, chunkSize); }
+	ND inline size_t ChunkSize() const noexcept { return m_chunkSize; }
+
+	// Number of chunks that were run by a thread other than the one they were first assigned to (since construction)
+	ND inline uint64_t StealCount() const noexcept { return m_stealCount.load(std::memory_order_relaxed); }
+
+private:
+	// Padded to a cache line so threads popping their own block do not false-share with their neighbors
+	struct alignas(64) ChunkQueue
+	{
+		std::atomic<uint64_t> range{ 0 };
+	};
+
+	ND static inline uint64_t Pack(uint32_t begin, uint32_t end) noexcept { return (static_cast<uint64_t>(end) << 32) | begin; }
+	ND static inline uint32_t Begin(uint64_t range) noexcept { return static_cast<uint32_t>(range); }
+	ND static inline uint32_t End(uint64_t range) noexcept { return static_cast<uint32_t>(range >> 32); }
+
+	void StartWorkers(unsigned int workerCount);
+	void StopWorkers() noexcept;
+	void WorkerLoop(unsigned int threadIndex);
+	void RunChunks(unsigned int threadIndex);
+
+	bool PopFront(unsigned int threadIndex, uint32_t& chunk) noexcept;
+	bool StealHalf(unsigned int thiefIndex) noexcept;
+
+	std::vector<std::thread> m_workers;
+	std::unique_ptr<ChunkQueue[]> m_queues;
+	size_t m_chunkSize;
+
+	// Current job. Only written by the calling thread while every worker is idle.
+	const std::function<void(unsigned int, size_t, size_t)>* m_job;
+	size_t m_jobBegin;
+	size_t m_jobEnd;
+	size_t m_jobChunkSize;
+
+	std::atomic<size_t> m_pendingChunks;
+	std::atomic<unsigned int> m_busyWorkers;
+	std::atomic<uint64_t> m_stealCount;
+
+	std::mutex m_mutex;
+	std::condition_variable m_wakeWorkers;
+	std::condition_variable m_jobFinished;
+	uint64_t m_generation;
+	bool m_stopping;
+};
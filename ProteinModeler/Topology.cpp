@@ -0,0 +1,591 @@
+#include "pch.h"
+#include "Topology.h"
+
+
+namespace
+{
+	// Terms are processed in batches of this many: gathered into local arrays, computed lane-parallel, scattered back
+	constexpr size_t TermBatch = 16;
+
+	constexpr float TwoPi = 6.28318530718f;
+
+	// Sorts terms by their atom indices, then stably regroups them by a greedy coloring so that no two terms of a color
+	// share an atom. Sorting first keeps each color walking through memory roughly in order.
+	template<unsigned int AtomsPerTerm, unsigned int ParametersPerTerm>
+	void SortAndColor(BondedTerms<AtomsPerTerm, ParametersPerTerm>& terms)
+	{
+		const size_t count = terms.Size();
+		terms.colorOffsets.clear();
+		if (count == 0)
+			return;
+
+		std::vector<unsigned int> order(count);
+		for (unsigned int iii = 0; iii < count; ++iii)
+			order[iii] = iii;
+
+		std::sort(order.begin(), order.end(), [&terms](unsigned int a, unsigned int b)
+			{
+				for (unsigned int jjj = 0; jjj < AtomsPerTerm; ++jjj)
+				{
+					if (terms.atoms[jjj][a] != terms.atoms[jjj][b])
+						return terms.atoms[jjj][a] < terms.atoms[jjj][b];
+				}
+				return a < b;
+			}
+		);
+
+		unsigned int atomCount = 0;
+		for (const auto& atoms : terms.atoms)
+			for (unsigned int atom : atoms)
+				atomCount = std::max(atomCount, atom + 1);
+
+		// One bit per color for every atom. Terms that find all ParallelColorLimit colors taken go to a last, serial color.
+		constexpr unsigned int SerialColor = Topology::ParallelColorLimit;
+		std::vector<uint64_t> usedColors(atomCount, 0);
+		std::vector<unsigned int> colors(count);
+		std::vector<unsigned int> colorCounts(SerialColor + 1, 0);
+
+		for (size_t iii = 0; iii < count; ++iii)
+		{
+			const unsigned int term = order[iii];
+
+			uint64_t used = 0;
+			for (unsigned int jjj = 0; jjj < AtomsPerTerm; ++jjj)
+				used |= usedColors[terms.atoms[jjj][term]];
+
+			unsigned int color = 0;
+			while (color < SerialColor && (used & (uint64_t(1) << color)))
+				++color;
+
+			if (color < SerialColor)
+			{
+				for (unsigned int jjj = 0; jjj < AtomsPerTerm; ++jjj)
+					usedColors[terms.atoms[jjj][term]] |= uint64_t(1) << color;
+			}
+
+			colors[iii] = color;
+			++colorCounts[color];
+		}
+
+		unsigned int colorCount = SerialColor + 1;
+		while (colorCounts[colorCount - 1] == 0)
+			--colorCount;
+
+		terms.colorOffsets.assign(colorCount + 1, 0u);
+		for (unsigned int iii = 0; iii < colorCount; ++iii)
+			terms.colorOffsets[iii + 1] = terms.colorOffsets[iii] + colorCounts[iii];
+
+		// Stable counting sort of the sorted order by color
+		std::vector<unsigned int> permutation(count);
+		std::vector<unsigned int> cursor(terms.colorOffsets.begin(), terms.colorOffsets.end() - 1);
+		for (size_t iii = 0; iii < count; ++iii)
+			permutation[cursor[colors[iii]]++] = order[iii];
+
+		AlignedVector<unsigned int> atomScratch(count);
+		for (auto& atoms : terms.atoms)
+		{
+			for (size_t iii = 0; iii < count; ++iii)
+				atomScratch[iii] = atoms[permutation[iii]];
+			atoms.swap(atomScratch);
+		}
+
+		AlignedVector<float> parameterScratch(count);
+		for (auto& parameters : terms.parameters)
+		{
+			for (size_t iii = 0; iii < count; ++iii)
+				parameterScratch[iii] = parameters[permutation[iii]];
+			parameters.swap(parameterScratch);
+		}
+	}
+
+	float BondKernel(const BondTerms& terms, ParticleArrays& particles, const MinimumImage& image, size_t begin, size_t end) noexcept
+	{
+		const unsigned int* atomI = terms.atoms[0].data();
+		const unsigned int* atomJ = terms.atoms[1].data();
+		const float* length = terms.parameters[0].data();
+		const float* forceConstant = terms.parameters[1].data();
+
+		const float* x = particles.x.data();
+		const float* y = particles.y.data();
+		const float* z = particles.z.data();
+		float* fx = particles.fx.data();
+		float* fy = particles.fy.data();
+		float* fz = particles.fz.data();
+
+		float energy = 0.0f;
+		for (size_t base = begin; base < end; base += TermBatch)
+		{
+			const size_t lanes = std::min(TermBatch, end - base);
+
+			alignas(64) float dx[TermBatch], dy[TermBatch], dz[TermBatch], r0[TermBatch], k[TermBatch];
+			alignas(64) float scale[TermBatch], e[TermBatch];
+
+			// Unused lanes hold a unit length bond with no force constant
+			for (size_t lane = 0; lane < TermBatch; ++lane)
+			{
+				if (lane < lanes)
+				{
+					const unsigned int i = atomI[base + lane];
+					const unsigned int j = atomJ[base + lane];
+					dx[lane] = x[i] - x[j];
+					dy[lane] = y[i] - y[j];
+					dz[lane] = z[i] - z[j];
+					image.Apply(dx[lane], dy[lane], dz[lane]);
+					r0[lane] = length[base + lane];
+					k[lane] = forceConstant[base + lane];
+				}
+				else
+				{
+					dx[lane] = 1.0f; dy[lane] = 0.0f; dz[lane] = 0.0f;
+					r0[lane] = 1.0f; k[lane] = 0.0f;
+				}
+			}
+
+			for (size_t lane = 0; lane < TermBatch; ++lane)
+			{
+				const float r = std::max(std::sqrt(dx[lane] * dx[lane] + dy[lane] * dy[lane] + dz[lane] * dz[lane]), 1e-6f);
+				const float dr = r - r0[lane];
+				e[lane] = 0.5f * k[lane] * dr * dr;
+				scale[lane] = -k[lane] * dr / r;
+			}
+
+			for (size_t lane = 0; lane < lanes; ++lane)
+			{
+				const unsigned int i = atomI[base + lane];
+				const unsigned int j = atomJ[base + lane];
+				const float forceX = scale[lane] * dx[lane];
+				const float forceY = scale[lane] * dy[lane];
+				const float forceZ = scale[lane] * dz[lane];
+				fx[i] += forceX; fy[i] += forceY; fz[i] += forceZ;
+				fx[j] -= forceX; fy[j] -= forceY; fz[j] -= forceZ;
+				energy += e[lane];
+			}
+		}
+		return energy;
+	}
+
+	float AngleKernel(const AngleTerms& terms, ParticleArrays& particles, const MinimumImage& image, size_t begin, size_t end) noexcept
+	{
+		const unsigned int* atomI = terms.atoms[0].data();
+		const unsigned int* atomJ = terms.atoms[1].data();
+		const unsigned int* atomK = terms.atoms[2].data();
+		const float* theta0 = terms.parameters[0].data();
+		const float* forceConstant = terms.parameters[1].data();
+
+		const float* x = particles.x.data();
+		const float* y = particles.y.data();
+		const float* z = particles.z.data();
+		float* fx = particles.fx.data();
+		float* fy = particles.fy.data();
+		float* fz = particles.fz.data();
+
+		float energy = 0.0f;
+		for (size_t base = begin; base < end; base += TermBatch)
+		{
+			const size_t lanes = std::min(TermBatch, end - base);
+
+			// a = x_i - x_j, b = x_k - x_j
+			alignas(64) float ax[TermBatch], ay[TermBatch], az[TermBatch], bx[TermBatch], by[TermBatch], bz[TermBatch];
+			alignas(64) float t0[TermBatch], k[TermBatch];
+			alignas(64) float fix[TermBatch], fiy[TermBatch], fiz[TermBatch], fkx[TermBatch], fky[TermBatch], fkz[TermBatch], e[TermBatch];
+
+			// Unused lanes hold a right angle with no force constant
+			for (size_t lane = 0; lane < TermBatch; ++lane)
+			{
+				if (lane < lanes)
+				{
+					const unsigned int i = atomI[base + lane];
+					const unsigned int j = atomJ[base + lane];
+					const unsigned int l = atomK[base + lane];
+					ax[lane] = x[i] - x[j]; ay[lane] = y[i] - y[j]; az[lane] = z[i] - z[j];
+					bx[lane] = x[l] - x[j]; by[lane] = y[l] - y[j]; bz[lane] = z[l] - z[j];
+					image.Apply(ax[lane], ay[lane], az[lane]);
+					image.Apply(bx[lane], by[lane], bz[lane]);
+					t0[lane] = theta0[base + lane];
+					k[lane] = forceConstant[base + lane];
+				}
+				else
+				{
+					ax[lane] = 1.0f; ay[lane] = 0.0f; az[lane] = 0.0f;
+					bx[lane] = 0.0f; by[lane] = 1.0f; bz[lane] = 0.0f;
+					t0[lane] = 0.0f; k[lane] = 0.0f;
+				}
+			}
+
+			for (size_t lane = 0; lane < TermBatch; ++lane)
+			{
+				const float aa = ax[lane] * ax[lane] + ay[lane] * ay[lane] + az[lane] * az[lane];
+				const float bb = bx[lane] * bx[lane] + by[lane] * by[lane] + bz[lane] * bz[lane];
+				const float ab = ax[lane] * bx[lane] + ay[lane] * by[lane] + az[lane] * bz[lane];
+				const float cx = ay[lane] * bz[lane] - az[lane] * by[lane];
+				const float cy = az[lane] * bx[lane] - ax[lane] * bz[lane];
+				const float cz = ax[lane] * by[lane] - ay[lane] * bx[lane];
+				const float crossNorm = std::sqrt(cx * cx + cy * cy + cz * cz);
+
+				// atan2 stays accurate near 0 and pi where acos does not
+				const float theta = std::atan2(crossNorm, ab);
+				const float dTheta = theta - t0[lane];
+				e[lane] = 0.5f * k[lane] * dTheta * dTheta;
+
+				// F_i = dV/dtheta / sin(theta) * d cos(theta) / d x_i, and likewise for k
+				const float inverseAB = 1.0f / std::max(std::sqrt(aa * bb), 1e-12f);
+				const float cosTheta = ab * inverseAB;
+				const float sinTheta = std::max(crossNorm * inverseAB, 1e-6f);
+				const float st = k[lane] * dTheta / sinTheta;
+				const float ca = cosTheta / std::max(aa, 1e-12f);
+				const float cb = cosTheta / std::max(bb, 1e-12f);
+
+				fix[lane] = st * (bx[lane] * inverseAB - ca * ax[lane]);
+				fiy[lane] = st * (by[lane] * inverseAB - ca * ay[lane]);
+				fiz[lane] = st * (bz[lane] * inverseAB - ca * az[lane]);
+				fkx[lane] = st * (ax[lane] * inverseAB - cb * bx[lane]);
+				fky[lane] = st * (ay[lane] * inverseAB - cb * by[lane]);
+				fkz[lane] = st * (az[lane] * inverseAB - cb * bz[lane]);
+			}
+
+			for (size_t lane = 0; lane < lanes; ++lane)
+			{
+				const unsigned int i = atomI[base + lane];
+				const unsigned int j = atomJ[base + lane];
+				const unsigned int l = atomK[base + lane];
+				fx[i] += fix[lane]; fy[i] += fiy[lane]; fz[i] += fiz[lane];
+				fx[l] += fkx[lane]; fy[l] += fky[lane]; fz[l] += fkz[lane];
+				fx[j] -= fix[lane] + fkx[lane]; fy[j] -= fiy[lane] + fky[lane]; fz[j] -= fiz[lane] + fkz[lane];
+				energy += e[lane];
+			}
+		}
+		return energy;
+	}
+
+	// Shared geometry for both dihedral kinds. potential(term, active, phi, dEnergyDPhi) returns the
+	// energy and its derivative; active is false for padding lanes.
+	// Forces follow Bekker's decomposition (as used by GROMACS), with r_ij = x_i - x_j, r_kj = x_k - x_j, r_kl = x_k - x_l,
+	// m = r_ij x r_kj and n = r_kj x r_kl.
+	template<unsigned int ParametersPerTerm, typename TPotential>
+	float DihedralKernel(const BondedTerms<4, ParametersPerTerm>& terms, ParticleArrays& particles, const MinimumImage& image, size_t begin, size_t end, const TPotential& potential) noexcept
+	{
+		const unsigned int* atomI = terms.atoms[0].data();
+		const unsigned int* atomJ = terms.atoms[1].data();
+		const unsigned int* atomK = terms.atoms[2].data();
+		const unsigned int* atomL = terms.atoms[3].data();
+
+		const float* x = particles.x.data();
+		const float* y = particles.y.data();
+		const float* z = particles.z.data();
+		float* fx = particles.fx.data();
+		float* fy = particles.fy.data();
+		float* fz = particles.fz.data();
+
+		float energy = 0.0f;
+		for (size_t base = begin; base < end; base += TermBatch)
+		{
+			const size_t lanes = std::min(TermBatch, end - base);
+
+			alignas(64) float ijx[TermBatch], ijy[TermBatch], ijz[TermBatch];
+			alignas(64) float kjx[TermBatch], kjy[TermBatch], kjz[TermBatch];
+			alignas(64) float klx[TermBatch], kly[TermBatch], klz[TermBatch];
+			alignas(64) float fix[TermBatch], fiy[TermBatch], fiz[TermBatch];
+			alignas(64) float flx[TermBatch], fly[TermBatch], flz[TermBatch];
+			alignas(64) float sx[TermBatch], sy[TermBatch], sz[TermBatch], e[TermBatch];
+
+			// Unused lanes hold a well-formed trans dihedral; their energy and forces are discarded
+			for (size_t lane = 0; lane < TermBatch; ++lane)
+			{
+				if (lane < lanes)
+				{
+					const unsigned int i = atomI[base + lane];
+					const unsigned int j = atomJ[base + lane];
+					const unsigned int k = atomK[base + lane];
+					const unsigned int l = atomL[base + lane];
+					ijx[lane] = x[i] - x[j]; ijy[lane] = y[i] - y[j]; ijz[lane] = z[i] - z[j];
+					kjx[lane] = x[k] - x[j]; kjy[lane] = y[k] - y[j]; kjz[lane] = z[k] - z[j];
+					klx[lane] = x[k] - x[l]; kly[lane] = y[k] - y[l]; klz[lane] = z[k] - z[l];
+					image.Apply(ijx[lane], ijy[lane], ijz[lane]);
+					image.Apply(kjx[lane], kjy[lane], kjz[lane]);
+					image.Apply(klx[lane], kly[lane], klz[lane]);
+				}
+				else
+				{
+					ijx[lane] = 0.0f; ijy[lane] = 1.0f; ijz[lane] = 0.0f;
+					kjx[lane] = 1.0f; kjy[lane] = 0.0f; kjz[lane] = 0.0f;
+					klx[lane] = 0.0f; kly[lane] = 1.0f; klz[lane] = 0.0f;
+				}
+			}
+
+			for (size_t lane = 0; lane < TermBatch; ++lane)
+			{
+				const float mx = ijy[lane] * kjz[lane] - ijz[lane] * kjy[lane];
+				const float my = ijz[lane] * kjx[lane] - ijx[lane] * kjz[lane];
+				const float mz = ijx[lane] * kjy[lane] - ijy[lane] * kjx[lane];
+				const float nx = kjy[lane] * klz[lane] - kjz[lane] * kly[lane];
+				const float ny = kjz[lane] * klx[lane] - kjx[lane] * klz[lane];
+				const float nz = kjx[lane] * kly[lane] - kjy[lane] * klx[lane];
+
+				const float mm = std::max(mx * mx + my * my + mz * mz, 1e-12f);
+				const float nn = std::max(nx * nx + ny * ny + nz * nz, 1e-12f);
+				const float kj2 = std::max(kjx[lane] * kjx[lane] + kjy[lane] * kjy[lane] + kjz[lane] * kjz[lane], 1e-12f);
+				const float kj = std::sqrt(kj2);
+
+				// |m x n| = |r_kj| |r_ij . n|, which also carries the sign of the dihedral
+				const float ijDotN = ijx[lane] * nx + ijy[lane] * ny + ijz[lane] * nz;
+				const float mDotN = mx * nx + my * ny + mz * nz;
+				const float phi = std::atan2(kj * ijDotN, mDotN);
+
+				float dEnergyDPhi;
+				e[lane] = potential(base + lane, lane < lanes, phi, dEnergyDPhi);
+
+				const float a = -dEnergyDPhi * kj / mm;
+				const float b = dEnergyDPhi * kj / nn;
+				fix[lane] = a * mx; fiy[lane] = a * my; fiz[lane] = a * mz;
+				flx[lane] = b * nx; fly[lane] = b * ny; flz[lane] = b * nz;
+
+				const float p = (ijx[lane] * kjx[lane] + ijy[lane] * kjy[lane] + ijz[lane] * kjz[lane]) / kj2;
+				const float q = (klx[lane] * kjx[lane] + kly[lane] * kjy[lane] + klz[lane] * kjz[lane]) / kj2;
+				sx[lane] = p * fix[lane] - q * flx[lane];
+				sy[lane] = p * fiy[lane] - q * fly[lane];
+				sz[lane] = p * fiz[lane] - q * flz[lane];
+			}
+
+			for (size_t lane = 0; lane < lanes; ++lane)
+			{
+				const unsigned int i = atomI[base + lane];
+				const unsigned int j = atomJ[base + lane];
+				const unsigned int k = atomK[base + lane];
+				const unsigned int l = atomL[base + lane];
+				fx[i] += fix[lane]; fy[i] += fiy[lane]; fz[i] += fiz[lane];
+				fx[j] -= fix[lane] - sx[lane]; fy[j] -= fiy[lane] - sy[lane]; fz[j] -= fiz[lane] - sz[lane];
+				fx[k] -= flx[lane] + sx[lane]; fy[k] -= fly[lane] + sy[lane]; fz[k] -= flz[lane] + sz[lane];
+				fx[l] += flx[lane]; fy[l] += fly[lane]; fz[l] += flz[lane];
+				energy += e[lane];
+			}
+		}
+		return energy;
+	}
+
+	float ProperDihedralKernel(const ProperDihedralTerms& terms, ParticleArrays& particles, const MinimumImage& image, size_t begin, size_t end) noexcept
+	{
+		const float* phi0 = terms.parameters[0].data();
+		const float* forceConstant = terms.parameters[1].data();
+		const float* multiplicity = terms.parameters[2].data();
+
+		return DihedralKernel(terms, particles, image, begin, end, [=](size_t term, bool active, float phi, float& dEnergyDPhi)
+			{
+				const float k = active ? forceConstant[term] : 0.0f;
+				const float n = active ? multiplicity[term] : 1.0f;
+				const float angle = n * phi - (active ? phi0[term] : 0.0f);
+				dEnergyDPhi = -k * n * std::sin(angle);
+				return k * (1.0f + std::cos(angle));
+			}
+		);
+	}
+
+	float ImproperDihedralKernel(const ImproperDihedralTerms& terms, ParticleArrays& particles, const MinimumImage& image, size_t begin, size_t end) noexcept
+	{
+		const float* xi0 = terms.parameters[0].data();
+		const float* forceConstant = terms.parameters[1].data();
+
+		return DihedralKernel(terms, particles, image, begin, end, [=](size_t term, bool active, float phi, float& dEnergyDPhi)
+			{
+				const float k = active ? forceConstant[term] : 0.0f;
+				float delta = phi - (active ? xi0[term] : 0.0f);
+
+				// Periodic difference in [-pi, pi)
+				delta -= TwoPi * std::floor(delta / TwoPi + 0.5f);
+				dEnergyDPhi = k * delta;
+				return 0.5f * k * delta * delta;
+			}
+		);
+	}
+}
+
+Topology::Topology() noexcept :
+	m_finalized(true),
+	m_bondEnergy(0.0f),
+	m_angleEnergy(0.0f),
+	m_properDihedralEnergy(0.0f),
+	m_improperDihedralEnergy(0.0f)
+{}
+
+void Topology::AddBond(unsigned int i, unsigned int j, float length, float k)
+{
+	WINRT_ASSERT(i != j);
+
+	// Store every term in one canonical direction so sorting groups the terms of an atom together
+	m_bonds.PushBack({ std::min(i, j), std::max(i, j) }, { length, k });
+	m_finalized = false;
+}
+
+void Topology::AddAngle(unsigned int i, unsigned int j, unsigned int k, float theta0, float forceConstant)
+{
+	if (i > k)
+		std::swap(i, k);
+
+	m_angles.PushBack({ i, j, k }, { theta0, forceConstant });
+	m_finalized = false;
+}
+
+void Topology::AddProperDihedral(unsigned int i, unsigned int j, unsigned int k, unsigned int l, float phi0, float forceConstant, unsigned int multiplicity)
+{
+	// Reversing the atom order leaves the dihedral angle unchanged
+	if (i > l)
+	{
+		std::swap(i, l);
+		std::swap(j, k);
+	}
+
+	m_properDihedrals.PushBack({ i, j, k, l }, { phi0, forceConstant, static_cast<float>(multiplicity) });
+	m_finalized = false;
+}
+
+void Topology::AddImproperDihedral(unsigned int i, unsigned int j, unsigned int k, unsigned int l, float xi0, float forceConstant)
+{
+	// Impropers are defined by their atom order, so they are stored as given
+	m_improperDihedrals.PushBack({ i, j, k, l }, { xi0, forceConstant });
+	m_finalized = false;
+}
+
+void Topology::Clear() noexcept
+{
+	m_bonds.Clear();
+	m_angles.Clear();
+	m_properDihedrals.Clear();
+	m_improperDihedrals.Clear();
+	m_finalized = true;
+}
+
+void Topology::Finalize()
+{
+	SortAndColor(m_bonds);
+	SortAndColor(m_angles);
+	SortAndColor(m_properDihedrals);
+	SortAndColor(m_improperDihedrals);
+	m_finalized = true;
+}
+
+void Topology::Remap(const std::vector<uint32_t>& newIndex)
+{
+	auto remap = [&](auto& terms) {
+		size_t kept = 0;
+		for (size_t t = 0; t < terms.Size(); ++t)
+		{
+			bool removed = false;
+			for (const auto& atoms : terms.atoms)
+				removed |= newIndex[atoms[t]] == RemovedAtom;
+			if (removed)
+				continue;
+
+			for (auto& atoms : terms.atoms)
+				atoms[kept] = newIndex[atoms[t]];
+			for (auto& parameters : terms.parameters)
+				parameters[kept] = parameters[t];
+			++kept;
+		}
+		terms.Resize(kept);
+	};
+	remap(m_bonds);
+	remap(m_angles);
+	remap(m_properDihedrals);
+	remap(m_improperDihedrals);
+	Finalize();
+}
+
+template<typename TTerms, typename TKernel>
+float Topology::ComputeTerms(const TTerms& terms, ParticleArrays& particles, ThreadPool& pool, const TKernel& kernel)
+{
+	float energy = 0.0f;
+	for (size_t color = 0; color < terms.ColorCount(); ++color)
+	{
+		const size_t begin = terms.colorOffsets[color];
+		const size_t end = terms.colorOffsets[color + 1];
+		if (begin == end)
+			continue;
+
+		if (color == ParallelColorLimit)
+		{
+			energy += kernel(terms, particles, m_image, begin, end);
+			continue;
+		}
+
+		for (ThreadEnergy& threadEnergy : m_threadEnergy)
+			threadEnergy.energy = 0.0f;
+
+		pool.ParallelFor(begin, end, [&](unsigned int threadIndex, size_t chunkBegin, size_t chunkEnd)
+			{
+				m_threadEnergy[threadIndex].energy += kernel(terms, particles, m_image, chunkBegin, chunkEnd);
+			}
+		);
+
+		for (const ThreadEnergy& threadEnergy : m_threadEnergy)
+			energy += threadEnergy.energy;
+	}
+	return energy;
+}
+
+float Topology::Compute(ParticleArrays& particles, ThreadPool& pool, const MinimumImage& image)
+{
+	if (!m_finalized)
+		Finalize();
+
+	m_image = image;
+
+	m_threadEnergy.resize(pool.ThreadCount());
+
+	m_bondEnergy = ComputeTerms(m_bonds, particles, pool, BondKernel);
+	m_angleEnergy = ComputeTerms(m_angles, particles, pool, AngleKernel);
+	m_properDihedralEnergy = ComputeTerms(m_properDihedrals, particles, pool, ProperDihedralKernel);
+	m_improperDihedralEnergy = ComputeTerms(m_improperDihedrals, particles, pool, ImproperDihedralKernel);
+
+	return m_bondEnergy + m_angleEnergy + m_properDihedralEnergy + m_improperDihedralEnergy;
+}
+
+void Topology::BuildExclusions(size_t atomCount, unsigned int maxBonds, std::vector<unsigned int>& offsets, std::vector<unsigned int>& excluded) const
+{
+	std::vector<std::vector<unsigned int>> bonded(atomCount);
+	for (size_t iii = 0; iii < m_bonds.Size(); ++iii)
+	{
+		const unsigned int i = m_bonds.atoms[0][iii];
+		const unsigned int j = m_bonds.atoms[1][iii];
+		if (i < atomCount && j < atomCount)
+		{
+			bonded[i].push_back(j);
+			bonded[j].push_back(i);
+		}
+	}
+
+	offsets.assign(atomCount + 1, 0u);
+	excluded.clear();
+
+	// Breadth-first search out to maxBonds bonds from every atom
+	std::vector<unsigned int> frontier;
+	std::vector<unsigned int> next;
+	std::vector<unsigned int> row;
+	for (unsigned int iii = 0; iii < atomCount; ++iii)
+	{
+		row.clear();
+		frontier.assign(1, iii);
+		for (unsigned int depth = 0; depth < maxBonds && !frontier.empty(); ++depth)
+		{
+			next.clear();
+			for (unsigned int atom : frontier)
+			{
+				for (unsigned int neighbor : bonded[atom])
+				{
+					if (neighbor != iii && std::find(row.begin(), row.end(), neighbor) == row.end())
+					{
+						row.push_back(neighbor);
+						next.push_back(neighbor);
+					}
+				}
+			}
+			frontier.swap(next);
+		}
+
+		std::sort(row.begin(), row.end());
+		for (unsigned int atom : row)
+		{
+			if (atom > iii)
+				excluded.push_back(atom);
+		}
+		offsets[iii + 1] = static_cast<unsigned int>(excluded.size());
+	}
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include "pch.h"
+#include "AlignedAllocator.h"
+#include "ParticleArrays.h"
+#include "ThreadPool.h"
+#include "SimulationBox.h"
+
+// One kind of bonded term stored as flat arrays: atoms[a][t] is the a-th atom of term t and parameters[p][t] its p-th
+// parameter. After Topology::Finalize the terms are grouped into colors: terms [colorOffsets[c], colorOffsets[c + 1])
+// never share an atom, so a color can be split over threads that write forces directly.
+template<unsigned int AtomsPerTerm, unsigned int ParametersPerTerm>
+struct BondedTerms
+{
+	std::array<AlignedVector<unsigned int>, AtomsPerTerm> atoms;
+	std::array<AlignedVector<float>, ParametersPerTerm> parameters;
+	std::vector<unsigned int> colorOffsets;
+
+	ND inline size_t Size() const noexcept { return atoms[0].size(); }
+	ND inline size_t ColorCount() const noexcept { return colorOffsets.empty() ? 0 : colorOffsets.size() - 1; }
+
+	void PushBack(const std::array<unsigned int, AtomsPerTerm>& termAtoms, const std::array<float, ParametersPerTerm>& termParameters)
+	{
+		for (unsigned int iii = 0; iii < AtomsPerTerm; ++iii)
+			atoms[iii].push_back(termAtoms[iii]);
+		for (unsigned int iii = 0; iii < ParametersPerTerm; ++iii)
+			parameters[iii].push_back(termParameters[iii]);
+	}
+
+	void Resize(size_t count)
+	{
+		for (auto& a : atoms)
+			a.resize(count);
+		for (auto& p : parameters)
+			p.resize(count);
+	}
+
+	void Clear() noexcept
+	{
+		for (auto& a : atoms)
+			a.clear();
+		for (auto& p : parameters)
+			p.clear();
+		colorOffsets.clear();
+	}
+};
+
+// Harmonic bonds:            i-j,     { length (nm), k (kJ/mol/nm^2) },            E = k/2 (r - length)^2
+// Harmonic angles:           i-j-k,   { theta0 (rad), k (kJ/mol/rad^2) },          E = k/2 (theta - theta0)^2
+// Periodic proper dihedrals: i-j-k-l, { phi0 (rad), k (kJ/mol), multiplicity },   E = k (1 + cos(n phi - phi0))
+// Harmonic improper:         i-j-k-l, { xi0 (rad), k (kJ/mol/rad^2) },            E = k/2 (xi - xi0)^2
+using BondTerms = BondedTerms<2, 2>;
+using AngleTerms = BondedTerms<3, 2>;
+using ProperDihedralTerms = BondedTerms<4, 3>;
+using ImproperDihedralTerms = BondedTerms<4, 2>;
+
+// Bonded interactions between atoms of the simulation, referenced by particle index. Terms may be added in any order;
+// Finalize sorts each kind by atom index for locality and colors it so the force kernels run in parallel without
+// atomics or per-thread force buffers. The kernels work on batches of terms: positions are gathered into small
+// contiguous blocks, the geometry is computed with straight-line loops the compiler vectorizes, and the forces are
+// scattered back.
+class Topology
+{
+public:
+	Topology() noexcept;
+
+	void AddBond(unsigned int i, unsigned int j, float length, float k);
+	void AddAngle(unsigned int i, unsigned int j, unsigned int k, float theta0, float forceConstant);
+	void AddProperDihedral(unsigned int i, unsigned int j, unsigned int k, unsigned int l, float phi0, float forceConstant, unsigned int multiplicity);
+	void AddImproperDihedral(unsigned int i, unsigned int j, unsigned int k, unsigned int l, float xi0, float forceConstant);
+	void Clear() noexcept;
+
+	ND inline bool Empty() const noexcept { return m_bonds.Size() + m_angles.Size() + m_properDihedrals.Size() + m_improperDihedrals.Size() == 0; }
+	ND inline bool IsFinalized() const noexcept { return m_finalized; }
+
+	// Sorts and colors all terms. Compute calls this itself if terms were added since the last call.
+	void Finalize();
+
+	// Renumbers the atoms of every term after the particle arrays were permuted or compacted: atom a becomes
+	// newIndex[a], and terms with an atom mapped to RemovedAtom are dropped. The terms are sorted and colored again.
+	void Remap(const std::vector<uint32_t>& newIndex);
+	static constexpr uint32_t RemovedAtom = std::numeric_limits<uint32_t>::max();
+
+	// Adds the bonded forces to particles.fx/fy/fz and returns the bonded potential energy (kJ/mol). Displacements use
+	// the minimum image, so molecules stay intact when their atoms are wrapped to opposite faces of a periodic box.
+	float Compute(ParticleArrays& particles, ThreadPool& pool, const MinimumImage& image = MinimumImage());
+
+	// Pairs of atoms separated by at most maxBonds bonds, as compressed rows holding only j > i (see NeighborList).
+	// These are excluded from the nonbonded interactions, which the bonded terms replace.
+	void BuildExclusions(size_t atomCount, unsigned int maxBonds, std::vector<unsigned int>& offsets, std::vector<unsigned int>& excluded) const;
+
+	ND inline const BondTerms& Bonds() const noexcept { return m_bonds; }
+	ND inline const AngleTerms& Angles() const noexcept { return m_angles; }
+	ND inline const ProperDihedralTerms& ProperDihedrals() const noexcept { return m_properDihedrals; }
+	ND inline const ImproperDihedralTerms& ImproperDihedrals() const noexcept { return m_improperDihedrals; }
+
+	// Energy breakdown of the last Compute call
+	ND inline float BondEnergy() const noexcept { return m_bondEnergy; }
+	ND inline float AngleEnergy() const noexcept { return m_angleEnergy; }
+	ND inline float ProperDihedralEnergy() const noexcept { return m_properDihedralEnergy; }
+	ND inline float ImproperDihedralEnergy() const noexcept { return m_improperDihedralEnergy; }
+
+	// Terms that still conflict after this many colors are evaluated by a single thread
+	static constexpr unsigned int ParallelColorLimit = 64;
+
+private:
+	template<typename TTerms, typename TKernel>
+	float ComputeTerms(const TTerms& terms, ParticleArrays& particles, ThreadPool& pool, const TKernel& kernel);
+
+	BondTerms m_bonds;
+	AngleTerms m_angles;
+	ProperDihedralTerms m_properDihedrals;
+	ImproperDihedralTerms m_improperDihedrals;
+
+	bool m_finalized;
+
+	float m_bondEnergy;
+	float m_angleEnergy;
+	float m_properDihedralEnergy;
+	float m_improperDihedralEnergy;
+
+	// Per-thread energy partial sums, padded so the threads do not share cache lines
+	struct alignas(64) ThreadEnergy
+	{
+		float energy = 0.0f;
+	};
+	std::vector<ThreadEnergy> m_threadEnergy;
+	MinimumImage m_image;
+};
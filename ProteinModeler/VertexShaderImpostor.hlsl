@@ -0,0 +1,86 @@
+// Defaults for number of lights.
+#ifndef NUM_DIR_LIGHTS
+#define NUM_DIR_LIGHTS 1
+#endif
+
+#ifndef NUM_POINT_LIGHTS
+#define NUM_POINT_LIGHTS 0
+#endif
+
+#ifndef NUM_SPOT_LIGHTS
+#define NUM_SPOT_LIGHTS 0
+#endif
+
+// Include structures and functions for lighting.
+#include "Lighting.hlsli"
+
+cbuffer cbPass : register(b0)
+{
+    float4x4 gView;
+    float4x4 gInvView;
+    float4x4 gProj;
+    float4x4 gInvProj;
+    float4x4 gViewProj;
+    float4x4 gInvViewProj;
+    float3 gEyePosW;
+    float cbPerObjectPad1;
+    float2 gRenderTargetSize;
+    float2 gInvRenderTargetSize;
+    float gNearZ;
+    float gFarZ;
+    float gTotalTime;
+    float gDeltaTime;
+    float4 gAmbientLight;
+    
+    // Indices [0, NUM_DIR_LIGHTS) are directional lights;
+    // indices [NUM_DIR_LIGHTS, NUM_DIR_LIGHTS+NUM_POINT_LIGHTS) are point lights;
+    // indices [NUM_DIR_LIGHTS+NUM_POINT_LIGHTS, NUM_DIR_LIGHTS+NUM_POINT_LIGHT+NUM_SPOT_LIGHTS)
+    // are spot lights for a maximum of MaxLights per object.
+    Light gLights[MaxLights];
+};
+
+struct VSOut
+{
+    float4 PosH : SV_POSITION;
+    float3 PosW : POSITION;
+    nointerpolation float4 CenterRadius : CENTER_RADIUS;
+    nointerpolation uint MaterialIndex : MATERIAL_INDEX;
+};
+
+// Expands a corner of the unit quad (x, y = +/-1) into the sphere's impostor. Mirrors SphereImpostor::ExpandQuad, which
+// must be kept in step with it.
+VSOut main(float3 cornerL : POSITION, float4 positionRadius : INSTANCE_POSITION_RADIUS, uint materialIndex : MATERIAL_INDEX)
+{
+    VSOut vout;
+
+    float3 center = positionRadius.xyz;
+    float radius = positionRadius.w;
+    float3 toCenter = center - gEyePosW;
+    float distance = length(toCenter);
+    float3 axis = toCenter / distance;
+
+    // Quad plane perpendicular to the line of sight to the center, oriented by the camera's up vector (row 1 of gInvView)
+    float3 right = cross(gInvView[1].xyz, axis);
+    float rightLength = length(right);
+    if (rightLength < 1e-6f)
+    {
+        right = cross(abs(axis.x) < 0.9f ? float3(1.0f, 0.0f, 0.0f) : float3(0.0f, 1.0f, 0.0f), axis);
+        rightLength = length(right);
+    }
+    right /= rightLength;
+    float3 up = cross(axis, right);
+
+    // Touching the sphere at its nearest point, sized to the cross section of the tangent cone there. With the eye inside
+    // the sphere the quad collapses to a point and nothing is drawn.
+    float planeDistance = distance - radius;
+    bool outside = distance > radius;
+    float halfSize = outside ? planeDistance * radius / sqrt(planeDistance * (distance + radius)) : 0.0f;
+    float3 quadCenter = outside ? gEyePosW + axis * planeDistance : center;
+
+    vout.PosW = quadCenter + (cornerL.x * right + cornerL.y * up) * halfSize;
+    vout.PosH = mul(float4(vout.PosW, 1.0f), gViewProj);
+    vout.CenterRadius = positionRadius;
+    vout.MaterialIndex = materialIndex;
+
+    return vout;
+}
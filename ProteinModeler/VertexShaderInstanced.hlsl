@@ -11,9 +11,6 @@
 #define NUM_SPOT_LIGHTS 0
 #endif
 
-// A constant buffer can hold a maximum of 4096 16-byte entries. This is 1024 float4x4 entries
-#define MAX_INSTANCES 1024
-
 // Include structures and functions for lighting.
 #include "Lighting.hlsli"
 
@@ -42,11 +39,6 @@ cbuffer cbPass : register(b0)
     Light gLights[MaxLights];
 };
 
-cbuffer cbPerObject : register(b1)
-{
-    float4x4 gWorld[MAX_INSTANCES];
-};
-
 struct VSIn
 {
     float3 PosL : POSITION;
@@ -62,23 +54,21 @@ struct VSOut
     uint Instance_ID : INSTANCE_ID;
 };
 
-VSOut main(VSIn vin, uint materialIndex : MATERIAL_INDEX, uint instanceID : SV_InstanceID)
+VSOut main(VSIn vin, float4 positionRadius : INSTANCE_POSITION_RADIUS, uint materialIndex : MATERIAL_INDEX, uint instanceID : SV_InstanceID)
 {
     VSOut vout;
     
-    // Look up the world matrix in the list of all world matrices
-    float4x4 world = gWorld[instanceID];
-    
     // Just forward the material index and instance ID
     vout.MaterialIndex = materialIndex;
     vout.Instance_ID = instanceID;
 	
-    // Transform to world space.
-    float4 posW = mul(float4(vin.PosL, 1.0f), world);
+    // Transform to world space. The world transform of an atom is a uniform scale by its radius followed by a
+    // translation to its center, so it is applied directly instead of being uploaded as a matrix.
+    float4 posW = float4(vin.PosL * positionRadius.w + positionRadius.xyz, 1.0f);
     vout.PosW = posW.xyz;
 
-    // Assumes nonuniform scaling; otherwise, need to use inverse-transpose of world matrix.
-    vout.NormalW = mul(vin.NormalL, (float3x3) world);
+    // A uniform scale leaves the normals' directions unchanged
+    vout.NormalW = vin.NormalL;
 
     // Transform to homogeneous clip space.
     vout.PosH = mul(posW, gViewProj);
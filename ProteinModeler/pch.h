@@ -30,6 +30,9 @@
 
 #include <profileapi.h> // For QueryPerformanceFrequency and QueryPerformanceTimer (See Timer.h)
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <vector>